@@ -1,6 +1,4 @@
 $debugDir = Join-Path -Path $PSScriptRoot -ChildPath "Debug"
-$executeOutCommand = ".\openh264_test.exe 0"
-$executeOutdiffCommand = ".\openh264_test.exe 1"
 $testBitratesMbps = @(
     "1.5",
     "2.5",
@@ -12,9 +10,8 @@ $testBitratesMbps = @(
 
 Set-Location -Path $debugDir
 
-foreach ($testBitrateMbps in $testBitratesMbps) {
-    $outCommand = $executeOutCommand + " " + $testBitrateMbps
-    $outdiffCommand = $executeOutdiffCommand + " " + $testBitrateMbps
-    Invoke-Expression -Command $outCommand
-    Invoke-Expression -Command $outdiffCommand
-}
\ No newline at end of file
+# one run encodes every bitrate without and with priorities; finished
+# encodes are journaled in testbin/sweep, so rerunning after an
+# interruption continues where it stopped
+$sweepCommand = ".\openh264_test.exe --sweep " + ($testBitratesMbps -join ",") + " " + ($args -join " ")
+Invoke-Expression -Command $sweepCommand
@@ -1,4 +1,5 @@
 import os
+import struct
 import typing
 
 
@@ -62,3 +63,17 @@ def get_files_path_in_path(root_dir: str) -> typing.List[str]:
             files_list.append(os.path.join(dirpath, filename))
         break
     return files_list
+
+
+# 读取编码时写出的 <out>.h264.idx 索引 (src/bitstream_index.h)
+# 每项: (offset, size, frame_num, nal_types, frame_type, spatial_id, temporal_id)
+def read_bitstream_index(idx_path: str) -> typing.List[typing.Tuple]:
+    entries = []
+    with open(idx_path, "rb") as f:
+        magic, version, entry_size = struct.unpack("<IHH", f.read(8))
+        if magic != 0x58444948 or version != 1 or entry_size != 24:
+            return entries
+        data = f.read()
+    for pos in range(0, len(data) - entry_size + 1, entry_size):
+        entries.append(struct.unpack_from("<QIiIBBBx", data, pos))
+    return entries
@@ -0,0 +1,181 @@
+#include "annexb.h"
+#include "bit_reader.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+size_t findStartCode(const uint8_t *data, size_t size, size_t pos) {
+#ifdef HAVE_SSE2
+    // 16 candidate positions per step: byte i and i+1 zero, byte i+2 one
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    for (; pos + 18 <= size; pos += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(data + pos));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(data + pos + 1));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(data + pos + 2));
+        const __m128i hit =
+            _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                                        _mm_cmpeq_epi8(b, zero)),
+                          _mm_cmpeq_epi8(c, one));
+        const int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            return pos + lowestBit(mask);
+        }
+    }
+#endif
+    // look at every third byte: anything above 1 cannot be part of a start
+    // code ending within the next two bytes
+    size_t i = pos + 2;
+    while (i < size) {
+        if (data[i] > 1) {
+            i += 3;
+        } else if (data[i] == 0) {
+            i++;
+        } else if (data[i - 1] == 0 && data[i - 2] == 0) {
+            return i - 2;
+        } else {
+            i += 3;
+        }
+    }
+    return size;
+}
+
+void findStartCodes(const uint8_t *data, size_t size, vector<size_t> &codes,
+                    int threads) {
+    codes.clear();
+    // below a few MB the threads cost more than the scan
+    const size_t minChunk = 4 << 20;
+    const size_t chunks =
+        max((size_t)1, min((size_t)max(threads, 1), size / minChunk));
+    vector<vector<size_t>> found(chunks);
+    auto scan = [&](size_t c) {
+        const size_t begin = size * c / chunks;
+        const size_t end = size * (c + 1) / chunks;
+        // a code belongs to the chunk holding its first byte
+        const size_t limit = min(end + 2, size);
+        for (size_t pos = findStartCode(data, limit, begin); pos < limit;
+             pos = findStartCode(data, limit, pos + 3)) {
+            found[c].push_back(pos);
+        }
+    };
+    vector<thread> workers;
+    for (size_t c = 1; c < chunks; c++) {
+        workers.emplace_back(scan, c);
+    }
+    scan(0);
+    for (thread &t : workers) {
+        t.join();
+    }
+    for (const vector<size_t> &f : found) {
+        codes.insert(codes.end(), f.begin(), f.end());
+    }
+}
+
+void splitNalUnits(const uint8_t *data, size_t size, vector<NalUnit> &nals,
+                   int threads) {
+    vector<size_t> codes;
+    findStartCodes(data, size, codes, threads);
+    nals.clear();
+    nals.reserve(codes.size());
+    size_t prevEnd = 0;
+    for (size_t k = 0; k < codes.size(); k++) {
+        const size_t sc = codes[k];
+        NalUnit nal;
+        nal.iStart = sc;
+        // zero_byte of a four-byte start code, or leading_zero_8bits
+        while (nal.iStart > prevEnd && data[nal.iStart - 1] == 0) {
+            nal.iStart--;
+        }
+        nal.iOffset = sc + 3;
+        const size_t next = k + 1 < codes.size() ? codes[k + 1] : size;
+        size_t end = next;
+        while (end > nal.iOffset && data[end - 1] == 0) {
+            end--;
+        }
+        nal.iSize = end - nal.iOffset;
+        if (nal.iSize > 0) {
+            nal.uiType = data[nal.iOffset] & 0x1f;
+            nals.push_back(nal);
+            prevEnd = end;
+        }
+    }
+}
+
+static bool startsPicture(const uint8_t *data, const vector<NalUnit> &nals,
+                          size_t i) {
+    const NalUnit &nal = nals[i];
+    switch (nal.uiType) {
+    case nalSei:
+    case nalSps:
+    case nalPps:
+    case nalAud:
+    case nalSubsetSps:
+        return true;
+    case nalPrefix:
+        // belongs to the base layer slice that follows it
+        return i + 1 < nals.size() &&
+               (nals[i + 1].uiType == nalSliceNonIdr ||
+                nals[i + 1].uiType == nalSliceIdr) &&
+               startsPicture(data, nals, i + 1);
+    case nalSliceNonIdr:
+    case nalSliceIdr:
+        // first_mb_in_slice is ue(v), so 0 is a single 1 bit
+        return nal.iSize > 1 && (data[nal.iOffset + 1] & 0x80);
+    default:
+        return false;
+    }
+}
+
+void groupAccessUnits(const uint8_t *data, const vector<NalUnit> &nals,
+                      vector<AccessUnit> &aus) {
+    aus.clear();
+    bool haveSlice = false;
+    for (size_t i = 0; i < nals.size(); i++) {
+        const NalUnit &nal = nals[i];
+        if (aus.empty() || (haveSlice && startsPicture(data, nals, i))) {
+            if (!aus.empty()) {
+                aus.back().iSize = nal.iStart - aus.back().iStart;
+            }
+            AccessUnit au;
+            au.iStart = nal.iStart;
+            au.iSize = 0;
+            au.iFirstNal = (int)i;
+            au.iNalCount = 0;
+            au.bIdr = false;
+            aus.push_back(au);
+            haveSlice = false;
+        }
+        AccessUnit &au = aus.back();
+        au.iNalCount++;
+        au.bIdr |= nal.uiType == nalSliceIdr;
+        haveSlice |= nal.uiType == nalSliceNonIdr ||
+                     nal.uiType == nalSliceIdr || nal.uiType == nalSliceExt;
+    }
+    if (!aus.empty()) {
+        const NalUnit &last = nals.back();
+        aus.back().iSize = last.iOffset + last.iSize - aus.back().iStart;
+    }
+}
+
+int peekSliceType(const uint8_t *data, const NalUnit &nal) {
+    size_t header = 1;
+    if (nal.uiType == nalSliceExt) {
+        header = 4; // nal_unit_header_svc_extension
+    } else if (nal.uiType != nalSliceNonIdr && nal.uiType != nalSliceIdr) {
+        return -1;
+    }
+    if (nal.iSize <= header) {
+        return -1;
+    }
+    // the first two ue(v) fit in 8 bytes of RBSP
+    vector<uint8_t> rbsp;
+    nalToRbsp(data + nal.iOffset + header,
+              min(nal.iSize - header, (size_t)12), rbsp);
+    BitReader br(rbsp.data(), rbsp.size());
+    br.ReadUe(); // first_mb_in_slice
+    const uint32_t sliceType = br.ReadUe();
+    return br.Overrun() || sliceType > 9 ? -1 : (int)(sliceType % 5);
+}
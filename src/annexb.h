@@ -0,0 +1,59 @@
+#ifndef __ANNEXB_H__
+#define __ANNEXB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// H.264 nal_unit_type values the harness looks at
+enum {
+    nalSliceNonIdr = 1,
+    nalSliceIdr = 5,
+    nalSei = 6,
+    nalSps = 7,
+    nalPps = 8,
+    nalAud = 9,
+    nalPrefix = 14,
+    nalSubsetSps = 15,
+    nalSliceExt = 20,
+};
+
+struct NalUnit {
+    size_t iStart;  ///< first byte of the start code
+    size_t iOffset; ///< NAL header byte, just after the start code
+    size_t iSize;   ///< header and payload, up to the next start code
+    uint8_t uiType;
+};
+
+struct AccessUnit {
+    size_t iStart; ///< start code of the first NAL
+    size_t iSize;  ///< bytes up to the next access unit, start codes included
+    int iFirstNal;
+    int iNalCount;
+    bool bIdr;
+};
+
+// Position of the next 00 00 01 at or after pos, or size when there is
+// none. A preceding zero byte (four-byte start code) is not included.
+size_t findStartCode(const uint8_t *data, size_t size, size_t pos);
+
+// Positions of all 00 00 01 in the buffer, in order. Large buffers are
+// scanned in up to `threads` chunks in parallel.
+void findStartCodes(const uint8_t *data, size_t size,
+                    std::vector<size_t> &codes, int threads = 1);
+
+// Splits an Annex-B byte stream into NAL units.
+void splitNalUnits(const uint8_t *data, size_t size,
+                   std::vector<NalUnit> &nals, int threads = 1);
+
+// Groups NAL units into access units (7.4.1.2.3): parameter sets, SEI and
+// delimiters after a slice, or a slice with first_mb_in_slice == 0, begin
+// the next picture.
+void groupAccessUnits(const uint8_t *data, const std::vector<NalUnit> &nals,
+                      std::vector<AccessUnit> &aus);
+
+// slice_type % 5 of a slice NAL (7.4.3: 0 P, 1 B, 2 I, 3 SP, 4 SI), or -1
+// for other NAL types and truncated headers
+int peekSliceType(const uint8_t *data, const NalUnit &nal);
+
+#endif //__ANNEXB_H__
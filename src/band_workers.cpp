@@ -0,0 +1,62 @@
+#include "band_workers.h"
+
+#include <algorithm>
+
+using namespace std;
+
+BandWorkers::BandWorkers(int bands)
+    : bands_(max(1, bands)), work_(nullptr), generation_(0), pending_(0),
+      stopping_(false) {
+    for (int b = 1; b < bands_; b++) {
+        threads_.emplace_back(&BandWorkers::Loop, this, b);
+    }
+}
+
+BandWorkers::~BandWorkers() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_.notify_all();
+    for (thread &t : threads_) {
+        t.join();
+    }
+}
+
+void BandWorkers::Run(const function<void(int)> &work) {
+    if (bands_ > 1) {
+        lock_guard<mutex> lock(mutex_);
+        work_ = &work;
+        pending_ = bands_ - 1;
+        generation_++;
+    }
+    start_.notify_all();
+    work(0);
+    if (bands_ > 1) {
+        unique_lock<mutex> lock(mutex_);
+        done_.wait(lock, [&] { return pending_ == 0; });
+        work_ = nullptr;
+    }
+}
+
+void BandWorkers::Loop(int band) {
+    int seen = 0;
+    for (;;) {
+        const function<void(int)> *work;
+        {
+            unique_lock<mutex> lock(mutex_);
+            start_.wait(lock,
+                        [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) {
+                return;
+            }
+            seen = generation_;
+            work = work_;
+        }
+        (*work)(band);
+        lock_guard<mutex> lock(mutex_);
+        if (--pending_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
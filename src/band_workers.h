@@ -0,0 +1,38 @@
+#ifndef __BAND_WORKERS_H__
+#define __BAND_WORKERS_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent threads that split per-frame work into bands. Run() blocks
+// until every band is done; the calling thread takes band 0, so one band
+// runs without any handoff.
+class BandWorkers {
+  public:
+    explicit BandWorkers(int bands);
+    ~BandWorkers();
+    BandWorkers(const BandWorkers &) = delete;
+    BandWorkers &operator=(const BandWorkers &) = delete;
+
+    int Bands() const { return bands_; }
+    // work(band) for band in [0, Bands())
+    void Run(const std::function<void(int)> &work);
+
+  private:
+    void Loop(int band);
+
+    const int bands_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(int)> *work_;
+    int generation_;
+    int pending_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+};
+
+#endif //__BAND_WORKERS_H__
@@ -0,0 +1,131 @@
+#ifndef __BIT_READER_H__
+#define __BIT_READER_H__
+
+#include "simd.h"
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Strips the emulation prevention bytes (00 00 03) of a NAL unit, leaving
+// its RBSP in rbsp.
+inline void nalToRbsp(const uint8_t *nal, size_t size,
+                      std::vector<uint8_t> &rbsp) {
+    rbsp.resize(size);
+    size_t n = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp[n++] = nal[i];
+    }
+    rbsp.resize(n);
+}
+
+// MSB-first reader over an RBSP. Reading past the end yields zero bits and
+// sets Overrun().
+class BitReader {
+  public:
+    BitReader(const uint8_t *data, size_t size)
+        : data_(data), size_(size), pos_(0), overrun_(false) {
+        // position of the rbsp_stop_one_bit
+        size_t end = size;
+        while (end > 0 && data[end - 1] == 0) {
+            end--;
+        }
+        stopBit_ = end ? end * 8 - 1 - lowestBit(data[end - 1]) : 0;
+    }
+
+    // up to 32 bits without consuming them
+    uint32_t PeekBits(int n) const {
+        if (n == 0) {
+            return 0;
+        }
+        return (uint32_t)((Load64(pos_ >> 3) << (pos_ & 7)) >> (64 - n));
+    }
+    void SkipBits(size_t n) {
+        pos_ += n;
+        overrun_ |= pos_ > size_ * 8;
+    }
+    uint32_t ReadBits(int n) {
+        const uint32_t v = PeekBits(n);
+        SkipBits(n);
+        return v;
+    }
+    uint32_t ReadBit() { return ReadBits(1); }
+
+    // ue(v), 9.1
+    uint32_t ReadUe() {
+        const uint32_t next = PeekBits(32);
+        if (next == 0) {
+            SkipBits(64);
+            return 0;
+        }
+        const int leadingZeros = 31 - highestBit(next);
+        SkipBits(leadingZeros + 1);
+        return (1u << leadingZeros) - 1 + ReadBits(leadingZeros);
+    }
+
+    // se(v), 9.1.1
+    int32_t ReadSe() {
+        const uint32_t k = ReadUe();
+        return (k & 1) ? (int32_t)((k + 1) / 2) : -(int32_t)(k / 2);
+    }
+
+    // te(v) with the given range, 9.1
+    uint32_t ReadTe(uint32_t range) {
+        return range > 1 ? ReadUe() : !ReadBit();
+    }
+
+    // zero bits before the next 1, which is consumed as well
+    int ReadLeadingZeros() {
+        int zeros = 0;
+        uint32_t next;
+        while ((next = PeekBits(32)) == 0) {
+            SkipBits(32);
+            zeros += 32;
+            if (overrun_) {
+                return zeros;
+            }
+        }
+        const int n = 31 - highestBit(next);
+        SkipBits(n + 1);
+        return zeros + n;
+    }
+
+    void AlignToByte() { pos_ = (pos_ + 7) & ~(size_t)7; }
+
+    bool Overrun() const { return overrun_; }
+    size_t BitsRead() const { return pos_; }
+    // more_rbsp_data(), 7.2
+    bool MoreRbspData() const { return pos_ < stopBit_; }
+
+  private:
+    uint64_t Load64(size_t byte) const {
+        uint64_t v = 0;
+        if (byte + 8 <= size_) {
+            uint8_t b[8];
+            memcpy(b, data_ + byte, 8);
+            for (int i = 0; i < 8; i++) {
+                v = (v << 8) | b[i];
+            }
+            return v;
+        }
+        for (int i = 0; i < 8; i++) {
+            v = (v << 8) | (byte + i < size_ ? data_[byte + i] : 0);
+        }
+        return v;
+    }
+
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+    size_t stopBit_;
+    bool overrun_;
+};
+
+#endif //__BIT_READER_H__
@@ -0,0 +1,275 @@
+#include "bitrate_search.h"
+#include "quality.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct SearchPoint {
+    int iKbps;
+    QualityScore score;
+    double fQuality;
+};
+
+struct SearchResult {
+    SearchPoint best;
+    bool bConverged = false;
+    int iEncodes = 0;
+    int iCacheHits = 0;
+};
+
+class BitrateSearch {
+  public:
+    BitrateSearch(const TestOptions &opts, const SEncParamExt &param)
+        : opts_(opts), param_(param), useSsim_(opts.targetSsim > 0),
+          target_(useSsim_ ? opts.targetSsim : opts.targetPsnr),
+          tolerance_(opts.searchTolerance > 0 ? opts.searchTolerance
+                     : useSsim_              ? 0.002
+                                             : 0.1),
+          searchDir_(testbinDir + "search/") {
+        fs::create_directories(searchDir_);
+        cacheFile_ = searchDir_ + "cache.txt";
+        LoadCache();
+    }
+
+    // searches one configuration over the first `frames` frames (0 = all)
+    SearchResult Run(const string &config, int frames, int startKbps);
+    const char *MetricName() const { return useSsim_ ? "SSIM" : "PSNR"; }
+    double Target() const { return target_; }
+
+  private:
+    SearchPoint Evaluate(const string &config, int kbps, int frames,
+                         SearchResult &result);
+    string CacheKey(const string &config, int kbps, int frames) const;
+    void LoadCache();
+    void StoreCache(const string &key, const QualityScore &score);
+
+    const TestOptions &opts_;
+    SEncParamExt param_;
+    bool useSsim_;
+    double target_;
+    double tolerance_;
+    string searchDir_;
+    string cacheFile_;
+    map<string, QualityScore> cache_;
+};
+
+string BitrateSearch::CacheKey(const string &config, int kbps,
+                               int frames) const {
+    const string hash = encodeConfigHash(opts_, param_, isDiffEncoding != 0);
+    char key[128];
+    snprintf(key, sizeof(key), "%s %s %d %d", config.c_str(), hash.c_str(),
+             kbps, frames);
+    return key;
+}
+
+void BitrateSearch::LoadCache() {
+    ifstream in(cacheFile_.c_str());
+    string line;
+    while (getline(in, line)) {
+        stringstream ss(line);
+        string config, hash;
+        int kbps, frames;
+        QualityScore score;
+        if (ss >> config >> hash >> kbps >> frames >> score.fPsnr >>
+            score.fSsim >> score.iFrames >> score.iBytes) {
+            cache_[config + " " + hash + " " + to_string(kbps) + " " +
+                   to_string(frames)] = score;
+        }
+    }
+}
+
+void BitrateSearch::StoreCache(const string &key, const QualityScore &score) {
+    cache_[key] = score;
+    FILE *fp = fopen(cacheFile_.c_str(), "a");
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "%s %.4f %.6f %d %lld\n", key.c_str(), score.fPsnr,
+            score.fSsim, score.iFrames, score.iBytes);
+    fclose(fp);
+}
+
+SearchPoint BitrateSearch::Evaluate(const string &config, int kbps,
+                                    int frames, SearchResult &result) {
+    SearchPoint point;
+    point.iKbps = kbps;
+    const string key = CacheKey(config, kbps, frames);
+    auto cached = cache_.find(key);
+    const bool fromCache = cached != cache_.end();
+    if (fromCache) {
+        point.score = cached->second;
+        result.iCacheHits++;
+    } else {
+        SEncParamExt p = param_;
+        p.sSpatialLayers[0].iSpatialBitrate = kbps * 1000;
+        string suffix;
+        BaseEncoderTest test;
+        test.maxFrames_ = frames;
+        test.prioritySource_ =
+            isDiffEncoding ? createPrioritySource(opts_, suffix, "-search")
+                           : nullptr;
+        QualityCallback cbk(width, height);
+        if (!cbk.Open(opts_.input)) {
+            cerr << "Cannot open decoder or " << opts_.input << '\n';
+            exit(1);
+        }
+        const string outName =
+            searchDir_ + config + "-" + to_string(kbps) + "k" +
+            (frames ? "-" + to_string(frames) + "f" : "") + h264Suffix;
+        test.SetUp();
+        test.EncodeFile(opts_.input.c_str(), &p, &cbk, outName);
+        test.TearDown();
+        delete test.prioritySource_;
+        if (cbk.DecodeFailures()) {
+            cerr << cbk.DecodeFailures() << " frames failed to decode\n";
+        }
+        point.score = cbk.Score();
+        StoreCache(key, point.score);
+        result.iEncodes++;
+    }
+    point.fQuality = useSsim_ ? point.score.fSsim : point.score.fPsnr;
+    cout << "  " << config << " " << kbps << " kbps"
+         << (frames ? " (" + to_string(frames) + " frames)" : "") << ": PSNR "
+         << point.score.fPsnr << " dB, SSIM " << point.score.fSsim
+         << (fromCache ? " [cached]" : "") << endl;
+    return point;
+}
+
+// Brackets the target by doubling or halving, then narrows with secant
+// steps on log(bitrate), where quality is close to linear. Each step is
+// kept inside the middle 80% of the bracket so a bad secant cannot stall.
+SearchResult BitrateSearch::Run(const string &config, int frames,
+                                int startKbps) {
+    SearchResult result;
+    const int minKbps = (int)(opts_.searchMinMbps * 1000);
+    const int maxKbps = (int)(opts_.searchMaxMbps * 1000);
+    int kbps = min(max(startKbps, minKbps), maxKbps);
+
+    SearchPoint point = Evaluate(config, kbps, frames, result);
+    result.best = point;
+    bool haveLow = false, haveHigh = false;
+    SearchPoint low, high;
+    while (result.iEncodes + result.iCacheHits < opts_.searchMaxEncodes) {
+        if (fabs(point.fQuality - target_) <=
+            fabs(result.best.fQuality - target_)) {
+            result.best = point;
+        }
+        if (fabs(point.fQuality - target_) <= tolerance_) {
+            result.bConverged = true;
+            break;
+        }
+        if (point.fQuality < target_) {
+            low = point;
+            haveLow = true;
+        } else {
+            high = point;
+            haveHigh = true;
+        }
+
+        int next;
+        if (!haveHigh) {
+            next = min(low.iKbps * 2, maxKbps);
+        } else if (!haveLow) {
+            next = max(high.iKbps / 2, minKbps);
+        } else {
+            const double lo = log((double)low.iKbps);
+            const double hi = log((double)high.iKbps);
+            double x = lo + (target_ - low.fQuality) * (hi - lo) /
+                                (high.fQuality - low.fQuality);
+            x = min(max(x, lo + 0.1 * (hi - lo)), hi - 0.1 * (hi - lo));
+            next = (int)lround(exp(x));
+        }
+        if (next == point.iKbps || (haveLow && next <= low.iKbps) ||
+            (haveHigh && next >= high.iKbps)) {
+            // out of range or bracket narrower than 1 kbps
+            break;
+        }
+        point = Evaluate(config, next, frames, result);
+    }
+    if (fabs(point.fQuality - target_) <=
+        fabs(result.best.fQuality - target_)) {
+        result.best = point;
+    }
+    result.bConverged = fabs(result.best.fQuality - target_) <= tolerance_;
+    return result;
+}
+
+} // namespace
+
+int runBitrateSearch(const TestOptions &opts, const SEncParamExt &param,
+                     float initialMbps) {
+    BitrateSearch search(opts, param);
+    const int diffEncoding = isDiffEncoding;
+    vector<pair<string, int>> configs;
+    configs.push_back(make_pair(string("base"), 0));
+    if (diffEncoding) {
+        configs.push_back(make_pair(prioritySuffix(opts).substr(1), 1));
+    }
+
+    StatsReport report;
+    vector<SearchResult> results;
+    for (auto &config : configs) {
+        isDiffEncoding = config.second;
+        cout << "Searching " << config.first << " for " << search.MetricName()
+             << " " << search.Target() << endl;
+        int startKbps = (int)(initialMbps * 1000);
+        SearchResult result;
+        if (opts.searchSubset > 0) {
+            SearchResult subset =
+                search.Run(config.first, opts.searchSubset, startKbps);
+            startKbps = subset.best.iKbps;
+            result.iEncodes += subset.iEncodes;
+            result.iCacheHits += subset.iCacheHits;
+        }
+        SearchResult full = search.Run(config.first, 0, startKbps);
+        full.iEncodes += result.iEncodes;
+        full.iCacheHits += result.iCacheHits;
+        results.push_back(full);
+
+        cout << config.first << ": " << full.best.iKbps << " kbps, PSNR "
+             << full.best.score.fPsnr << " dB, SSIM " << full.best.score.fSsim
+             << (full.bConverged ? "" : " (target not reached)") << ", "
+             << full.iEncodes << " encodes, " << full.iCacheHits
+             << " cached" << endl;
+        const string prefix = "search_" + config.first + "_";
+        report.AddCounter(prefix + "kbps", full.best.iKbps);
+        report.AddCounter(prefix + "psnr", full.best.score.fPsnr);
+        report.AddCounter(prefix + "ssim", full.best.score.fSsim);
+        report.AddCounter(prefix + "converged", full.bConverged);
+        report.AddCounter(prefix + "encodes", full.iEncodes);
+        report.AddCounter(prefix + "cache_hits", full.iCacheHits);
+    }
+    isDiffEncoding = diffEncoding;
+
+    if (results.size() == 2) {
+        const double saving =
+            (1 - (double)results[1].best.iKbps / results[0].best.iKbps) * 100;
+        cout << configs[1].first << " needs " << saving
+             << "% less bitrate than base for equal " << search.MetricName()
+             << endl;
+        report.AddCounter("search_bitrate_saving_pct", saving);
+    }
+    const string statsFile = testbinDir + "search/search.stats.json";
+    if (!report.WriteJson(statsFile)) {
+        cerr << "Failed to write " << statsFile << '\n';
+    }
+    for (const SearchResult &result : results) {
+        if (!result.bConverged) {
+            return 1;
+        }
+    }
+    return 0;
+}
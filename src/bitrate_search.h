@@ -0,0 +1,16 @@
+#ifndef __BITRATE_SEARCH_H__
+#define __BITRATE_SEARCH_H__
+
+#include "harness.h"
+
+// Searches the iSpatialBitrate that reaches opts.targetPsnr (or
+// opts.targetSsim) within the tolerance, for the baseline and, when
+// isDiffEncoding is set, the priority-map configuration. Quality is
+// measured in-process by decoding each encode (quality.h). Results are
+// cached in testbin/search/cache.txt, keyed by configuration, encoder
+// parameters, bitrate and frame count, so reruns and the full-sequence
+// confirmation reuse earlier encodes.
+int runBitrateSearch(const TestOptions &opts, const SEncParamExt &param,
+                     float initialMbps);
+
+#endif //__BITRATE_SEARCH_H__
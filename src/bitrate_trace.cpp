@@ -0,0 +1,236 @@
+#include "bitrate_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// a step has settled once the rate over the last settleFrames_ frames is
+// this close to the new target
+static const float settleTolerance = 0.1f;
+
+bool loadBandwidthTrace(const string &fileName,
+                        vector<BandwidthSample> &samples) {
+    ifstream trace(fileName.c_str());
+    if (!trace.is_open()) {
+        return false;
+    }
+    string line;
+    while (getline(trace, line)) {
+        replace(line.begin(), line.end(), ',', ' ');
+        stringstream ss(line);
+        BandwidthSample sample;
+        if (ss >> sample.fTimestampMs >> sample.fKbps && sample.fKbps > 0) {
+            samples.push_back(sample);
+        }
+    }
+    trace.close();
+    return !samples.empty();
+}
+
+BitrateController::BitrateController(const vector<BandwidthSample> &samples,
+                                     float fps, float headroom, int windowMs)
+    : samples_(samples), cursor_(0), fps_(fps), headroom_(headroom),
+      windowMs_(windowMs), appliedKbps_(0), endMs_(0), setOptionFailures_(0) {
+    const double t0 = samples_[0].fTimestampMs;
+    for (auto &s : samples_) {
+        s.fTimestampMs -= t0;
+    }
+    settleFrames_ = max(1, (int)lround(fps / 10));
+    recentBytes_.assign(settleFrames_, 0);
+}
+
+long long BitrateController::TimestampMs(int frameNum) const {
+    return (long long)((frameNum - 1) * 1000.0 / fps_);
+}
+
+float BitrateController::CapacityAt(double timestampMs) {
+    while (cursor_ + 1 < samples_.size() &&
+           samples_[cursor_ + 1].fTimestampMs <= timestampMs) {
+        cursor_++;
+    }
+    return samples_[cursor_].fKbps;
+}
+
+bool BitrateController::SetBitrate(ISVCEncoder *encoder,
+                                   ENCODER_OPTION option, float kbps) {
+    SBitrateInfo bitrate;
+    bitrate.iLayer = SPATIAL_LAYER_ALL;
+    bitrate.iBitrate = (int)(kbps * 1000);
+    if (encoder->SetOption(option, &bitrate) != cmResultSuccess) {
+        if (!setOptionFailures_++) {
+            cerr << "SetOption rejected bitrate " << bitrate.iBitrate << '\n';
+        }
+        return false;
+    }
+    return true;
+}
+
+void BitrateController::Apply(ISVCEncoder *encoder, int frameNum) {
+    const double t = TimestampMs(frameNum);
+    const float kbps = CapacityAt(t);
+    if (kbps == appliedKbps_) {
+        return;
+    }
+    // keep target <= max at every point of the update
+    if (kbps < appliedKbps_) {
+        SetBitrate(encoder, ENCODER_OPTION_BITRATE, kbps * headroom_);
+        SetBitrate(encoder, ENCODER_OPTION_MAX_BITRATE, kbps);
+    } else {
+        SetBitrate(encoder, ENCODER_OPTION_MAX_BITRATE, kbps);
+        SetBitrate(encoder, ENCODER_OPTION_BITRATE, kbps * headroom_);
+    }
+    if (appliedKbps_ > 0) {
+        Step step;
+        step.fTimestampMs = t;
+        step.fKbps = kbps * headroom_;
+        step.iFrameNum = frameNum;
+        steps_.push_back(step);
+    }
+    appliedKbps_ = kbps;
+}
+
+void BitrateController::FrameEncoded(ISVCEncoder *encoder, int frameNum,
+                                     const SFrameBSInfo &info) {
+    const double t = TimestampMs(frameNum);
+    const size_t w = (size_t)(t / windowMs_);
+    if (windows_.size() <= w) {
+        windows_.resize(w + 1);
+    }
+    Window &window = windows_[w];
+    long long bytes = 0;
+    if (info.eFrameType == videoFrameTypeSkip) {
+        window.iSkipped++;
+    } else {
+        bytes = info.iFrameSizeInBytes;
+        SEncoderStatistics stats;
+        memset(&stats, 0, sizeof(stats));
+        encoder->GetOption(ENCODER_OPTION_GET_STATISTICS, &stats);
+        window.iBytes += bytes;
+        window.iFrames++;
+        window.iQpSum += stats.uiAverageFrameQP;
+    }
+    recentBytes_[frameNum % settleFrames_] = bytes;
+    endMs_ = t + 1000.0 / fps_;
+
+    if (steps_.empty() || steps_.back().fReactionMs >= 0 ||
+        frameNum - steps_.back().iFrameNum + 1 < settleFrames_) {
+        return;
+    }
+    Step &step = steps_.back();
+    long long recent = 0;
+    for (long long b : recentBytes_) {
+        recent += b;
+    }
+    const double kbps = recent * 8 * fps_ / settleFrames_ / 1000;
+    if (fabs(kbps - step.fKbps) <= settleTolerance * step.fKbps) {
+        step.fReactionMs = endMs_ - step.fTimestampMs;
+        reaction_.Record(step.fReactionMs * 1000);
+    }
+}
+
+// kbit the trace allows over [fromMs, toMs)
+double BitrateController::CapacityKbit(double fromMs, double toMs) const {
+    double kbit = 0;
+    for (size_t s = 0; s < samples_.size(); s++) {
+        const double begin = max(fromMs, samples_[s].fTimestampMs);
+        const double end = s + 1 < samples_.size()
+                               ? min(toMs, samples_[s + 1].fTimestampMs)
+                               : toMs;
+        if (end > begin) {
+            kbit += samples_[s].fKbps * (end - begin) / 1000;
+        }
+    }
+    return kbit;
+}
+
+bool BitrateController::WriteCsv(const string &fileName) const {
+    FILE *fp = fopen(fileName.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+    fprintf(fp, "window_start_ms,capacity_kbps,target_kbps,achieved_kbps,"
+                "overshoot_pct,mean_qp,frames,skipped\n");
+    for (size_t w = 0; w < windows_.size(); w++) {
+        const Window &window = windows_[w];
+        const double begin = (double)w * windowMs_;
+        const double seconds = (min(endMs_, begin + windowMs_) - begin) / 1000;
+        const double capacity = CapacityKbit(begin, begin + seconds * 1000) /
+                                seconds;
+        const double achieved = window.iBytes * 8 / 1000.0 / seconds;
+        fprintf(fp, "%.0f,%.1f,%.1f,%.1f,%.2f,%.2f,%d,%d\n", begin, capacity,
+                capacity * headroom_, achieved,
+                (achieved / capacity - 1) * 100,
+                window.iFrames ? (double)window.iQpSum / window.iFrames : 0.0,
+                window.iFrames, window.iSkipped);
+    }
+    fclose(fp);
+    return true;
+}
+
+void BitrateController::Summarize(Summary &s) const {
+    memset(&s, 0, sizeof(s));
+    for (size_t w = 0; w < windows_.size(); w++) {
+        const Window &window = windows_[w];
+        const double begin = (double)w * windowMs_;
+        const double end = min(endMs_, begin + windowMs_);
+        const double capacityKbit = CapacityKbit(begin, end);
+        const double achievedKbit = window.iBytes * 8 / 1000.0;
+        if (achievedKbit > capacityKbit) {
+            s.iWindowsOver++;
+            s.fExcessKbit += achievedKbit - capacityKbit;
+            s.fMaxOvershootPct = max(
+                s.fMaxOvershootPct, (achievedKbit / capacityKbit - 1) * 100);
+        }
+        s.fCapacityKbit += capacityKbit;
+        s.fAchievedKbit += achievedKbit;
+        s.iFrames += window.iFrames;
+        s.iSkipped += window.iSkipped;
+        s.iQpSum += window.iQpSum;
+    }
+    for (const Step &step : steps_) {
+        s.iSettled += step.fReactionMs >= 0;
+    }
+}
+
+void BitrateController::printSummary() const {
+    Summary s;
+    Summarize(s);
+    const double seconds = endMs_ / 1000;
+    cout << "Bandwidth trace: " << steps_.size() << " bitrate changes, "
+         << s.iSettled << " settled within " << settleTolerance * 100
+         << "% of target" << endl;
+    cout << "  capacity " << s.fCapacityKbit / seconds << " kbps, achieved "
+         << s.fAchievedKbit / seconds << " kbps, " << s.iWindowsOver << "/"
+         << windows_.size() << " windows over capacity (max +"
+         << s.fMaxOvershootPct << "%, " << s.fExcessKbit << " kbit excess)"
+         << endl;
+    cout << "  mean QP " << (s.iFrames ? (double)s.iQpSum / s.iFrames : 0)
+         << ", " << s.iSkipped << " frames skipped, reaction p50 "
+         << reaction_.Percentile(50) / 1000 << " ms, max "
+         << reaction_.Max() / 1000 << " ms" << endl;
+}
+
+void BitrateController::AddToReport(StatsReport &report) const {
+    Summary s;
+    Summarize(s);
+    const double seconds = endMs_ / 1000;
+    report.AddCounter("bw_changes", (double)steps_.size());
+    report.AddCounter("bw_changes_settled", s.iSettled);
+    report.AddCounter("bw_capacity_kbps", s.fCapacityKbit / seconds);
+    report.AddCounter("bw_achieved_kbps", s.fAchievedKbit / seconds);
+    report.AddCounter("bw_windows", (double)windows_.size());
+    report.AddCounter("bw_windows_over_capacity", s.iWindowsOver);
+    report.AddCounter("bw_max_overshoot_pct", s.fMaxOvershootPct);
+    report.AddCounter("bw_excess_kbit", s.fExcessKbit);
+    report.AddCounter("bw_mean_qp",
+                      s.iFrames ? (double)s.iQpSum / s.iFrames : 0);
+    report.AddCounter("bw_frames_skipped", s.iSkipped);
+    report.AddCounter("bw_setoption_failures", setOptionFailures_);
+    report.AddHistogram("rc_reaction", reaction_);
+}
@@ -0,0 +1,90 @@
+#ifndef __BITRATE_TRACE_H__
+#define __BITRATE_TRACE_H__
+
+#include "stats.h"
+
+#include <wels/codec_api.h>
+#include <wels/codec_app_def.h>
+
+#include <string>
+#include <vector>
+
+// One bandwidth trace sample: the link capacity from fTimestampMs until the
+// next sample, in kbit/s.
+struct BandwidthSample {
+    double fTimestampMs;
+    float fKbps;
+};
+
+bool loadBandwidthTrace(const std::string &fileName,
+                        std::vector<BandwidthSample> &samples);
+
+// Drives the encoder's target and max bitrate from a bandwidth trace during
+// a single encode and accounts what rate control made of it. The trace is
+// rebased onto the media timeline (frame n at (n - 1) / fps) and held at
+// its last value past the end.
+class BitrateController {
+  public:
+    BitrateController(const std::vector<BandwidthSample> &samples, float fps,
+                      float headroom, int windowMs);
+
+    long long TimestampMs(int frameNum) const;
+    // SetOption BITRATE / MAX_BITRATE when the capacity changes
+    void Apply(ISVCEncoder *encoder, int frameNum);
+    void FrameEncoded(ISVCEncoder *encoder, int frameNum,
+                      const SFrameBSInfo &info);
+
+    bool WriteCsv(const std::string &fileName) const;
+    void printSummary() const;
+    void AddToReport(StatsReport &report) const;
+
+  private:
+    // achieved rate over fixed windows of the media timeline
+    struct Window {
+        long long iBytes = 0;
+        int iFrames = 0;
+        int iSkipped = 0;
+        long long iQpSum = 0;
+    };
+    // a capacity change waiting for rate control to follow it
+    struct Step {
+        double fTimestampMs;
+        float fKbps;  ///< new target
+        int iFrameNum; ///< first frame encoded with it
+        double fReactionMs = -1; ///< -1 until settled
+    };
+    struct Summary {
+        double fCapacityKbit;
+        double fAchievedKbit;
+        double fExcessKbit;
+        double fMaxOvershootPct;
+        int iWindowsOver;
+        int iFrames;
+        int iSkipped;
+        long long iQpSum;
+        int iSettled;
+    };
+
+    float CapacityAt(double timestampMs);
+    double CapacityKbit(double fromMs, double toMs) const;
+    bool SetBitrate(ISVCEncoder *encoder, ENCODER_OPTION option, float kbps);
+    void Summarize(Summary &s) const;
+
+    std::vector<BandwidthSample> samples_;
+    size_t cursor_;
+    float fps_;
+    float headroom_;
+    int windowMs_;
+    float appliedKbps_;
+    double endMs_;
+
+    std::vector<Window> windows_;
+    std::vector<Step> steps_;
+    // bytes of the most recent frames, to judge when a step has settled
+    std::vector<long long> recentBytes_;
+    int settleFrames_;
+    int setOptionFailures_;
+    LatencyHistogram reaction_;
+};
+
+#endif //__BITRATE_TRACE_H__
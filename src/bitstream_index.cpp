@@ -0,0 +1,256 @@
+#include "bitstream_index.h"
+#include "annexb.h"
+#include "durable.h"
+#include "mapped_file.h"
+#include "timing.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static uint8_t nalTypeOf(const unsigned char *nal, int len) {
+    // openh264 NAL lengths include the start code
+    for (int k = 0; k + 1 < len; k++) {
+        if (nal[k] == 1) {
+            return nal[k + 1] & 0x1f;
+        }
+        if (nal[k] != 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static BitstreamIndexEntry entryAt(uint64_t offset, int frameNum) {
+    BitstreamIndexEntry e;
+    memset(&e, 0, sizeof(e));
+    e.uiOffset = offset;
+    e.iFrameNum = frameNum;
+    e.uiFrameType = videoFrameTypeInvalid;
+    return e;
+}
+
+bool BitstreamIndexWriter::Open(const string &fileName,
+                                uint64_t streamOffset) {
+    Close();
+    fp_ = fopen(fileName.c_str(), streamOffset == 0 ? "wb" : "ab");
+    if (!fp_) {
+        return false;
+    }
+    fseek(fp_, 0, SEEK_END);
+    if (ftell(fp_) == 0) {
+        BitstreamIndexHeader hdr = {bitstreamIndexMagic, bitstreamIndexVersion,
+                                    (uint16_t)sizeof(BitstreamIndexEntry)};
+        fwrite(&hdr, sizeof(hdr), 1, fp_);
+    }
+    return true;
+}
+
+void BitstreamIndexWriter::AddFrame(int frameNum, const SFrameBSInfo &frameInfo,
+                                    uint64_t streamOffset) {
+    if (!fp_) {
+        return;
+    }
+    BitstreamIndexEntry e = entryAt(streamOffset, frameNum);
+    uint64_t pos = streamOffset;
+    for (int l = 0; l < frameInfo.iLayerNum; l++) {
+        const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+        const unsigned char *nal = layer.pBsBuf;
+        for (int n = 0; n < layer.iNalCount; n++) {
+            const int len = layer.pNalLengthInByte[n];
+            e.uiNalTypes |= 1u << nalTypeOf(nal, len);
+            e.uiSize += len;
+            nal += len;
+        }
+        pos += nal - layer.pBsBuf;
+        if (layer.uiLayerType == VIDEO_CODING_LAYER) {
+            e.uiFrameType = (uint8_t)layer.eFrameType;
+            e.uiSpatialId = layer.uiSpatialId;
+            e.uiTemporalId = layer.uiTemporalId;
+            fwrite(&e, sizeof(e), 1, fp_);
+            e = entryAt(pos, frameNum);
+        }
+    }
+    if (e.uiSize) {
+        // parameter sets without a layer after them
+        e.uiFrameType = (uint8_t)frameInfo.eFrameType;
+        fwrite(&e, sizeof(e), 1, fp_);
+    }
+}
+
+void BitstreamIndexWriter::Close() {
+    if (fp_) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+}
+
+bool BitstreamIndexWriter::Flush() { return !fp_ || fflush(fp_) == 0; }
+
+bool BitstreamIndexWriter::Sync() { return !fp_ || syncFile(fp_); }
+
+bool loadBitstreamIndex(const string &fileName,
+                        vector<BitstreamIndexEntry> &entries) {
+    entries.clear();
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    BitstreamIndexHeader hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              hdr.uiMagic == bitstreamIndexMagic &&
+              hdr.uiVersion == bitstreamIndexVersion &&
+              hdr.uiEntrySize == sizeof(BitstreamIndexEntry);
+    BitstreamIndexEntry e;
+    while (ok && fread(&e, sizeof(e), 1, fp) == 1) {
+        entries.push_back(e);
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool writeBitstreamIndex(const string &fileName,
+                         const vector<BitstreamIndexEntry> &entries) {
+    FILE *fp = fopen(fileName.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    BitstreamIndexHeader hdr = {bitstreamIndexMagic, bitstreamIndexVersion,
+                                (uint16_t)sizeof(BitstreamIndexEntry)};
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(entries.data(), sizeof(BitstreamIndexEntry),
+                     entries.size(), fp) == entries.size();
+    return fclose(fp) == 0 && ok;
+}
+
+bool truncateBitstream(const string &stream, uint64_t offset) {
+    error_code ec;
+    if (!fs::exists(stream, ec) || fs::file_size(stream, ec) < offset) {
+        return false;
+    }
+    vector<BitstreamIndexEntry> entries;
+    loadBitstreamIndex(stream + bitstreamIndexSuffix, entries);
+    vector<BitstreamIndexEntry> kept;
+    uint64_t end = 0;
+    for (const BitstreamIndexEntry &e : entries) {
+        if (e.uiOffset >= offset) {
+            break;
+        }
+        kept.push_back(e);
+        end = e.uiOffset + e.uiSize;
+    }
+    if (end != offset) {
+        return false;
+    }
+    fs::resize_file(stream, offset, ec);
+    return !ec && writeBitstreamIndex(stream + bitstreamIndexSuffix, kept);
+}
+
+void indexAnnexB(const uint8_t *data, size_t size,
+                 vector<BitstreamIndexEntry> &entries, int threads) {
+    vector<NalUnit> nals;
+    vector<AccessUnit> aus;
+    splitNalUnits(data, size, nals, threads);
+    groupAccessUnits(data, nals, aus);
+    entries.clear();
+    entries.reserve(aus.size());
+    for (size_t a = 0; a < aus.size(); a++) {
+        const AccessUnit &au = aus[a];
+        BitstreamIndexEntry e = entryAt(au.iStart, (int)a + 1);
+        bool haveSlice = false;
+        for (int n = au.iFirstNal; n < au.iFirstNal + au.iNalCount; n++) {
+            const NalUnit &nal = nals[n];
+            const uint8_t *p = data + nal.iOffset;
+            // nal_unit_header_svc_extension of prefix and extension NALs
+            const bool svc = (nal.uiType == nalPrefix ||
+                              nal.uiType == nalSliceExt) &&
+                             nal.iSize >= 4;
+            const uint8_t spatialId = svc ? (p[2] >> 4) & 7 : 0;
+            if (nal.uiType == nalSliceExt && haveSlice &&
+                spatialId != e.uiSpatialId) {
+                e.uiSize = (uint32_t)(nal.iStart - e.uiOffset);
+                entries.push_back(e);
+                e = entryAt(nal.iStart, (int)a + 1);
+                haveSlice = false;
+            }
+            e.uiNalTypes |= 1u << nal.uiType;
+            if (svc) {
+                e.uiTemporalId = p[3] >> 5;
+                e.uiSpatialId = spatialId;
+            }
+            if (nal.uiType != nalSliceNonIdr && nal.uiType != nalSliceIdr &&
+                nal.uiType != nalSliceExt) {
+                continue;
+            }
+            if (!haveSlice) {
+                const int sliceType = peekSliceType(data, nal);
+                if (nal.uiType == nalSliceIdr ||
+                    (nal.uiType == nalSliceExt && svc && (p[1] & 0x40))) {
+                    e.uiFrameType = videoFrameTypeIDR;
+                } else if (sliceType == 2 || sliceType == 4) {
+                    e.uiFrameType = videoFrameTypeI;
+                } else {
+                    e.uiFrameType = videoFrameTypeP;
+                }
+            }
+            haveSlice = true;
+        }
+        e.uiSize = (uint32_t)(au.iStart + au.iSize - e.uiOffset);
+        entries.push_back(e);
+    }
+}
+
+// the scan cannot see frame numbers, nor temporal ids without SVC headers
+static bool sameLayout(const BitstreamIndexEntry &scanned,
+                       const BitstreamIndexEntry &written) {
+    const bool svc = scanned.uiNalTypes &
+                     ((1u << nalPrefix) | (1u << nalSliceExt));
+    return scanned.uiOffset == written.uiOffset &&
+           scanned.uiSize == written.uiSize &&
+           scanned.uiNalTypes == written.uiNalTypes &&
+           scanned.uiFrameType == written.uiFrameType &&
+           scanned.uiSpatialId == written.uiSpatialId &&
+           (!svc || scanned.uiTemporalId == written.uiTemporalId);
+}
+
+int runIndexer(const string &streamFileName, int threads) {
+    MappedFile stream;
+    if (!stream.Open(streamFileName)) {
+        cerr << "Cannot map " << streamFileName << '\n';
+        return 1;
+    }
+    const int64_t startUs = monotonicUs();
+    vector<BitstreamIndexEntry> entries;
+    indexAnnexB(stream.Data(), stream.Size(), entries, threads);
+    const double seconds = (monotonicUs() - startUs) / 1e6;
+    cout << streamFileName << ": " << entries.size() << " entries in "
+         << seconds * 1000 << " ms ("
+         << (seconds > 0 ? stream.Size() / seconds / (1 << 20) : 0)
+         << " MB/s)" << endl;
+
+    const string indexFileName = streamFileName + bitstreamIndexSuffix;
+    vector<BitstreamIndexEntry> written;
+    if (loadBitstreamIndex(indexFileName, written)) {
+        size_t i = 0;
+        while (i < entries.size() && i < written.size() &&
+               sameLayout(entries[i], written[i])) {
+            i++;
+        }
+        if (i == entries.size() && i == written.size()) {
+            cout << "Encode-time sidecar matches the scan, kept "
+                 << indexFileName << endl;
+            return 0;
+        }
+        cout << "Sidecar differs from the scan at entry " << i
+             << ", rewriting it" << endl;
+    }
+    if (!writeBitstreamIndex(indexFileName, entries)) {
+        cerr << "Failed to write " << indexFileName << '\n';
+        return 1;
+    }
+    cout << "Wrote " << indexFileName << endl;
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef __BITSTREAM_INDEX_H__
+#define __BITSTREAM_INDEX_H__
+
+#include <wels/codec_app_def.h>
+
+#include <cstdio>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+const uint32_t bitstreamIndexMagic = 0x58444948; // "HIDX"
+const uint16_t bitstreamIndexVersion = 1;
+// sidecar of out.h264 is out.h264.idx
+const char *const bitstreamIndexSuffix = ".idx";
+
+// Sidecar layout: this header, then one entry per frame and spatial layer
+// in stream order, little endian. Entries tile the stream: parameter sets
+// and SEI go with the layer that follows them, so [uiOffset, uiOffset +
+// uiSize) can be fed to a decoder on its own once the preceding layers of
+// the same dependency chain are decoded.
+struct BitstreamIndexHeader {
+    uint32_t uiMagic;
+    uint16_t uiVersion;
+    uint16_t uiEntrySize;
+};
+
+struct BitstreamIndexEntry {
+    uint64_t uiOffset;
+    uint32_t uiSize;
+    int32_t iFrameNum;    ///< source frame (1-based); rebuilt: access unit
+    uint32_t uiNalTypes;  ///< bit n set when a NAL of type n is present
+    uint8_t uiFrameType;  ///< EVideoFrameType of the layer
+    uint8_t uiSpatialId;  ///< dependency_id
+    uint8_t uiTemporalId; ///< temporal_id, 0 without SVC headers
+    uint8_t uiReserved;
+};
+static_assert(sizeof(BitstreamIndexEntry) == 24, "sidecar entry layout");
+
+// Appends entries while the bitstream is written, one per video coding
+// layer of each encoded frame.
+class BitstreamIndexWriter {
+  public:
+    BitstreamIndexWriter() : fp_(nullptr) {}
+    ~BitstreamIndexWriter() { Close(); }
+    BitstreamIndexWriter(const BitstreamIndexWriter &) = delete;
+    BitstreamIndexWriter &operator=(const BitstreamIndexWriter &) = delete;
+
+    // a stream starting at offset 0 replaces an older sidecar, a stream
+    // appended to an existing file extends it
+    bool Open(const std::string &fileName, uint64_t streamOffset);
+    // frameInfo's layers start at streamOffset in the bitstream
+    void AddFrame(int frameNum, const SFrameBSInfo &frameInfo,
+                  uint64_t streamOffset);
+    bool Flush();
+    bool Sync();
+    void Close();
+
+  private:
+    FILE *fp_;
+};
+
+bool loadBitstreamIndex(const std::string &fileName,
+                        std::vector<BitstreamIndexEntry> &entries);
+bool writeBitstreamIndex(const std::string &fileName,
+                         const std::vector<BitstreamIndexEntry> &entries);
+// Cuts stream and its sidecar back to offset, where a frame ends. False
+// when they do not reach it.
+bool truncateBitstream(const std::string &stream, uint64_t offset);
+
+// Rebuilds the sidecar entries of an existing Annex-B stream by scanning
+// it; frame numbers count access units from 1.
+void indexAnnexB(const uint8_t *data, size_t size,
+                 std::vector<BitstreamIndexEntry> &entries, int threads = 1);
+
+// `--index <stream.h264> [threads]`: rebuilds <stream>.idx, keeping an
+// encode-time sidecar that agrees with the scan (it has the real frame
+// numbers of skipped-frame streams).
+int runIndexer(const std::string &streamFileName, int threads);
+
+#endif //__BITSTREAM_INDEX_H__
@@ -0,0 +1,661 @@
+#include "cluster.h"
+#include "durable.h"
+#include "harness.h"
+#include "process_util.h"
+#include "socket_util.h"
+#include "stats.h"
+#include "sweep.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+bool sendJob(SocketHandle s, int job, const vector<string> &args) {
+    // one send, so the small message is not split across segments
+    string msg;
+    ClusterJobHeader hdr = {clusterMagic, job, (uint32_t)args.size()};
+    msg.append((const char *)&hdr, sizeof(hdr));
+    for (const string &arg : args) {
+        const uint32_t len = (uint32_t)arg.size();
+        msg.append((const char *)&len, sizeof(len));
+        msg += arg;
+    }
+    return sendAll(s, msg.data(), msg.size());
+}
+
+bool recvJob(SocketHandle s, int &job, vector<string> &args) {
+    ClusterJobHeader hdr;
+    if (!recvAll(s, &hdr, sizeof(hdr)) || hdr.uiMagic != clusterMagic ||
+        hdr.uiArgc > 256) {
+        return false;
+    }
+    job = hdr.iJob;
+    args.resize(hdr.uiArgc);
+    for (string &arg : args) {
+        uint32_t len;
+        if (!recvAll(s, &len, sizeof(len)) || len > 4096) {
+            return false;
+        }
+        arg.resize(len);
+        if (len && !recvAll(s, &arg[0], len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readFile(const string &fileName, string &data) {
+    ifstream in(fileName.c_str(), ios::binary);
+    if (!in) {
+        return false;
+    }
+    stringstream ss;
+    ss << in.rdbuf();
+    data = ss.str();
+    return true;
+}
+
+struct ClusterJob {
+    SweepJob job;
+    vector<string> args; ///< command line sent to the worker
+    int iRunning = 0;    ///< workers encoding it
+    int iFailures = 0;
+    bool bDone = false;
+    int64_t iStartUs = 0; ///< first taken
+    uint64_t uiMaxResult = 0; ///< bytes a stream or index may take
+};
+
+// Jobs give up after this many failed or abandoned attempts.
+const int maxJobFailures = 2;
+
+class Coordinator {
+  public:
+    Coordinator(vector<ClusterJob> &jobs, Journal &journal)
+        : jobs_(jobs), journal_(journal), remaining_(0), steals_(0),
+          requeues_(0), failed_(0), doneUs_(0), doneCount_(0) {
+        for (size_t i = 0; i < jobs_.size(); i++) {
+            if (!jobs_[i].bDone) {
+                pending_.push_back((int)i);
+                remaining_++;
+            }
+        }
+    }
+
+    // shut down once the last job is in, ending the accept loop
+    void SetListener(SocketHandle listener) {
+        lock_guard<mutex> lock(mutex_);
+        listener_ = listener;
+    }
+    // the next job for a worker, -1 when the sweep is complete
+    int Take();
+    // stores the result of a successful job; false for a duplicate that
+    // lost the race, which is dropped
+    bool Finish(int job, const ClusterRequest &result, const string &stream,
+                const string &index);
+    // the worker failed the job or went away with it
+    void Abandon(int job);
+    // ends the sweep with jobs left, when no worker is left to run them
+    void Stop() {
+        lock_guard<mutex> lock(mutex_);
+        stopped_ = true;
+        shutdownSocket(listener_);
+        cv_.notify_all();
+    }
+    bool Complete() {
+        lock_guard<mutex> lock(mutex_);
+        return remaining_ == 0 || stopped_;
+    }
+    void AddToReport(StatsReport &report);
+
+  private:
+    void JobDone(); // with mutex_ held
+
+    vector<ClusterJob> &jobs_;
+    Journal &journal_;
+    mutex mutex_;
+    condition_variable cv_;
+    deque<int> pending_;
+    int remaining_;
+    int steals_;
+    int requeues_;
+    int failed_;
+    int64_t doneUs_; ///< summed durations of the finished jobs
+    int doneCount_;
+    SocketHandle listener_ = invalidSocket;
+    bool stopped_ = false;
+    mutex storeMutex_;
+};
+
+int Coordinator::Take() {
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        if (!pending_.empty()) {
+            const int job = pending_.front();
+            pending_.pop_front();
+            if (!jobs_[job].iRunning) {
+                jobs_[job].iStartUs = monotonicUs();
+            }
+            jobs_[job].iRunning++;
+            return job;
+        }
+        if (remaining_ == 0 || stopped_) {
+            return -1;
+        }
+        // steal the longest-running job once it is late against the
+        // average; a second copy at most
+        const int64_t now = monotonicUs();
+        const int64_t average = doneCount_ ? doneUs_ / doneCount_ : -1;
+        int victim = -1;
+        for (size_t i = 0; i < jobs_.size(); i++) {
+            const ClusterJob &j = jobs_[i];
+            if (!j.bDone && j.iRunning == 1 && average >= 0 &&
+                now - j.iStartUs > average &&
+                (victim < 0 || j.iStartUs < jobs_[victim].iStartUs)) {
+                victim = (int)i;
+            }
+        }
+        if (victim >= 0) {
+            jobs_[victim].iRunning++;
+            steals_++;
+            return victim;
+        }
+        cv_.wait_for(lock, chrono::milliseconds(100));
+    }
+}
+
+void Coordinator::JobDone() {
+    if (--remaining_ == 0) {
+        shutdownSocket(listener_);
+    }
+    cv_.notify_all();
+}
+
+bool Coordinator::Finish(int job, const ClusterRequest &result,
+                         const string &stream, const string &index) {
+    ClusterJob &j = jobs_[job];
+    {
+        lock_guard<mutex> lock(mutex_);
+        j.iRunning--;
+        if (j.bDone) {
+            return false;
+        }
+        // claimed; the other copy, if any, is dropped when it reports
+        j.bDone = true;
+        doneUs_ += monotonicUs() - j.iStartUs;
+        doneCount_++;
+    }
+    QualityScore score;
+    score.fPsnr = result.fPsnr;
+    score.fSsim = result.fSsim;
+    score.iFrames = result.iFrames;
+    score.iBytes = result.iBytes;
+    bool stored;
+    {
+        lock_guard<mutex> lock(storeMutex_);
+        const string out = j.job.sOutFile + h264Suffix;
+        fs::create_directories(fs::path(out).parent_path());
+        stored = writeFileAtomic(out, stream) &&
+                 writeFileAtomic(out + bitstreamIndexSuffix, index);
+        if (stored && h264ToMp4(j.job.sOutFile) != 0) {
+            cerr << "Cannot convert " << out << " to mp4\n";
+        }
+        stored = stored && journal_.Append(j.job.sJob, formatSweepScore(score));
+    }
+    cout << "  " << j.job.sClip << " " << j.job.fMbps << " Mbps "
+         << (j.job.bDiff ? "diff" : "base") << ": PSNR " << score.fPsnr
+         << " dB, SSIM " << score.fSsim << endl;
+    lock_guard<mutex> lock(mutex_);
+    if (!stored) {
+        cerr << "Cannot store " << j.job.sOutFile << h264Suffix << '\n';
+        failed_++;
+    }
+    JobDone();
+    return true;
+}
+
+void Coordinator::Abandon(int job) {
+    lock_guard<mutex> lock(mutex_);
+    ClusterJob &j = jobs_[job];
+    j.iRunning--;
+    if (j.bDone || j.iRunning > 0) {
+        return;
+    }
+    if (++j.iFailures >= maxJobFailures) {
+        cerr << "Giving up on " << j.job.sOutFile << h264Suffix << " after "
+             << j.iFailures << " attempts\n";
+        j.bDone = true;
+        failed_++;
+        JobDone();
+    } else {
+        pending_.push_front(job);
+        requeues_++;
+        cv_.notify_all();
+    }
+}
+
+void Coordinator::AddToReport(StatsReport &report) {
+    lock_guard<mutex> lock(mutex_);
+    report.AddCounter("cluster_steals", steals_);
+    report.AddCounter("cluster_requeues", requeues_);
+    report.AddCounter("cluster_failed", failed_);
+    report.AddCounter("cluster_job_ms",
+                      doneCount_ ? doneUs_ / doneCount_ / 1000.0 : 0);
+}
+
+// Serves one worker connection until the sweep completes or the worker
+// goes away.
+void serveWorker(SocketHandle s, Coordinator &coordinator,
+                 vector<ClusterJob> &jobs, int &jobsDone) {
+    int current = -1;
+    while (true) {
+        ClusterRequest req;
+        if (!recvAll(s, &req, sizeof(req)) || req.uiMagic != clusterMagic) {
+            break;
+        }
+        if (req.uiKind == clusterResult) {
+            if (current < 0 || req.iJob != current) {
+                break;
+            }
+            // past the limit the peer is broken, not the encode
+            const uint64_t limit = jobs[current].uiMaxResult;
+            if (req.iStatus == 0 &&
+                (req.uiStreamSize > limit || req.uiIndexSize > limit)) {
+                break;
+            }
+            string stream(req.iStatus == 0 ? req.uiStreamSize : 0, '\0');
+            string index(req.iStatus == 0 ? req.uiIndexSize : 0, '\0');
+            if ((!stream.empty() && !recvAll(s, &stream[0], stream.size())) ||
+                (!index.empty() && !recvAll(s, &index[0], index.size()))) {
+                break;
+            }
+            if (req.iStatus == 0) {
+                jobsDone += coordinator.Finish(current, req, stream, index);
+            } else {
+                coordinator.Abandon(current);
+            }
+            current = -1;
+        }
+        const int job = coordinator.Take();
+        if (!sendJob(s, job, job >= 0 ? jobs[job].args : vector<string>())) {
+            if (job >= 0) {
+                coordinator.Abandon(job);
+            }
+            break;
+        }
+        if (job < 0) {
+            break;
+        }
+        current = job;
+    }
+    if (current >= 0) {
+        coordinator.Abandon(current);
+    }
+}
+
+// the options of argv meant for the workers, without the coordinator's own
+struct CoordinatorOptions {
+    string listen = "0.0.0.0:7870";
+    vector<string> clips;
+    int spawnWorkers = 0;
+    vector<string> passOn; ///< argv[3..] minus the coordinator flags
+};
+
+bool parseCoordinatorOptions(int argc, char const *argv[],
+                             CoordinatorOptions &copts) {
+    for (int i = 3; i < argc; i++) {
+        const string key = argv[i];
+        if (key != "--listen" && key != "--clips" &&
+            key != "--spawn-workers") {
+            copts.passOn.push_back(key);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for option: " << key << '\n';
+            return false;
+        }
+        const string value = argv[++i];
+        if (key == "--listen") {
+            copts.listen = value;
+        } else if (key == "--clips") {
+            stringstream ss(value);
+            string clip;
+            while (getline(ss, clip, ',')) {
+                if (!clip.empty()) {
+                    copts.clips.push_back(clip);
+                }
+            }
+        } else {
+            copts.spawnWorkers = parseInt(value);
+        }
+    }
+    return true;
+}
+
+string clipName(const string &clip) { return fs::path(clip).stem().string(); }
+
+} // namespace
+
+int runCoordinator(int argc, char const *argv[]) {
+    vector<float> bitrates;
+    if (!parseBitrates(argv[2], bitrates)) {
+        cerr << "Invalid bitrate list: " << argv[2] << '\n';
+        return 1;
+    }
+    CoordinatorOptions copts;
+    if (!parseCoordinatorOptions(argc, argv, copts)) {
+        return 1;
+    }
+    vector<const char *> optArgv(argv, argv + 3);
+    for (const string &arg : copts.passOn) {
+        optArgv.push_back(arg.c_str());
+    }
+    TestOptions opts;
+    if (!parseOptions((int)optArgv.size(), optArgv.data(), opts) ||
+        !checkSweepOptions(opts)) {
+        return 1;
+    }
+    if (copts.clips.empty()) {
+        copts.clips.push_back(opts.input);
+    }
+    string host;
+    int port;
+    if (!splitHostPort(copts.listen, host, port)) {
+        cerr << "Invalid --listen address: " << copts.listen << '\n';
+        return 1;
+    }
+
+    const string sweepDir = testbinDir + "sweep/";
+    fs::create_directories(sweepDir);
+    Journal journal;
+    if (!journal.Open(sweepDir + sweepJournalName)) {
+        cerr << "Cannot open " << sweepDir << sweepJournalName << '\n';
+        return 1;
+    }
+
+    // one job per clip, mode and bitrate; several clips get a directory
+    // each so their outputs do not collide
+    vector<ClusterJob> jobs;
+    map<string, pair<size_t, size_t>> clipJobs; ///< [begin, end) of jobs
+    set<string> clipNames;
+    for (const string &clip : copts.clips) {
+        TestOptions clipOpts = opts;
+        clipOpts.input = clip;
+        if (!fs::is_regular_file(clip)) {
+            cerr << "Clips must be files: " << clip << '\n';
+            return 1;
+        }
+        if (!clipNames.insert(clipName(clip)).second) {
+            cerr << "Clips need distinct names: " << clip << '\n';
+            return 1;
+        }
+        if (!prepareSweepInput(clipOpts)) {
+            return 1;
+        }
+        SEncParamExt param;
+        fillSweepParam(clipOpts, param);
+        vector<SweepJob> sweepJobs;
+        addSweepJobs(clipOpts, param, bitrates,
+                     copts.clips.size() > 1
+                         ? testbinDir + clipName(clip) + "/"
+                         : testbinDir,
+                     sweepJobs);
+        clipJobs[clip] = make_pair(jobs.size(), jobs.size() + sweepJobs.size());
+        for (const SweepJob &job : sweepJobs) {
+            ClusterJob j;
+            j.job = job;
+            j.bDone = journal.Find(job.sJob) != nullptr;
+            // an encode far larger than its raw input is no encode
+            j.uiMaxResult = 2 * (uint64_t)fs::file_size(clip) + (1 << 20);
+            j.args.push_back(argv[0]);
+            j.args.push_back(job.bDiff ? "1" : "0");
+            j.args.push_back(to_string(job.fMbps));
+            j.args.insert(j.args.end(), copts.passOn.begin(),
+                          copts.passOn.end());
+            j.args.push_back("--input");
+            j.args.push_back(clip);
+            j.args.push_back(job.sJob);
+            jobs.push_back(j);
+        }
+    }
+    if (!usesGeneratedPriorities(opts)) {
+        prepareWeightFiles();
+    }
+
+    Coordinator coordinator(jobs, journal);
+    const size_t journaled =
+        count_if(jobs.begin(), jobs.end(),
+                 [](const ClusterJob &j) { return j.bDone; });
+    SocketHandle listener = listenTcp(host, port);
+    if (listener == invalidSocket) {
+        cerr << "Cannot listen on " << copts.listen << '\n';
+        return 1;
+    }
+    cout << "Coordinator on " << host << ":" << port << ": " << jobs.size()
+         << " jobs, " << journaled << " already journaled" << endl;
+
+    // argv[0] is not a path when started through PATH
+    const string exe = currentExecutable();
+    vector<ProcessHandle> spawned;
+    for (int i = 0; i < copts.spawnWorkers && !coordinator.Complete(); i++) {
+        ProcessHandle p = spawnProcess(
+            {exe, "--worker", "127.0.0.1:" + to_string(port)});
+        if (p == invalidProcess) {
+            cerr << "Cannot start worker " << i << '\n';
+        } else {
+            spawned.push_back(p);
+        }
+    }
+
+    // with local workers only, the sweep cannot go on once they are all
+    // gone, crashed or not
+    thread reaper;
+    if (!spawned.empty()) {
+        reaper = thread([&coordinator, &spawned] {
+            for (ProcessHandle p : spawned) {
+                waitProcess(p);
+            }
+            coordinator.Stop();
+        });
+    }
+
+    const int64_t startUs = monotonicUs();
+    mutex connectionMutex;
+    vector<SocketHandle> connections;
+    vector<thread> threads;
+    deque<int> jobsDone; ///< per connection
+    coordinator.SetListener(listener);
+    while (!coordinator.Complete()) {
+        SocketHandle client = acceptSocket(listener);
+        if (client == invalidSocket) {
+            break;
+        }
+        setNoDelay(client);
+        lock_guard<mutex> lock(connectionMutex);
+        connections.push_back(client);
+        jobsDone.push_back(0);
+        int &done = jobsDone.back();
+        threads.emplace_back([&coordinator, &jobs, client, &done] {
+            serveWorker(client, coordinator, jobs, done);
+        });
+    }
+    {
+        // workers still racing a stolen job learn on their next send
+        lock_guard<mutex> lock(connectionMutex);
+        for (SocketHandle s : connections) {
+            shutdownSocket(s);
+        }
+    }
+    for (thread &t : threads) {
+        t.join();
+    }
+    if (reaper.joinable()) {
+        reaper.join();
+    }
+    for (SocketHandle s : connections) {
+        closeSocket(s);
+    }
+    closeSocket(listener);
+    const double seconds = (monotonicUs() - startUs) / 1e6;
+
+    int encoded = 0;
+    for (int done : jobsDone) {
+        encoded += done;
+    }
+    cout << "Cluster sweep: " << encoded << " encodes on "
+         << threads.size() << " workers in " << seconds << " s; per worker:";
+    for (int done : jobsDone) {
+        cout << ' ' << done;
+    }
+    cout << endl;
+    StatsReport report;
+    report.AddCounter("cluster_jobs", (double)jobs.size());
+    report.AddCounter("cluster_journaled", (double)journaled);
+    report.AddCounter("cluster_workers", (double)threads.size());
+    report.AddCounter("cluster_wall_s", seconds);
+    coordinator.AddToReport(report);
+    if (!report.WriteJson(sweepDir + "cluster.stats.json")) {
+        cerr << "Failed to write " << sweepDir << "cluster.stats.json\n";
+    }
+
+    bool ok = true;
+    int unfinished = 0;
+    for (const auto &c : clipJobs) {
+        vector<SweepJob> clipSweep;
+        vector<QualityScore> scores;
+        for (size_t i = c.second.first; i < c.second.second; i++) {
+            QualityScore score;
+            const string *record = journal.Find(jobs[i].job.sJob);
+            if (!record || !parseSweepScore(*record, score)) {
+                unfinished++;
+            }
+            clipSweep.push_back(jobs[i].job);
+            scores.push_back(score);
+        }
+        const string prefix =
+            sweepDir + (copts.clips.size() > 1 ? clipName(c.first) + "-" : "");
+        if (!writeScoreTables(prefix, clipSweep, scores)) {
+            cerr << "Cannot write the scores to " << sweepDir << '\n';
+            ok = false;
+        }
+    }
+    if (unfinished) {
+        cerr << unfinished << " jobs unfinished; rerun to continue\n";
+    }
+    return ok && !unfinished ? 0 : 1;
+}
+
+int runWorker(const string &address) {
+    string host;
+    int port;
+    if (!splitHostPort(address, host, port)) {
+        cerr << "Invalid coordinator address: " << address << '\n';
+        return 1;
+    }
+    // the coordinator may still be starting
+    SocketHandle s = invalidSocket;
+    for (int attempt = 0; attempt < 50 && s == invalidSocket; attempt++) {
+        s = connectTcp(host, port);
+        if (s == invalidSocket) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+    }
+    if (s == invalidSocket) {
+        cerr << "No coordinator on " << address << '\n';
+        return 1;
+    }
+    const string scratchDir =
+        testbinDir + "worker-" + to_string(currentProcessId()) + "/";
+    fs::create_directories(scratchDir);
+
+    ClusterRequest req;
+    memset(&req, 0, sizeof(req));
+    req.uiMagic = clusterMagic;
+    req.uiKind = clusterPull;
+    bool ok = sendAll(s, &req, sizeof(req));
+    int jobsDone = 0;
+    while (ok) {
+        int job;
+        vector<string> args;
+        if (!recvJob(s, job, args)) {
+            ok = false;
+            break;
+        }
+        if (job < 0) {
+            break;
+        }
+        memset(&req, 0, sizeof(req));
+        req.uiMagic = clusterMagic;
+        req.uiKind = clusterResult;
+        req.iJob = job;
+        req.iStatus = 1;
+        string stream, index;
+
+        vector<const char *> argv;
+        for (size_t i = 0; i + 1 < args.size(); i++) {
+            argv.push_back(args[i].c_str());
+        }
+        TestOptions opts;
+        if (args.size() >= 4 &&
+            parseOptions((int)argv.size(), argv.data(), opts) &&
+            checkSweepOptions(opts) && prepareSweepInput(opts)) {
+            if (!usesGeneratedPriorities(opts)) {
+                prepareWeightFiles();
+            }
+            SEncParamExt param;
+            fillSweepParam(opts, param);
+            SweepJob sweepJob;
+            sweepJob.sClip = opts.input;
+            sweepJob.bDiff = parseInt(args[1]) != 0;
+            sweepJob.fMbps = parseFloat(args[2]);
+            sweepJob.sJob = args.back();
+            sweepJob.sOutFile = scratchDir + sweepJob.sJob;
+            bool resumed;
+            QualityScore score;
+            const bool encoded =
+                runSweepJob(opts, param, sweepJob, resumed, score);
+            const string out = sweepJob.sOutFile + h264Suffix;
+            if (encoded && readFile(out, stream) &&
+                readFile(out + bitstreamIndexSuffix, index)) {
+                req.iStatus = 0;
+                req.fPsnr = score.fPsnr;
+                req.fSsim = score.fSsim;
+                req.iFrames = score.iFrames;
+                req.iBytes = score.iBytes;
+                req.uiStreamSize = (uint32_t)stream.size();
+                req.uiIndexSize = (uint32_t)index.size();
+            }
+            remove(out.c_str());
+            remove((out + bitstreamIndexSuffix).c_str());
+            remove((out + ".ckpt").c_str());
+        }
+        cout << "Worker " << currentProcessId() << ": job " << job
+             << (req.iStatus == 0 ? " done" : " failed") << endl;
+        ok = sendAll(s, &req, sizeof(req)) &&
+             (req.iStatus != 0 || (sendAll(s, stream.data(), stream.size()) &&
+                                   sendAll(s, index.data(), index.size())));
+        jobsDone += req.iStatus == 0;
+    }
+    closeSocket(s);
+    error_code ec;
+    fs::remove_all(scratchDir, ec);
+    cout << "Worker " << currentProcessId() << ": " << jobsDone << " jobs"
+         << endl;
+    return ok ? 0 : 1;
+}
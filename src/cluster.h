@@ -0,0 +1,62 @@
+#ifndef __CLUSTER_H__
+#define __CLUSTER_H__
+
+#include <stdint.h>
+#include <string>
+
+// The sweep of sweep.h spread over worker processes on any number of hosts.
+//
+// `--coordinator <bitrates> [--listen host:port] [--clips a,b,...]
+//  [--spawn-workers n] [options]` builds the (clip, mode, bitrate) jobs,
+// skips those testbin/sweep/journal.txt has, and serves the rest over TCP.
+// Workers pull one job at a time, so fast workers take more. Once the queue
+// is empty an idle worker steals a job that has run longer than the average
+// one and races its first taker, and the first result wins; a worker that
+// disconnects mid-job returns its job to the queue. Bitstreams and sidecars
+// come back to the coordinator, which stores them where --sweep would and
+// journals the scores. With several clips each gets testbin/<clip>/ and
+// testbin/sweep/<clip>-psnr.txt. --spawn-workers starts n local workers, a
+// stand-in for a cluster; the sweep then stops, complete or not, once they
+// have all exited. Unfinished jobs are left for a rerun.
+//
+// `--worker <host:port>` encodes jobs until the coordinator is done. Clips,
+// weights/ and gaze traces are read by the path the coordinator was given,
+// so hosts need them at the same place (a shared or mirrored directory).
+int runCoordinator(int argc, char const *argv[]);
+int runWorker(const std::string &address);
+
+const uint32_t clusterMagic = 0x50455753; // "SWEP"
+
+enum ClusterRequestKind : uint32_t {
+    clusterPull = 0,   ///< asks for a job
+    clusterResult = 1, ///< reports one, then asks for the next
+};
+
+// Worker to coordinator. A successful result is followed by uiStreamSize
+// bytes of bitstream and uiIndexSize bytes of its sidecar.
+struct ClusterRequest {
+    uint32_t uiMagic;
+    uint32_t uiKind;
+    int32_t iJob;
+    int32_t iStatus; ///< 0: encoded and scored
+    double fPsnr;
+    double fSsim;
+    int32_t iFrames;
+    uint32_t uiStreamSize;
+    int64_t iBytes;
+    uint32_t uiIndexSize;
+    uint32_t uiReserved;
+};
+static_assert(sizeof(ClusterRequest) == 56, "cluster request layout");
+
+// Coordinator to worker: this header, then uiArgc arguments, each a
+// uint32_t length and the bytes. They are an openh264_test command line
+// for the job (`<isDiffEncoding> <bitrateMbps> [options] --input <clip>`,
+// argv[0] included) followed by the journal key. iJob -1: no work left.
+struct ClusterJobHeader {
+    uint32_t uiMagic;
+    int32_t iJob;
+    uint32_t uiArgc;
+};
+
+#endif //__CLUSTER_H__
@@ -0,0 +1,168 @@
+#include "color_convert.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// BT.601 limited range, 8-bit fixed point, R, G, B order
+const int yCoef[3] = {66, 129, 25};
+const int uCoef[3] = {-38, -74, 112};
+const int vCoef[3] = {112, -94, -18};
+
+const bool useAvx2 = cpuHasAvx2();
+
+void packedRgbColumns(const uint8_t *src, bool bgr, uint8_t *dst[3],
+                      int width, int rowBegin, int rowEnd, int xBegin) {
+    const int r = bgr ? 2 : 0;
+    const int b = bgr ? 0 : 2;
+    for (int y = rowBegin; y < rowEnd; y += 2) {
+        const uint8_t *s0 = src + (size_t)y * width * 4;
+        const uint8_t *s1 = s0 + (size_t)width * 4;
+        uint8_t *y0 = dst[0] + (size_t)y * width;
+        uint8_t *y1 = y0 + width;
+        uint8_t *u = dst[1] + (size_t)(y / 2) * (width / 2);
+        uint8_t *v = dst[2] + (size_t)(y / 2) * (width / 2);
+        for (int x = xBegin; x < width; x += 2) {
+            const uint8_t *px[4] = {s0 + x * 4, s0 + x * 4 + 4, s1 + x * 4,
+                                    s1 + x * 4 + 4};
+            uint8_t *luma[4] = {y0 + x, y0 + x + 1, y1 + x, y1 + x + 1};
+            int sum[3] = {0, 0, 0};
+            for (int i = 0; i < 4; i++) {
+                const int rgb[3] = {px[i][r], px[i][1], px[i][b]};
+                *luma[i] = (uint8_t)(((yCoef[0] * rgb[0] + yCoef[1] * rgb[1] +
+                                       yCoef[2] * rgb[2] + 128) >>
+                                      8) +
+                                     16);
+                for (int c = 0; c < 3; c++) {
+                    sum[c] += rgb[c];
+                }
+            }
+            // the 2x2 sum carries two more bits than one sample
+            u[x / 2] = (uint8_t)(((uCoef[0] * sum[0] + uCoef[1] * sum[1] +
+                                   uCoef[2] * sum[2] + 512) >>
+                                  10) +
+                                 128);
+            v[x / 2] = (uint8_t)(((vCoef[0] * sum[0] + vCoef[1] * sum[1] +
+                                   vCoef[2] * sum[2] + 512) >>
+                                  10) +
+                                 128);
+        }
+    }
+}
+
+void nv12Columns(const uint8_t *src, uint8_t *dst[3], int width, int height,
+                 int rowBegin, int rowEnd, int xBegin) {
+    const uint8_t *uv = src + (size_t)width * height;
+    for (int y = rowBegin / 2; y < rowEnd / 2; y++) {
+        const uint8_t *s = uv + (size_t)y * width;
+        uint8_t *u = dst[1] + (size_t)y * (width / 2);
+        uint8_t *v = dst[2] + (size_t)y * (width / 2);
+        for (int x = xBegin / 2; x < width / 2; x++) {
+            u[x] = s[2 * x];
+            v[x] = s[2 * x + 1];
+        }
+    }
+}
+
+} // namespace
+
+bool parsePixelFormat(const string &name, PixelFormat &format) {
+    const PixelFormat formats[] = {pixelI420, pixelRgba, pixelBgra,
+                                   pixelNv12};
+    for (PixelFormat f : formats) {
+        if (name == pixelFormatName(f)) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pixelFormatName(PixelFormat format) {
+    switch (format) {
+    case pixelRgba:
+        return "rgba";
+    case pixelBgra:
+        return "bgra";
+    case pixelNv12:
+        return "nv12";
+    default:
+        return "i420";
+    }
+}
+
+size_t pixelFrameSize(PixelFormat format, int width, int height) {
+    const size_t pixels = (size_t)width * height;
+    return format == pixelRgba || format == pixelBgra ? pixels * 4
+                                                      : pixels * 3 / 2;
+}
+
+void packedRgbToI420Rows(const uint8_t *src, bool bgr, uint8_t *dst[3],
+                         int width, int rowBegin, int rowEnd) {
+    int x = 0;
+#ifdef HAVE_AVX2
+    if (useAvx2) {
+        x = packedRgbToI420RowsAvx2(src, bgr, dst, width, rowBegin, rowEnd);
+    }
+#endif
+    packedRgbColumns(src, bgr, dst, width, rowBegin, rowEnd, x);
+}
+
+void nv12ToI420Rows(const uint8_t *src, uint8_t *dst[3], int width,
+                    int height, int rowBegin, int rowEnd) {
+    // luma is a plain copy
+    memcpy(dst[0] + (size_t)rowBegin * width, src + (size_t)rowBegin * width,
+           (size_t)(rowEnd - rowBegin) * width);
+    int x = 0;
+#ifdef HAVE_AVX2
+    if (useAvx2) {
+        x = nv12ToI420RowsAvx2(src, dst, width, height, rowBegin, rowEnd);
+    }
+#endif
+    nv12Columns(src, dst, width, height, rowBegin, rowEnd, x);
+}
+
+ConvertingInputStream::ConvertingInputStream(InputStream *in,
+                                             PixelFormat format, int width,
+                                             int height, int threads)
+    : in_(in), format_(format), width_(width), height_(height),
+      frame_(pixelFrameSize(format, width, height)),
+      // bands of at least 64 rows
+      workers_(max(1, min(threads, height / 64))) {
+    assert(width % 2 == 0 && height % 2 == 0);
+}
+
+int ConvertingInputStream::read(void *ptr, size_t len) {
+    assert(len == pixelFrameSize(pixelI420, width_, height_));
+    size_t got = 0;
+    while (got < frame_.size()) {
+        const int n = in_->read(frame_.data() + got, frame_.size() - got);
+        if (n <= 0) {
+            return 0;
+        }
+        got += n;
+    }
+    uint8_t *dst[3];
+    dst[0] = (uint8_t *)ptr;
+    dst[1] = dst[0] + (size_t)width_ * height_;
+    dst[2] = dst[1] + (size_t)width_ * height_ / 4;
+    const int pairs = height_ / 2;
+    const int bands = workers_.Bands();
+    workers_.Run([&](int band) {
+        const int rowBegin = pairs * band / bands * 2;
+        const int rowEnd = pairs * (band + 1) / bands * 2;
+        if (format_ == pixelNv12) {
+            nv12ToI420Rows(frame_.data(), dst, width_, height_, rowBegin,
+                           rowEnd);
+        } else {
+            packedRgbToI420Rows(frame_.data(), format_ == pixelBgra, dst,
+                                width_, rowBegin, rowEnd);
+        }
+    });
+    return (int)len;
+}
@@ -0,0 +1,62 @@
+#ifndef __COLOR_CONVERT_H__
+#define __COLOR_CONVERT_H__
+
+#include <wels/utils/InputStream.h>
+
+#include "band_workers.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Layout of the raw frames in an input file.
+enum PixelFormat {
+    pixelI420, ///< planar Y, U, V; what the encoder takes
+    pixelRgba, ///< packed 8-bit R, G, B, A
+    pixelBgra, ///< packed 8-bit B, G, R, A (D3D/DXGI swap chains)
+    pixelNv12, ///< planar Y, then interleaved U/V
+};
+
+bool parsePixelFormat(const std::string &name, PixelFormat &format);
+const char *pixelFormatName(PixelFormat format);
+// bytes of one width x height frame
+size_t pixelFrameSize(PixelFormat format, int width, int height);
+
+// Row kernels over [rowBegin, rowEnd) of the destination, both even.
+// RGB conversion is BT.601 limited range with 2x2 averaged chroma, the
+// same as ffmpeg's default rgb -> yuv420p. dst[0..2] are tightly packed
+// I420 planes.
+void packedRgbToI420Rows(const uint8_t *src, bool bgr, uint8_t *dst[3],
+                         int width, int rowBegin, int rowEnd);
+void nv12ToI420Rows(const uint8_t *src, uint8_t *dst[3], int width,
+                    int height, int rowBegin, int rowEnd);
+#ifdef HAVE_AVX2
+// 32 luma / 16 chroma samples per step; the kernels above pick these when
+// the CPU has AVX2 and finish the rows with the scalar code
+int packedRgbToI420RowsAvx2(const uint8_t *src, bool bgr, uint8_t *dst[3],
+                            int width, int rowBegin, int rowEnd);
+int nv12ToI420RowsAvx2(const uint8_t *src, uint8_t *dst[3], int width,
+                       int height, int rowBegin, int rowEnd);
+#endif
+
+// Reads frames of another format from an InputStream and hands them out
+// as I420, converting straight into the caller's buffer with the rows
+// split over threads.
+class ConvertingInputStream : public InputStream {
+  public:
+    ConvertingInputStream(InputStream *in, PixelFormat format, int width,
+                          int height, int threads);
+    // len must be one I420 frame; returns 0 at the end of the input
+    int read(void *ptr, size_t len);
+
+  private:
+    InputStream *in_;
+    PixelFormat format_;
+    int width_;
+    int height_;
+    std::vector<uint8_t> frame_; ///< one source frame
+    BandWorkers workers_;
+};
+
+#endif //__COLOR_CONVERT_H__
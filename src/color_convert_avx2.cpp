@@ -0,0 +1,132 @@
+// Built with AVX2 code generation; only reached through the dispatch in
+// color_convert.cpp.
+#include "color_convert.h"
+
+#include <immintrin.h>
+
+namespace {
+
+// 8 pixels -> 8 32-bit dot products with coef, in pixel order within
+// each 128-bit lane ([0-3 | 4-7]) after the hadd
+inline __m256i dot8(__m256i px, __m256i coef) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+    return _mm256_hadd_epi32(lo, hi);
+}
+
+// 32 pixels of one row to 32 luma samples
+inline __m256i luma32(const uint8_t *s, __m256i coef) {
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i offset = _mm256_set1_epi16(16);
+    __m256i y[4];
+    for (int k = 0; k < 4; k++) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)(s + 32 * k));
+        y[k] = _mm256_srli_epi32(_mm256_add_epi32(dot8(px, coef), round), 8);
+    }
+    const __m256i y01 = _mm256_add_epi16(_mm256_packs_epi32(y[0], y[1]), offset);
+    const __m256i y23 = _mm256_add_epi16(_mm256_packs_epi32(y[2], y[3]), offset);
+    // lanes hold [0-3 8-11 16-19 24-27 | 4-7 12-15 20-23 28-31]
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(y01, y23),
+                                       _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3,
+                                                         7));
+}
+
+// 2x2 channel sums of 8 pixels of two rows: 16-bit R, G, B, A of chroma
+// samples [0 1 | 2 3]
+inline __m256i sum2x2(const uint8_t *s0, const uint8_t *s1) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i a = _mm256_loadu_si256((const __m256i *)s0);
+    const __m256i b = _mm256_loadu_si256((const __m256i *)s1);
+    const __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+                                        _mm256_unpacklo_epi8(b, zero));
+    const __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+                                        _mm256_unpackhi_epi8(b, zero));
+    // horizontal neighbours sit 8 bytes apart within a lane
+    const __m256i l = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+    const __m256i h = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+    return _mm256_unpacklo_epi64(l, h);
+}
+
+// 16 chroma samples from the 2x2 sums of 32 pixels
+inline __m128i chroma16(const __m256i sums[4], __m256i coef) {
+    const __m256i round = _mm256_set1_epi32(512);
+    const __m256i offset = _mm256_set1_epi16(128);
+    __m256i c[2];
+    for (int k = 0; k < 2; k++) {
+        const __m256i d = _mm256_hadd_epi32(_mm256_madd_epi16(sums[2 * k], coef),
+                                            _mm256_madd_epi16(sums[2 * k + 1],
+                                                              coef));
+        c[k] = _mm256_srai_epi32(_mm256_add_epi32(d, round), 10);
+    }
+    const __m256i c16 =
+        _mm256_add_epi16(_mm256_packs_epi32(c[0], c[1]), offset);
+    // [0 1 4 5 8 9 12 13 | 2 3 6 7 10 11 14 15]
+    const __m256i c8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(c16, c16),
+                                                0x08);
+    return _mm_shuffle_epi8(_mm256_castsi256_si128(c8),
+                            _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12,
+                                          13, 6, 7, 14, 15));
+}
+
+inline __m256i coefficients(int r, int g, int b, bool bgr) {
+    return bgr ? _mm256_setr_epi16(b, g, r, 0, b, g, r, 0, b, g, r, 0, b, g,
+                                   r, 0)
+               : _mm256_setr_epi16(r, g, b, 0, r, g, b, 0, r, g, b, 0, r, g,
+                                   b, 0);
+}
+
+} // namespace
+
+int packedRgbToI420RowsAvx2(const uint8_t *src, bool bgr, uint8_t *dst[3],
+                            int width, int rowBegin, int rowEnd) {
+    // same fixed point as the scalar code
+    const __m256i yCoef = coefficients(66, 129, 25, bgr);
+    const __m256i uCoef = coefficients(-38, -74, 112, bgr);
+    const __m256i vCoef = coefficients(112, -94, -18, bgr);
+    const int end = width & ~31;
+    for (int y = rowBegin; y < rowEnd; y += 2) {
+        const uint8_t *s0 = src + (size_t)y * width * 4;
+        const uint8_t *s1 = s0 + (size_t)width * 4;
+        uint8_t *y0 = dst[0] + (size_t)y * width;
+        uint8_t *y1 = y0 + width;
+        uint8_t *u = dst[1] + (size_t)(y / 2) * (width / 2);
+        uint8_t *v = dst[2] + (size_t)(y / 2) * (width / 2);
+        for (int x = 0; x < end; x += 32) {
+            _mm256_storeu_si256((__m256i *)(y0 + x), luma32(s0 + x * 4, yCoef));
+            _mm256_storeu_si256((__m256i *)(y1 + x), luma32(s1 + x * 4, yCoef));
+            __m256i sums[4];
+            for (int k = 0; k < 4; k++) {
+                sums[k] = sum2x2(s0 + (x + 8 * k) * 4, s1 + (x + 8 * k) * 4);
+            }
+            _mm_storeu_si128((__m128i *)(u + x / 2), chroma16(sums, uCoef));
+            _mm_storeu_si128((__m128i *)(v + x / 2), chroma16(sums, vCoef));
+        }
+    }
+    return end;
+}
+
+int nv12ToI420RowsAvx2(const uint8_t *src, uint8_t *dst[3], int width,
+                       int height, int rowBegin, int rowEnd) {
+    // U bytes to the low half of each lane, V bytes to the high half
+    const __m256i split = _mm256_setr_epi8(
+        0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8,
+        10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    const uint8_t *uv = src + (size_t)width * height;
+    const int end = width & ~31;
+    for (int y = rowBegin / 2; y < rowEnd / 2; y++) {
+        const uint8_t *s = uv + (size_t)y * width;
+        uint8_t *u = dst[1] + (size_t)y * (width / 2);
+        uint8_t *v = dst[2] + (size_t)y * (width / 2);
+        for (int x = 0; x < end; x += 32) {
+            const __m256i px = _mm256_shuffle_epi8(
+                _mm256_loadu_si256((const __m256i *)(s + x)), split);
+            const __m256i planar = _mm256_permute4x64_epi64(px, 0xd8);
+            _mm_storeu_si128((__m128i *)(u + x / 2),
+                             _mm256_castsi256_si128(planar));
+            _mm_storeu_si128((__m128i *)(v + x / 2),
+                             _mm256_extracti128_si256(planar, 1));
+        }
+    }
+    return end;
+}
@@ -0,0 +1,401 @@
+#include "daemon.h"
+#include "frame_store.h"
+#include "harness.h"
+#include "mapped_file.h"
+#include "socket_util.h"
+#include "timing.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+typedef pair<int, string> JobResult;
+
+// weights/<n>.txt parsed once and served from memory
+class PreloadedPrioritySource : public PrioritySource {
+  public:
+    explicit PreloadedPrioritySource(const vector<vector<float>> &maps)
+        : maps_(maps) {}
+    virtual bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                                   float *priorityArray) {
+        // like a missing weights file, a frame without a map keeps the
+        // previous contents
+        if (frameNum >= 1 && frameNum <= (int)maps_.size()) {
+            memcpy(priorityArray, maps_[frameNum - 1].data(),
+                   iArraySize * sizeof(float));
+        }
+        return true;
+    }
+
+  private:
+    const vector<vector<float>> &maps_;
+};
+
+struct JobCallback : public TestCallback {
+    int frames = 0;
+    int skipped = 0;
+    long long bytes = 0;
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const string &outFileName) {
+        bytes += frameInfo.iFrameSizeInBytes;
+        TestCallback::onEncodeFrame(frameInfo, outFileName);
+    }
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        frames++;
+        skipped += frameInfo.eFrameType == videoFrameTypeSkip;
+    }
+};
+
+struct Job {
+    vector<string> args;
+    promise<JobResult> result;
+};
+
+class EncodeDaemon {
+  public:
+    explicit EncodeDaemon(int workers) : stopping_(false) {
+        for (int i = 0; i < workers; i++) {
+            workers_.emplace_back(&EncodeDaemon::WorkerLoop, this);
+        }
+    }
+
+    // blocks until a worker has run the job
+    JobResult Submit(const vector<string> &args) {
+        Job job;
+        job.args = args;
+        future<JobResult> result = job.result.get_future();
+        {
+            lock_guard<mutex> lock(mutex_);
+            queue_.push_back(&job);
+        }
+        cv_.notify_one();
+        return result.get();
+    }
+
+    // finishes the queued jobs, then joins the workers
+    void Stop() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (thread &t : workers_) {
+            t.join();
+        }
+    }
+
+  private:
+    void WorkerLoop();
+    JobResult RunJob(BaseEncoderTest &test, const vector<string> &args);
+    const MappedFile *Source(const string &fileName);
+    const vector<vector<float>> &Weights(BaseEncoderTest &test,
+                                         const string &dir);
+
+    mutex mutex_;
+    condition_variable cv_;
+    deque<Job *> queue_;
+    bool stopping_;
+    set<string> busyOutputs_;
+    vector<thread> workers_;
+
+    mutex cacheMutex_;
+    map<string, unique_ptr<MappedFile>> sources_;
+    map<string, unique_ptr<vector<vector<float>>>> weights_;
+};
+
+void EncodeDaemon::WorkerLoop() {
+    BaseEncoderTest test;
+    test.SetUp();
+    while (true) {
+        Job *job = nullptr;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            job = queue_.front();
+            queue_.pop_front();
+        }
+        job->result.set_value(RunJob(test, job->args));
+    }
+    test.TearDown();
+}
+
+const MappedFile *EncodeDaemon::Source(const string &fileName) {
+    lock_guard<mutex> lock(cacheMutex_);
+    unique_ptr<MappedFile> &source = sources_[fileName];
+    if (!source) {
+        unique_ptr<MappedFile> file(new MappedFile());
+        if (!file->Open(fileName)) {
+            sources_.erase(fileName);
+            return nullptr;
+        }
+        source = move(file);
+    }
+    return source.get();
+}
+
+const vector<vector<float>> &EncodeDaemon::Weights(BaseEncoderTest &test,
+                                                   const string &dir) {
+    lock_guard<mutex> lock(cacheMutex_);
+    unique_ptr<vector<vector<float>>> &maps = weights_[dir];
+    if (!maps) {
+        prepareWeightFiles();
+        maps.reset(new vector<vector<float>>());
+        const int count = fs::is_directory(dir) ? countFiles(dir) : 0;
+        maps->resize(count, vector<float>(iArraySize));
+        for (int i = 0; i < count; i++) {
+            test.ReadWeights(dir + "/" + to_string(i + 1) + ".txt",
+                             (*maps)[i].data(), width, height);
+        }
+    }
+    return *maps;
+}
+
+JobResult EncodeDaemon::RunJob(BaseEncoderTest &test,
+                               const vector<string> &args) {
+    if (args.size() < 3) {
+        return JobResult(1,
+                         "usage: <isDiffEncoding> <bitrateMbps> [options]\n");
+    }
+    vector<const char *> argv;
+    for (const string &arg : args) {
+        argv.push_back(arg.c_str());
+    }
+    const bool diffEncoding = parseInt(args[1]) != 0;
+    const float targetBitrate = parseFloat(args[2]);
+    TestOptions opts;
+    if (!parseOptions((int)argv.size(), argv.data(), opts)) {
+        return JobResult(1, "invalid options, see the daemon log\n");
+    }
+    if (!opts.stereoRight.empty() || !opts.prioritySocket.empty() ||
+        opts.rtpMtu > 0 || opts.targetPsnr > 0 || opts.targetSsim > 0 ||
+        opts.paced || !opts.bandwidthTrace.empty() || opts.dumpRecon ||
+        !opts.ladder.empty() || opts.temporalLayers > 1 ||
+        opts.assertNoAlloc || opts.perfCounters || opts.pin ||
+        opts.scaling > 0 || opts.weightsWidth > 0 ||
+        opts.resample != resampleArea || !opts.priorityTransform.empty()) {
+        // allocation counts are per process, the daemon runs jobs side by
+        // side
+        return JobResult(1, "the daemon runs plain encodes only, without "
+                            "--stereo, --priority-socket, --rtp, --paced, "
+                            "--bandwidth-trace, --dump-recon, --ladder, "
+                            "--temporal-layers, --assert-no-alloc, "
+                            "--perf-counters, --pin, --scaling, "
+                            "--weights-size, --resample, "
+                            "--priority-transform or a quality target\n");
+    }
+    if (opts.input == "-" || opts.inputWidth > 0 || opts.inputFps > 0) {
+        // warm encoders and cached maps are sized for the default clip
+        return JobResult(1, "the daemon encodes raw files of the default "
+                            "geometry, not stdin or --size/--fps\n");
+    }
+    // loaded here: createPrioritySource exits on a bad trace, which would
+    // take every queued job with it
+    vector<GazeSample> gaze;
+    if (!opts.gazeTrace.empty() && !loadGazeTrace(opts.gazeTrace, gaze)) {
+        return JobResult(1, "cannot read gaze trace " + opts.gazeTrace + "\n");
+    }
+    const MappedFile *source = Source(opts.input);
+    if (!source) {
+        return JobResult(1, "cannot map " + opts.input + "\n");
+    }
+    if (source->Size() >= 9 && memcmp(source->Data(), "YUV4MPEG2", 9) == 0) {
+        return JobResult(1, "the daemon reads raw I420, not Y4M\n");
+    }
+    if (source->Size() >= 4 &&
+        memcmp(source->Data(), &frameStoreMagic, 4) == 0) {
+        return JobResult(1, "the daemon reads raw I420, not frame stores\n");
+    }
+
+    SEncParamExt param;
+    fillEncParamExt(param, targetBitrate);
+    param.bEnableFrameSkip = opts.frameSkip;
+    param.uiIntraPeriod = opts.gop;
+
+    string suffix = diffEncoding ? "-diff" : "";
+    unique_ptr<PrioritySource> prioritySource;
+    if (diffEncoding && !gaze.empty()) {
+        suffix = prioritySuffix(opts);
+        prioritySource.reset(new GazePrioritySource(gaze, opts.foveation, width,
+                                                    height, inputFps));
+    } else if (diffEncoding) {
+        prioritySource.reset(createPrioritySource(opts, suffix));
+        if (!prioritySource) {
+            prioritySource.reset(
+                new PreloadedPrioritySource(Weights(test, weightsDir)));
+        }
+    }
+    string outFile = opts.outFile;
+    if (outFile.empty()) {
+        const string outFileDir = testbinDir + to_string(targetBitrate) + "m/";
+        fs::create_directories(outFileDir);
+        outFile = outFileDir + "out" + suffix;
+    }
+    const string outFileName = outFile + h264Suffix;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!busyOutputs_.insert(outFileName).second) {
+            return JobResult(1, outFileName +
+                                    " is being written by another job\n");
+        }
+    }
+    remove(outFileName.c_str());
+
+    JobCallback cbk;
+    MappedInputStream in(*source);
+    test.diffEncoding_ = diffEncoding;
+    test.prioritySource_ = prioritySource.get();
+    test.maxFrames_ = 0;
+    test.inputFormat_ = opts.inputFormat;
+    test.convertThreads_ = opts.convertThreads;
+    const int64_t startUs = monotonicUs();
+    test.EncodeStream(&in, &param, &cbk, outFileName);
+    test.encoder_->Uninitialize();
+    const double seconds = (monotonicUs() - startUs) / 1e6;
+    test.prioritySource_ = NULL;
+    {
+        lock_guard<mutex> lock(mutex_);
+        busyOutputs_.erase(outFileName);
+    }
+
+    stringstream report;
+    report << outFileName << ": " << cbk.frames << " frames ("
+           << cbk.skipped << " skipped) in " << seconds * 1000 << " ms, "
+           << (seconds > 0 ? cbk.frames / seconds : 0) << " fps, "
+           << (cbk.frames ? cbk.bytes * 8 * inputFps / cbk.frames / 1000 : 0)
+           << " kbps\n";
+    return JobResult(0, report.str());
+}
+
+bool readJob(SocketHandle s, vector<string> &args) {
+    DaemonRequestHeader hdr;
+    if (!recvAll(s, &hdr, sizeof(hdr)) || hdr.uiMagic != daemonRequestMagic ||
+        hdr.uiArgc > 256) {
+        return false;
+    }
+    args.resize(hdr.uiArgc);
+    for (string &arg : args) {
+        uint32_t len;
+        if (!recvAll(s, &len, sizeof(len)) || len > 4096) {
+            return false;
+        }
+        arg.resize(len);
+        if (len && !recvAll(s, &arg[0], len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sendReply(SocketHandle s, const JobResult &result) {
+    DaemonReplyHeader hdr = {result.first, (uint32_t)result.second.size()};
+    return sendAll(s, &hdr, sizeof(hdr)) &&
+           sendAll(s, result.second.data(), result.second.size());
+}
+
+} // namespace
+
+int runDaemon(const string &socketPath, int workers) {
+    SocketHandle listener = listenUnix(socketPath);
+    if (listener == invalidSocket) {
+        cerr << "Cannot listen on " << socketPath << '\n';
+        return 1;
+    }
+    EncodeDaemon daemon(workers);
+    cout << "Encode daemon on " << socketPath << " with " << workers
+         << " workers" << endl;
+
+    // one thread per connection; each waits for its job on the pool
+    mutex connectionMutex;
+    condition_variable idle;
+    int connections = 0;
+    bool stopping = false;
+    while (true) {
+        SocketHandle client = acceptSocket(listener);
+        if (client == invalidSocket) {
+            break;
+        }
+        {
+            lock_guard<mutex> lock(connectionMutex);
+            if (stopping) {
+                closeSocket(client);
+                break;
+            }
+            connections++;
+        }
+        thread([&, client] {
+            vector<string> args;
+            if (readJob(client, args)) {
+                if (args.size() == 1 && args[0] == "--shutdown") {
+                    {
+                        lock_guard<mutex> lock(connectionMutex);
+                        stopping = true;
+                    }
+                    sendReply(client, JobResult(0, "shutting down\n"));
+                    shutdownSocket(listener);
+                } else {
+                    sendReply(client, daemon.Submit(args));
+                }
+            }
+            closeSocket(client);
+            lock_guard<mutex> lock(connectionMutex);
+            connections--;
+            idle.notify_all();
+        }).detach();
+    }
+    {
+        unique_lock<mutex> lock(connectionMutex);
+        idle.wait(lock, [&] { return connections == 0; });
+    }
+    daemon.Stop();
+    closeSocket(listener);
+    remove(socketPath.c_str());
+    return 0;
+}
+
+int submitJob(const string &socketPath, const vector<string> &args) {
+    SocketHandle s = connectUnix(socketPath);
+    if (s == invalidSocket) {
+        cerr << "No encode daemon on " << socketPath << '\n';
+        return 1;
+    }
+    DaemonRequestHeader hdr = {daemonRequestMagic, (uint32_t)args.size()};
+    bool ok = sendAll(s, &hdr, sizeof(hdr));
+    for (size_t i = 0; ok && i < args.size(); i++) {
+        const uint32_t len = (uint32_t)args[i].size();
+        ok = sendAll(s, &len, sizeof(len)) &&
+             sendAll(s, args[i].data(), len);
+    }
+    DaemonReplyHeader reply;
+    string text;
+    if (ok && recvAll(s, &reply, sizeof(reply))) {
+        text.resize(reply.uiLength);
+        ok = !reply.uiLength || recvAll(s, &text[0], reply.uiLength);
+    } else {
+        ok = false;
+    }
+    closeSocket(s);
+    if (!ok) {
+        cerr << "Lost the connection to the encode daemon\n";
+        return 1;
+    }
+    cout << text;
+    return reply.iStatus;
+}
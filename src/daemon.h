@@ -0,0 +1,35 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+const uint32_t daemonRequestMagic = 0x424f4a45; // "EJOB"
+
+// Request: this header, then uiArgc arguments, each a uint32_t length and
+// the bytes. The arguments are an openh264_test command line, argv[0]
+// included; paths resolve against the daemon's working directory. The
+// single argument "--shutdown" stops the daemon once running jobs finish.
+struct DaemonRequestHeader {
+    uint32_t uiMagic;
+    uint32_t uiArgc;
+};
+
+// Reply: this header followed by uiLength bytes of report text.
+struct DaemonReplyHeader {
+    int32_t iStatus; ///< 0 on success, like the process exit code
+    uint32_t uiLength;
+};
+
+// Serves encode jobs on a Unix domain socket with a pool of workers. Each
+// worker keeps one encoder for its lifetime (Uninitialize/InitializeExt
+// between jobs), sources stay memory-mapped and weights/<n>.txt are parsed
+// once, so a job costs only the encode itself.
+int runDaemon(const std::string &socketPath, int workers);
+
+// Sends one job and prints the daemon's report; returns its status.
+int submitJob(const std::string &socketPath,
+              const std::vector<std::string> &args);
+
+#endif //__DAEMON_H__
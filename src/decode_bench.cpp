@@ -0,0 +1,316 @@
+#include "decode_bench.h"
+#include "annexb.h"
+#include "harness.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+struct DecodeRun {
+    int iFrames = 0;
+    int iErrors = 0;
+    int iWidth = 0;
+    int iHeight = 0;
+    double fSeconds = 0;
+    LatencyHistogram latency;
+    SDecoderStatistics stats;
+    vector<uint64_t> hashes; ///< per picture, verification pass only
+    int iReconMismatches = 0;
+    int iFirstReconMismatch = -1;
+};
+
+class DecodeBench {
+  public:
+    DecodeBench(const MappedFile &stream, const vector<AccessUnit> &aus,
+                const MappedFile *recon)
+        : stream_(stream), aus_(aus), recon_(recon) {}
+
+    // one pass over the stream; verify hashes the pictures and compares
+    // them with the reconstruction instead of timing them
+    bool Run(int threads, bool verify, DecodeRun &run);
+
+  private:
+    void Output(unsigned char *dst[3], const SBufferInfo &info, bool verify,
+                DecodeRun &run);
+
+    const MappedFile &stream_;
+    const vector<AccessUnit> &aus_;
+    const MappedFile *recon_;
+    deque<int64_t> pending_; ///< feed times of access units not yet output
+};
+
+bool DecodeBench::Run(int threads, bool verify, DecodeRun &run) {
+    ISVCDecoder *decoder = NULL;
+    if (WelsCreateDecoder(&decoder) != 0 || !decoder) {
+        return false;
+    }
+    // must precede Initialize, which sets up the thread contexts
+    decoder->SetOption(DECODER_OPTION_NUM_OF_THREADS, &threads);
+    SDecodingParam decParam;
+    memset(&decParam, 0, sizeof(SDecodingParam));
+    decParam.eEcActiveIdc = ERROR_CON_DISABLE;
+    decParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+    if (decoder->Initialize(&decParam) != 0) {
+        WelsDestroyDecoder(decoder);
+        return false;
+    }
+
+    pending_.clear();
+    unsigned char *dst[3];
+    SBufferInfo info;
+    const int64_t startUs = monotonicUs();
+    for (const AccessUnit &au : aus_) {
+        pending_.push_back(monotonicUs());
+        memset(&info, 0, sizeof(SBufferInfo));
+        DECODING_STATE state = decoder->DecodeFrameNoDelay(
+            stream_.Data() + au.iStart, (int)au.iSize, dst, &info);
+        if (state != dsErrorFree) {
+            run.iErrors++;
+        }
+        if (info.iBufferStatus == 1) {
+            Output(dst, info, verify, run);
+        }
+        if (threads <= 1) {
+            // without frame threads a picture comes back from its own
+            // call or not at all
+            pending_.clear();
+        }
+    }
+    // frame threads still hold the last pictures
+    int endOfStream = 1;
+    decoder->SetOption(DECODER_OPTION_END_OF_STREAM, &endOfStream);
+    while (!pending_.empty()) {
+        memset(&info, 0, sizeof(SBufferInfo));
+        decoder->FlushFrame(dst, &info);
+        if (info.iBufferStatus != 1) {
+            break;
+        }
+        Output(dst, info, verify, run);
+    }
+    run.fSeconds = (monotonicUs() - startUs) / 1e6;
+
+    memset(&run.stats, 0, sizeof(SDecoderStatistics));
+    decoder->GetOption(DECODER_OPTION_GET_STATISTICS, &run.stats);
+    decoder->Uninitialize();
+    WelsDestroyDecoder(decoder);
+    return true;
+}
+
+void DecodeBench::Output(unsigned char *dst[3], const SBufferInfo &info,
+                         bool verify, DecodeRun &run) {
+    const int frame = run.iFrames++;
+    if (!pending_.empty()) {
+        run.latency.Record((double)(monotonicUs() - pending_.front()));
+        pending_.pop_front();
+    }
+    if (!verify) {
+        return;
+    }
+    const SSysMEMBuffer &sys = info.UsrData.sSystemBuffer;
+    run.iWidth = sys.iWidth;
+    run.iHeight = sys.iHeight;
+    const int w[3] = {sys.iWidth, sys.iWidth / 2, sys.iWidth / 2};
+    const int h[3] = {sys.iHeight, sys.iHeight / 2, sys.iHeight / 2};
+    const size_t frameSize = (size_t)sys.iWidth * sys.iHeight * 3 / 2;
+    const uint8_t *recon = nullptr;
+    if (recon_ && (size_t)(frame + 1) * frameSize <= recon_->Size()) {
+        recon = recon_->Data() + frame * frameSize;
+    }
+    bool match = recon != nullptr;
+    uint64_t hash = fnvOffset;
+    for (int p = 0; p < 3; p++) {
+        const int stride = sys.iStride[p == 0 ? 0 : 1];
+        for (int y = 0; y < h[p]; y++) {
+            const uint8_t *row = dst[p] + (size_t)y * stride;
+            hash = fnv1a(hash, row, w[p]);
+            if (match && memcmp(row, recon, w[p]) != 0) {
+                match = false;
+            }
+            if (recon) {
+                recon += w[p];
+            }
+        }
+    }
+    run.hashes.push_back(hash);
+    if (recon_ && !match) {
+        if (run.iFirstReconMismatch < 0) {
+            run.iFirstReconMismatch = frame;
+        }
+        run.iReconMismatches++;
+    }
+}
+
+bool parseThreadList(const string &value, vector<int> &threads) {
+    threads.clear();
+    stringstream ss(value);
+    string item;
+    while (getline(ss, item, ',')) {
+        const int n = parseInt(item);
+        if (n < 0) {
+            return false;
+        }
+        threads.push_back(n);
+    }
+    return !threads.empty();
+}
+
+} // namespace
+
+bool parseDecodeBenchOptions(int argc, char const *argv[],
+                             DecodeBenchOptions &opts) {
+    for (int i = 3; i < argc; i++) {
+        const string key = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for option: " << key << '\n';
+            return false;
+        }
+        const string value = argv[++i];
+        if (key == "--threads") {
+            if (!parseThreadList(value, opts.threads)) {
+                cerr << "Invalid thread list: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--repeat") {
+            opts.repeat = max(1, parseInt(value));
+        } else if (key == "--recon") {
+            opts.recon = value;
+        } else if (key == "--stats") {
+            opts.statsFile = value;
+        } else {
+            cerr << "Unknown option: " << key << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int runDecodeBench(const DecodeBenchOptions &opts) {
+    MappedFile stream;
+    if (!stream.Open(opts.stream)) {
+        cerr << "Cannot map " << opts.stream << '\n';
+        return 1;
+    }
+    MappedFile recon;
+    if (!opts.recon.empty() && !recon.Open(opts.recon)) {
+        cerr << "Cannot map " << opts.recon << '\n';
+        return 1;
+    }
+    vector<NalUnit> nals;
+    vector<AccessUnit> aus;
+    splitNalUnits(stream.Data(), stream.Size(), nals);
+    groupAccessUnits(stream.Data(), nals, aus);
+    cout << opts.stream << ": " << aus.size() << " access units, "
+         << nals.size() << " NAL units" << endl;
+    if (aus.empty()) {
+        return 1;
+    }
+
+    DecodeBench bench(stream, aus, opts.recon.empty() ? nullptr : &recon);
+    StatsReport report;
+    vector<uint64_t> reference;
+    bool haveReference = false;
+    bool ok = true;
+    for (int threads : opts.threads) {
+        // best of the timed passes; latency over all of them
+        DecodeRun best;
+        LatencyHistogram latency;
+        for (int r = 0; r < opts.repeat; r++) {
+            DecodeRun run;
+            if (!bench.Run(threads, false, run)) {
+                cerr << "Cannot create a decoder with " << threads
+                     << " threads\n";
+                return 1;
+            }
+            latency.Merge(run.latency);
+            if (r == 0 || run.fSeconds < best.fSeconds) {
+                best = run;
+            }
+        }
+        DecodeRun verify;
+        if (!bench.Run(threads, true, verify)) {
+            cerr << "Cannot create a decoder with " << threads
+                 << " threads\n";
+            return 1;
+        }
+        if (!haveReference) {
+            reference = verify.hashes;
+            haveReference = true;
+        }
+        const bool sameAsReference = verify.hashes == reference;
+        const bool reconOk = opts.recon.empty() ||
+                             (verify.iReconMismatches == 0 &&
+                              (size_t)verify.iFrames * verify.iWidth *
+                                      verify.iHeight * 3 / 2 ==
+                                  recon.Size());
+        ok = ok && sameAsReference && reconOk && best.iErrors == 0 &&
+             verify.iErrors == 0;
+
+        const double fps = best.fSeconds > 0 ? best.iFrames / best.fSeconds : 0;
+        const SDecoderStatistics &s = best.stats;
+        cout << "threads " << threads << ": " << best.iFrames << " frames, "
+             << fps << " fps, latency mean " << latency.Mean() / 1000
+             << " ms, p50 " << latency.Percentile(50) / 1000 << " ms, p99 "
+             << latency.Percentile(99) / 1000 << " ms, max "
+             << latency.Max() / 1000 << " ms" << endl;
+        cout << "  decoder: " << s.fAverageFrameSpeedInMs << " ms/frame ("
+             << s.fActualAverageFrameSpeedInMs << " with freezes), "
+             << s.uiDecodedFrameCount << " decoded, " << s.uiIDRCorrectNum
+             << " IDR, avg luma QP " << s.iAvgLumaQp << ", "
+             << s.uiEcFrameNum << " concealed, "
+             << s.uiFreezingIDRNum + s.uiFreezingNonIDRNum << " frozen, "
+             << best.iErrors << " errors" << endl;
+        cout << "  output "
+             << (sameAsReference ? "matches" : "DIFFERS FROM") << " threads "
+             << opts.threads[0];
+        if (!opts.recon.empty()) {
+            if (reconOk) {
+                cout << ", matches the encoder reconstruction";
+            } else if (verify.iReconMismatches) {
+                cout << ", " << verify.iReconMismatches
+                     << " frames differ from the reconstruction, first "
+                     << verify.iFirstReconMismatch;
+            } else {
+                cout << ", frame count differs from the reconstruction";
+            }
+        }
+        cout << endl;
+
+        const string prefix = "decode_t" + to_string(threads) + "_";
+        report.AddCounter(prefix + "frames", best.iFrames);
+        report.AddCounter(prefix + "fps", fps);
+        report.AddCounter(prefix + "errors", best.iErrors);
+        report.AddCounter(prefix + "avg_frame_ms", s.fAverageFrameSpeedInMs);
+        report.AddCounter(prefix + "actual_avg_frame_ms",
+                          s.fActualAverageFrameSpeedInMs);
+        report.AddCounter(prefix + "decoded_frames", s.uiDecodedFrameCount);
+        report.AddCounter(prefix + "idr_correct", s.uiIDRCorrectNum);
+        report.AddCounter(prefix + "avg_luma_qp", s.iAvgLumaQp);
+        report.AddCounter(prefix + "ec_frames", s.uiEcFrameNum);
+        report.AddCounter(prefix + "freezing_frames",
+                          s.uiFreezingIDRNum + s.uiFreezingNonIDRNum);
+        report.AddCounter(prefix + "matches_reference", sameAsReference);
+        if (!opts.recon.empty()) {
+            report.AddCounter(prefix + "recon_mismatches",
+                              verify.iReconMismatches);
+        }
+        report.AddHistogram(prefix + "latency", latency);
+    }
+
+    const string statsFile = opts.statsFile.empty()
+                                 ? opts.stream + ".decode.stats.json"
+                                 : opts.statsFile;
+    if (!report.WriteJson(statsFile)) {
+        cerr << "Failed to write " << statsFile << '\n';
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __DECODE_BENCH_H__
+#define __DECODE_BENCH_H__
+
+#include <string>
+#include <vector>
+
+struct DecodeBenchOptions {
+    std::string stream;
+    std::vector<int> threads = {0, 1, 2, 3}; ///< DECODER_OPTION_NUM_OF_THREADS
+    int repeat = 3;        ///< timed passes per thread count
+    std::string recon;     ///< encoder reconstruction (--dump-recon) to match
+    std::string statsFile; ///< defaults to <stream>.decode.stats.json
+};
+
+// parses the flags following --decode-bench <stream.h264>
+bool parseDecodeBenchOptions(int argc, char const *argv[],
+                             DecodeBenchOptions &opts);
+
+// Decodes an Annex-B stream access unit by access unit with
+// DecodeFrameNoDelay once per thread count. Reports fps, per-frame latency
+// from feeding an access unit to getting its picture back, and the
+// decoder's SDecoderStatistics. An untimed pass per thread count hashes
+// every picture; all thread counts must produce the same pictures, and the
+// pictures must equal the encoder reconstruction when one is given.
+int runDecodeBench(const DecodeBenchOptions &opts);
+
+#endif //__DECODE_BENCH_H__
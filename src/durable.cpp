@@ -0,0 +1,120 @@
+#include "durable.h"
+#include "hash.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static uint64_t recordHash(const string &key, const string &value) {
+    uint64_t hash = fnv1a(fnvOffset, key.data(), key.size());
+    hash = fnv1a(hash, "\t", 1);
+    return fnv1a(hash, value.data(), value.size());
+}
+
+bool syncFile(FILE *fp) {
+    if (fflush(fp) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0;
+#else
+    return fsync(fileno(fp)) == 0;
+#endif
+}
+
+bool writeFileAtomic(const string &fileName, const string &data) {
+    const string tmp = fileName + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size() &&
+              syncFile(fp);
+    ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp.c_str(), fileName.c_str(),
+                           MOVEFILE_REPLACE_EXISTING |
+                               MOVEFILE_WRITE_THROUGH);
+#else
+    ok = ok && rename(tmp.c_str(), fileName.c_str()) == 0;
+#endif
+    if (!ok) {
+        remove(tmp.c_str());
+    }
+    return ok;
+}
+
+Journal::~Journal() {
+    if (fp_) {
+        fclose(fp_);
+    }
+}
+
+bool Journal::Open(const string &fileName) {
+    records_.clear();
+    discarded_ = 0;
+    ifstream in(fileName.c_str(), ios::binary);
+    string line;
+    bool torn = false;
+    while (getline(in, line)) {
+        // getline also returns a last line without its newline
+        torn = in.eof();
+        const size_t tab1 = line.find('\t');
+        const size_t tab2 =
+            tab1 == string::npos ? string::npos : line.find('\t', tab1 + 1);
+        if (torn || tab2 == string::npos) {
+            discarded_++;
+            continue;
+        }
+        const string key = line.substr(0, tab1);
+        const string value = line.substr(tab1 + 1, tab2 - tab1 - 1);
+        if (strtoull(line.c_str() + tab2 + 1, nullptr, 16) !=
+            recordHash(key, value)) {
+            discarded_++;
+            continue;
+        }
+        records_[key] = value;
+    }
+    in.close();
+    if (fp_) {
+        fclose(fp_);
+    }
+    fp_ = fopen(fileName.c_str(), "ab");
+    if (fp_ && torn) {
+        // the next record must not continue the torn line
+        fputc('\n', fp_);
+    }
+    return fp_ != nullptr;
+}
+
+bool Journal::Append(const string &key, const string &value) {
+    if (!fp_) {
+        return false;
+    }
+    char hash[24];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)recordHash(key, value));
+    const string line = key + '\t' + value + '\t' + hash + '\n';
+    if (fwrite(line.data(), 1, line.size(), fp_) != line.size() ||
+        !syncFile(fp_)) {
+        cerr << "Cannot append to the journal\n";
+        return false;
+    }
+    records_[key] = value;
+    return true;
+}
+
+const string *Journal::Find(const string &key) const {
+    auto it = records_.find(key);
+    return it == records_.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,46 @@
+#ifndef __DURABLE_H__
+#define __DURABLE_H__
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+// fflush and push fp's data to the disk, so it survives a crash or a power
+// loss and not just the process
+bool syncFile(FILE *fp);
+
+// Replaces fileName with data all at once: written and synced under a
+// temporary name, then renamed over it. Readers see the old or the new
+// content, never a mix.
+bool writeFileAtomic(const std::string &fileName, const std::string &data);
+
+// Append-only log of key/value records, one line each:
+//   <key>\t<value>\t<fnv1a of key and value, hex>
+// A record is written with one write and synced before Append returns.
+// Loading skips a torn last line or one whose checksum does not match, so
+// a crash mid-append loses at most that record. Keys and values must not
+// contain tabs or newlines; a later record replaces an earlier one.
+class Journal {
+  public:
+    Journal() : fp_(nullptr) {}
+    ~Journal();
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    // loads the records of fileName and opens it for appending
+    bool Open(const std::string &fileName);
+    bool Append(const std::string &key, const std::string &value);
+    // nullptr when key has no record
+    const std::string *Find(const std::string &key) const;
+    const std::map<std::string, std::string> &Records() const {
+        return records_;
+    }
+    int Discarded() const { return discarded_; }
+
+  private:
+    FILE *fp_;
+    std::map<std::string, std::string> records_;
+    int discarded_ = 0;
+};
+
+#endif //__DURABLE_H__
@@ -0,0 +1,538 @@
+#include "frame_store.h"
+#include "band_workers.h"
+#include "harness.h"
+#include "hash.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// plane sizes of an I420 frame
+void planeSizes(int width, int height, int w[3], int h[3]) {
+    w[0] = width;
+    h[0] = height;
+    w[1] = w[2] = width / 2;
+    h[1] = h[2] = height / 2;
+}
+
+void leftDelta(const uint8_t *src, uint8_t *dst, int width, int height) {
+    int w[3], h[3];
+    planeSizes(width, height, w, h);
+    for (int p = 0; p < 3; p++) {
+        for (int y = 0; y < h[p]; y++) {
+            const uint8_t *row = src + (size_t)y * w[p];
+            uint8_t *out = dst + (size_t)y * w[p];
+            out[0] = (uint8_t)(row[0] - (y ? row[-w[p]] : 0));
+            for (int x = 1; x < w[p]; x++) {
+                out[x] = (uint8_t)(row[x] - row[x - 1]);
+            }
+        }
+        src += (size_t)w[p] * h[p];
+        dst += (size_t)w[p] * h[p];
+    }
+}
+
+// inverse of leftDelta, in place
+void undoLeftDelta(uint8_t *frame, int width, int height) {
+    int w[3], h[3];
+    planeSizes(width, height, w, h);
+    for (int p = 0; p < 3; p++) {
+        for (int y = 0; y < h[p]; y++) {
+            uint8_t *row = frame + (size_t)y * w[p];
+            if (y) {
+                row[0] = (uint8_t)(row[0] + row[-w[p]]);
+            }
+            for (int x = 1; x < w[p]; x++) {
+                row[x] = (uint8_t)(row[x] + row[x - 1]);
+            }
+        }
+        frame += (size_t)w[p] * h[p];
+    }
+}
+
+bool compressFrame(FrameStoreCodec codec, int level, const uint8_t *src,
+                   size_t size, vector<uint8_t> &out) {
+    switch (codec) {
+    case frameStoreRaw:
+        out.assign(src, src + size);
+        return true;
+#ifdef HAVE_LZ4
+    case frameStoreLz4: {
+        out.resize(LZ4_compressBound((int)size));
+        const int n =
+            LZ4_compress_fast((const char *)src, (char *)out.data(), (int)size,
+                              (int)out.size(), max(1, level));
+        out.resize(max(n, 0));
+        return n > 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case frameStoreZstd: {
+        out.resize(ZSTD_compressBound(size));
+        const size_t n =
+            ZSTD_compress(out.data(), out.size(), src, size, level);
+        if (ZSTD_isError(n)) {
+            return false;
+        }
+        out.resize(n);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool decompressFrame(FrameStoreCodec codec, const uint8_t *src, size_t size,
+                     uint8_t *dst, size_t rawSize) {
+    switch (codec) {
+    case frameStoreRaw:
+        if (size != rawSize) {
+            return false;
+        }
+        memcpy(dst, src, size);
+        return true;
+#ifdef HAVE_LZ4
+    case frameStoreLz4:
+        return LZ4_decompress_safe((const char *)src, (char *)dst, (int)size,
+                                   (int)rawSize) == (int)rawSize;
+#endif
+#ifdef HAVE_ZSTD
+    case frameStoreZstd:
+        return ZSTD_decompress(dst, rawSize, src, size) == rawSize;
+#endif
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+bool parseFrameStoreCodec(const string &name, FrameStoreCodec &codec) {
+    const FrameStoreCodec codecs[] = {frameStoreRaw, frameStoreLz4,
+                                      frameStoreZstd};
+    for (FrameStoreCodec c : codecs) {
+        if (name == frameStoreCodecName(c)) {
+            codec = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *frameStoreCodecName(FrameStoreCodec codec) {
+    switch (codec) {
+    case frameStoreLz4:
+        return "lz4";
+    case frameStoreZstd:
+        return "zstd";
+    default:
+        return "raw";
+    }
+}
+
+bool frameStoreCodecAvailable(FrameStoreCodec codec) {
+    switch (codec) {
+    case frameStoreRaw:
+        return true;
+#ifdef HAVE_LZ4
+    case frameStoreLz4:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case frameStoreZstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+FrameStoreInputStream::FrameStoreInputStream(int threads)
+    : threads_(max(1, threads)), index_(nullptr), nextDecode_(0),
+      nextRead_(0), stopping_(false) {
+    memset(&header_, 0, sizeof(header_));
+}
+
+FrameStoreInputStream::~FrameStoreInputStream() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    freed_.notify_all();
+    for (thread &t : workers_) {
+        t.join();
+    }
+}
+
+bool FrameStoreInputStream::Open(const string &fileName,
+                                 InputGeometry &geometry) {
+    if (!file_.Open(fileName) || file_.Size() < sizeof(header_)) {
+        cerr << "Cannot map frame store " << fileName << '\n';
+        return false;
+    }
+    memcpy(&header_, file_.Data(), sizeof(header_));
+    const size_t rawSize = (size_t)header_.uiWidth * header_.uiHeight * 3 / 2;
+    const uint64_t indexSize =
+        (uint64_t)header_.uiFrameCount * sizeof(FrameStoreEntry);
+    if (header_.uiMagic != frameStoreMagic ||
+        header_.uiVersion != frameStoreVersion ||
+        header_.uiIndexOffset > file_.Size() ||
+        indexSize > file_.Size() - header_.uiIndexOffset ||
+        header_.uiIndexOffset % alignof(FrameStoreEntry)) {
+        cerr << fileName << " is not a valid frame store\n";
+        return false;
+    }
+    if (!frameStoreCodecAvailable((FrameStoreCodec)header_.uiCodec)) {
+        cerr << fileName << " is compressed with "
+             << frameStoreCodecName((FrameStoreCodec)header_.uiCodec)
+             << ", which this build does not include\n";
+        return false;
+    }
+    index_ = (const FrameStoreEntry *)(file_.Data() + header_.uiIndexOffset);
+    for (uint32_t f = 0; f < header_.uiFrameCount; f++) {
+        const FrameStoreEntry &e = index_[f];
+        if (e.uiRawSize != rawSize || e.uiOffset > header_.uiIndexOffset ||
+            e.uiSize > header_.uiIndexOffset - e.uiOffset) {
+            cerr << fileName << ": bad index entry " << f << '\n';
+            return false;
+        }
+    }
+    geometry.iWidth = header_.uiWidth;
+    geometry.iHeight = header_.uiHeight;
+    geometry.fFps = header_.fFps;
+
+    // two frames in flight per thread keep every thread busy while the
+    // reader copies one out
+    slots_.resize(threads_ * 2);
+    for (Slot &slot : slots_) {
+        slot.data.resize(rawSize);
+    }
+    for (int t = 0; t < threads_; t++) {
+        workers_.emplace_back(&FrameStoreInputStream::Worker, this);
+    }
+    return true;
+}
+
+bool FrameStoreInputStream::Decode(const FrameStoreEntry &entry,
+                                   vector<uint8_t> &frame) {
+    if (!decompressFrame((FrameStoreCodec)header_.uiCodec,
+                         file_.Data() + entry.uiOffset, entry.uiSize,
+                         frame.data(), entry.uiRawSize)) {
+        return false;
+    }
+    if (header_.bLeftDelta) {
+        undoLeftDelta(frame.data(), header_.uiWidth, header_.uiHeight);
+    }
+    return true;
+}
+
+void FrameStoreInputStream::Worker() {
+    const int depth = (int)slots_.size();
+    for (;;) {
+        int frame;
+        {
+            unique_lock<mutex> lock(mutex_);
+            freed_.wait(lock, [&] {
+                return stopping_ ||
+                       (nextDecode_ < (int)header_.uiFrameCount &&
+                        nextDecode_ < nextRead_ + depth);
+            });
+            if (stopping_) {
+                return;
+            }
+            frame = nextDecode_++;
+        }
+        Slot &slot = slots_[frame % depth];
+        const bool ok = Decode(index_[frame], slot.data);
+        {
+            lock_guard<mutex> lock(mutex_);
+            slot.iFrame = frame;
+            slot.bFailed = !ok;
+        }
+        ready_.notify_all();
+    }
+}
+
+int FrameStoreInputStream::read(void *ptr, size_t len) {
+    if (nextRead_ >= (int)header_.uiFrameCount) {
+        return 0;
+    }
+    Slot &slot = slots_[nextRead_ % slots_.size()];
+    {
+        unique_lock<mutex> lock(mutex_);
+        ready_.wait(lock, [&] { return slot.iFrame == nextRead_; });
+    }
+    if (slot.bFailed || len != slot.data.size()) {
+        cerr << "Frame " << nextRead_ + 1 << " of the store is corrupt\n";
+        return 0;
+    }
+    memcpy(ptr, slot.data.data(), len);
+    {
+        lock_guard<mutex> lock(mutex_);
+        slot.iFrame = -1;
+        nextRead_++;
+    }
+    freed_.notify_all();
+    return (int)len;
+}
+
+bool parsePackOptions(int argc, char const *argv[], PackOptions &opts) {
+    opts.codec = frameStoreCodecAvailable(frameStoreZstd)  ? frameStoreZstd
+                 : frameStoreCodecAvailable(frameStoreLz4) ? frameStoreLz4
+                                                           : frameStoreRaw;
+    opts.geometry.iWidth = width;
+    opts.geometry.iHeight = height;
+    opts.geometry.fFps = inputFps;
+    for (int i = 4; i < argc; i++) {
+        const string key = argv[i];
+        if (key == "--no-delta") {
+            opts.leftDelta = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for option: " << key << '\n';
+            return false;
+        }
+        const string value = argv[++i];
+        if (key == "--codec") {
+            if (!parseFrameStoreCodec(value, opts.codec) ||
+                !frameStoreCodecAvailable(opts.codec)) {
+                cerr << "Codec not available in this build: " << value
+                     << '\n';
+                return false;
+            }
+        } else if (key == "--level") {
+            opts.level = parseInt(value);
+        } else if (key == "--threads") {
+            opts.threads = max(0, parseInt(value));
+        } else if (key == "--input-format") {
+            if (!parsePixelFormat(value, opts.inputFormat)) {
+                cerr << "Unknown input format: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--size") {
+            InputGeometry &g = opts.geometry;
+            if (sscanf(value.c_str(), "%dx%d", &g.iWidth, &g.iHeight) != 2 ||
+                g.iWidth <= 0 || g.iHeight <= 0 || g.iWidth % 2 ||
+                g.iHeight % 2) {
+                cerr << "Invalid picture size: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--fps") {
+            opts.geometry.fFps = parseFloat(value);
+        } else {
+            cerr << "Unknown option: " << key << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int runPack(const PackOptions &opts) {
+    const int threads =
+        opts.threads > 0 ? opts.threads
+                         : max(1, (int)thread::hardware_concurrency());
+    InputGeometry geometry = opts.geometry;
+    unique_ptr<InputStream> source =
+        openInput(opts.input, opts.inputFormat, geometry, threads);
+    if (!source) {
+        return 1;
+    }
+    InputStream *in = source.get();
+    unique_ptr<ConvertingInputStream> converter;
+    if (opts.inputFormat != pixelI420) {
+        converter.reset(new ConvertingInputStream(
+            in, opts.inputFormat, geometry.iWidth, geometry.iHeight, threads));
+        in = converter.get();
+    }
+    FILE *fp = fopen(opts.output.c_str(), "wb");
+    if (!fp) {
+        cerr << "Cannot create " << opts.output << '\n';
+        return 1;
+    }
+    FrameStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    header.uiMagic = frameStoreMagic;
+    header.uiVersion = frameStoreVersion;
+    header.uiCodec = (uint8_t)opts.codec;
+    // the filter only helps an entropy coder
+    const bool leftDeltaOn = opts.leftDelta && opts.codec != frameStoreRaw;
+    header.bLeftDelta = leftDeltaOn;
+    header.uiWidth = geometry.iWidth;
+    header.uiHeight = geometry.iHeight;
+    header.fFps = geometry.fFps;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // read a batch sequentially, compress it one frame per thread, write
+    // it in order
+    const size_t rawSize = (size_t)geometry.iWidth * geometry.iHeight * 3 / 2;
+    struct Job {
+        vector<uint8_t> raw;
+        vector<uint8_t> filtered;
+        vector<uint8_t> packed;
+        uint64_t hash;
+        bool ok;
+    };
+    vector<Job> jobs(threads);
+    for (Job &job : jobs) {
+        job.raw.resize(rawSize);
+        job.filtered.resize(rawSize);
+    }
+    BandWorkers workers(threads);
+    vector<FrameStoreEntry> index;
+    vector<uint64_t> hashes;
+    uint64_t offset = sizeof(header);
+    bool ok = true;
+    const int64_t startUs = monotonicUs();
+    for (bool more = true; more && ok;) {
+        int count = 0;
+        while (count < threads &&
+               in->read(jobs[count].raw.data(), rawSize) == (int)rawSize) {
+            count++;
+        }
+        more = count == threads;
+        workers.Run([&](int j) {
+            if (j >= count) {
+                return;
+            }
+            Job &job = jobs[j];
+            const uint8_t *src = job.raw.data();
+            if (leftDeltaOn) {
+                leftDelta(src, job.filtered.data(), geometry.iWidth,
+                          geometry.iHeight);
+                src = job.filtered.data();
+            }
+            job.ok = compressFrame(opts.codec, opts.level, src, rawSize,
+                                   job.packed);
+            job.hash = fnv1a(fnvOffset, job.raw.data(), rawSize);
+        });
+        for (int j = 0; j < count && ok; j++) {
+            const Job &job = jobs[j];
+            FrameStoreEntry e = {offset, (uint32_t)job.packed.size(),
+                                 (uint32_t)rawSize};
+            ok = job.ok && fwrite(job.packed.data(), 1, job.packed.size(),
+                                  fp) == job.packed.size();
+            index.push_back(e);
+            hashes.push_back(job.hash);
+            offset += job.packed.size();
+        }
+    }
+    // index entries are read in place from the mapping
+    const uint64_t pad = (alignof(FrameStoreEntry) -
+                          offset % alignof(FrameStoreEntry)) %
+                         alignof(FrameStoreEntry);
+    const uint8_t zeros[alignof(FrameStoreEntry)] = {};
+    fwrite(zeros, 1, pad, fp);
+    header.uiIndexOffset = offset + pad;
+    header.uiFrameCount = (uint32_t)index.size();
+    ok = ok &&
+         fwrite(index.data(), sizeof(FrameStoreEntry), index.size(), fp) ==
+             index.size() &&
+         fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    const double packSeconds = (monotonicUs() - startUs) / 1e6;
+    if (!ok) {
+        cerr << "Failed to write " << opts.output << '\n';
+        return 1;
+    }
+    const double rawMb = (double)rawSize * index.size() / (1 << 20);
+    const double packedMb = (double)(offset - sizeof(header)) / (1 << 20);
+    cout << opts.output << ": " << index.size() << " frames, "
+         << frameStoreCodecName(opts.codec)
+         << (leftDeltaOn ? " + left delta" : "") << ", " << rawMb
+         << " MB -> " << packedMb << " MB ("
+         << (packedMb > 0 ? rawMb / packedMb : 0) << "x) in "
+         << packSeconds * 1000 << " ms" << endl;
+
+    // check the store frame by frame
+    vector<uint8_t> frame(rawSize);
+    size_t frames = 0, mismatches = 0;
+    {
+        FrameStoreInputStream store(threads);
+        InputGeometry stored;
+        if (!store.Open(opts.output, stored)) {
+            return 1;
+        }
+        while (store.read(frame.data(), rawSize) == (int)rawSize) {
+            if (frames >= hashes.size() ||
+                fnv1a(fnvOffset, frame.data(), rawSize) != hashes[frames]) {
+                mismatches++;
+            }
+            frames++;
+        }
+    }
+    const bool identical = !mismatches && frames == hashes.size();
+    cout << "  read back " << frames << " frames, "
+         << (identical ? "identical" : "MISMATCH") << endl;
+    if (!identical) {
+        return 1;
+    }
+
+    // then time plain reads of both, I420 frames handed out the way an
+    // encode takes them; stdin or a FIFO cannot be read a second time
+    auto timeReads = [&](InputStream *s) {
+        const int64_t readStartUs = monotonicUs();
+        size_t n = 0;
+        while (n < frames && s->read(frame.data(), rawSize) == (int)rawSize) {
+            n++;
+        }
+        return n == frames ? (monotonicUs() - readStartUs) / 1e6 : -1.0;
+    };
+    auto printRate = [&](const char *what, double seconds) {
+        cout << "  " << what << ": " << seconds * 1000 << " ms ("
+             << (seconds > 0 ? frames / seconds : 0) << " fps, "
+             << (seconds > 0 ? rawMb / seconds : 0) << " MB/s)" << endl;
+    };
+    double rawSeconds = -1;
+    if (std::filesystem::is_regular_file(opts.input)) {
+        InputGeometry again = opts.geometry;
+        unique_ptr<InputStream> raw =
+            openInput(opts.input, opts.inputFormat, again, threads);
+        unique_ptr<ConvertingInputStream> rawConverter;
+        InputStream *rawIn = raw.get();
+        if (rawIn && opts.inputFormat != pixelI420) {
+            rawConverter.reset(new ConvertingInputStream(
+                rawIn, opts.inputFormat, geometry.iWidth, geometry.iHeight,
+                threads));
+            rawIn = rawConverter.get();
+        }
+        rawSeconds = rawIn ? timeReads(rawIn) : -1;
+    }
+    FrameStoreInputStream store(threads);
+    InputGeometry stored;
+    if (!store.Open(opts.output, stored)) {
+        return 1;
+    }
+    const double storeSeconds = timeReads(&store);
+    if (rawSeconds >= 0) {
+        printRate("raw input read", rawSeconds);
+    } else {
+        cout << "  raw input read: not repeatable, " << opts.input << '\n';
+    }
+    printRate(("frame store read, " + to_string(threads) + " threads")
+                  .c_str(),
+              storeSeconds);
+    if (rawSeconds > 0 && storeSeconds > 0) {
+        cout << "  frame store reads " << rawSeconds / storeSeconds
+             << "x the speed of the raw input (both warm in the page "
+                "cache)"
+             << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef __FRAME_STORE_H__
+#define __FRAME_STORE_H__
+
+#include <wels/utils/InputStream.h>
+
+#include "input_source.h"
+#include "mapped_file.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+const uint32_t frameStoreMagic = 0x31534659; // "YFS1"
+const uint16_t frameStoreVersion = 1;
+
+enum FrameStoreCodec {
+    frameStoreRaw = 0,
+    frameStoreLz4 = 1,
+    frameStoreZstd = 2,
+};
+
+// Layout, little endian: this header, the frames as independently
+// compressed blocks, then uiFrameCount entries at uiIndexOffset. Frames
+// are I420; with bLeftDelta every row holds differences to the pixel on
+// its left (the first column: to the pixel above), which makes camera
+// and rendered content compress several times better.
+struct FrameStoreHeader {
+    uint32_t uiMagic;
+    uint16_t uiVersion;
+    uint8_t uiCodec; ///< FrameStoreCodec
+    uint8_t bLeftDelta;
+    uint32_t uiWidth;
+    uint32_t uiHeight;
+    float fFps;
+    uint32_t uiFrameCount;
+    uint64_t uiIndexOffset;
+};
+static_assert(sizeof(FrameStoreHeader) == 32, "frame store header layout");
+
+struct FrameStoreEntry {
+    uint64_t uiOffset;
+    uint32_t uiSize;    ///< compressed
+    uint32_t uiRawSize; ///< one I420 frame
+};
+static_assert(sizeof(FrameStoreEntry) == 16, "frame store entry layout");
+
+bool parseFrameStoreCodec(const std::string &name, FrameStoreCodec &codec);
+const char *frameStoreCodecName(FrameStoreCodec codec);
+// whether this build links the codec's library
+bool frameStoreCodecAvailable(FrameStoreCodec codec);
+
+// Hands out the frames of a store in order while a pool of threads
+// decompresses the next ones into a ring of frame buffers.
+class FrameStoreInputStream : public InputStream {
+  public:
+    explicit FrameStoreInputStream(int threads);
+    ~FrameStoreInputStream();
+
+    bool Open(const std::string &fileName, InputGeometry &geometry);
+    int read(void *ptr, size_t len);
+
+  private:
+    struct Slot {
+        std::vector<uint8_t> data;
+        int iFrame = -1; ///< frame held, -1 while being filled
+        bool bFailed = false;
+    };
+    void Worker();
+    bool Decode(const FrameStoreEntry &entry, std::vector<uint8_t> &frame);
+
+    int threads_;
+    MappedFile file_;
+    FrameStoreHeader header_;
+    const FrameStoreEntry *index_;
+    std::vector<Slot> slots_;
+    std::mutex mutex_;
+    std::condition_variable ready_; ///< a slot got its frame
+    std::condition_variable freed_; ///< the reader moved on
+    int nextDecode_;
+    int nextRead_;
+    bool stopping_;
+    std::vector<std::thread> workers_;
+};
+
+struct PackOptions {
+    std::string input;
+    std::string output;
+    FrameStoreCodec codec; ///< zstd when built in, else lz4, else raw
+    int level = 3;        ///< zstd level; lz4 acceleration above 1
+    bool leftDelta = true;
+    int threads = 0;      ///< 0: one per hardware thread
+    PixelFormat inputFormat = pixelI420;
+    InputGeometry geometry;
+};
+
+// parses the flags following --pack <input> <out.yfs>
+bool parsePackOptions(int argc, char const *argv[], PackOptions &opts);
+
+// Compresses an input (raw, Y4M, any --input-format) into a frame store,
+// frames in parallel, then reads it back through FrameStoreInputStream to
+// time decompression and check every frame.
+int runPack(const PackOptions &opts);
+
+#endif //__FRAME_STORE_H__
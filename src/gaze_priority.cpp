@@ -0,0 +1,200 @@
+#include "gaze_priority.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+bool parseFalloff(const string &name, FoveationFalloff &eFalloff) {
+    if (name == "gaussian") {
+        eFalloff = FALLOFF_GAUSSIAN;
+    } else if (name == "linear") {
+        eFalloff = FALLOFF_LINEAR;
+    } else if (name == "hyperbolic") {
+        eFalloff = FALLOFF_HYPERBOLIC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// trace lines are "timestamp_ms x y", separated by spaces or commas; lines
+// that do not parse (headers, comments) are skipped
+bool loadGazeTrace(const string &fileName, vector<GazeSample> &samples) {
+    ifstream trace(fileName.c_str());
+    if (!trace.is_open()) {
+        return false;
+    }
+    string line;
+    while (getline(trace, line)) {
+        replace(line.begin(), line.end(), ',', ' ');
+        stringstream ss(line);
+        GazeSample sample;
+        if (ss >> sample.fTimestampMs >> sample.fX >> sample.fY) {
+            samples.push_back(sample);
+        }
+    }
+    trace.close();
+    return !samples.empty();
+}
+
+GazePrioritySource::GazePrioritySource(const vector<GazeSample> &samples,
+                                       const FoveationModel &model,
+                                       int picWidth, int picHeight, float fps)
+    : samples_(samples), cursor_(0), model_(model),
+      widthInMb_((picWidth + 15) >> 4), heightInMb_((picHeight + 15) >> 4),
+      aspect_((float)picHeight / picWidth), fps_(fps), totalComputeUs_(0),
+      computeCount_(0) {
+    colCenter_.resize(widthInMb_);
+    rowCenter_.resize(heightInMb_);
+    dx2_.resize(widthInMb_);
+    for (int x = 0; x < widthInMb_; x++) {
+        colCenter_[x] = (x * 16 + 8) / (float)picWidth;
+    }
+    for (int y = 0; y < heightInMb_; y++) {
+        rowCenter_[y] = (y * 16 + 8) / (float)picWidth;
+    }
+    if (!samples_.empty()) {
+        const double t0 = samples_[0].fTimestampMs;
+        for (auto &s : samples_) {
+            s.fTimestampMs -= t0;
+        }
+    }
+}
+
+bool GazePrioritySource::fillPriorityArray(int frameNum,
+                                           const SSourcePicture &pic,
+                                           float *priorityArray) {
+    if (samples_.empty()) {
+        return false;
+    }
+    float gazeX = 0, gazeY = 0;
+    GazeAt((frameNum - 1) * 1000.0 / fps_, gazeX, gazeY);
+
+    auto start = chrono::steady_clock::now();
+    ComputeGrid(gazeX, gazeY, priorityArray);
+    totalComputeUs_ += chrono::duration<double, micro>(
+                           chrono::steady_clock::now() - start)
+                           .count();
+    computeCount_++;
+    return true;
+}
+
+double GazePrioritySource::AverageComputeUs() const {
+    return computeCount_ ? totalComputeUs_ / computeCount_ : 0;
+}
+
+void GazePrioritySource::printSummary() {
+    cout << "Gaze priority map: " << AverageComputeUs() << " us/frame" << endl;
+}
+
+// linear interpolation between the two samples around timestampMs; frames
+// only move forward so the search resumes from the previous position
+void GazePrioritySource::GazeAt(double timestampMs, float &gazeX,
+                                float &gazeY) {
+    while (cursor_ + 1 < samples_.size() &&
+           samples_[cursor_ + 1].fTimestampMs <= timestampMs) {
+        cursor_++;
+    }
+    const GazeSample &a = samples_[cursor_];
+    if (cursor_ + 1 == samples_.size() || timestampMs <= a.fTimestampMs) {
+        gazeX = a.fX;
+        gazeY = a.fY;
+        return;
+    }
+    const GazeSample &b = samples_[cursor_ + 1];
+    float t = (float)((timestampMs - a.fTimestampMs) /
+                      (b.fTimestampMs - a.fTimestampMs));
+    gazeX = a.fX + (b.fX - a.fX) * t;
+    gazeY = a.fY + (b.fY - a.fY) * t;
+}
+
+static inline float falloffScalar(const FoveationModel &m, float d2) {
+    float t = max(sqrtf(d2) - m.fFoveaRadius, 0.0f);
+    float w = m.fFalloffWidth;
+    float k = 0;
+    switch (m.eFalloff) {
+    case FALLOFF_GAUSSIAN:
+        k = expf(-t * t / (2 * w * w));
+        break;
+    case FALLOFF_LINEAR:
+        k = 1.0f - min(t / w, 1.0f);
+        break;
+    case FALLOFF_HYPERBOLIC:
+        k = w / (w + t);
+        break;
+    }
+    return m.fMinPriority + (m.fMaxPriority - m.fMinPriority) * k;
+}
+
+#ifdef HAVE_SSE2
+// exp(x) for x <= 0: 2^i * 2^f with f in [-0.5, 0.5] and a degree-5
+// series for 2^f, accurate to ~3e-6 relative, plenty for a priority weight
+static inline __m128 expNegSse2(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+    __m128i i = _mm_cvtps_epi32(t);
+    __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+    __m128 p = _mm_set1_ps(1.3333558e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    __m128i e = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+#endif
+
+void GazePrioritySource::ComputeGrid(float gazeX, float gazeY,
+                                     float *priorityArray) {
+    const float gx = gazeX;
+    const float gy = gazeY * aspect_;
+    for (int x = 0; x < widthInMb_; x++) {
+        float dx = colCenter_[x] - gx;
+        dx2_[x] = dx * dx;
+    }
+
+    const FoveationModel &m = model_;
+    for (int y = 0; y < heightInMb_; y++) {
+        float dy = rowCenter_[y] - gy;
+        float dy2 = dy * dy;
+        float *row = priorityArray + y * widthInMb_;
+        int x = 0;
+#ifdef HAVE_SSE2
+        const __m128 vDy2 = _mm_set1_ps(dy2);
+        const __m128 vRadius = _mm_set1_ps(m.fFoveaRadius);
+        const __m128 vWidth = _mm_set1_ps(m.fFalloffWidth);
+        const __m128 vMin = _mm_set1_ps(m.fMinPriority);
+        const __m128 vRange = _mm_set1_ps(m.fMaxPriority - m.fMinPriority);
+        const __m128 vOne = _mm_set1_ps(1.0f);
+        const __m128 vGauss =
+            _mm_set1_ps(-1.0f / (2 * m.fFalloffWidth * m.fFalloffWidth));
+        for (; x + 4 <= widthInMb_; x += 4) {
+            __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_loadu_ps(&dx2_[x]), vDy2));
+            __m128 t = _mm_max_ps(_mm_sub_ps(d, vRadius), _mm_setzero_ps());
+            __m128 k;
+            switch (m.eFalloff) {
+            case FALLOFF_GAUSSIAN:
+                k = expNegSse2(_mm_mul_ps(_mm_mul_ps(t, t), vGauss));
+                break;
+            case FALLOFF_LINEAR:
+                k = _mm_sub_ps(vOne, _mm_min_ps(_mm_div_ps(t, vWidth), vOne));
+                break;
+            default:
+                k = _mm_div_ps(vWidth, _mm_add_ps(vWidth, t));
+                break;
+            }
+            _mm_storeu_ps(row + x, _mm_add_ps(vMin, _mm_mul_ps(vRange, k)));
+        }
+#endif
+        for (; x < widthInMb_; x++) {
+            row[x] = falloffScalar(m, dx2_[x] + dy2);
+        }
+    }
+}
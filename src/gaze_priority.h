@@ -0,0 +1,68 @@
+#ifndef __GAZE_PRIORITY_H__
+#define __GAZE_PRIORITY_H__
+
+#include "priority_source.h"
+
+#include <string>
+#include <vector>
+
+enum FoveationFalloff {
+    FALLOFF_GAUSSIAN,  ///< exp(-d^2 / 2w^2) outside the fovea
+    FALLOFF_LINEAR,    ///< linear ramp of width w outside the fovea
+    FALLOFF_HYPERBOLIC ///< w / (w + d), the cortical magnification shape
+};
+
+// Distances are measured in fractions of the picture width so one model
+// works for any resolution.
+struct FoveationModel {
+    FoveationFalloff eFalloff = FALLOFF_GAUSSIAN;
+    float fFoveaRadius = 0.05f;  ///< full priority inside this radius
+    float fFalloffWidth = 0.15f; ///< sigma / ramp width / half-priority distance
+    float fMinPriority = 0.1f;
+    float fMaxPriority = 1.0f;
+};
+
+// One eye-tracker sample: timestamp in milliseconds, gaze point normalized
+// to [0, 1] over the picture (origin top-left).
+struct GazeSample {
+    double fTimestampMs;
+    float fX;
+    float fY;
+};
+
+bool parseFalloff(const std::string &name, FoveationFalloff &eFalloff);
+bool loadGazeTrace(const std::string &fileName,
+                   std::vector<GazeSample> &samples);
+
+// Generates the MB priority grid from a gaze trace. The trace is rebased so
+// that its first sample lines up with the first frame.
+class GazePrioritySource : public PrioritySource {
+  public:
+    GazePrioritySource(const std::vector<GazeSample> &samples,
+                       const FoveationModel &model, int picWidth,
+                       int picHeight, float fps);
+
+    bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                           float *priorityArray) override;
+    void printSummary() override;
+    void ComputeGrid(float gazeX, float gazeY, float *priorityArray);
+    double AverageComputeUs() const;
+
+  private:
+    void GazeAt(double timestampMs, float &gazeX, float &gazeY);
+
+    std::vector<GazeSample> samples_;
+    size_t cursor_;
+    FoveationModel model_;
+    int widthInMb_;
+    int heightInMb_;
+    float aspect_;
+    float fps_;
+    std::vector<float> colCenter_;
+    std::vector<float> rowCenter_;
+    std::vector<float> dx2_;
+    double totalComputeUs_;
+    int computeCount_;
+};
+
+#endif //__GAZE_PRIORITY_H__
@@ -0,0 +1,1062 @@
+#include "harness.h"
+#include "durable.h"
+#include "hash.h"
+#include "ladder.h"
+#include "temporal.h"
+#include "priority_socket.h"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+const string testbinDir = "../testbin/";
+const string weightsDir = testbinDir + "weights";
+const string inputFileName = testbinDir + "cut.yuv";
+const string h264Suffix = ".h264";
+const string mp4Suffix = ".mp4";
+
+int width = 1824;
+int height = 1920;
+float inputFps = 60;
+float outputFps = 60;
+int iWidthInMb = width / 16;
+int iHeightInMb = height / 16;
+int iArraySize = iWidthInMb * iHeightInMb;
+int weightsWidth = width;
+int weightsHeight = height;
+ResampleFilter priorityFilter = resampleArea;
+PriorityTransform priorityTransform;
+
+void setInputGeometry(const InputGeometry &geometry) {
+    width = geometry.iWidth;
+    height = geometry.iHeight;
+    inputFps = outputFps = geometry.fFps;
+    // the encoder pads partial macroblocks, so does the priority grid
+    iWidthInMb = (width + 15) / 16;
+    iHeightInMb = (height + 15) / 16;
+    iArraySize = iWidthInMb * iHeightInMb;
+}
+
+int isDiffEncoding = 0;
+
+bool fileExists(const string &name) {
+    struct stat buffer;
+    return (stat(name.c_str(), &buffer) == 0);
+}
+
+int countFiles(const fs::path &dir) {
+    int count = 0;
+    for (auto &p : fs::directory_iterator(dir)) {
+        count++;
+    }
+    return count;
+}
+
+void TestCallback::onEncodeFrame(const SFrameBSInfo &frameInfo,
+                                 const string &outFileName) {
+    if (outFileName != fileName_) {
+        onStreamDone();
+        if (fopen_s(&fp_, outFileName.c_str(), "ab") != 0) {
+            fp_ = nullptr;
+            return;
+        }
+        assert(fp_ != nullptr);
+        fileName_ = outFileName;
+        offset_ = fs::file_size(outFileName);
+        index_.Open(outFileName + bitstreamIndexSuffix, offset_);
+    }
+    const uint64_t frameOffset = offset_;
+    int iLayer = 0;
+    while (iLayer < frameInfo.iLayerNum) {
+        const SLayerBSInfo *pLayerInfo = &frameInfo.sLayerInfo[iLayer++];
+        if (pLayerInfo) {
+            int iLayerSize = 0;
+            int iNalIndex = pLayerInfo->iNalCount - 1;
+            do {
+                iLayerSize += pLayerInfo->pNalLengthInByte[iNalIndex];
+                iNalIndex--;
+            } while (iNalIndex >= 0);
+            fwrite(pLayerInfo->pBsBuf, 1, iLayerSize, fp_);
+            offset_ += iLayerSize;
+        }
+    }
+    index_.AddFrame(frameNum_, frameInfo, frameOffset);
+}
+
+bool TestCallback::Flush() {
+    return !fp_ || (fflush(fp_) == 0 && index_.Flush());
+}
+
+bool TestCallback::Sync() {
+    return !fp_ || (syncFile(fp_) && index_.Sync());
+}
+
+void TestCallback::onStreamDone() {
+    if (fp_) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+    index_.Close();
+    fileName_.clear();
+}
+
+BaseEncoderTest::BaseEncoderTest()
+    : encoder_(NULL), prioritySource_(NULL), weightsDir_(weightsDir),
+      diffEncoding_(isDiffEncoding != 0), pacer_(NULL),
+      bitrateController_(NULL), allocTracker_(NULL), profiler_(NULL),
+      placement_(NULL), maxFrames_(0),
+      startFrame_(1),
+      inputFormat_(pixelI420),
+      convertThreads_(0) {}
+
+void BaseEncoderTest::SetUp() {
+    int rv = WelsCreateSVCEncoder(&encoder_);
+    assert(rv == cmResultSuccess);
+    assert(encoder_ != NULL);
+
+    unsigned int uiTraceLevel = WELS_LOG_DEBUG;
+    encoder_->SetOption(ENCODER_OPTION_TRACE_LEVEL, &uiTraceLevel);
+}
+
+void BaseEncoderTest::TearDown() {
+    if (encoder_) {
+        encoder_->Uninitialize();
+        WelsDestroySVCEncoder(encoder_);
+    }
+}
+
+namespace {
+
+// Runs prepare(slot, frameNum) on one persistent thread, a frame ahead of
+// the encode. Unlike a std::async per frame it allocates nothing once
+// started.
+class FramePrefetcher {
+  public:
+    FramePrefetcher(function<bool(int, int)> prepare,
+                    const CpuPlacement *placement)
+        : prepare_(move(prepare)), placement_(placement), slot_(0),
+          frameNum_(0), pending_(false), done_(false), result_(false),
+          stopping_(false), thread_(&FramePrefetcher::Loop, this) {}
+    ~FramePrefetcher() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        start_.notify_one();
+        thread_.join();
+    }
+
+    void Start(int slot, int frameNum) {
+        lock_guard<mutex> lock(mutex_);
+        slot_ = slot;
+        frameNum_ = frameNum;
+        pending_ = true;
+        done_ = false;
+        start_.notify_one();
+    }
+    // the result of the last Start
+    bool Wait() {
+        unique_lock<mutex> lock(mutex_);
+        finished_.wait(lock, [&] { return done_; });
+        return result_;
+    }
+
+  private:
+    void Loop() {
+        if (placement_) {
+            // Windows threads do not inherit the affinity of their creator
+            placement_->Apply();
+        }
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            start_.wait(lock, [&] { return pending_ || stopping_; });
+            if (stopping_) {
+                return;
+            }
+            pending_ = false;
+            const int slot = slot_, frameNum = frameNum_;
+            lock.unlock();
+            const bool result = prepare_(slot, frameNum);
+            lock.lock();
+            result_ = result;
+            done_ = true;
+            finished_.notify_one();
+        }
+    }
+
+    function<bool(int, int)> prepare_;
+    const CpuPlacement *placement_;
+    mutex mutex_;
+    condition_variable start_;
+    condition_variable finished_;
+    int slot_;
+    int frameNum_;
+    bool pending_;
+    bool done_;
+    bool result_;
+    bool stopping_;
+    thread thread_;
+};
+
+// Reads a whole file into buf and NUL terminates it. buf only grows, so
+// rereading files of the same size does not allocate.
+bool readTextFile(const string &fileName, vector<char> &buf) {
+#ifdef _WIN32
+    const int fd = _open(fileName.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    const int fd = open(fileName.c_str(), O_RDONLY);
+#endif
+    if (fd < 0) {
+        return false;
+    }
+    size_t got = 0;
+    while (true) {
+        if (buf.size() < got + 4097) {
+            buf.resize(max(buf.size() * 2, got + 4097));
+        }
+#ifdef _WIN32
+        const int n = _read(fd, buf.data() + got,
+                            (unsigned)(buf.size() - got - 1));
+#else
+        const ssize_t n = read(fd, buf.data() + got, buf.size() - got - 1);
+#endif
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+    buf[got] = '\0';
+    return true;
+}
+
+} // namespace
+
+void BaseEncoderTest::EncodeStream(InputStream *in, SEncParamExt *pEncParamExt,
+                                   Callback *cbk, const string &outFileName) {
+    assert(NULL != pEncParamExt);
+
+    int rv = encoder_->InitializeExt(pEncParamExt);
+    assert(rv == cmResultSuccess);
+    if (!reconFile_.empty()) {
+        // builds without ENABLE_FRAME_DUMP ignore the option; do not leave
+        // an older dump behind
+        remove(reconFile_.c_str());
+        SDumpLayer dump;
+        dump.iLayer = 0;
+        dump.pFileName = const_cast<char *>(reconFile_.c_str());
+        encoder_->SetOption(ENCODER_OPTION_DUMP_FILE, &dump);
+    }
+
+    // I420: 1(Y) + 1/4(U) + 1/4(V)
+    int frameSize = pEncParamExt->iPicWidth * pEncParamExt->iPicHeight * 3 / 2;
+    unique_ptr<ConvertingInputStream> converter;
+    if (inputFormat_ != pixelI420) {
+        const int threads =
+            convertThreads_ > 0
+                ? convertThreads_
+                : min(8, max(1, (int)thread::hardware_concurrency()));
+        converter.reset(new ConvertingInputStream(
+            in, inputFormat_, pEncParamExt->iPicWidth,
+            pEncParamExt->iPicHeight, threads));
+        in = converter.get();
+    }
+
+    // double-buffered so that reading frame i+1 and computing its
+    // priorities overlaps with encoding frame i
+    BufferedData bufs[2];
+    SSourcePicture pics[2];
+    vector<float> priorityArrays[2];
+    for (int slot = 0; slot < 2; slot++) {
+        BufferedData &buf = bufs[slot];
+        buf.SetLength(frameSize);
+        assert(buf.Length() == (size_t)frameSize);
+
+        SSourcePicture &pic = pics[slot];
+        memset(&pic, 0, sizeof(SSourcePicture));
+        pic.iPicWidth = pEncParamExt->iPicWidth;
+        pic.iPicHeight = pEncParamExt->iPicHeight;
+        pic.iColorFormat = videoFormatI420;
+        pic.iStride[0] = pic.iPicWidth;
+        pic.iStride[1] = pic.iStride[2] = pic.iPicWidth >> 1;
+        pic.pData[0] = buf.data();
+        pic.pData[1] =
+            pic.pData[0] + pEncParamExt->iPicWidth * pEncParamExt->iPicHeight;
+        pic.pData[2] =
+            pic.pData[1] +
+            (pEncParamExt->iPicWidth * pEncParamExt->iPicHeight >> 2);
+
+        priorityArrays[slot].resize(iArraySize);
+    }
+    // a fresh encoder starts the temporal steps over
+    transform_ = priorityTransform;
+    if (diffEncoding_ && !transform_.Empty()) {
+        transform_.Prepare((pEncParamExt->iPicWidth + 15) >> 4,
+                           (pEncParamExt->iPicHeight + 15) >> 4);
+    }
+
+    SFrameBSInfo info;
+    memset(&info, 0, sizeof(SFrameBSInfo));
+
+    // weights/<n>.txt, rebuilt in place so that frames do not allocate
+    string weightLog = weightsDir_ + "/";
+    const size_t weightLogDirSize = weightLog.size();
+    weightLog.reserve(weightLogDirSize + 16);
+
+    auto prepareFrame = [&](int slot, int frameNum) {
+        if (profiler_) {
+            profiler_->Begin(stageRead);
+        }
+        const bool read = in->read(bufs[slot].data(), frameSize) == frameSize;
+        if (profiler_) {
+            profiler_->End(stageRead);
+        }
+        if (!read) {
+            return false;
+        }
+        if (diffEncoding_) {
+            if (profiler_) {
+                profiler_->Begin(stagePriorities);
+            }
+            float *priorityArray = priorityArrays[slot].data();
+            bool fresh = true;
+            if (prioritySource_) {
+                bool filled = prioritySource_->fillPriorityArray(
+                    frameNum, pics[slot], priorityArray);
+                assert(filled);
+            } else {
+                char name[16];
+                snprintf(name, sizeof(name), "%d.txt", frameNum);
+                weightLog.resize(weightLogDirSize);
+                weightLog += name;
+                fresh = ReadWeights(weightLog, priorityArray,
+                                    pEncParamExt->iPicWidth,
+                                    pEncParamExt->iPicHeight);
+            }
+            // a map left over in the slot is transformed already
+            if (fresh && !transform_.Empty()) {
+                transform_.Apply(priorityArray);
+            }
+            if (profiler_) {
+                profiler_->End(stagePriorities);
+            }
+        }
+        return true;
+    };
+
+    // frames an earlier, interrupted run has encoded already
+    vector<uint8_t> skipped(startFrame_ > 1 ? frameSize : 0);
+    for (int n = 1; n < startFrame_; n++) {
+        if (in->read(skipped.data(), frameSize) != frameSize) {
+            break;
+        }
+    }
+
+    int i = startFrame_;
+    FramePrefetcher prefetcher(prepareFrame, placement_);
+    prefetcher.Start((i - 1) & 1, i);
+    while (prefetcher.Wait() && (!maxFrames_ || i <= maxFrames_)) {
+        const int slot = (i - 1) & 1;
+        prefetcher.Start(slot ^ 1, i + 1);
+        if (allocTracker_) {
+            allocTracker_->FrameStart(i);
+        }
+
+        if (pacer_) {
+            if (!pacer_->WaitForRelease(i)) {
+                i++;
+                continue;
+            }
+            pics[slot].uiTimeStamp = pacer_->TimestampMs(i);
+        }
+        if (bitrateController_) {
+            pics[slot].uiTimeStamp = bitrateController_->TimestampMs(i);
+            bitrateController_->Apply(encoder_, i);
+        }
+        cbk->onFrameStart(i);
+        if (profiler_) {
+            profiler_->Begin(stageEncode);
+        }
+        int rv = -1;
+        if (diffEncoding_) {
+            rv = encoder_->EncodeFrame(&pics[slot], &info,
+                                       priorityArrays[slot].data());
+        } else {
+            rv = encoder_->EncodeFrame(&pics[slot], &info);
+        }
+        assert(rv == cmResultSuccess);
+        if (profiler_) {
+            profiler_->End(stageEncode);
+        }
+        if (pacer_) {
+            pacer_->FrameEncoded(i, info);
+        }
+        if (bitrateController_) {
+            bitrateController_->FrameEncoded(encoder_, i, info);
+        }
+        if (profiler_) {
+            profiler_->Begin(stageCallback);
+        }
+        if (info.eFrameType != videoFrameTypeSkip) {
+            cbk->onEncodeFrame(info, outFileName);
+        }
+        cbk->onFrameDone(i, info);
+        if (profiler_) {
+            profiler_->End(stageCallback);
+        }
+        i++;
+    }
+    if (allocTracker_) {
+        allocTracker_->StreamDone();
+    }
+    cbk->onStreamDone();
+}
+
+void BaseEncoderTest::EncodeFile(const char *fileName,
+                                 SEncParamExt *pEncParamExt, Callback *cbk,
+                                 const string &outFileName) {
+    InputGeometry geometry = {width, height, inputFps};
+    unique_ptr<InputStream> in =
+        openInput(fileName, inputFormat_, geometry, convertThreads_);
+    assert(in);
+    assert(geometry.iWidth == pEncParamExt->iPicWidth &&
+           geometry.iHeight == pEncParamExt->iPicHeight);
+    EncodeInput(in.get(), pEncParamExt, cbk, outFileName);
+}
+
+void BaseEncoderTest::EncodeInput(InputStream *in, SEncParamExt *pEncParamExt,
+                                  Callback *cbk, const string &outFileName) {
+    if (fileExists(outFileName)) {
+        int removeRes = remove(outFileName.c_str());
+        assert(removeRes == 0);
+        cout << "Removed existing file before encoding: " << outFileName
+             << endl;
+    }
+    EncodeStream(in, pEncParamExt, cbk, outFileName);
+}
+
+// check if the weight log file is valid
+void BaseEncoderTest::CheckWeightLog(const string &fileName, int width,
+                                     int height) {
+    ifstream weightLog(fileName.c_str());
+    string line;
+    int lineNum = 0;
+    while (getline(weightLog, line)) {
+        lineNum++;
+        if (line.empty()) {
+            continue;
+        }
+
+        float num = 0;
+        int colNum = 0;
+        stringstream ss(line);
+        while (ss >> num) {
+            colNum++;
+        }
+        assert(colNum == width);
+    }
+    assert(lineNum - 1 == height);
+
+    weightLog.close();
+}
+
+// read just one priority array from one file
+bool BaseEncoderTest::ReadPriorityArray(const string &fileName,
+                                        float *priorityArray, int width,
+                                        int height) {
+    // CheckWeightLog(fileName, width, height);
+
+    // one buffer per thread, reused frame after frame
+    thread_local vector<char> text;
+    if (!readTextFile(fileName, text)) {
+        return false;
+    }
+    const char *p = text.data();
+    const float *end = priorityArray + (size_t)width * height;
+    while (priorityArray < end) {
+        char *next;
+        const float num = strtof(p, &next);
+        if (next == p) {
+            break;
+        }
+        *priorityArray++ = num;
+        p = next;
+    }
+    return true;
+}
+
+bool BaseEncoderTest::ReadWeights(const string &fileName,
+                                  float *priorityArray, int picWidth,
+                                  int picHeight) {
+    const int gridWidth = (weightsWidth + 15) / 16;
+    const int gridHeight = (weightsHeight + 15) / 16;
+    if (picWidth == weightsWidth && picHeight == weightsHeight) {
+        return ReadPriorityArray(fileName, priorityArray, gridWidth,
+                                 gridHeight);
+    }
+    // kept across frames, so a missing file repeats the previous map
+    thread_local vector<float> grid;
+    thread_local unique_ptr<PriorityResampler> resampler;
+    if (!resampler || !resampler->Matches(weightsWidth, weightsHeight,
+                                          picWidth, picHeight,
+                                          priorityFilter)) {
+        resampler.reset(new PriorityResampler(weightsWidth, weightsHeight,
+                                              picWidth, picHeight,
+                                              priorityFilter));
+        grid.assign((size_t)gridWidth * gridHeight, 0);
+    }
+    ReadPriorityArray(fileName, grid.data(), gridWidth, gridHeight);
+    resampler->Resample(grid.data(), priorityArray);
+    return true;
+}
+
+void splitWeightLog(const string &fileName, const string &weightsDir) {
+    ifstream weightLog(fileName.c_str());
+    string line;
+    int frameNum = 1;
+
+    while (getline(weightLog, line)) {
+        // write line to file with name: <weightsDir>/<frameNum>.txt
+        string targetFileName = weightsDir + "/" + to_string(frameNum) + ".txt";
+        fstream targetFile(targetFileName.c_str(), ios::app);
+        targetFile << line << endl;
+        if (line == "") {
+            frameNum++;
+        }
+        targetFile.close();
+    }
+
+    weightLog.close();
+}
+
+int parseInt(const string &s) {
+    assert(!s.empty());
+    int res = 0;
+    try {
+        size_t pos;
+        res = stoi(s, &pos);
+        if (pos < s.size()) {
+            cerr << "Trailing characters after number: " << s << '\n';
+        }
+    } catch (invalid_argument const &) {
+        cerr << "Invalid number: " << s << '\n';
+    } catch (out_of_range const &) {
+        cerr << "Number out of range: " << s << '\n';
+    }
+    return res;
+}
+
+float parseFloat(const string &s) {
+    assert(!s.empty());
+    float res = 0.0;
+    try {
+        size_t pos;
+        res = stof(s, &pos);
+        if (pos < s.size()) {
+            cerr << "Trailing characters after number: " << s << '\n';
+        }
+    } catch (invalid_argument const &) {
+        cerr << "Invalid number: " << s << '\n';
+    } catch (out_of_range const &) {
+        cerr << "Number out of range: " << s << '\n';
+    }
+    return res;
+}
+
+int h264ToMp4(const string h264File) {
+    const string h264FileName = h264File + h264Suffix;
+    const string mp4FileName = h264File + mp4Suffix;
+    const string ffmpegCommand = "ffmpeg -framerate " + to_string(inputFps) + " -i " + h264FileName + " -c copy " + mp4FileName;
+    int ret = system(ffmpegCommand.c_str());
+    return ret;
+}
+
+
+void fillEncParamExt(SEncParamExt &param, float targetBitrate) {
+    memset(&param, 0, sizeof(SEncParamExt));
+    param.iUsageType = EUsageType::CAMERA_VIDEO_REAL_TIME;
+    param.bSimulcastAVC = false;
+    param.iPicWidth = width;
+    param.iPicHeight = height;
+    param.fMaxFrameRate = outputFps;
+    param.iTemporalLayerNum = 1;
+    param.uiIntraPeriod = 0;
+    param.eSpsPpsIdStrategy = EParameterSetStrategy::INCREASING_ID;
+    param.bEnableFrameCroppingFlag = 1;
+    param.iEntropyCodingModeFlag = 0;
+    param.uiMaxNalSize = 0;
+    param.iComplexityMode = ECOMPLEXITY_MODE::LOW_COMPLEXITY;
+    param.iLoopFilterDisableIdc = 0;
+    param.iLoopFilterAlphaC0Offset = 0;
+    param.iLoopFilterBetaOffset = 0;
+    param.iMultipleThreadIdc = 1;
+    param.bUseLoadBalancing = true;
+    param.iRCMode = RC_BITRATE_MODE;
+    param.iTargetBitrate = 288000000;
+    param.iMaxBitrate = UNSPECIFIED_BIT_RATE;
+    param.bEnableFrameSkip = false;
+    param.iMaxQp = 51;
+    param.iMinQp = 0;
+    param.bEnableDenoise = false;
+    param.bEnableSceneChangeDetect = false;
+    param.bEnableBackgroundDetection = false;
+    param.bEnableAdaptiveQuant = false;
+    param.bEnableLongTermReference = false;
+    param.iLtrMarkPeriod = 30;
+    param.bPrefixNalAddingCtrl = false;
+    param.iSpatialLayerNum = 1;
+
+    SSpatialLayerConfig *pDLayer = &param.sSpatialLayers[0];
+    pDLayer->iVideoWidth = width;
+    pDLayer->iVideoHeight = height;
+    pDLayer->fFrameRate = outputFps;
+    pDLayer->uiProfileIdc = PRO_BASELINE;
+    pDLayer->iSpatialBitrate = (int)(targetBitrate * 1000 * 1000);
+    pDLayer->iMaxSpatialBitrate = UNSPECIFIED_BIT_RATE;
+    pDLayer->iDLayerQp = 24;
+    pDLayer->sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
+    // param.iMinQp = iMinQp;
+    // param.iMaxQp = iMaxQp;
+}
+
+string encodeConfigHash(const TestOptions &opts, const SEncParamExt &param,
+                        bool priorities) {
+    SEncParamExt p = param;
+    for (int i = 0; i < MAX_SPATIAL_LAYER_NUM; i++) {
+        p.sSpatialLayers[i].iSpatialBitrate = 0;
+    }
+    uint64_t hash = fnv1a(fnvOffset, &p, sizeof(p));
+    stringstream extra;
+    if (priorities) {
+        const FoveationModel &f = opts.foveation;
+        const SaliencyWeights &w = opts.saliencyWeights;
+        extra << opts.gazeTrace << ' ' << f.eFalloff << ' ' << f.fFoveaRadius
+              << ' ' << f.fFalloffWidth << ' ' << f.fMinPriority << ' '
+              << f.fMaxPriority << ' ' << opts.saliency << ' ' << w.fVariance
+              << ' ' << w.fEdge << ' ' << w.fTemporal << ' '
+              << opts.weightsWidth << 'x' << opts.weightsHeight << ' '
+              << opts.resample << ' ' << opts.priorityTransform << ' ';
+    }
+    // a pipe or device has no size; its name alone keys it
+    error_code ec;
+    const uintmax_t size = fs::file_size(opts.input, ec);
+    extra << opts.input << ' ' << (ec ? 0 : size);
+    const string s = extra.str();
+    hash = fnv1a(hash, s.data(), s.size());
+    char key[24];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    return key;
+}
+
+string prioritySuffix(const TestOptions &opts) {
+    if (!opts.gazeTrace.empty()) {
+        return "-gaze";
+    }
+    if (opts.saliency) {
+        return "-saliency";
+    }
+    if (!opts.prioritySocket.empty()) {
+        return "-live";
+    }
+    return "-diff";
+}
+
+PrioritySource *createPrioritySource(const TestOptions &opts, string &suffix,
+                                     const string &tag) {
+    if (!usesGeneratedPriorities(opts)) {
+        return nullptr;
+    }
+    suffix = prioritySuffix(opts);
+    if (!opts.gazeTrace.empty()) {
+        vector<GazeSample> samples;
+        if (!loadGazeTrace(opts.gazeTrace, samples)) {
+            cerr << "Cannot read gaze trace: " << opts.gazeTrace << '\n';
+            exit(1);
+        }
+        return new GazePrioritySource(samples, opts.foveation, width, height,
+                                      inputFps);
+    }
+    if (opts.saliency) {
+        return new SaliencyPrioritySource(
+            opts.saliencyWeights, width, height, opts.foveation.fMinPriority,
+            opts.foveation.fMaxPriority);
+    }
+    if (!opts.prioritySocket.empty()) {
+        const string socketPath = opts.prioritySocket + tag;
+        SocketPrioritySource *source = new SocketPrioritySource(
+            socketPath, iWidthInMb, iHeightInMb, inputFps,
+            (int64_t)(opts.priorityDeadlineMs * 1000),
+            opts.foveation.fMaxPriority);
+        if (!source->Start()) {
+            cerr << "Cannot listen on " << socketPath << '\n';
+            exit(1);
+        }
+        return source;
+    }
+    return nullptr;
+}
+
+bool usesGeneratedPriorities(const TestOptions &opts) {
+    return !opts.gazeTrace.empty() || opts.saliency ||
+           !opts.prioritySocket.empty();
+}
+
+void applyPriorityOptions(const TestOptions &opts) {
+    if (opts.weightsWidth > 0) {
+        weightsWidth = opts.weightsWidth;
+        weightsHeight = opts.weightsHeight;
+    }
+    priorityFilter = opts.resample;
+    // validated by parseOptions
+    priorityTransform.Parse(opts.priorityTransform);
+}
+
+// split weight log file into multiple files for each frame
+void prepareWeightFiles() {
+    const string weightLog = testbinDir + "weight_cut.log";
+    if (!fs::is_directory(weightsDir)) {
+        fs::create_directory(weightsDir);
+        splitWeightLog(weightLog, weightsDir);
+    }
+}
+
+bool parseOptions(int argc, char const *argv[], TestOptions &opts) {
+    for (int i = 3; i < argc; i++) {
+        const string key = argv[i];
+        if (key == "--saliency") {
+            opts.saliency = true;
+            continue;
+        }
+        if (key == "--stereo-interleave") {
+            opts.stereoInterleave = true;
+            continue;
+        }
+        if (key == "--paced") {
+            opts.paced = true;
+            continue;
+        }
+        if (key == "--pace-drop") {
+            opts.paced = opts.paceDrop = true;
+            continue;
+        }
+        if (key == "--frame-skip") {
+            opts.frameSkip = true;
+            continue;
+        }
+        if (key == "--dump-recon") {
+            opts.dumpRecon = true;
+            continue;
+        }
+        if (key == "--assert-no-alloc") {
+            opts.assertNoAlloc = true;
+            continue;
+        }
+        if (key == "--perf-counters") {
+            opts.perfCounters = true;
+            continue;
+        }
+        if (key == "--pin") {
+            opts.pin = true;
+            continue;
+        }
+        if (key == "--rtp-overhead") {
+            opts.rtpOverhead = true;
+            continue;
+        }
+        if (key == "--ladder-svc") {
+            opts.ladderSvc = true;
+            continue;
+        }
+        if (key == "--ladder-compare") {
+            opts.ladderCompare = true;
+            continue;
+        }
+        if (key == "--ladder-isolate") {
+            opts.ladderIsolate = true;
+            continue;
+        }
+        if (key == "--temporal-compare") {
+            opts.temporalCompare = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "Missing value for option: " << key << '\n';
+            return false;
+        }
+        const string value = argv[++i];
+        if (key == "--input") {
+            opts.input = value;
+        } else if (key == "--input-format") {
+            if (!parsePixelFormat(value, opts.inputFormat)) {
+                cerr << "Unknown input format: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--size") {
+            if (sscanf(value.c_str(), "%dx%d", &opts.inputWidth,
+                       &opts.inputHeight) != 2 ||
+                opts.inputWidth <= 0 || opts.inputHeight <= 0 ||
+                opts.inputWidth % 2 || opts.inputHeight % 2) {
+                cerr << "Invalid picture size: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--fps") {
+            opts.inputFps = parseFloat(value);
+        } else if (key == "--convert-threads") {
+            opts.convertThreads = parseInt(value);
+        } else if (key == "--out") {
+            opts.outFile = value;
+        } else if (key == "--submit") {
+            opts.submitSocket = value;
+        } else if (key == "--gaze") {
+            opts.gazeTrace = value;
+        } else if (key == "--falloff") {
+            if (!parseFalloff(value, opts.foveation.eFalloff)) {
+                cerr << "Unknown falloff model: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--fovea") {
+            opts.foveation.fFoveaRadius = parseFloat(value);
+        } else if (key == "--falloff-width") {
+            opts.foveation.fFalloffWidth = parseFloat(value);
+            if (!(opts.foveation.fFalloffWidth > 0)) {
+                cerr << "--falloff-width takes a positive width\n";
+                return false;
+            }
+        } else if (key == "--saliency-weights") {
+            SaliencyWeights &w = opts.saliencyWeights;
+            if (sscanf(value.c_str(), "%f:%f:%f", &w.fVariance, &w.fEdge,
+                       &w.fTemporal) != 3) {
+                cerr << "Invalid saliency weights: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--priority-socket") {
+            opts.prioritySocket = value;
+        } else if (key == "--priority-deadline-ms") {
+            opts.priorityDeadlineMs = parseFloat(value);
+        } else if (key == "--stereo") {
+            opts.stereoRight = value;
+        } else if (key == "--right-weights") {
+            opts.stereoRightWeights = value;
+        } else if (key == "--bandwidth-trace") {
+            opts.bandwidthTrace = value;
+        } else if (key == "--bw-headroom") {
+            opts.bandwidthHeadroom = parseFloat(value);
+        } else if (key == "--bw-window-ms") {
+            opts.bandwidthWindowMs = parseInt(value);
+        } else if (key == "--gop") {
+            opts.gop = parseInt(value);
+            if (opts.gop < 0) {
+                cerr << "Invalid GOP length: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--rtp") {
+            opts.rtpMtu = parseInt(value);
+        } else if (key == "--target-psnr") {
+            opts.targetPsnr = parseFloat(value);
+        } else if (key == "--target-ssim") {
+            opts.targetSsim = parseFloat(value);
+        } else if (key == "--search-tolerance") {
+            opts.searchTolerance = parseFloat(value);
+        } else if (key == "--search-subset") {
+            opts.searchSubset = parseInt(value);
+        } else if (key == "--search-max-encodes") {
+            opts.searchMaxEncodes = parseInt(value);
+        } else if (key == "--search-range") {
+            if (sscanf(value.c_str(), "%f:%f", &opts.searchMinMbps,
+                       &opts.searchMaxMbps) != 2 ||
+                opts.searchMinMbps <= 0 ||
+                opts.searchMaxMbps < opts.searchMinMbps) {
+                cerr << "Invalid search range: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--ladder") {
+            if (!parseLadder(value, opts.ladder)) {
+                cerr << "Invalid ladder: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--weights-size") {
+            if (sscanf(value.c_str(), "%dx%d", &opts.weightsWidth,
+                       &opts.weightsHeight) != 2 ||
+                opts.weightsWidth <= 0 || opts.weightsHeight <= 0) {
+                cerr << "Invalid weights size: " << value << '\n';
+                return false;
+            }
+        } else if (key == "--resample") {
+            if (!parseResampleFilter(value, opts.resample)) {
+                cerr << "--resample takes area, bilinear or max\n";
+                return false;
+            }
+        } else if (key == "--priority-transform") {
+            PriorityTransform transform;
+            if (!transform.Parse(value)) {
+                return false;
+            }
+            opts.priorityTransform = value;
+        } else if (key == "--scaling") {
+            opts.scaling = parseInt(value);
+            if (opts.scaling < 1) {
+                cerr << "--scaling takes the largest number of encoders\n";
+                return false;
+            }
+        } else if (key == "--temporal-layers") {
+            opts.temporalLayers = parseInt(value);
+            if (opts.temporalLayers < 1 ||
+                opts.temporalLayers > maxTemporalLayers) {
+                cerr << "--temporal-layers takes 1 to " << maxTemporalLayers
+                     << '\n';
+                return false;
+            }
+        } else if (key == "--priority-min") {
+            opts.foveation.fMinPriority = parseFloat(value);
+        } else if (key == "--priority-max") {
+            opts.foveation.fMaxPriority = parseFloat(value);
+        } else {
+            cerr << "Unknown option: " << key << '\n';
+            return false;
+        }
+    }
+    if (!opts.gazeTrace.empty() + opts.saliency +
+            !opts.prioritySocket.empty() >
+        1) {
+        cerr << "--gaze, --saliency and --priority-socket are mutually "
+                "exclusive\n";
+        return false;
+    }
+    if (!opts.bandwidthTrace.empty() && !opts.stereoRight.empty()) {
+        cerr << "--bandwidth-trace is not supported with --stereo\n";
+        return false;
+    }
+    if (opts.paced && !opts.stereoRight.empty()) {
+        // the eyes run in lockstep as fast as both encode
+        cerr << "--paced and --pace-drop are not supported with --stereo\n";
+        return false;
+    }
+    if (opts.rtpMtu > 0 && !opts.stereoRight.empty()) {
+        cerr << "--rtp is not supported with --stereo\n";
+        return false;
+    }
+    if (opts.dumpRecon && !opts.stereoRight.empty()) {
+        cerr << "--dump-recon is not supported with --stereo\n";
+        return false;
+    }
+    if (opts.assertNoAlloc &&
+        (!opts.stereoRight.empty() || !opts.ladder.empty() ||
+         opts.targetPsnr > 0 || opts.targetSsim > 0)) {
+        // it checks the encode loop of a single stream
+        cerr << "--assert-no-alloc does not combine with --stereo, --ladder "
+                "or a quality target\n";
+        return false;
+    }
+    if (opts.input == "-" &&
+        (!opts.stereoRight.empty() || opts.rtpOverhead ||
+         opts.targetPsnr > 0 || opts.targetSsim > 0)) {
+        // all of these read the input more than once
+        cerr << "stdin input does not combine with --stereo, --rtp-overhead "
+                "or a quality target\n";
+        return false;
+    }
+    if (opts.scaling > 0 &&
+        (opts.input == "-" || !opts.stereoRight.empty() ||
+         !opts.ladder.empty() || opts.rtpMtu > 0 || opts.paced ||
+         !opts.bandwidthTrace.empty() || !opts.prioritySocket.empty() ||
+         opts.dumpRecon || opts.assertNoAlloc || opts.targetPsnr > 0 ||
+         opts.targetSsim > 0)) {
+        // every encoder reads the input on its own and runs a plain encode
+        cerr << "--scaling needs a file input and does not combine with "
+                "--stereo, --ladder, --rtp, --paced, --bandwidth-trace, "
+                "--priority-socket, --dump-recon, --assert-no-alloc or a "
+                "quality target\n";
+        return false;
+    }
+    if (opts.rtpOverhead && opts.rtpMtu <= 0) {
+        cerr << "--rtp-overhead needs --rtp <mtu>\n";
+        return false;
+    }
+    if (opts.targetPsnr > 0 || opts.targetSsim > 0) {
+        if (opts.targetPsnr > 0 && opts.targetSsim > 0) {
+            cerr << "--target-psnr and --target-ssim are exclusive\n";
+            return false;
+        }
+        if (opts.inputFormat != pixelI420) {
+            // the quality reference is read as I420
+            cerr << "The bitrate search needs an I420 input\n";
+            return false;
+        }
+        if (!opts.stereoRight.empty() || !opts.bandwidthTrace.empty() ||
+            !opts.prioritySocket.empty()) {
+            cerr << "The bitrate search does not combine with --stereo, "
+                    "--bandwidth-trace or --priority-socket\n";
+            return false;
+        }
+    }
+    if (opts.ladder.empty() &&
+        (opts.ladderSvc || opts.ladderCompare || opts.ladderIsolate)) {
+        cerr << "--ladder-svc, --ladder-compare and --ladder-isolate need "
+                "--ladder\n";
+        return false;
+    }
+    if (!opts.ladder.empty()) {
+        if (!opts.stereoRight.empty() || opts.rtpMtu > 0 ||
+            !opts.bandwidthTrace.empty() || opts.targetPsnr > 0 ||
+            opts.targetSsim > 0 || opts.dumpRecon) {
+            cerr << "--ladder does not combine with --stereo, --rtp, "
+                    "--bandwidth-trace, --dump-recon or a quality target\n";
+            return false;
+        }
+        if ((opts.ladderCompare || opts.ladderIsolate) &&
+            (opts.input == "-" || !opts.prioritySocket.empty())) {
+            // the independent encodes read the input and maps again
+            cerr << "--ladder-compare and --ladder-isolate need a file input "
+                    "and no --priority-socket\n";
+            return false;
+        }
+    }
+    if (opts.temporalCompare && opts.temporalLayers < 2) {
+        cerr << "--temporal-compare needs --temporal-layers of 2 or more\n";
+        return false;
+    }
+    if (opts.temporalLayers > 1) {
+        if (!opts.stereoRight.empty() || !opts.ladder.empty() ||
+            opts.targetPsnr > 0 || opts.targetSsim > 0) {
+            cerr << "--temporal-layers does not combine with --stereo, "
+                    "--ladder or a quality target\n";
+            return false;
+        }
+        if (opts.temporalCompare && opts.input == "-") {
+            // the per-tier encodes read the input again
+            cerr << "--temporal-compare needs a file input\n";
+            return false;
+        }
+    }
+    if (opts.bandwidthHeadroom <= 0 || opts.bandwidthWindowMs <= 0) {
+        cerr << "--bw-headroom and --bw-window-ms must be positive\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,236 @@
+#ifndef __HARNESS_H__
+#define __HARNESS_H__
+
+#include <wels/codec_api.h>
+#include <wels/codec_app_def.h>
+#include <wels/codec_def.h>
+#include <wels/utils/BufferedData.h>
+#include <wels/utils/InputStream.h>
+
+#include "bitrate_trace.h"
+#include "bitstream_index.h"
+#include "color_convert.h"
+#include "input_source.h"
+#include "gaze_priority.h"
+#include "memory_stats.h"
+#include "pacer.h"
+#include "perf_counters.h"
+#include "priority_resample.h"
+#include "priority_source.h"
+#include "priority_transform.h"
+#include "saliency_priority.h"
+#include "topology.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+extern const std::string testbinDir;
+extern const std::string weightsDir;
+extern const std::string inputFileName;
+extern const std::string h264Suffix;
+extern const std::string mp4Suffix;
+
+// geometry of the input; the defaults describe cut.yuv, a Y4M header or
+// --size/--fps replace them through setInputGeometry before encoding
+extern int width;
+extern int height;
+extern float inputFps;
+extern float outputFps;
+extern int iWidthInMb;
+extern int iHeightInMb;
+extern int iArraySize;
+
+void setInputGeometry(const InputGeometry &geometry);
+
+// picture size weights/<n>.txt were made for, cut.yuv unless --weights-size
+// says otherwise; maps are resampled from it to the size being encoded
+extern int weightsWidth;
+extern int weightsHeight;
+// how priority maps are fitted to another picture size
+extern ResampleFilter priorityFilter;
+// --priority-transform, copied by every encode for its own state
+extern PriorityTransform priorityTransform;
+
+extern int isDiffEncoding;
+
+// optional flags following the positional <isDiffEncoding> <bitrate>
+struct TestOptions {
+    std::string input = inputFileName;
+    PixelFormat inputFormat = pixelI420;
+    int inputWidth = 0;  ///< --size of raw input, 0 keeps the default
+    int inputHeight = 0;
+    float inputFps = 0;  ///< --fps of raw input
+    int convertThreads = 0; ///< 0: one per hardware thread, up to 8
+    std::string outFile; ///< output path without suffix, empty for default
+    std::string submitSocket;
+    std::string gazeTrace;
+    FoveationModel foveation;
+    bool saliency = false;
+    SaliencyWeights saliencyWeights;
+    std::string prioritySocket;
+    float priorityDeadlineMs = 4;
+    std::string stereoRight;
+    std::string stereoRightWeights;
+    bool stereoInterleave = false;
+    bool paced = false;
+    bool paceDrop = false;
+    bool frameSkip = false;
+    int gop = 0; ///< IDR period in frames, 0: only the first frame
+    std::string bandwidthTrace;
+    float bandwidthHeadroom = 1.0f;
+    int bandwidthWindowMs = 1000;
+    bool dumpRecon = false;
+    bool assertNoAlloc = false; ///< fail when steady-state frames allocate
+    bool perfCounters = false;  ///< time and count the pipeline stages
+    bool pin = false; ///< place concurrent encoders with planPlacements
+    int weightsWidth = 0; ///< --weights-size, 0 keeps the default
+    int weightsHeight = 0;
+    ResampleFilter resample = resampleArea;
+    std::string priorityTransform; ///< chain applied to every map
+    int scaling = 0;  ///< benchmark 1 to this many concurrent encoders
+    int rtpMtu = 0;
+    bool rtpOverhead = false;
+    float targetPsnr = 0;
+    float targetSsim = 0;
+    float searchTolerance = 0; ///< 0: 0.1 dB PSNR / 0.002 SSIM
+    int searchSubset = 0;      ///< frames of the coarse pass, 0 = none
+    int searchMaxEncodes = 8;  ///< per configuration and pass
+    float searchMinMbps = 0.25f;
+    float searchMaxMbps = 64;
+    std::vector<float> ladder; ///< --ladder scales of the spatial layers
+    bool ladderSvc = false;    ///< one SVC stream instead of simulcast
+    bool ladderCompare = false;
+    bool ladderIsolate = false; ///< independent encodes in child processes
+    int temporalLayers = 1; ///< dyadic temporal layers of the encode
+    bool temporalCompare = false;
+};
+
+class BaseEncoderTest {
+  public:
+    struct Callback {
+        virtual ~Callback() {}
+        virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                                   const std::string &outFileName) = 0;
+        // bracket every EncodeFrame call, including skipped frames
+        virtual void onFrameStart(int frameNum) {}
+        virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        }
+        // after the last frame of an EncodeStream call
+        virtual void onStreamDone() {}
+    };
+
+    BaseEncoderTest();
+    void SetUp();
+    void TearDown();
+    // opens fileName with openInput; its geometry must match pEncParamExt
+    void EncodeFile(const char *fileName, SEncParamExt *pEncParamExt,
+                    Callback *cbk, const std::string &outFileName);
+    // EncodeStream into a fresh outFileName
+    void EncodeInput(InputStream *in, SEncParamExt *pEncParamExt,
+                     Callback *cbk, const std::string &outFileName);
+    void EncodeStream(InputStream *in, SEncParamExt *pEncParamExt,
+                      Callback *cbk, const std::string &outFileName);
+    void CheckWeightLog(const std::string &fileName, int width, int height);
+    // false, leaving priorityArray as it was, when the file is missing
+    static bool ReadPriorityArray(const std::string &fileName,
+                                  float *priorityArray, int width,
+                                  int height);
+    // a weights file, resampled with priorityFilter onto the macroblock
+    // grid of a picWidth x picHeight picture; allocates only when a thread
+    // first reads for a new picture size. false when priorityArray was
+    // left as it was.
+    static bool ReadWeights(const std::string &fileName, float *priorityArray,
+                            int picWidth, int picHeight);
+
+    ISVCEncoder *encoder_;
+    // generates priorities in-process instead of reading weights/<n>.txt
+    PrioritySource *prioritySource_;
+    // directory holding weights/<n>.txt, the right eye has its own in stereo
+    std::string weightsDir_;
+    // encode with priority maps; defaults to the global isDiffEncoding
+    bool diffEncoding_;
+    // feeds frames on the wall-clock schedule instead of as fast as read
+    FramePacer *pacer_;
+    // retargets rate control from a bandwidth trace while encoding
+    BitrateController *bitrateController_;
+    // charges heap allocations and RSS to the frames of the encode
+    AllocTracker *allocTracker_;
+    // hardware counters and wall time of the stages of every frame
+    StageProfiler *profiler_;
+    // applied to the prefetch thread; the caller places its own thread
+    // before SetUp so that the encoder and its buffers are node-local
+    const CpuPlacement *placement_;
+    // priorityTransform with the temporal state of this encode
+    PriorityTransform transform_;
+    // stop after this many frames, 0 encodes the whole input
+    int maxFrames_;
+    // skip the frames before this one, resuming an interrupted encode;
+    // it must start a GOP
+    int startFrame_;
+    // encoder reconstruction of the base layer (ENCODER_OPTION_DUMP_FILE)
+    std::string reconFile_;
+    // raw frame layout of the input, converted to I420 while reading
+    PixelFormat inputFormat_;
+    int convertThreads_;
+
+  private:
+};
+
+// Appends the bitstream to outFileName and writes its sidecar index
+// (<outFileName>.idx) alongside. Both stay open until the stream is done.
+// Subclasses overriding onFrameStart must chain to it.
+struct TestCallback : public BaseEncoderTest::Callback {
+    TestCallback() : fp_(nullptr), offset_(0), frameNum_(0) {}
+    virtual ~TestCallback() { onStreamDone(); }
+    virtual void onFrameStart(int frameNum) { frameNum_ = frameNum; }
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const std::string &outFileName);
+    virtual void onStreamDone();
+    // hands the bitstream and its sidecar to the OS, so they outlive a
+    // crash of the process
+    bool Flush();
+    // flushes the bitstream and its sidecar to the disk
+    bool Sync();
+    // bytes of the current output, where the next frame goes
+    uint64_t StreamOffset() const { return offset_; }
+
+  private:
+    FILE *fp_;
+    std::string fileName_;
+    uint64_t offset_; ///< bytes in the file, where the next frame goes
+    int frameNum_;
+    BitstreamIndexWriter index_;
+};
+
+bool fileExists(const std::string &name);
+int countFiles(const std::filesystem::path &dir);
+void splitWeightLog(const std::string &fileName,
+                    const std::string &weightsDir);
+int parseInt(const std::string &s);
+float parseFloat(const std::string &s);
+int h264ToMp4(const std::string h264File);
+
+// parses the flags following <isDiffEncoding> <bitrate>
+bool parseOptions(int argc, char const *argv[], TestOptions &opts);
+bool usesGeneratedPriorities(const TestOptions &opts);
+void prepareWeightFiles();
+// --weights-size, --resample and --priority-transform, for every map read,
+// resampled or encoded later
+void applyPriorityOptions(const TestOptions &opts);
+
+void fillEncParamExt(SEncParamExt &param, float targetBitrate);
+// hex digest of everything besides the bitrate that changes what an encode
+// produces; priorities adds the options shaping the priority maps
+std::string encodeConfigHash(const TestOptions &opts,
+                             const SEncParamExt &param, bool priorities);
+// output name suffix of priority-map encodes: -gaze, -saliency, -live, or
+// -diff for weights/<n>.txt; creates nothing
+std::string prioritySuffix(const TestOptions &opts);
+// in-process priority source selected by the options, nullptr when the maps
+// come from weights/<n>.txt; tag distinguishes concurrent instances
+PrioritySource *createPrioritySource(const TestOptions &opts,
+                                     std::string &suffix,
+                                     const std::string &tag = "");
+
+#endif //__HARNESS_H__
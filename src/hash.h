@@ -0,0 +1,18 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint64_t fnvOffset = 0xcbf29ce484222325ULL;
+
+// 64-bit FNV-1a, chainable by passing the previous result as hash
+inline uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#endif //__HASH_H__
@@ -0,0 +1,230 @@
+#include "input_source.h"
+#include "frame_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+FdInputStream::FdInputStream() : fd_(-1), owned_(false), pendingPos_(0) {}
+
+FdInputStream::~FdInputStream() {
+    if (owned_ && fd_ >= 0) {
+#ifdef _WIN32
+        _close(fd_);
+#else
+        close(fd_);
+#endif
+    }
+}
+
+bool FdInputStream::Open(const string &name) {
+    if (name == "-") {
+#ifdef _WIN32
+        fd_ = _fileno(stdin);
+        _setmode(fd_, _O_BINARY);
+#else
+        fd_ = STDIN_FILENO;
+#endif
+        owned_ = false;
+    } else {
+#ifdef _WIN32
+        fd_ = _open(name.c_str(), _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#else
+        fd_ = open(name.c_str(), O_RDONLY);
+#endif
+        owned_ = true;
+    }
+    if (fd_ < 0) {
+        return false;
+    }
+#if defined(F_SETPIPE_SZ)
+    // fewer wakeups per frame when a capture tool writes into a pipe; a
+    // regular file rejects this
+    fcntl(fd_, F_SETPIPE_SZ, 1 << 20);
+#endif
+    return true;
+}
+
+size_t FdInputStream::ReadFd(uint8_t *ptr, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+#ifdef _WIN32
+        const int n =
+            _read(fd_, ptr + got, (unsigned)min(len - got, (size_t)1 << 30));
+#else
+        const ssize_t n = ::read(fd_, ptr + got, len - got);
+#endif
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+int FdInputStream::read(void *ptr, size_t len) {
+    uint8_t *dst = (uint8_t *)ptr;
+    size_t got = 0;
+    if (pendingPos_ < pending_.size()) {
+        got = min(len, pending_.size() - pendingPos_);
+        memcpy(dst, pending_.data() + pendingPos_, got);
+        pendingPos_ += got;
+    }
+    got += ReadFd(dst + got, len - got);
+    return (int)got;
+}
+
+size_t FdInputStream::Peek(void *ptr, size_t len) {
+    // only used on a fresh stream, before anything is read
+    pending_.resize(len);
+    pending_.resize(ReadFd(pending_.data(), len));
+    pendingPos_ = 0;
+    memcpy(ptr, pending_.data(), pending_.size());
+    return pending_.size();
+}
+
+bool FdInputStream::ReadLine(string &line, size_t maxLen) {
+    line.clear();
+    char c;
+    while (read(&c, 1) == 1) {
+        if (c == '\n') {
+            return true;
+        }
+        if (line.size() >= maxLen) {
+            return false;
+        }
+        line.push_back(c);
+    }
+    return false;
+}
+
+Y4mInputStream::Y4mInputStream(unique_ptr<FdInputStream> in)
+    : in_(move(in)), frameSize_(0) {}
+
+bool Y4mInputStream::ReadHeader(InputGeometry &geometry) {
+    string header;
+    if (!in_->ReadLine(header, 4096) || header.compare(0, 9, "YUV4MPEG2")) {
+        cerr << "Not a Y4M stream\n";
+        return false;
+    }
+    int w = 0, h = 0, rateNum = 0, rateDen = 1;
+    string colorspace = "420jpeg";
+    size_t pos = 9;
+    while (pos < header.size()) {
+        const size_t end = min(header.find(' ', pos + 1), header.size());
+        const string param = header.substr(pos + 1, end - pos - 1);
+        pos = end;
+        if (param.empty()) {
+            continue;
+        }
+        switch (param[0]) {
+        case 'W':
+            w = atoi(param.c_str() + 1);
+            break;
+        case 'H':
+            h = atoi(param.c_str() + 1);
+            break;
+        case 'F':
+            if (sscanf(param.c_str() + 1, "%d:%d", &rateNum, &rateDen) != 2) {
+                rateNum = 0;
+            }
+            break;
+        case 'C':
+            colorspace = param.substr(1);
+            break;
+        case 'I':
+            if (param != "Ip" && param != "I?") {
+                cerr << "Interlaced Y4M is encoded as progressive frames\n";
+            }
+            break;
+        default:
+            break; // aspect ratio and X extensions do not matter
+        }
+    }
+    // 4:2:0 chroma siting variants share the I420 layout
+    if (colorspace != "420" && colorspace != "420jpeg" &&
+        colorspace != "420paldv" && colorspace != "420mpeg2") {
+        cerr << "Unsupported Y4M colorspace C" << colorspace
+             << ", only 8-bit 4:2:0\n";
+        return false;
+    }
+    if (w <= 0 || h <= 0 || w % 2 || h % 2) {
+        cerr << "Invalid Y4M picture size " << w << "x" << h << '\n';
+        return false;
+    }
+    geometry.iWidth = w;
+    geometry.iHeight = h;
+    if (rateNum > 0 && rateDen > 0) {
+        geometry.fFps = (float)rateNum / rateDen;
+    }
+    frameSize_ = (size_t)w * h * 3 / 2;
+    return true;
+}
+
+int Y4mInputStream::read(void *ptr, size_t len) {
+    if (len != frameSize_) {
+        cerr << "Y4M frames are " << frameSize_ << " bytes, asked for " << len
+             << '\n';
+        return 0;
+    }
+    // FRAME and optional parameters
+    if (!in_->ReadLine(line_, 1024) || line_.compare(0, 5, "FRAME")) {
+        return 0;
+    }
+    return in_->read(ptr, len);
+}
+
+unique_ptr<InputStream> openInput(const string &name, PixelFormat format,
+                                  InputGeometry &geometry, int threads) {
+    unique_ptr<FdInputStream> in(new FdInputStream());
+    if (!in->Open(name)) {
+        cerr << "Cannot open input " << name << '\n';
+        return nullptr;
+    }
+    char magic[10];
+    const size_t peeked = in->Peek(magic, sizeof(magic));
+    if (peeked == sizeof(magic) &&
+        memcmp(magic, "YUV4MPEG2 ", sizeof(magic)) == 0) {
+        if (format != pixelI420) {
+            cerr << "Y4M input carries I420 frames, drop --input-format\n";
+            return nullptr;
+        }
+        unique_ptr<Y4mInputStream> y4m(new Y4mInputStream(move(in)));
+        if (!y4m->ReadHeader(geometry)) {
+            return nullptr;
+        }
+        return y4m;
+    }
+    if (peeked >= 4 && memcmp(magic, &frameStoreMagic, 4) == 0) {
+        if (name == "-") {
+            cerr << "Frame stores are memory mapped, they cannot be piped\n";
+            return nullptr;
+        }
+        if (format != pixelI420) {
+            cerr << "Frame stores carry I420 frames, drop --input-format\n";
+            return nullptr;
+        }
+        if (threads <= 0) {
+            threads = min(8, max(1, (int)thread::hardware_concurrency()));
+        }
+        unique_ptr<FrameStoreInputStream> store(
+            new FrameStoreInputStream(threads));
+        if (!store->Open(name, geometry)) {
+            return nullptr;
+        }
+        return store;
+    }
+    return in;
+}
@@ -0,0 +1,72 @@
+#ifndef __INPUT_SOURCE_H__
+#define __INPUT_SOURCE_H__
+
+#include <wels/utils/InputStream.h>
+
+#include "color_convert.h"
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Picture size and rate of an input, from the command line for raw frames
+// or from the stream header for Y4M.
+struct InputGeometry {
+    int iWidth;
+    int iHeight;
+    float fFps;
+};
+
+// Unbuffered reads from a file descriptor, straight into the caller's
+// buffer. "-" is stdin; pipes and FIFOs are read until the request is
+// filled, so a frame never comes back split.
+class FdInputStream : public InputStream {
+  public:
+    FdInputStream();
+    ~FdInputStream();
+    FdInputStream(const FdInputStream &) = delete;
+    FdInputStream &operator=(const FdInputStream &) = delete;
+
+    bool Open(const std::string &name);
+    int read(void *ptr, size_t len);
+    // reads up to len bytes that the next reads return again
+    size_t Peek(void *ptr, size_t len);
+    // one '\n' terminated line without the '\n'; false at the end or
+    // when it is longer than maxLen
+    bool ReadLine(std::string &line, size_t maxLen);
+
+  private:
+    size_t ReadFd(uint8_t *ptr, size_t len);
+
+    int fd_;
+    bool owned_;
+    std::vector<uint8_t> pending_; ///< peeked bytes not yet read
+    size_t pendingPos_;
+};
+
+// YUV4MPEG2 with 8-bit 4:2:0 frames; every read returns one I420 frame.
+class Y4mInputStream : public InputStream {
+  public:
+    explicit Y4mInputStream(std::unique_ptr<FdInputStream> in);
+    // parses the stream header; fills geometry
+    bool ReadHeader(InputGeometry &geometry);
+    int read(void *ptr, size_t len);
+
+  private:
+    std::unique_ptr<FdInputStream> in_;
+    size_t frameSize_;
+    std::string line_;
+};
+
+// Opens a file, FIFO or "-" for stdin. A Y4M stream or frame store
+// (recognized by their signatures) replaces geometry with the one in its
+// header; raw frames keep the geometry passed in. threads decompress a
+// frame store, 0 picks up to 8. Null, with the reason printed, on failure.
+std::unique_ptr<InputStream> openInput(const std::string &name,
+                                       PixelFormat format,
+                                       InputGeometry &geometry,
+                                       int threads = 0);
+
+#endif //__INPUT_SOURCE_H__
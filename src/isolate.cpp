@@ -0,0 +1,365 @@
+#include "isolate.h"
+#include "harness.h"
+#include "process_util.h"
+#include "scaler.h"
+#include "timing.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+size_t alignUp(size_t n) { return (n + 63) & ~(size_t)63; }
+
+// The parts of a mapped ring; frame and map sizes follow the geometry
+// globals, which both sides set from the header.
+struct RingView {
+    explicit RingView(void *base)
+        : hdr((IsolateRingHeader *)base),
+          children((IsolatedChild *)((uint8_t *)base +
+                                     alignUp(sizeof(IsolateRingHeader)))),
+          slots((uint8_t *)children +
+                alignUp(sizeof(IsolatedChild) * hdr->uiChildren)) {}
+
+    static size_t Size(int children, size_t slotSize) {
+        return alignUp(sizeof(IsolateRingHeader)) +
+               alignUp(sizeof(IsolatedChild) * children) +
+               slotSize * isolateRingSlots;
+    }
+    static size_t SlotSize() {
+        return alignUp((size_t)width * height * 3 / 2) +
+               alignUp(sizeof(float) * iArraySize);
+    }
+
+    uint8_t *Frame(int frameNum) const {
+        return slots + hdr->uiSlotSize * ((frameNum - 1) % isolateRingSlots);
+    }
+    float *Map(int frameNum) const {
+        return (float *)(Frame(frameNum) +
+                         alignUp((size_t)width * height * 3 / 2));
+    }
+
+    IsolateRingHeader *hdr;
+    IsolatedChild *children;
+    uint8_t *slots;
+};
+
+// Polls until ready(): the ring is shared across processes, so there is
+// nothing to block on. False when the supervisor aborted or, seen from a
+// child, exited.
+template <typename Ready>
+bool waitForRing(const IsolateRingHeader &hdr, Ready ready) {
+    const bool child = hdr.iSupervisor != currentProcessId();
+    for (int spins = 0; !ready(); spins++) {
+        if (hdr.bAbort ||
+            (child && spins % 8192 == 8191 && !processAlive(hdr.iSupervisor))) {
+            return false;
+        }
+        if (spins < 64) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    }
+    return true;
+}
+
+// the frame every running child has encoded, so its slot and the ones
+// before it are free
+int oldestDone(const RingView &ring) {
+    int oldest = INT_MAX;
+    for (int c = 0; c < ring.hdr->uiChildren; c++) {
+        const IsolatedChild &child = ring.children[c];
+        if (child.iState == isolatedRunning) {
+            oldest = min(oldest, (int)child.iDone);
+        }
+    }
+    return oldest;
+}
+
+// Frames of the ring scaled to the encode's size. Frames before first
+// read as nothing, for the skipping of BaseEncoderTest::startFrame_.
+class RingInputStream : public InputStream {
+  public:
+    RingInputStream(const RingView &ring, int first, int dstWidth,
+                    int dstHeight)
+        : ring_(ring), first_(first), next_(1) {
+        if (dstWidth != width || dstHeight != height) {
+            scaler_.reset(new FrameScaler(width, height, dstWidth, dstHeight));
+        }
+    }
+
+    int read(void *ptr, size_t len) {
+        const int frameNum = next_++;
+        if (frameNum < first_) {
+            return (int)len;
+        }
+        const IsolateRingHeader &hdr = *ring_.hdr;
+        if (!waitForRing(hdr, [&] {
+                return hdr.iProduced >= frameNum || hdr.bEnd;
+            }) ||
+            hdr.iProduced < frameNum) {
+            return 0;
+        }
+        const uint8_t *src = ring_.Frame(frameNum);
+        if (scaler_) {
+            scaler_->ScaleRows(src, (uint8_t *)ptr, 0, scaler_->DstHeight(),
+                               tmp_);
+        } else {
+            memcpy(ptr, src, len);
+        }
+        return (int)len;
+    }
+
+  private:
+    RingView ring_;
+    int first_;
+    int next_;
+    unique_ptr<FrameScaler> scaler_;
+    vector<uint8_t> tmp_;
+};
+
+// the map of the full-size frame in the ring, resampled to the picture
+class RingPrioritySource : public PrioritySource {
+  public:
+    explicit RingPrioritySource(const RingView &ring) : ring_(ring) {}
+
+    virtual bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                                   float *priorityArray) {
+        if (!resampler_) {
+            // the picture size is only known here; the first frame is
+            // warm-up anyway
+            resampler_.reset(new PriorityResampler(
+                width, height, pic.iPicWidth, pic.iPicHeight, priorityFilter));
+        }
+        resampler_->Resample(ring_.Map(frameNum), priorityArray);
+        return true;
+    }
+
+  private:
+    RingView ring_;
+    unique_ptr<PriorityResampler> resampler_;
+};
+
+// Publishes every frame once the stream holds it, so a restart can cut the
+// stream back to it.
+struct IsolatedCallback : public TestCallback {
+    explicit IsolatedCallback(IsolatedChild &child) : child_(child) {}
+
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        if (!Flush()) {
+            cerr << "Cannot write " << child_.szOutFile << '\n';
+            exit(1);
+        }
+        // 0 until this process writes, a skipped frame adds nothing
+        if (StreamOffset()) {
+            child_.uiOffset = StreamOffset();
+        }
+        child_.iDone = frameNum;
+    }
+
+    IsolatedChild &child_;
+};
+
+// Starts child index and restarts it after a crash until it finishes or
+// runs out of restarts.
+void superviseChild(const RingView &ring, const string &ringName, int index) {
+    IsolatedChild &child = ring.children[index];
+    const string exe = currentExecutable();
+    while (true) {
+        ProcessHandle process = spawnProcess(
+            {exe, "--isolated-encoder", ringName, to_string(index)});
+        const int code = process != invalidProcess ? waitProcess(process) : -1;
+        if (code == 0 && child.iState == isolatedFinished) {
+            return;
+        }
+        if (process == invalidProcess || child.iState == isolatedFailed ||
+            child.iRestarts >= maxIsolatedRestarts || ring.hdr->bAbort) {
+            cerr << "Giving up on " << child.szOutFile << " after "
+                 << child.iRestarts << " restarts\n";
+            child.iState = isolatedFailed;
+            return;
+        }
+        child.iRestarts++;
+        cerr << "Encoder of " << child.szOutFile << " exited with " << code
+             << ", restarting after frame " << child.iDone << '\n';
+    }
+}
+
+} // namespace
+
+bool runIsolatedEncodes(const vector<IsolatedEncode> &encodes,
+                        InputStream *input, PrioritySource *source,
+                        vector<IsolatedResult> &results) {
+    results.assign(encodes.size(), IsolatedResult());
+    const size_t slotSize = RingView::SlotSize();
+    const string ringName =
+        "openh264_test-ring-" + to_string(currentProcessId());
+    SharedMemory shm;
+    if (encodes.empty() || encodes.size() > UINT16_MAX ||
+        !shm.Create(ringName, RingView::Size((int)encodes.size(), slotSize))) {
+        cerr << "Cannot create the shared frame ring " << ringName << '\n';
+        return false;
+    }
+    // zero-filled, which is what the atomics start at as well
+    IsolateRingHeader *hdr = new (shm.Data()) IsolateRingHeader();
+    hdr->uiMagic = isolateRingMagic;
+    hdr->uiVersion = isolateRingVersion;
+    hdr->uiChildren = (uint16_t)encodes.size();
+    hdr->iWidth = width;
+    hdr->iHeight = height;
+    hdr->fFps = inputFps;
+    hdr->bDiff = isDiffEncoding;
+    hdr->iFilter = priorityFilter;
+    if (priorityTransform.Spec().size() >= sizeof(hdr->szTransform)) {
+        cerr << "Priority transform too long: " << priorityTransform.Spec()
+             << '\n';
+        return false;
+    }
+    strcpy(hdr->szTransform, priorityTransform.Spec().c_str());
+    hdr->iSupervisor = currentProcessId();
+    hdr->uiSlotSize = slotSize;
+    RingView ring(shm.Data());
+    for (size_t c = 0; c < encodes.size(); c++) {
+        IsolatedChild *child = new (&ring.children[c]) IsolatedChild();
+        child->sParam = encodes[c].sParam;
+        if (encodes[c].sOutFile.size() >= sizeof(child->szOutFile)) {
+            cerr << "Output path too long: " << encodes[c].sOutFile << '\n';
+            return false;
+        }
+        strcpy(child->szOutFile, encodes[c].sOutFile.c_str());
+        remove(child->szOutFile);
+        remove((encodes[c].sOutFile + bitstreamIndexSuffix).c_str());
+    }
+
+    vector<thread> supervisors;
+    for (size_t c = 0; c < encodes.size(); c++) {
+        supervisors.emplace_back(superviseChild, cref(ring), cref(ringName),
+                                 (int)c);
+    }
+
+    const size_t frameSize = (size_t)width * height * 3 / 2;
+    SSourcePicture pic;
+    memset(&pic, 0, sizeof(pic));
+    pic.iPicWidth = width;
+    pic.iPicHeight = height;
+    pic.iColorFormat = videoFormatI420;
+    pic.iStride[0] = width;
+    pic.iStride[1] = pic.iStride[2] = width / 2;
+    bool ok = true;
+    for (int frameNum = 1;; frameNum++) {
+        // the slot held frameNum - isolateRingSlots
+        waitForRing(*hdr, [&] {
+            return oldestDone(ring) >= frameNum - isolateRingSlots;
+        });
+        uint8_t *frame = ring.Frame(frameNum);
+        size_t got = 0;
+        while (got < frameSize) {
+            const int n = input->read(frame + got, frameSize - got);
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        if (got < frameSize) {
+            break;
+        }
+        if (hdr->bDiff) {
+            float *map = ring.Map(frameNum);
+            if (source) {
+                pic.pData[0] = frame;
+                pic.pData[1] = frame + (size_t)width * height;
+                pic.pData[2] = pic.pData[1] + (size_t)width * height / 4;
+                if (!source->fillPriorityArray(frameNum, pic, map)) {
+                    cerr << "No priorities for frame " << frameNum << '\n';
+                    ok = false;
+                    hdr->bAbort = 1;
+                    break;
+                }
+            } else {
+                BaseEncoderTest::ReadWeights(
+                    weightsDir + "/" + to_string(frameNum) + ".txt", map,
+                    width, height);
+            }
+        }
+        hdr->iProduced = frameNum;
+    }
+    hdr->bEnd = 1;
+    for (thread &t : supervisors) {
+        t.join();
+    }
+
+    for (size_t c = 0; c < encodes.size(); c++) {
+        const IsolatedChild &child = ring.children[c];
+        IsolatedResult &r = results[c];
+        r.bOk = ok && child.iState == isolatedFinished;
+        r.iFrames = child.iDone;
+        r.iBytes = (int64_t)child.uiOffset;
+        r.iRestarts = child.iRestarts;
+        r.iCpuUs = child.iCpuUs;
+    }
+    return ok;
+}
+
+int runIsolatedEncoder(const string &ringName, int index) {
+    SharedMemory shm;
+    if (!shm.Open(ringName) || shm.Size() < sizeof(IsolateRingHeader)) {
+        cerr << "No frame ring " << ringName << '\n';
+        return 1;
+    }
+    const IsolateRingHeader &hdr = *(const IsolateRingHeader *)shm.Data();
+    if (hdr.uiMagic != isolateRingMagic ||
+        hdr.uiVersion != isolateRingVersion || index < 0 ||
+        index >= hdr.uiChildren) {
+        cerr << "Not a frame ring or no encoder " << index << ": " << ringName
+             << '\n';
+        return 1;
+    }
+    InputGeometry geometry = {hdr.iWidth, hdr.iHeight, hdr.fFps};
+    setInputGeometry(geometry);
+    isDiffEncoding = hdr.bDiff;
+    priorityFilter = (ResampleFilter)hdr.iFilter;
+    priorityTransform.Parse(hdr.szTransform);
+    RingView ring(shm.Data());
+    IsolatedChild &child = ring.children[index];
+    const string outFile = child.szOutFile;
+
+    // a restart continues after the last frame the stream holds
+    const int first = child.iDone + 1;
+    if (first > 1 && !truncateBitstream(outFile, child.uiOffset)) {
+        cerr << "Cannot cut " << outFile << " back to frame " << child.iDone
+             << '\n';
+        child.iState = isolatedFailed;
+        return 1;
+    }
+    if (first == 1) {
+        remove(outFile.c_str());
+        remove((outFile + bitstreamIndexSuffix).c_str());
+    }
+
+    SEncParamExt param = child.sParam;
+    RingInputStream in(ring, first, param.iPicWidth, param.iPicHeight);
+    RingPrioritySource priorities(ring);
+    IsolatedCallback cbk(child);
+    BaseEncoderTest test;
+    test.prioritySource_ = &priorities;
+    test.startFrame_ = first;
+    const int64_t startCpuUs = processCpuUs();
+    test.SetUp();
+    test.EncodeStream(&in, &param, &cbk, outFile);
+    test.TearDown();
+    if (hdr.bAbort || !hdr.bEnd || child.iDone != hdr.iProduced) {
+        // the ring ended early, or the supervisor went away
+        return 1;
+    }
+    child.iCpuUs += processCpuUs() - startCpuUs;
+    child.iState = isolatedFinished;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef __ISOLATE_H__
+#define __ISOLATE_H__
+
+#include <wels/codec_api.h>
+#include <wels/utils/InputStream.h>
+
+#include "priority_source.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Encoders in child processes of a supervisor, fed from a shared-memory
+// ring of source frames and priority maps. The supervisor reads and
+// converts the input once and computes every map once; each child scales
+// its frames and resamples its maps straight out of the ring. A ring slot
+// is reused once every live child has encoded its frame, so a child that
+// crashes finds the frames after its last finished one still there: it is
+// restarted at that frame with a fresh encoder (starting an IDR), after
+// its stream is cut back to that frame, and the other children go on.
+
+const uint32_t isolateRingMagic = 0x474e4952; // "RING"
+const uint16_t isolateRingVersion = 3;
+const int isolateRingSlots = 8;
+const int maxIsolatedRestarts = 3;
+
+enum IsolatedChildState : int32_t {
+    isolatedRunning = 0,
+    isolatedFinished = 1,
+    isolatedFailed = 2, ///< crashed more than maxIsolatedRestarts times
+};
+
+// One encoder. The supervisor fills it before starting the child; the
+// child publishes its progress after every frame.
+struct IsolatedChild {
+    SEncParamExt sParam; ///< picture size and bitrate of this encode
+    char szOutFile[512]; ///< stream path with suffix
+    std::atomic<int32_t> iDone;       ///< last frame in the stream, 0: none
+    std::atomic<uint64_t> uiOffset;   ///< stream bytes up to iDone
+    std::atomic<int32_t> iState;      ///< IsolatedChildState
+    std::atomic<int64_t> iCpuUs;      ///< CPU time of finished processes
+    int32_t iRestarts;
+};
+
+// Shared layout: this header, uiChildren IsolatedChild, then
+// isolateRingSlots slots of one I420 frame and one priority map each,
+// every part 64-byte aligned. Frame n (1-based) is in slot
+// (n - 1) % isolateRingSlots.
+struct IsolateRingHeader {
+    uint32_t uiMagic;
+    uint16_t uiVersion;
+    uint16_t uiChildren;
+    int32_t iWidth;
+    int32_t iHeight;
+    float fFps;
+    int32_t bDiff;       ///< slots carry priority maps
+    int32_t iFilter;     ///< ResampleFilter fitting them to each encode
+    char szTransform[256]; ///< PriorityTransform spec applied after that
+    int32_t iSupervisor; ///< process id; children stop once it is gone
+    uint64_t uiSlotSize;
+    std::atomic<int32_t> iProduced; ///< frames in the ring so far
+    std::atomic<int32_t> bEnd;      ///< iProduced is the last frame
+    std::atomic<int32_t> bAbort;    ///< the supervisor gave up
+};
+static_assert(std::atomic<int64_t>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "ring counters must work across processes");
+
+struct IsolatedEncode {
+    SEncParamExt sParam;
+    std::string sOutFile; ///< stream path with suffix
+};
+
+struct IsolatedResult {
+    bool bOk = false;
+    int iFrames = 0;
+    int64_t iBytes = 0;
+    int iRestarts = 0;
+    int64_t iCpuUs = 0; ///< of the child processes that finished
+};
+
+// Runs encodes in child processes until input ends. source fills the
+// priority maps when the global isDiffEncoding is set, weights/<n>.txt
+// when it is null. Results are per encode; false when the ring or the
+// children could not be set up.
+bool runIsolatedEncodes(const std::vector<IsolatedEncode> &encodes,
+                        InputStream *input, PrioritySource *source,
+                        std::vector<IsolatedResult> &results);
+
+// The child side: `--isolated-encoder <ring> <index>`, started by
+// runIsolatedEncodes and not meant to be run by hand.
+int runIsolatedEncoder(const std::string &ringName, int index);
+
+#endif //__ISOLATE_H__
@@ -0,0 +1,517 @@
+#include "ladder.h"
+#include "isolate.h"
+#include "scaler.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+struct LadderRung {
+    int iWidth;
+    int iHeight;
+    int iBitrate;
+    string name; ///< output path without suffix
+};
+
+// smallest first, the order openh264 numbers spatial layers in; the
+// bitrate of the top layer is spread by picture area
+vector<LadderRung> makeRungs(const vector<float> &scales, int topBitrate) {
+    vector<LadderRung> rungs;
+    for (auto it = scales.rbegin(); it != scales.rend(); ++it) {
+        LadderRung rung;
+        rung.iWidth = max(16, (int)lround(width * *it / 2) * 2);
+        rung.iHeight = max(16, (int)lround(height * *it / 2) * 2);
+        rung.iBitrate = (int)((double)topBitrate * rung.iWidth *
+                              rung.iHeight / ((double)width * height));
+        rungs.push_back(rung);
+    }
+    return rungs;
+}
+
+string rungSize(const LadderRung &rung) {
+    return to_string(rung.iWidth) + "x" + to_string(rung.iHeight);
+}
+
+// a failed conversion leaves the .h264 in place
+void convertToMp4(const string &name) {
+    if (h264ToMp4(name) != 0) {
+        cerr << "Cannot convert " << name << h264Suffix << " to mp4\n";
+    }
+}
+
+double kbps(int64_t bytes, int frames) {
+    return frames ? bytes * 8 / 1000.0 / (frames / inputFps) : 0;
+}
+
+// Splits a simulcast encode into one file per spatial layer, or writes an
+// SVC encode to one file; counts the bytes of every layer either way.
+struct LadderCallback : public BaseEncoderTest::Callback {
+    LadderCallback(const vector<LadderRung> &rungs, bool svc)
+        : rungs_(rungs), svc_(svc), files_(svc ? 1 : rungs.size()),
+          bytes_(rungs.size(), 0), frames_(0) {}
+
+    virtual void onFrameStart(int frameNum) {
+        for (TestCallback &file : files_) {
+            file.onFrameStart(frameNum);
+        }
+    }
+
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const string &outFileName) {
+        for (int l = 0; l < frameInfo.iLayerNum; l++) {
+            const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+            if (layer.uiSpatialId < bytes_.size()) {
+                bytes_[layer.uiSpatialId] += layerSize(layer);
+            }
+        }
+        if (svc_) {
+            files_[0].onEncodeFrame(frameInfo, outFileName);
+            return;
+        }
+        for (size_t r = 0; r < files_.size(); r++) {
+            // parameter sets carry the spatial id of their layer too
+            SFrameBSInfo layerInfo = frameInfo;
+            layerInfo.iLayerNum = 0;
+            layerInfo.iFrameSizeInBytes = 0;
+            layerInfo.eFrameType = videoFrameTypeSkip;
+            for (int l = 0; l < frameInfo.iLayerNum; l++) {
+                const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+                if (layer.uiSpatialId != r) {
+                    continue;
+                }
+                layerInfo.sLayerInfo[layerInfo.iLayerNum++] = layer;
+                layerInfo.iFrameSizeInBytes += layerSize(layer);
+                if (layer.uiLayerType == VIDEO_CODING_LAYER) {
+                    layerInfo.eFrameType = layer.eFrameType;
+                }
+            }
+            if (layerInfo.iLayerNum) {
+                files_[r].onEncodeFrame(layerInfo,
+                                        rungs_[r].name + h264Suffix);
+            }
+        }
+    }
+
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        frames_++;
+    }
+
+    virtual void onStreamDone() {
+        for (TestCallback &file : files_) {
+            file.onStreamDone();
+        }
+    }
+
+    static int layerSize(const SLayerBSInfo &layer) {
+        int size = 0;
+        for (int n = 0; n < layer.iNalCount; n++) {
+            size += layer.pNalLengthInByte[n];
+        }
+        return size;
+    }
+
+    const vector<LadderRung> &rungs_;
+    bool svc_;
+    vector<TestCallback> files_;
+    vector<int64_t> bytes_; ///< per spatial layer
+    int frames_;
+};
+
+struct RungCallback : public TestCallback {
+    RungCallback() : bytes_(0), frames_(0) {}
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        bytes_ += frameInfo.iFrameSizeInBytes;
+        frames_++;
+    }
+    int64_t bytes_;
+    int frames_;
+};
+
+// Priorities of a prescaled rung: the map of the full-size frame from the
+// inner source, or weights/<n>.txt, resampled to the rung's grid.
+class ResampledPrioritySource : public PrioritySource {
+  public:
+    ResampledPrioritySource(PrioritySource *inner,
+                            const ScalingInputStream *source, int dstWidth,
+                            int dstHeight)
+        : inner_(inner), source_(source), dstWidth_(dstWidth),
+          dstHeight_(dstHeight),
+          resampler_(width, height, dstWidth, dstHeight, priorityFilter),
+          full_(iArraySize), last_((size_t)resampler_.DstWidthInMb() *
+                                   resampler_.DstHeightInMb()) {}
+
+    virtual bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                                   float *priorityArray) {
+        if (inner_) {
+            // generated maps look at the picture they describe
+            SSourcePicture fullPic = pic;
+            fullPic.iPicWidth = width;
+            fullPic.iPicHeight = height;
+            fullPic.iStride[0] = width;
+            fullPic.iStride[1] = fullPic.iStride[2] = width / 2;
+            fullPic.pData[0] = const_cast<uint8_t *>(source_->SourceFrame());
+            fullPic.pData[1] = fullPic.pData[0] + (size_t)width * height;
+            fullPic.pData[2] = fullPic.pData[1] + (size_t)width * height / 4;
+            if (!inner_->fillPriorityArray(frameNum, fullPic, full_.data())) {
+                return false;
+            }
+            resampler_.Resample(full_.data(), priorityArray);
+        } else {
+            // straight from the grid of the weights; a missing file repeats
+            // the previous frame, not what the slot held two frames ago
+            const size_t bytes = sizeof(float) * last_.size();
+            if (BaseEncoderTest::ReadWeights(
+                    weightsDir + "/" + to_string(frameNum) + ".txt",
+                    priorityArray, dstWidth_, dstHeight_)) {
+                memcpy(last_.data(), priorityArray, bytes);
+            } else {
+                memcpy(priorityArray, last_.data(), bytes);
+            }
+        }
+        return true;
+    }
+
+    virtual void printSummary() {
+        if (inner_) {
+            inner_->printSummary();
+        }
+    }
+
+  private:
+    PrioritySource *inner_;
+    const ScalingInputStream *source_;
+    int dstWidth_;
+    int dstHeight_;
+    PriorityResampler resampler_;
+    vector<float> full_;
+    vector<float> last_; ///< the last map read, zero before the first
+};
+
+struct RungResult {
+    bool bOk = false;
+    int64_t iBytes = 0;
+    int iFrames = 0;
+    int64_t iScaleUs = 0;
+};
+
+int convertThreads(const TestOptions &opts) {
+    return opts.convertThreads > 0
+               ? opts.convertThreads
+               : min(8, max(1, (int)thread::hardware_concurrency()));
+}
+
+// a fresh read of the input as I420 frames, null when it cannot be opened
+InputStream *reopenInput(const TestOptions &opts,
+                         unique_ptr<InputStream> &source,
+                         unique_ptr<ConvertingInputStream> &converter) {
+    InputGeometry geometry = {width, height, inputFps};
+    source = openInput(opts.input, opts.inputFormat, geometry,
+                       opts.convertThreads);
+    if (!source || opts.inputFormat == pixelI420) {
+        return source.get();
+    }
+    converter.reset(new ConvertingInputStream(source.get(), opts.inputFormat,
+                                              width, height,
+                                              convertThreads(opts)));
+    return converter.get();
+}
+
+// single-layer parameters of a rung
+SEncParamExt rungParam(const SEncParamExt &param, const LadderRung &rung) {
+    SEncParamExt p = param;
+    p.iPicWidth = rung.iWidth;
+    p.iPicHeight = rung.iHeight;
+    SSpatialLayerConfig &layer = p.sSpatialLayers[0];
+    layer.iVideoWidth = rung.iWidth;
+    layer.iVideoHeight = rung.iHeight;
+    layer.iSpatialBitrate = rung.iBitrate;
+    return p;
+}
+
+// one independent single-layer encode of a rung, from its own read of
+// the input
+void encodeRung(const TestOptions &opts, const SEncParamExt &param,
+                const LadderRung &rung, int index,
+                const CpuPlacement *placement, RungResult &result) {
+    if (placement && !placement->Apply()) {
+        cerr << "Cannot pin rung " << rungSize(rung) << " to "
+             << placement->Describe() << endl;
+    }
+    unique_ptr<InputStream> source;
+    unique_ptr<ConvertingInputStream> converter;
+    InputStream *in = reopenInput(opts, source, converter);
+    if (!in) {
+        return;
+    }
+    const int threads = convertThreads(opts);
+    string unused;
+    unique_ptr<PrioritySource> rungSource(
+        createPrioritySource(opts, unused, "-rung" + to_string(index)));
+    unique_ptr<ScalingInputStream> scaler;
+    unique_ptr<PrioritySource> resampled;
+    if (rung.iWidth != width || rung.iHeight != height) {
+        scaler.reset(new ScalingInputStream(in, width, height, rung.iWidth,
+                                            rung.iHeight, threads));
+        in = scaler.get();
+        resampled.reset(new ResampledPrioritySource(
+            rungSource.get(), scaler.get(), rung.iWidth, rung.iHeight));
+    }
+
+    SEncParamExt p = rungParam(param, rung);
+    BaseEncoderTest test;
+    test.prioritySource_ = resampled ? resampled.get() : rungSource.get();
+    test.placement_ = placement;
+    RungCallback cbk;
+    test.SetUp();
+    test.EncodeInput(in, &p, &cbk, rung.name + h264Suffix);
+    test.TearDown();
+    if (test.prioritySource_) {
+        test.prioritySource_->printSummary();
+    }
+    result.bOk = true;
+    result.iBytes = cbk.bytes_;
+    result.iFrames = cbk.frames_;
+    result.iScaleUs = scaler ? scaler->ScaleUs() : 0;
+}
+
+// The rungs as independent encodes once more, each in a child process fed
+// from one read of the input, against threadsSec and threadFrames of the
+// in-process threads. False when an encode failed for good.
+bool encodeIsolatedRungs(const TestOptions &opts, const SEncParamExt &param,
+                         const vector<LadderRung> &rungs,
+                         const string &outFile, double threadsSec,
+                         int threadFrames, StatsReport &report) {
+    vector<IsolatedEncode> encodes(rungs.size());
+    for (size_t l = 0; l < rungs.size(); l++) {
+        encodes[l].sParam = rungParam(param, rungs[l]);
+        encodes[l].sOutFile =
+            outFile + "-isolated-" + rungSize(rungs[l]) + h264Suffix;
+    }
+    unique_ptr<InputStream> source;
+    unique_ptr<ConvertingInputStream> converter;
+    InputStream *in = reopenInput(opts, source, converter);
+    if (!in) {
+        cerr << "The isolated encodes could not open their input\n";
+        return false;
+    }
+    string unused;
+    unique_ptr<PrioritySource> priorities(
+        createPrioritySource(opts, unused, "-isolated"));
+    vector<IsolatedResult> results;
+    const int64_t startUs = monotonicUs();
+    const int64_t startCpuUs = processCpuUs();
+    bool ok = runIsolatedEncodes(encodes, in, priorities.get(), results);
+    const double sec = (monotonicUs() - startUs) / 1e6;
+    // the supervisor reads, converts and computes the maps
+    const double supervisorCpuSec = (processCpuUs() - startCpuUs) / 1e6;
+    if (priorities) {
+        priorities->printSummary();
+    }
+
+    int frames = 0, restarts = 0;
+    int64_t childCpuUs = 0;
+    for (const IsolatedResult &r : results) {
+        ok = ok && r.bOk;
+        frames += r.iFrames;
+        restarts += r.iRestarts;
+        childCpuUs += r.iCpuUs;
+    }
+    const double fps = sec > 0 ? frames / sec : 0;
+    const double threadFps = threadsSec > 0 ? threadFrames / threadsSec : 0;
+    cout << "Isolated encodes: " << frames << " frames in " << sec << " s ("
+         << fps << " fps over all rungs), CPU " << supervisorCpuSec
+         << " s supervisor + " << childCpuUs / 1e6 << " s children, "
+         << restarts << " restarts" << endl;
+    for (int l = (int)rungs.size() - 1; l >= 0; l--) {
+        const IsolatedResult &r = results[l];
+        cout << "  " << rungSize(rungs[l]) << ": ";
+        if (r.bOk) {
+            cout << kbps(r.iBytes, r.iFrames) << " kbps" << endl;
+        } else {
+            cout << "failed after " << r.iFrames << " frames" << endl;
+        }
+        report.AddCounter("isolated_" + rungSize(rungs[l]) + "_kbps",
+                          kbps(r.iBytes, r.iFrames));
+    }
+    cout << "Child processes ran at " << fps / max(threadFps, 1e-9)
+         << "x the frame rate of in-process threads" << endl;
+    report.AddCounter("isolated_wall_ms", sec * 1000);
+    report.AddCounter("isolated_supervisor_cpu_ms", supervisorCpuSec * 1000);
+    report.AddCounter("isolated_children_cpu_ms", childCpuUs / 1000.0);
+    report.AddCounter("isolated_restarts", restarts);
+    report.AddCounter("isolated_fps", fps);
+    report.AddCounter("independent_fps", threadFps);
+    return ok;
+}
+
+} // namespace
+
+bool parseLadder(const string &value, vector<float> &scales) {
+    scales.clear();
+    stringstream ss(value);
+    string item;
+    while (getline(ss, item, ',')) {
+        const float scale = parseFloat(item);
+        if (!(scale > 0 && scale <= 1)) {
+            return false;
+        }
+        scales.push_back(scale);
+    }
+    sort(scales.rbegin(), scales.rend());
+    return scales.size() >= 2 && scales.size() <= MAX_SPATIAL_LAYER_NUM &&
+           scales[0] == 1 &&
+           adjacent_find(scales.begin(), scales.end()) == scales.end();
+}
+
+int runLadder(const TestOptions &opts, const SEncParamExt &param,
+              PrioritySource *prioritySource, InputStream *input,
+              const string &outFile) {
+    vector<LadderRung> rungs =
+        makeRungs(opts.ladder, param.sSpatialLayers[0].iSpatialBitrate);
+    const int layers = (int)rungs.size();
+
+    SEncParamExt ladderParam = param;
+    ladderParam.iSpatialLayerNum = layers;
+    ladderParam.bSimulcastAVC = !opts.ladderSvc;
+    for (int l = 0; l < layers; l++) {
+        SSpatialLayerConfig &layer = ladderParam.sSpatialLayers[l];
+        layer = param.sSpatialLayers[0];
+        layer.iVideoWidth = rungs[l].iWidth;
+        layer.iVideoHeight = rungs[l].iHeight;
+        layer.iSpatialBitrate = rungs[l].iBitrate;
+        rungs[l].name = outFile + "-ladder-" + rungSize(rungs[l]);
+        // the files are appended to frame by frame
+        remove((rungs[l].name + h264Suffix).c_str());
+    }
+    const string svcName = outFile + "-svc";
+
+    LadderCallback cbk(rungs, opts.ladderSvc);
+    BaseEncoderTest test;
+    test.prioritySource_ = prioritySource;
+    test.inputFormat_ = opts.inputFormat;
+    test.convertThreads_ = opts.convertThreads;
+    const int64_t startUs = monotonicUs();
+    const int64_t startCpuUs = processCpuUs();
+    test.SetUp();
+    test.EncodeInput(input, &ladderParam, &cbk, svcName + h264Suffix);
+    test.TearDown();
+    const double ladderSec = (monotonicUs() - startUs) / 1e6;
+    const double ladderCpuSec = (processCpuUs() - startCpuUs) / 1e6;
+
+    StatsReport report;
+    report.AddCounter("ladder_layers", layers);
+    report.AddCounter("ladder_svc", opts.ladderSvc);
+    report.AddCounter("ladder_frames", cbk.frames_);
+    report.AddCounter("ladder_wall_ms", ladderSec * 1000);
+    report.AddCounter("ladder_cpu_ms", ladderCpuSec * 1000);
+    cout << "Ladder " << (opts.ladderSvc ? "SVC" : "simulcast") << ", "
+         << layers << " layers in one encoder: " << cbk.frames_
+         << " frames in " << ladderSec << " s ("
+         << (ladderSec > 0 ? cbk.frames_ / ladderSec : 0) << " fps), CPU "
+         << ladderCpuSec << " s" << endl;
+    for (int l = layers - 1; l >= 0; l--) {
+        const double rate = kbps(cbk.bytes_[l], cbk.frames_);
+        cout << "  " << rungSize(rungs[l]) << ": " << rate << " kbps (target "
+             << rungs[l].iBitrate / 1000 << ")" << endl;
+        report.AddCounter("ladder_" + rungSize(rungs[l]) + "_kbps", rate);
+    }
+    if (prioritySource) {
+        prioritySource->printSummary();
+    }
+
+    bool isolatedOk = true;
+    if (opts.ladderCompare || opts.ladderIsolate) {
+        // the same rungs as independent single-layer encodes, concurrently
+        // like a farm of separate encoders would run them
+        vector<RungResult> results(layers);
+        for (int l = 0; l < layers; l++) {
+            rungs[l].name = outFile + "-single-" + rungSize(rungs[l]);
+        }
+        vector<CpuPlacement> placements;
+        if (opts.pin) {
+            CpuTopology topology;
+            topology.Load();
+            placements = planPlacements(topology, layers);
+        }
+        const int64_t soloStartUs = monotonicUs();
+        const int64_t soloStartCpuUs = processCpuUs();
+        vector<thread> encodes;
+        for (int l = 0; l < layers; l++) {
+            encodes.emplace_back(encodeRung, cref(opts), cref(param),
+                                 cref(rungs[l]), l,
+                                 opts.pin ? &placements[l] : nullptr,
+                                 ref(results[l]));
+        }
+        for (thread &t : encodes) {
+            t.join();
+        }
+        const double soloSec = (monotonicUs() - soloStartUs) / 1e6;
+        const double soloCpuSec = (processCpuUs() - soloStartCpuUs) / 1e6;
+        int64_t scaleUs = 0;
+        int frames = 0;
+        for (const RungResult &r : results) {
+            if (!r.bOk) {
+                cerr << "An independent encode could not open its input\n";
+                return 1;
+            }
+            scaleUs += r.iScaleUs;
+            frames += r.iFrames;
+        }
+        cout << "Independent encodes: " << frames << " frames in " << soloSec
+             << " s (" << (soloSec > 0 ? frames / soloSec : 0)
+             << " fps over all rungs), CPU " << soloCpuSec
+             << " s, prescaling " << scaleUs / 1e6 << " s" << endl;
+        for (int l = layers - 1; l >= 0; l--) {
+            const double rate = kbps(results[l].iBytes, results[l].iFrames);
+            cout << "  " << rungSize(rungs[l]) << ": " << rate << " kbps"
+                 << endl;
+            report.AddCounter("independent_" + rungSize(rungs[l]) + "_kbps",
+                              rate);
+        }
+        cout << "One encoder used " << ladderCpuSec / max(soloCpuSec, 1e-9)
+             << "x the CPU and " << ladderSec / max(soloSec, 1e-9)
+             << "x the wall time of the independent encodes" << endl;
+        report.AddCounter("independent_wall_ms", soloSec * 1000);
+        report.AddCounter("independent_cpu_ms", soloCpuSec * 1000);
+        report.AddCounter("independent_scale_ms", scaleUs / 1000.0);
+        report.AddCounter("ladder_cpu_ratio",
+                          ladderCpuSec / max(soloCpuSec, 1e-9));
+        if (opts.ladderIsolate) {
+            isolatedOk = encodeIsolatedRungs(opts, param, rungs, outFile,
+                                             soloSec, frames, report);
+        }
+    }
+    if (!report.WriteJson(outFile + "-ladder.stats.json")) {
+        cerr << "Failed to write " << outFile << "-ladder.stats.json\n";
+    }
+
+    // an SVC stream only plays its base layer in an mp4
+    if (!opts.ladderSvc) {
+        for (const LadderRung &rung : makeRungs(opts.ladder, 0)) {
+            convertToMp4(outFile + "-ladder-" + rungSize(rung));
+        }
+    }
+    if (opts.ladderCompare || opts.ladderIsolate) {
+        for (const LadderRung &rung : rungs) {
+            convertToMp4(rung.name);
+        }
+    }
+    if (opts.ladderIsolate && isolatedOk) {
+        for (const LadderRung &rung : rungs) {
+            convertToMp4(outFile + "-isolated-" + rungSize(rung));
+        }
+    }
+    return isolatedOk ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#ifndef __LADDER_H__
+#define __LADDER_H__
+
+#include "harness.h"
+
+#include <string>
+#include <vector>
+
+// parses "1,0.75,0.5": two to four scales in (0, 1], one of them 1 (the
+// input is the top layer); sorted from the largest
+bool parseLadder(const std::string &value, std::vector<float> &scales);
+
+// Encodes input once into opts.ladder spatial layers of one encoder:
+// simulcast AVC, one <outFile>-ladder-<w>x<h>.h264 per layer, or with
+// opts.ladderSvc a single SVC stream <outFile>-svc.h264. The encoder
+// downscales the lower layers itself and takes the priority map of the
+// top layer. opts.ladderCompare then encodes every rung on its own, the
+// lower ones from frames prescaled with FrameScaler and their maps
+// resampled to their grid with priorityFilter, and reports wall and CPU
+// time of both ways.
+// opts.ladderIsolate runs those encodes on threads as well and once more
+// as child processes fed from one shared read of the input (isolate.h),
+// to <outFile>-isolated-<w>x<h>.h264, and compares their frame rates.
+int runLadder(const TestOptions &opts, const SEncParamExt &param,
+              PrioritySource *prioritySource, InputStream *input,
+              const std::string &outFile);
+
+#endif //__LADDER_H__
@@ -1,350 +1,259 @@
-#include <wels/codec_api.h>
-#include <wels/codec_app_def.h>
-#include <wels/codec_def.h>
-#include <wels/utils/BufferedData.h>
-#include <wels/utils/FileInputStream.h>
-#include <wels/utils/InputStream.h>
-
+#include "bitrate_search.h"
+#include "daemon.h"
+#include "bitstream_index.h"
+#include "cluster.h"
+#include "decode_bench.h"
+#include "frame_store.h"
+#include "harness.h"
+#include "isolate.h"
+#include "ladder.h"
+#include "mb_stats.h"
+#include "rtp.h"
+#include "scaling.h"
+#include "stereo.h"
+#include "sweep.h"
+#include "temporal.h"
+
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
-#include <sstream>
-#include <stdexcept>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std;
 namespace fs = std::filesystem;
 
-const string testbinDir = "../testbin/";
-const string weightsDir = testbinDir + "weights";
-const string inputFileName = testbinDir + "cut.yuv";
-const string h264Suffix = ".h264";
-const string mp4Suffix = ".mp4";
-
-const int width = 1824;
-const int height = 1920;
-const float inputFps = 60;
-const float outputFps = 60;
-const int iWidthInMb = width / 16;
-const int iHeightInMb = height / 16;
-const int iArraySize = iWidthInMb * iHeightInMb;
-
-int isDiffEncoding = 0;
-
-class BaseEncoderTest {
-  public:
-    struct Callback {
-        virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
-                                   const string &outFileName) = 0;
-    };
-
-    BaseEncoderTest();
-    void SetUp();
-    void TearDown();
-    void EncodeFile(const char *fileName, SEncParamExt *pEncParamExt,
-                    Callback *cbk, const string &outFileName);
-    void EncodeStream(InputStream *in, SEncParamExt *pEncParamExt,
-                      Callback *cbk, const string &outFileName);
-    void CheckWeightLog(const string &fileName, int width, int height);
-    void ReadPriorityArray(const string &fileName, float *priorityArray,
-                           int width, int height);
-
-    ISVCEncoder *encoder_;
-
-  private:
-};
-
-inline bool fileExists(const string &name) {
-    struct stat buffer;
-    return (stat(name.c_str(), &buffer) == 0);
+void printUsage(const char *prog) {
+    cerr << "Usage: " << prog << " <isDiffEncoding> <bitrateMbps> [options]\n"
+         << "       " << prog << " --daemon <socket> [workers]\n"
+         << "       " << prog << " --shutdown <socket>\n"
+         << "       " << prog << " --sweep <mbps,mbps,...> [options]\n"
+         << "       " << prog << " --coordinator <mbps,mbps,...> [--listen "
+            "host:port]\n"
+         << "                 [--clips a,b,...] [--spawn-workers n] "
+            "[options]\n"
+         << "       " << prog << " --worker <host:port>\n"
+         << "       " << prog << " --decode-bench <stream.h264> [--threads "
+            "0,1,2,3]\n"
+         << "                 [--repeat n] [--recon <yuv>] [--stats <json>]\n"
+         << "       " << prog << " --index <stream.h264> [threads]\n"
+         << "       " << prog << " --extract-temporal <stream.h264> <max_tid> "
+            "[out.h264]\n"
+         << "       " << prog << " --mb-stats <stream.h264> [--weights <dir>]\n"
+         << "                 [--threads n] [--grids <dir>] [--csv <file>]\n"
+         << "       " << prog << " --pack <input> <out.yfs> [--codec zstd|lz4|raw]\n"
+         << "                 [--level n] [--no-delta] [--threads n] [--size "
+            "<w>x<h>]\n"
+         << "                 [--fps f] [--input-format f]\n"
+         << "  --input <yuv>           source instead of testbin/cut.yuv; a\n"
+         << "                          .y4m file, .yfs frame store, FIFO or -\n"
+         << "                          for stdin works too\n"
+         << "  --size <w>x<h>          raw input size (default 1824x1920)\n"
+         << "  --fps <f>               raw input frame rate (default 60)\n"
+         << "  --input-format <f>      i420 (default), rgba, bgra or nv12;\n"
+         << "                          converted to I420 while reading\n"
+         << "  --convert-threads <n>   row bands of the conversion, or threads\n"
+         << "                          decompressing a frame store\n"
+         << "  --out <path>            output path without the .h264 suffix\n"
+         << "  --submit <socket>       run the encode in a --daemon instance\n"
+         << "  --gaze <trace>          generate priorities from a gaze trace\n"
+         << "                          (lines: timestamp_ms x y, x/y in [0,1])\n"
+         << "  --falloff <model>       gaussian | linear | hyperbolic\n"
+         << "  --fovea <r>             fovea radius, fraction of width\n"
+         << "  --falloff-width <w>     falloff width, fraction of width\n"
+         << "  --saliency              derive priorities from the frame content\n"
+         << "  --saliency-weights v:e:t  variance:edge:temporal weights\n"
+         << "  --priority-socket <path>  receive maps from a producer process\n"
+         << "  --priority-deadline-ms <ms>  wait per frame before reusing the\n"
+         << "                          last map (default 4)\n"
+         << "  --priority-min <p>      lowest generated priority\n"
+         << "  --priority-max <p>      highest generated priority\n"
+         << "  --stereo <right.yuv>    encode the right eye alongside the input\n"
+         << "  --right-weights <dir>   weights/<n>.txt for the right eye\n"
+         << "  --stereo-interleave     write one interleaved .s264 container\n"
+         << "  --paced                 release frames at inputFps wall-clock rate\n"
+         << "  --pace-drop             --paced, dropping frames a full interval\n"
+         << "                          late\n"
+         << "  --frame-skip            let rate control skip frames\n"
+         << "  --gop <n>               IDR every n frames (default: first only)\n"
+         << "  --bandwidth-trace <trace>  retarget the bitrate mid-stream\n"
+         << "                          (lines: timestamp_ms kbps)\n"
+         << "  --bw-headroom <f>       target = f * trace bandwidth (default 1)\n"
+         << "  --bw-window-ms <ms>     accounting window (default 1000)\n"
+         << "  --rtp <mtu>             size-limited slices, sent as RTP over\n"
+         << "                          loopback UDP and verified\n"
+         << "  --rtp-overhead          measure slice limiting cost at fixed QP\n"
+         << "  --dump-recon            write the encoder reconstruction to\n"
+         << "                          <out>.recon.yuv for --decode-bench\n"
+         << "  --assert-no-alloc       fail when a frame after the first two\n"
+         << "                          allocates on the heap\n"
+         << "  --perf-counters         time every pipeline stage and read the\n"
+         << "                          CPU counters around it (Linux)\n"
+         << "  --weights-size <WxH>    picture size weights/<n>.txt were made\n"
+         << "                          for (default 1824x1920)\n"
+         << "  --resample <filter>     fits priority maps to other sizes:\n"
+         << "                          area (default), bilinear or max\n"
+         << "  --priority-transform <chain>\n"
+         << "                          applied to every map before encoding,\n"
+         << "                          in order: gamma=<g>, clamp=<lo>:<hi>,\n"
+         << "                          mean=<m>, ema=<alpha>, border=<mbs>:<gain>\n"
+         << "                          e.g. gamma=0.8,clamp=0.1:0.9,mean=0.5\n"
+         << "  --pin                   pin every encoder to its own cores and\n"
+         << "                          NUMA node (stereo, ladder, plain)\n"
+         << "  --scaling <n>           throughput of 1 to n concurrent encoders,\n"
+         << "                          unpinned and pinned\n"
+         << "  --ladder <s,s,...>      spatial layers at these scales of the\n"
+         << "                          input (one is 1) in a single encoder\n"
+         << "  --ladder-svc            one SVC stream instead of simulcast\n"
+         << "  --ladder-compare        also encode each layer on its own and\n"
+         << "                          compare wall and CPU time\n"
+         << "  --ladder-isolate        also encode each layer in a child\n"
+         << "                          process fed from a shared frame ring\n"
+         << "                          and compare with in-process threads\n"
+         << "  --temporal-layers <n>   dyadic temporal layers (1-4); writes\n"
+         << "                          <out>-<fps>fps.h264 for each lower rate\n"
+         << "  --temporal-compare      also encode each rate on its own at\n"
+         << "                          fixed QP and compare size and CPU time\n"
+         << "  --target-psnr <dB>      search the bitrate reaching this luma\n"
+         << "                          PSNR, <bitrateMbps> is the first guess\n"
+         << "  --target-ssim <s>       same for luma SSIM\n"
+         << "  --search-tolerance <t>  default 0.1 dB / 0.002\n"
+         << "  --search-subset <n>     search on the first n frames, then\n"
+         << "                          confirm on the whole input\n"
+         << "  --search-max-encodes <n>  per configuration and pass (default 8)\n"
+         << "  --search-range <lo:hi>  bitrate bounds in Mbps (default 0.25:64)\n";
 }
 
-inline int countFiles(const fs::path &dir) {
-    int count = 0;
-    for (auto &p : fs::directory_iterator(dir)) {
-        count++;
+int main(int argc, char const *argv[]) {
+    if (argc >= 3 && string(argv[1]) == "--daemon") {
+        const int workers =
+            argc > 3 ? parseInt(argv[3])
+                     : max(1, (int)thread::hardware_concurrency());
+        return runDaemon(argv[2], workers);
     }
-    return count;
-}
-
-struct TestCallback : public BaseEncoderTest::Callback {
-    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
-                               const string &outFileName) {
-        int iLayer = 0;
-        while (iLayer < frameInfo.iLayerNum) {
-            const SLayerBSInfo *pLayerInfo = &frameInfo.sLayerInfo[iLayer++];
-            if (pLayerInfo) {
-                int iLayerSize = 0;
-                int iNalIndex = pLayerInfo->iNalCount - 1;
-                do {
-                    iLayerSize += pLayerInfo->pNalLengthInByte[iNalIndex];
-                    iNalIndex--;
-                } while (iNalIndex >= 0);
-                FILE *fp = nullptr;
-                if (fopen_s(&fp, outFileName.c_str(), "ab") == 0) {
-                    assert(fp != nullptr);
-                    fwrite(pLayerInfo->pBsBuf, 1, iLayerSize, fp);
-                    fclose(fp);
-                }
-            }
-        }
+    if (argc >= 3 && string(argv[1]) == "--shutdown") {
+        return submitJob(argv[2], vector<string>(1, "--shutdown"));
     }
-};
-
-BaseEncoderTest::BaseEncoderTest() : encoder_(NULL) {}
-
-void BaseEncoderTest::SetUp() {
-    int rv = WelsCreateSVCEncoder(&encoder_);
-    assert(rv == cmResultSuccess);
-    assert(encoder_ != NULL);
-
-    unsigned int uiTraceLevel = WELS_LOG_DEBUG;
-    encoder_->SetOption(ENCODER_OPTION_TRACE_LEVEL, &uiTraceLevel);
-}
-
-void BaseEncoderTest::TearDown() {
-    if (encoder_) {
-        encoder_->Uninitialize();
-        WelsDestroySVCEncoder(encoder_);
-    }
-}
-
-void BaseEncoderTest::EncodeStream(InputStream *in, SEncParamExt *pEncParamExt,
-                                   Callback *cbk, const string &outFileName) {
-    assert(NULL != pEncParamExt);
-
-    int rv = encoder_->InitializeExt(pEncParamExt);
-    assert(rv == cmResultSuccess);
-
-    // I420: 1(Y) + 1/4(U) + 1/4(V)
-    int frameSize = pEncParamExt->iPicWidth * pEncParamExt->iPicHeight * 3 / 2;
-
-    BufferedData buf;
-    buf.SetLength(frameSize);
-    assert(buf.Length() == (size_t)frameSize);
-
-    SFrameBSInfo info;
-    memset(&info, 0, sizeof(SFrameBSInfo));
-
-    SSourcePicture pic;
-    memset(&pic, 0, sizeof(SSourcePicture));
-    pic.iPicWidth = pEncParamExt->iPicWidth;
-    pic.iPicHeight = pEncParamExt->iPicHeight;
-    pic.iColorFormat = videoFormatI420;
-    pic.iStride[0] = pic.iPicWidth;
-    pic.iStride[1] = pic.iStride[2] = pic.iPicWidth >> 1;
-    pic.pData[0] = buf.data();
-    pic.pData[1] =
-        pic.pData[0] + pEncParamExt->iPicWidth * pEncParamExt->iPicHeight;
-    pic.pData[2] = pic.pData[1] +
-                   (pEncParamExt->iPicWidth * pEncParamExt->iPicHeight >> 2);
-
-    int i = 1;
-    while (in->read(buf.data(), frameSize) == frameSize) {
-        int rv = -1;
-        if (isDiffEncoding) {
-
-            float priorityArray[iArraySize];
-            float fAverageWeight = 0.0;
-            const string weightLog = weightsDir + "/" + to_string(i++) + ".txt";
-            ReadPriorityArray(weightLog, priorityArray, iWidthInMb,
-                              iHeightInMb);
-            rv = encoder_->EncodeFrame(&pic, &info, priorityArray);
-        } else {
-            rv = encoder_->EncodeFrame(&pic, &info);
-        }
-        assert(rv == cmResultSuccess);
-        if (info.eFrameType != videoFrameTypeSkip) {
-            cbk->onEncodeFrame(info, outFileName);
+    if (argc >= 3 && string(argv[1]) == "--decode-bench") {
+        DecodeBenchOptions benchOpts;
+        benchOpts.stream = argv[2];
+        if (!parseDecodeBenchOptions(argc, argv, benchOpts)) {
+            printUsage(argv[0]);
+            return 1;
         }
+        return runDecodeBench(benchOpts);
     }
-}
-
-void BaseEncoderTest::EncodeFile(const char *fileName,
-                                 SEncParamExt *pEncParamExt, Callback *cbk,
-                                 const string &outFileName) {
-    FileInputStream fileStream;
-    bool res = fileStream.Open(fileName);
-    if (fileExists(outFileName)) {
-        int removeRes = remove(outFileName.c_str());
-        assert(removeRes == 0);
-        cout << "Removed existing file before encoding: " << outFileName
-             << endl;
-    }
-    assert(res == true);
-    EncodeStream(&fileStream, pEncParamExt, cbk, outFileName);
-}
-
-// check if the weight log file is valid
-void BaseEncoderTest::CheckWeightLog(const string &fileName, int width,
-                                     int height) {
-    ifstream weightLog(fileName.c_str());
-    string line;
-    int lineNum = 0;
-    while (getline(weightLog, line)) {
-        lineNum++;
-        if (line.empty()) {
-            continue;
+    if (argc >= 4 && string(argv[1]) == "--pack") {
+        PackOptions packOpts;
+        packOpts.input = argv[2];
+        packOpts.output = argv[3];
+        if (!parsePackOptions(argc, argv, packOpts)) {
+            printUsage(argv[0]);
+            return 1;
         }
-
-        float num = 0;
-        int colNum = 0;
-        stringstream ss(line);
-        while (ss >> num) {
-            colNum++;
-        }
-        assert(colNum == width);
+        return runPack(packOpts);
     }
-    assert(lineNum - 1 == height);
-
-    weightLog.close();
-}
-
-// read just one priority array from one file
-void BaseEncoderTest::ReadPriorityArray(const string &fileName,
-                                        float *priorityArray, int width,
-                                        int height) {
-    // CheckWeightLog(fileName, width, height);
-
-    ifstream file(fileName.c_str());
-    string line;
-    while (getline(file, line)) {
-        if (line.empty()) {
-            continue;
-        }
-
-        float num = 0;
-        stringstream ss(line);
-        while (ss >> num) {
-            *priorityArray++ = num;
-        }
+    if (argc >= 3 && string(argv[1]) == "--index") {
+        const int threads =
+            argc > 3 ? parseInt(argv[3])
+                     : max(1, (int)thread::hardware_concurrency());
+        return runIndexer(argv[2], threads);
     }
-    file.close();
-}
-
-void splitWeightLog(const string &fileName, const string &weightsDir) {
-    ifstream weightLog(fileName.c_str());
-    string line;
-    int frameNum = 1;
-
-    while (getline(weightLog, line)) {
-        // write line to file with name: <weightsDir>/<frameNum>.txt
-        string targetFileName = weightsDir + "/" + to_string(frameNum) + ".txt";
-        fstream targetFile(targetFileName.c_str(), ios::app);
-        targetFile << line << endl;
-        if (line == "") {
-            frameNum++;
+    if (argc >= 3 && string(argv[1]) == "--sweep") {
+        return runSweep(argc, argv);
+    }
+    if (argc >= 3 && string(argv[1]) == "--coordinator") {
+        return runCoordinator(argc, argv);
+    }
+    if (argc >= 3 && string(argv[1]) == "--worker") {
+        return runWorker(argv[2]);
+    }
+    if (argc >= 4 && string(argv[1]) == "--isolated-encoder") {
+        return runIsolatedEncoder(argv[2], parseInt(argv[3]));
+    }
+    if (argc >= 4 && string(argv[1]) == "--extract-temporal") {
+        return runTemporalExtract(argc, argv);
+    }
+    if (argc >= 3 && string(argv[1]) == "--mb-stats") {
+        MbStatsOptions mbOpts;
+        mbOpts.stream = argv[2];
+        mbOpts.weightsDir = weightsDir;
+        if (!parseMbStatsOptions(argc, argv, mbOpts)) {
+            printUsage(argv[0]);
+            return 1;
         }
-        targetFile.close();
+        return runMbStats(mbOpts);
+    }
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
     }
 
-    weightLog.close();
-}
-
-int parseInt(const string &s) {
-    assert(!s.empty());
-    int res = 0;
-    try {
-        size_t pos;
-        res = stoi(s, &pos);
-        if (pos < s.size()) {
-            cerr << "Trailing characters after number: " << s << '\n';
-        }
-    } catch (invalid_argument const &) {
-        cerr << "Invalid number: " << s << '\n';
-    } catch (out_of_range const &) {
-        cerr << "Number out of range: " << s << '\n';
+    // parse input and process yuv file
+    isDiffEncoding = parseInt(argv[1]);
+    float targetBitrate = parseFloat(argv[2]);
+    TestOptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
     }
-    return res;
-}
 
-float parseFloat(const string &s) {
-    assert(!s.empty());
-    float res = 0.0;
-    try {
-        size_t pos;
-        res = stof(s, &pos);
-        if (pos < s.size()) {
-            cerr << "Trailing characters after number: " << s << '\n';
+    if (!opts.submitSocket.empty()) {
+        vector<string> args;
+        for (int i = 0; i < argc; i++) {
+            if (string(argv[i]) == "--submit") {
+                i++;
+            } else {
+                args.push_back(argv[i]);
+            }
         }
-    } catch (invalid_argument const &) {
-        cerr << "Invalid number: " << s << '\n';
-    } catch (out_of_range const &) {
-        cerr << "Number out of range: " << s << '\n';
+        return submitJob(opts.submitSocket, args);
     }
-    return res;
-}
 
-int h264ToMp4(const string h264File) {
-    const string h264FileName = h264File + h264Suffix;
-    const string mp4FileName = h264File + mp4Suffix;
-    const string ffmpegCommand = "ffmpeg -framerate " + to_string(inputFps) + " -i " + h264FileName + " -c copy " + mp4FileName;
-    int ret = system(ffmpegCommand.c_str());
-    return ret;
-}
-
-int main(int argc, char const *argv[]) {
-    // split weight log file into multiple files for each frame
-    const string weightsDir = testbinDir + "weights";
-    const string weightLog = testbinDir + "weight_cut.log";
-    if (!fs::is_directory(weightsDir)) {
-        fs::create_directory(weightsDir);
-        splitWeightLog(weightLog, weightsDir);
+    // a Y4M header or --size/--fps size everything below; the stream stays
+    // open for the encode since stdin cannot be opened twice
+    InputGeometry geometry = {width, height, inputFps};
+    if (opts.inputWidth > 0) {
+        geometry.iWidth = opts.inputWidth;
+        geometry.iHeight = opts.inputHeight;
+    }
+    if (opts.inputFps > 0) {
+        geometry.fFps = opts.inputFps;
     }
+    unique_ptr<InputStream> input =
+        openInput(opts.input, opts.inputFormat, geometry, opts.convertThreads);
+    if (!input) {
+        return 1;
+    }
+    setInputGeometry(geometry);
+    applyPriorityOptions(opts);
 
-    // parse input and process yuv file
-    isDiffEncoding = parseInt(argv[1]);
-    float targetBitrate = parseFloat(argv[2]);
+    if (!usesGeneratedPriorities(opts)) {
+        prepareWeightFiles();
+    }
 
     SEncParamExt param;
-    memset(&param, 0, sizeof(SEncParamExt));
-    param.iUsageType = EUsageType::CAMERA_VIDEO_REAL_TIME;
-    param.bSimulcastAVC = false;
-    param.iPicWidth = width;
-    param.iPicHeight = height;
-    param.fMaxFrameRate = outputFps;
-    param.iTemporalLayerNum = 1;
-    param.uiIntraPeriod = 0;
-    param.eSpsPpsIdStrategy = EParameterSetStrategy::INCREASING_ID;
-    param.bEnableFrameCroppingFlag = 1;
-    param.iEntropyCodingModeFlag = 0;
-    param.uiMaxNalSize = 0;
-    param.iComplexityMode = ECOMPLEXITY_MODE::LOW_COMPLEXITY;
-    param.iLoopFilterDisableIdc = 0;
-    param.iLoopFilterAlphaC0Offset = 0;
-    param.iLoopFilterBetaOffset = 0;
-    param.iMultipleThreadIdc = 1;
-    param.bUseLoadBalancing = true;
-    param.iRCMode = RC_BITRATE_MODE;
-    param.iTargetBitrate = 288000000;
-    param.iMaxBitrate = UNSPECIFIED_BIT_RATE;
-    param.bEnableFrameSkip = false;
-    param.iMaxQp = 51;
-    param.iMinQp = 0;
-    param.bEnableDenoise = false;
-    param.bEnableSceneChangeDetect = false;
-    param.bEnableBackgroundDetection = false;
-    param.bEnableAdaptiveQuant = false;
-    param.bEnableLongTermReference = false;
-    param.iLtrMarkPeriod = 30;
-    param.bPrefixNalAddingCtrl = false;
-    param.iSpatialLayerNum = 1;
+    fillEncParamExt(param, targetBitrate);
+    param.bEnableFrameSkip = opts.frameSkip;
+    param.uiIntraPeriod = opts.gop;
+    configureTemporalLayers(param, opts.temporalLayers);
+    if (opts.rtpMtu > 0) {
+        configureSizeLimitedSlices(param, opts.rtpMtu);
+    }
 
-    SSpatialLayerConfig *pDLayer = &param.sSpatialLayers[0];
-    pDLayer->iVideoWidth = width;
-    pDLayer->iVideoHeight = height;
-    pDLayer->fFrameRate = outputFps;
-    pDLayer->uiProfileIdc = PRO_BASELINE;
-    pDLayer->iSpatialBitrate = (int)(targetBitrate * 1000 * 1000);
-    pDLayer->iMaxSpatialBitrate = UNSPECIFIED_BIT_RATE;
-    pDLayer->iDLayerQp = 24;
-    pDLayer->sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
-    // param.iMinQp = iMinQp;
-    // param.iMaxQp = iMaxQp;
+    if (opts.targetPsnr > 0 || opts.targetSsim > 0) {
+        return runBitrateSearch(opts, param, targetBitrate);
+    }
 
-    const string diffSuffix = isDiffEncoding ? "-diff" : "";
+    string diffSuffix = isDiffEncoding ? "-diff" : "";
+    PrioritySource *prioritySource = nullptr;
+    if (isDiffEncoding) {
+        prioritySource = createPrioritySource(opts, diffSuffix);
+    }
     // const string qpSuffix = "-minqp" + to_string(iMinQp) + "-maxqp" +
     // to_string(iMaxQp); const string outFileName = testbinDir + "out" +
     // diffSuffix + qpSuffix + ".h264";
@@ -352,15 +261,153 @@ int main(int argc, char const *argv[]) {
     if (!fs::is_directory(outFileDir)) {
         assert(fs::create_directory(outFileDir) == true);
     }
-    const string outFile = outFileDir + "out" + diffSuffix;
+    string outFile = outFileDir + "out" + diffSuffix;
+
+    BitrateController *bitrateController = nullptr;
+    if (!opts.bandwidthTrace.empty()) {
+        vector<BandwidthSample> samples;
+        if (!loadBandwidthTrace(opts.bandwidthTrace, samples)) {
+            cerr << "Failed to load bandwidth trace: " << opts.bandwidthTrace
+                 << '\n';
+            return 1;
+        }
+        bitrateController = new BitrateController(
+            samples, inputFps, opts.bandwidthHeadroom, opts.bandwidthWindowMs);
+        outFile += "-bwtrace";
+    }
+    if (opts.rtpMtu > 0) {
+        outFile += "-rtp";
+    }
+    if (!opts.outFile.empty()) {
+        outFile = opts.outFile;
+    }
+
+    if (!opts.stereoRight.empty()) {
+        int ret = runStereo(opts, param, prioritySource, outFile);
+        delete prioritySource;
+        return ret;
+    }
+    if (!opts.ladder.empty()) {
+        int ret =
+            runLadder(opts, param, prioritySource, input.get(), outFile);
+        delete prioritySource;
+        return ret;
+    }
+    if (opts.scaling > 0) {
+        // every encoder brings its own input and priority source
+        delete prioritySource;
+        return runScalingBench(opts, param, outFile);
+    }
 
-    TestCallback cbk;
+    TestCallback fileCbk;
+    TestCallback *cbk = &fileCbk;
+    RtpSinkCallback *rtpSink = nullptr;
+    if (opts.rtpMtu > 0) {
+        rtpSink = new RtpSinkCallback(opts.rtpMtu, inputFps);
+        if (!rtpSink->Start(outFile + "-rx" + h264Suffix)) {
+            cerr << "Failed to set up the loopback RTP receiver\n";
+            return 1;
+        }
+        cbk = rtpSink;
+    }
     BaseEncoderTest *pTest = new BaseEncoderTest();
+    pTest->prioritySource_ = prioritySource;
+    FramePacer *pacer = nullptr;
+    if (opts.paced) {
+        pacer = new FramePacer(inputFps, opts.paceDrop);
+        pTest->pacer_ = pacer;
+    }
+    pTest->bitrateController_ = bitrateController;
+    pTest->inputFormat_ = opts.inputFormat;
+    pTest->convertThreads_ = opts.convertThreads;
+    if (opts.dumpRecon) {
+        pTest->reconFile_ = outFile + ".recon.yuv";
+    }
+    AllocTracker allocTracker;
+    pTest->allocTracker_ = &allocTracker;
+    CpuPlacement placement;
+    if (opts.pin) {
+        CpuTopology topology;
+        topology.Load();
+        placement = planPlacements(topology, 1)[0];
+        if (placement.Apply()) {
+            pTest->placement_ = &placement;
+        } else {
+            cerr << "Cannot pin to " << placement.Describe() << '\n';
+        }
+    }
+    StageProfiler profiler("encode");
+    if (opts.perfCounters) {
+        pTest->profiler_ = &profiler;
+    }
     pTest->SetUp();
-    pTest->EncodeFile(inputFileName.c_str(), &param, &cbk, outFile + h264Suffix);
+    pTest->EncodeInput(input.get(), &param, cbk, outFile + h264Suffix);
     pTest->TearDown();
+    if (rtpSink) {
+        rtpSink->Finish();
+    }
+    if (opts.dumpRecon && !fileExists(pTest->reconFile_)) {
+        cerr << "The encoder wrote no reconstruction; this openh264 build "
+                "ignores ENCODER_OPTION_DUMP_FILE\n";
+    }
+
+    allocTracker.printSummary();
+    if (opts.perfCounters) {
+        profiler.printSummary();
+    }
+
+    bool measured = true;
+    if (pacer || bitrateController || rtpSink || opts.temporalLayers > 1 ||
+        opts.assertNoAlloc || opts.perfCounters) {
+        StatsReport report;
+        allocTracker.AddToReport(report);
+        if (opts.perfCounters) {
+            profiler.AddToReport(report);
+        }
+        if (pacer) {
+            pacer->printSummary();
+            pacer->AddToReport(report);
+            delete pacer;
+        }
+        if (bitrateController) {
+            bitrateController->printSummary();
+            bitrateController->AddToReport(report);
+            if (!bitrateController->WriteCsv(outFile + ".windows.csv")) {
+                cerr << "Failed to write " << outFile << ".windows.csv\n";
+            }
+            delete bitrateController;
+        }
+        if (rtpSink) {
+            rtpSink->printSummary();
+            rtpSink->AddToReport(report);
+            delete rtpSink;
+            if (opts.rtpOverhead) {
+                measureSliceOverhead(opts, param, report);
+            }
+        }
+        if (opts.temporalLayers > 1) {
+            extractTemporalTiers(param, outFile, report);
+            if (opts.temporalCompare) {
+                measured = measureTemporalCost(opts, param, report);
+            }
+        }
+        if (!report.WriteJson(outFile + ".stats.json")) {
+            cerr << "Failed to write " << outFile << ".stats.json\n";
+        }
+    }
+
+    if (prioritySource) {
+        prioritySource->printSummary();
+        delete prioritySource;
+    }
 
     assert(h264ToMp4(outFile) == 0);
 
-    return 0;
+    if (opts.assertNoAlloc && allocTracker.SteadyAllocs()) {
+        cerr << "--assert-no-alloc: " << allocTracker.SteadyAllocs()
+             << " heap allocations after the warm-up, the first in frame "
+             << allocTracker.FirstAllocatingFrame() << '\n';
+        return 1;
+    }
+    return measured ? 0 : 1;
 }
@@ -0,0 +1,100 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE),
+      mapping_(nullptr) {}
+#else
+MappedFile::MappedFile() : data_(nullptr), size_(0) {}
+#endif
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const string &fileName) {
+    Close();
+#ifdef _WIN32
+    file_ = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size) ||
+        size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) {
+        Close();
+        return false;
+    }
+    data_ = (const uint8_t *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    size_ = (size_t)size.QuadPart;
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    // start paging the source in before the first encode needs it
+    madvise(p, st.st_size, MADV_WILLNEED);
+    data_ = (const uint8_t *)p;
+    size_ = st.st_size;
+#endif
+    if (!data_) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+    }
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) {
+        munmap((void *)data_, size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+
+int MappedInputStream::read(void *ptr, size_t len) {
+    const size_t n = min(len, file_.Size() - pos_);
+    memcpy(ptr, file_.Data() + pos_, n);
+    pos_ += n;
+    return (int)n;
+}
@@ -0,0 +1,47 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <wels/utils/InputStream.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Read-only memory mapping of a whole file. The pages stay resident across
+// encodes as long as the mapping lives.
+class MappedFile {
+  public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(const std::string &fileName);
+    const uint8_t *Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+  private:
+    void Close();
+
+    const uint8_t *data_;
+    size_t size_;
+#ifdef _WIN32
+    void *file_;
+    void *mapping_;
+#endif
+};
+
+// InputStream over a MappedFile; each stream keeps its own position, so
+// concurrent encodes can share one mapping.
+class MappedInputStream : public InputStream {
+  public:
+    explicit MappedInputStream(const MappedFile &file)
+        : file_(file), pos_(0) {}
+    int read(void *ptr, size_t len);
+
+  private:
+    const MappedFile &file_;
+    size_t pos_;
+};
+
+#endif //__MAPPED_FILE_H__
@@ -0,0 +1,460 @@
+#include "mb_stats.h"
+#include "annexb.h"
+#include "bitstream_index.h"
+#include "harness.h"
+#include "mapped_file.h"
+#include "slice_parser.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+struct Picture {
+    size_t iAu;
+    int iParamSets; ///< snapshot active for the picture
+    int iFrameNum;
+};
+
+struct FrameMbStats {
+    bool bParsed = false;
+    bool bIdr = false;
+    int iSlices = 0;
+    uint64_t uiBits = 0; ///< all macroblocks
+    uint64_t uiHeaderBits = 0;
+    int iSkip = 0;
+    int iInter = 0;
+    int iIntra = 0; ///< I_PCM included
+    int iMissing = 0;
+    double fMeanQp = 0;
+    int iMinQp = 0;
+    int iMaxQp = 0;
+    bool bHavePriority = false;
+    double fBitsCorr = NAN; ///< Pearson(priority, bits) over coded area
+    double fQpCorr = NAN;   ///< Pearson(priority, QP)
+    double fTopShare = NAN; ///< share of bits in the top priority quartile
+    double fParseUs = 0;
+};
+
+double pearson(const vector<double> &x, const vector<double> &y) {
+    const size_t n = x.size();
+    if (n < 2) {
+        return NAN;
+    }
+    double mx = 0, my = 0;
+    for (size_t i = 0; i < n; i++) {
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+    double sxy = 0, sxx = 0, syy = 0;
+    for (size_t i = 0; i < n; i++) {
+        sxy += (x[i] - mx) * (y[i] - my);
+        sxx += (x[i] - mx) * (x[i] - mx);
+        syy += (y[i] - my) * (y[i] - my);
+    }
+    return sxx > 0 && syy > 0 ? sxy / sqrt(sxx * syy) : NAN;
+}
+
+// whitespace separated values of a weights/<n>.txt map; false when the
+// file is missing or holds a different number of values
+bool loadPriorityGrid(const string &fileName, vector<float> &grid,
+                      size_t count) {
+    ifstream file(fileName.c_str());
+    if (!file) {
+        return false;
+    }
+    grid.clear();
+    float value;
+    while (file >> value) {
+        grid.push_back(value);
+    }
+    return grid.size() == count;
+}
+
+template <typename T>
+bool writeGrid(const string &fileName, const vector<MbStat> &mbs, int width,
+               T value) {
+    FILE *fp = fopen(fileName.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+    for (size_t i = 0; i < mbs.size(); i++) {
+        fprintf(fp, "%d%c", value(mbs[i]),
+                (int)(i % width) == width - 1 ? '\n' : ' ');
+    }
+    return fclose(fp) == 0;
+}
+
+class MbStatsRun {
+  public:
+    MbStatsRun(const MbStatsOptions &opts, const MappedFile &stream,
+               const vector<NalUnit> &nals, const vector<AccessUnit> &aus,
+               const vector<H264ParamSets> &paramSets,
+               const vector<Picture> &pictures)
+        : opts_(opts), stream_(stream), nals_(nals), aus_(aus),
+          paramSets_(paramSets), pictures_(pictures),
+          results_(pictures.size()), next_(0) {}
+
+    void Run(int threads);
+    const vector<FrameMbStats> &Results() const { return results_; }
+
+  private:
+    void Worker();
+    void Analyze(const Picture &pic, SliceParser &parser,
+                 vector<float> &priority, FrameMbStats &r);
+
+    const MbStatsOptions &opts_;
+    const MappedFile &stream_;
+    const vector<NalUnit> &nals_;
+    const vector<AccessUnit> &aus_;
+    const vector<H264ParamSets> &paramSets_;
+    const vector<Picture> &pictures_;
+    vector<FrameMbStats> results_;
+    atomic<size_t> next_;
+};
+
+void MbStatsRun::Run(int threads) {
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(&MbStatsRun::Worker, this);
+    }
+    Worker();
+    for (thread &t : workers) {
+        t.join();
+    }
+}
+
+void MbStatsRun::Worker() {
+    // per thread, so parsing allocates only on the first picture
+    SliceParser parser;
+    vector<float> priority;
+    size_t i;
+    while ((i = next_++) < pictures_.size()) {
+        const int64_t startUs = monotonicUs();
+        Analyze(pictures_[i], parser, priority, results_[i]);
+        results_[i].fParseUs = (double)(monotonicUs() - startUs);
+    }
+}
+
+void MbStatsRun::Analyze(const Picture &pic, SliceParser &parser,
+                         vector<float> &priority, FrameMbStats &r) {
+    const AccessUnit &au = aus_[pic.iAu];
+    const H264ParamSets &params = paramSets_[pic.iParamSets];
+    parser.Begin();
+    bool ok = true;
+    for (int n = au.iFirstNal; n < au.iFirstNal + au.iNalCount; n++) {
+        const NalUnit &nal = nals_[n];
+        // the AVC base layer only; SVC enhancement slices are type 20
+        if (nal.uiType != nalSliceNonIdr && nal.uiType != nalSliceIdr) {
+            continue;
+        }
+        r.bIdr |= nal.uiType == nalSliceIdr;
+        ok = parser.ParseSlice(stream_.Data() + nal.iOffset, nal.iSize,
+                               params) &&
+             ok;
+    }
+    const vector<MbStat> &mbs = parser.Mbs();
+    r.bParsed = ok && parser.Slices() > 0;
+    r.iSlices = parser.Slices();
+    r.uiHeaderBits = parser.HeaderBits();
+    if (!r.bParsed) {
+        return;
+    }
+
+    int64_t qpSum = 0;
+    int coded = 0;
+    r.iMinQp = 51;
+    for (const MbStat &mb : mbs) {
+        switch (mb.uiKind) {
+        case mbMissing:
+            r.iMissing++;
+            continue;
+        case mbSkip:
+            r.iSkip++;
+            break;
+        case mbInter:
+            r.iInter++;
+            break;
+        default:
+            r.iIntra++;
+            break;
+        }
+        r.uiBits += mb.uiBits;
+        qpSum += mb.iQp;
+        r.iMinQp = min(r.iMinQp, (int)mb.iQp);
+        r.iMaxQp = max(r.iMaxQp, (int)mb.iQp);
+        coded++;
+    }
+    r.fMeanQp = coded ? (double)qpSum / coded : 0;
+
+    const string frame = to_string(pic.iFrameNum);
+    if (!opts_.gridsDir.empty()) {
+        const int width = parser.WidthInMbs();
+        writeGrid(opts_.gridsDir + "/" + frame + ".bits.txt", mbs, width,
+                  [](const MbStat &mb) { return (int)mb.uiBits; });
+        writeGrid(opts_.gridsDir + "/" + frame + ".qp.txt", mbs, width,
+                  [](const MbStat &mb) { return (int)mb.iQp; });
+    }
+
+    // priority maps are in macroblock raster order like the picture
+    r.bHavePriority = loadPriorityGrid(opts_.weightsDir + "/" + frame + ".txt",
+                                       priority, mbs.size());
+    if (!r.bHavePriority) {
+        return;
+    }
+    vector<double> p, bits, qp;
+    p.reserve(coded);
+    bits.reserve(coded);
+    qp.reserve(coded);
+    for (size_t i = 0; i < mbs.size(); i++) {
+        if (mbs[i].uiKind != mbMissing) {
+            p.push_back(priority[i]);
+            bits.push_back(mbs[i].uiBits);
+            qp.push_back(mbs[i].iQp);
+        }
+    }
+    r.fBitsCorr = pearson(p, bits);
+    r.fQpCorr = pearson(p, qp);
+
+    vector<double> sorted = p;
+    const size_t q3 = sorted.size() * 3 / 4;
+    if (q3 < sorted.size() && r.uiBits > 0) {
+        nth_element(sorted.begin(), sorted.begin() + q3, sorted.end());
+        const double threshold = sorted[q3];
+        // in a map with few distinct levels the quartile falls on the
+        // lowest one; take what is above it then, nothing for a flat map
+        const bool strict =
+            threshold == *min_element(sorted.begin(), sorted.end());
+        double topBits = 0;
+        size_t top = 0;
+        for (size_t i = 0; i < p.size(); i++) {
+            if (strict ? p[i] > threshold : p[i] >= threshold) {
+                topBits += bits[i];
+                top++;
+            }
+        }
+        if (top > 0) {
+            r.fTopShare = topBits / r.uiBits;
+        }
+    }
+}
+
+bool writeCsv(const string &fileName, const vector<Picture> &pictures,
+              const vector<FrameMbStats> &results) {
+    FILE *fp = fopen(fileName.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+    fprintf(fp, "frame,idr,parsed,slices,mb_bits,header_bits,skip,inter,"
+                "intra,missing,mean_qp,min_qp,max_qp,corr_priority_bits,"
+                "corr_priority_qp,top_quartile_bits_share\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const FrameMbStats &r = results[i];
+        fprintf(fp,
+                "%d,%d,%d,%d,%llu,%llu,%d,%d,%d,%d,%.2f,%d,%d,%.4f,%.4f,"
+                "%.4f\n",
+                pictures[i].iFrameNum, r.bIdr, r.bParsed, r.iSlices,
+                (unsigned long long)r.uiBits,
+                (unsigned long long)r.uiHeaderBits, r.iSkip, r.iInter,
+                r.iIntra, r.iMissing, r.fMeanQp, r.iMinQp, r.iMaxQp,
+                r.fBitsCorr, r.fQpCorr, r.fTopShare);
+    }
+    return fclose(fp) == 0;
+}
+
+} // namespace
+
+bool parseMbStatsOptions(int argc, char const *argv[], MbStatsOptions &opts) {
+    for (int i = 3; i < argc; i++) {
+        const string key = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for option: " << key << '\n';
+            return false;
+        }
+        const string value = argv[++i];
+        if (key == "--weights") {
+            opts.weightsDir = value;
+        } else if (key == "--threads") {
+            opts.threads = max(0, parseInt(value));
+        } else if (key == "--grids") {
+            opts.gridsDir = value;
+        } else if (key == "--csv") {
+            opts.csvFile = value;
+        } else {
+            cerr << "Unknown option: " << key << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int runMbStats(const MbStatsOptions &opts) {
+    MappedFile stream;
+    if (!stream.Open(opts.stream)) {
+        cerr << "Cannot map " << opts.stream << '\n';
+        return 1;
+    }
+    if (!opts.gridsDir.empty()) {
+        std::filesystem::create_directories(opts.gridsDir);
+    }
+    const int threads =
+        opts.threads > 0 ? opts.threads
+                         : max(1, (int)thread::hardware_concurrency());
+    const int64_t startUs = monotonicUs();
+    vector<NalUnit> nals;
+    vector<AccessUnit> aus;
+    splitNalUnits(stream.Data(), stream.Size(), nals, threads);
+    groupAccessUnits(stream.Data(), nals, aus);
+
+    vector<BitstreamIndexEntry> index;
+    loadBitstreamIndex(opts.stream + bitstreamIndexSuffix, index);
+
+    // parameter sets are few and sequential: snapshot them whenever their
+    // bytes change so the pictures can be parsed in any order
+    vector<H264ParamSets> paramSets;
+    vector<Picture> pictures;
+    H264ParamSets active;
+    string lastParams, params;
+    int orphans = 0;
+    for (size_t a = 0; a < aus.size(); a++) {
+        const AccessUnit &au = aus[a];
+        params.clear();
+        bool haveSlice = false;
+        for (int n = au.iFirstNal; n < au.iFirstNal + au.iNalCount; n++) {
+            const NalUnit &nal = nals[n];
+            if (nal.uiType == nalSps || nal.uiType == nalPps) {
+                params.append((const char *)stream.Data() + nal.iOffset,
+                              nal.iSize);
+            }
+            haveSlice |= nal.uiType == nalSliceNonIdr ||
+                         nal.uiType == nalSliceIdr;
+        }
+        if (!params.empty() && params != lastParams) {
+            for (int n = au.iFirstNal; n < au.iFirstNal + au.iNalCount; n++) {
+                const NalUnit &nal = nals[n];
+                active.Add(stream.Data() + nal.iOffset, nal.iSize);
+            }
+            paramSets.push_back(active);
+            lastParams = params;
+        }
+        if (!haveSlice) {
+            continue;
+        }
+        if (paramSets.empty()) {
+            orphans++;
+            continue;
+        }
+        Picture pic;
+        pic.iAu = a;
+        pic.iParamSets = (int)paramSets.size() - 1;
+        pic.iFrameNum = (int)pictures.size() + 1;
+        // sidecar entries start where their access unit does
+        auto it = lower_bound(index.begin(), index.end(), au.iStart,
+                              [](const BitstreamIndexEntry &e, size_t pos) {
+                                  return e.uiOffset < pos;
+                              });
+        if (it != index.end() && it->uiOffset == au.iStart) {
+            pic.iFrameNum = it->iFrameNum;
+        }
+        pictures.push_back(pic);
+    }
+
+    MbStatsRun run(opts, stream, nals, aus, paramSets, pictures);
+    run.Run(threads);
+    const double seconds = (monotonicUs() - startUs) / 1e6;
+    const vector<FrameMbStats> &results = run.Results();
+
+    int parsed = 0, withPriority = 0, correlated = 0, shared = 0;
+    uint64_t bits = 0, headerBits = 0;
+    double bitsCorr = 0, qpCorr = 0, topShare = 0, qpSum = 0;
+    LatencyHistogram parseLatency;
+    for (const FrameMbStats &r : results) {
+        parseLatency.Record(r.fParseUs);
+        if (!r.bParsed) {
+            continue;
+        }
+        parsed++;
+        bits += r.uiBits;
+        headerBits += r.uiHeaderBits;
+        qpSum += r.fMeanQp;
+        withPriority += r.bHavePriority;
+        if (!std::isnan(r.fBitsCorr) && !std::isnan(r.fQpCorr)) {
+            bitsCorr += r.fBitsCorr;
+            qpCorr += r.fQpCorr;
+            correlated++;
+        }
+        if (!std::isnan(r.fTopShare)) {
+            topShare += r.fTopShare;
+            shared++;
+        }
+    }
+    const int failed = (int)results.size() - parsed + orphans;
+    cout << opts.stream << ": " << parsed << " of " << results.size() + orphans
+         << " pictures parsed in " << seconds * 1000 << " ms ("
+         << (seconds > 0 ? results.size() / seconds : 0) << " fps, "
+         << threads << " threads)" << endl;
+    if (failed) {
+        cout << "  " << failed
+             << " pictures not parsed (CABAC, 8x8 transform, B slices, "
+                "interlace or corrupt)"
+             << endl;
+    }
+    if (parsed) {
+        cout << "  " << (bits + headerBits) / 8 / parsed
+             << " bytes/frame, " << headerBits * 100.0 / (bits + headerBits)
+             << "% slice headers, mean QP " << qpSum / parsed << endl;
+    }
+    if (correlated) {
+        cout << "  priority vs bits r = " << bitsCorr / correlated
+             << ", priority vs QP r = " << qpCorr / correlated << " (mean of "
+             << correlated << " frames)";
+        if (shared) {
+            cout << ", top quartile holds " << topShare / shared * 100
+                 << "% of the bits";
+        }
+        cout << endl;
+    } else {
+        cout << "  no priority maps of the stream's size in "
+             << opts.weightsDir << endl;
+    }
+
+    const string csvFile =
+        opts.csvFile.empty() ? opts.stream + ".mbstats.csv" : opts.csvFile;
+    if (!writeCsv(csvFile, pictures, results)) {
+        cerr << "Failed to write " << csvFile << '\n';
+        return 1;
+    }
+    StatsReport report;
+    report.AddCounter("mbstats_pictures", (double)results.size() + orphans);
+    report.AddCounter("mbstats_parsed", parsed);
+    report.AddCounter("mbstats_with_priority", withPriority);
+    report.AddCounter("mbstats_mb_bits", (double)bits);
+    report.AddCounter("mbstats_header_bits", (double)headerBits);
+    report.AddCounter("mbstats_mean_qp", parsed ? qpSum / parsed : 0);
+    if (correlated) {
+        report.AddCounter("mbstats_corr_priority_bits", bitsCorr / correlated);
+        report.AddCounter("mbstats_corr_priority_qp", qpCorr / correlated);
+    }
+    if (shared) {
+        report.AddCounter("mbstats_top_quartile_bits_share",
+                          topShare / shared);
+    }
+    report.AddCounter("mbstats_seconds", seconds);
+    report.AddHistogram("mbstats_parse_latency", parseLatency);
+    const string statsFile = opts.stream + ".mbstats.stats.json";
+    if (!report.WriteJson(statsFile)) {
+        cerr << "Failed to write " << statsFile << '\n';
+    }
+    return failed ? 1 : 0;
+}
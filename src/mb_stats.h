@@ -0,0 +1,24 @@
+#ifndef __MB_STATS_H__
+#define __MB_STATS_H__
+
+#include <string>
+
+struct MbStatsOptions {
+    std::string stream;
+    std::string weightsDir; ///< <n>.txt priority maps, default weights/
+    int threads = 0;        ///< 0: one per hardware thread
+    std::string gridsDir;   ///< per-frame <n>.bits.txt and <n>.qp.txt
+    std::string csvFile;    ///< defaults to <stream>.mbstats.csv
+};
+
+// parses the flags following --mb-stats <stream.h264>
+bool parseMbStatsOptions(int argc, char const *argv[], MbStatsOptions &opts);
+
+// Parses the macroblock layer of every picture of a CAVLC stream, frames
+// spread over threads, and relates the bits and QP spent per macroblock to
+// the priority map the frame was encoded with. Frame numbers come from the
+// .idx sidecar when there is one (skipped frames), else count pictures.
+// Writes one CSV row per frame and a stats JSON summary.
+int runMbStats(const MbStatsOptions &opts);
+
+#endif //__MB_STATS_H__
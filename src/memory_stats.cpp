@@ -0,0 +1,229 @@
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define PSAPI_VERSION 2
+#include <windows.h>
+
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+atomic<uint64_t> allocs(0);
+atomic<uint64_t> allocBytes(0);
+
+void *countedAlloc(size_t size) {
+    allocs.fetch_add(1, memory_order_relaxed);
+    allocBytes.fetch_add(size, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *countedAlignedAlloc(size_t size, size_t align) {
+    allocs.fetch_add(1, memory_order_relaxed);
+    allocBytes.fetch_add(size, memory_order_relaxed);
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    void *p = nullptr;
+    return posix_memalign(&p, max(align, sizeof(void *)), size ? size : 1) == 0
+               ? p
+               : nullptr;
+#endif
+}
+
+void alignedFree(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+    void *p = countedAlloc(size);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const nothrow_t &) noexcept {
+    return countedAlloc(size);
+}
+void *operator new[](size_t size, const nothrow_t &) noexcept {
+    return countedAlloc(size);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+
+void *operator new(size_t size, align_val_t align) {
+    void *p = countedAlignedAlloc(size, (size_t)align);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+void *operator new[](size_t size, align_val_t align) {
+    return operator new(size, align);
+}
+void *operator new(size_t size, align_val_t align,
+                   const nothrow_t &) noexcept {
+    return countedAlignedAlloc(size, (size_t)align);
+}
+void *operator new[](size_t size, align_val_t align,
+                     const nothrow_t &) noexcept {
+    return countedAlignedAlloc(size, (size_t)align);
+}
+void operator delete(void *p, align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept {
+    alignedFree(p);
+}
+void operator delete[](void *p, size_t, align_val_t) noexcept {
+    alignedFree(p);
+}
+void operator delete(void *p, align_val_t, const nothrow_t &) noexcept {
+    alignedFree(p);
+}
+void operator delete[](void *p, align_val_t, const nothrow_t &) noexcept {
+    alignedFree(p);
+}
+
+AllocCounts allocCounts() {
+    AllocCounts counts = {allocs.load(memory_order_relaxed),
+                          allocBytes.load(memory_order_relaxed)};
+    return counts;
+}
+
+int64_t currentRssBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                                sizeof(counters))
+               ? (int64_t)counters.WorkingSetSize
+               : 0;
+#else
+    // the second field of statm is resident pages; read without the heap
+    const int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    char buf[128];
+    const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    char *end;
+    strtoll(buf, &end, 10);
+    return strtoll(end, nullptr, 10) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int64_t peakRssBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                                sizeof(counters))
+               ? (int64_t)counters.PeakWorkingSetSize
+               : 0;
+#else
+    struct rusage usage;
+    // kilobytes on Linux
+    return getrusage(RUSAGE_SELF, &usage) == 0
+               ? (int64_t)usage.ru_maxrss * 1024
+               : 0;
+#endif
+}
+
+AllocTracker::AllocTracker(int warmupFrames)
+    : warmupFrames_(warmupFrames), frames_(0), frameNum_(0), last_(),
+      warmup_(), steady_(), maxFrameAllocs_(0), firstAllocatingFrame_(0),
+      maxRssBytes_(0) {}
+
+void AllocTracker::CloseFrame(const AllocCounts &now) {
+    const uint64_t n = now.uiAllocs - last_.uiAllocs;
+    const uint64_t bytes = now.uiBytes - last_.uiBytes;
+    frames_++;
+    if (frames_ <= warmupFrames_) {
+        warmup_.uiAllocs += n;
+        warmup_.uiBytes += bytes;
+    } else {
+        steady_.uiAllocs += n;
+        steady_.uiBytes += bytes;
+        maxFrameAllocs_ = max(maxFrameAllocs_, n);
+        if (n && !firstAllocatingFrame_) {
+            firstAllocatingFrame_ = frameNum_;
+        }
+    }
+    maxRssBytes_ = max(maxRssBytes_, currentRssBytes());
+}
+
+void AllocTracker::FrameStart(int frameNum) {
+    const AllocCounts now = allocCounts();
+    if (frameNum_) {
+        CloseFrame(now);
+    }
+    frameNum_ = frameNum;
+    last_ = now;
+}
+
+void AllocTracker::StreamDone() {
+    if (frameNum_) {
+        CloseFrame(allocCounts());
+        frameNum_ = 0;
+    }
+}
+
+int64_t AllocTracker::PeakRssBytes() const {
+    // the OS and the samples may count shared pages differently
+    return max(peakRssBytes(), maxRssBytes_);
+}
+
+void AllocTracker::printSummary() const {
+    const int steadyFrames = max(0, frames_ - warmupFrames_);
+    cout << "Allocations: " << warmup_.uiAllocs << " (" << warmup_.uiBytes
+         << " bytes) in the first " << min(frames_, warmupFrames_)
+         << " frames, " << steady_.uiAllocs << " (" << steady_.uiBytes
+         << " bytes) in the " << steadyFrames << " after";
+    if (firstAllocatingFrame_) {
+        cout << ", first at frame " << firstAllocatingFrame_ << ", at most "
+             << maxFrameAllocs_ << " per frame";
+    }
+    cout << "; RSS " << maxRssBytes_ / 1048576.0 << " MB, peak "
+         << PeakRssBytes() / 1048576.0 << " MB" << endl;
+}
+
+void AllocTracker::AddToReport(StatsReport &report) const {
+    const int steadyFrames = max(0, frames_ - warmupFrames_);
+    report.AddCounter("alloc_warmup_count", (double)warmup_.uiAllocs);
+    report.AddCounter("alloc_warmup_bytes", (double)warmup_.uiBytes);
+    report.AddCounter("alloc_steady_count", (double)steady_.uiAllocs);
+    report.AddCounter("alloc_steady_bytes", (double)steady_.uiBytes);
+    report.AddCounter("alloc_steady_per_frame",
+                      steadyFrames ? (double)steady_.uiAllocs / steadyFrames
+                                   : 0);
+    report.AddCounter("alloc_max_per_frame", (double)maxFrameAllocs_);
+    report.AddCounter("rss_mb", maxRssBytes_ / 1048576.0);
+    report.AddCounter("peak_rss_mb", PeakRssBytes() / 1048576.0);
+}
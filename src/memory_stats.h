@@ -0,0 +1,58 @@
+#ifndef __MEMORY_STATS_H__
+#define __MEMORY_STATS_H__
+
+#include "stats.h"
+
+#include <stdint.h>
+
+// Process-wide count of heap allocations made through operator new, kept
+// by the replacement operators in memory_stats.cpp. It covers every
+// standard container and string of the harness; malloc from C code and
+// the allocations inside the openh264 DLL are not seen.
+struct AllocCounts {
+    uint64_t uiAllocs;
+    uint64_t uiBytes;
+};
+AllocCounts allocCounts();
+
+// resident set size of the process now and at its peak, 0 when unknown
+int64_t currentRssBytes();
+int64_t peakRssBytes();
+
+// Allocations and RSS across the frames of one encode. The harness calls
+// FrameStart before every frame; what was allocated since the previous
+// call is charged to that previous frame, whatever thread allocated it.
+// The first warmupFrames open files and size buffers, every later frame
+// is steady state and should allocate nothing.
+class AllocTracker {
+  public:
+    explicit AllocTracker(int warmupFrames = 2);
+    // never allocates
+    void FrameStart(int frameNum);
+    // closes the last frame
+    void StreamDone();
+
+    int Frames() const { return frames_; }
+    uint64_t SteadyAllocs() const { return steady_.uiAllocs; }
+    // first steady-state frame that allocated, 0 when none did
+    int FirstAllocatingFrame() const { return firstAllocatingFrame_; }
+
+    void printSummary() const;
+    void AddToReport(StatsReport &report) const;
+
+  private:
+    void CloseFrame(const AllocCounts &now);
+    int64_t PeakRssBytes() const;
+
+    int warmupFrames_;
+    int frames_;
+    int frameNum_; ///< frame being charged, 0 before the first
+    AllocCounts last_;
+    AllocCounts warmup_;
+    AllocCounts steady_;
+    uint64_t maxFrameAllocs_;
+    int firstAllocatingFrame_;
+    int64_t maxRssBytes_;
+};
+
+#endif //__MEMORY_STATS_H__
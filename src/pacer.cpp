@@ -0,0 +1,79 @@
+#include "pacer.h"
+#include "timing.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+FramePacer::FramePacer(float fps, bool dropLate)
+    : fps_(fps), dropLate_(dropLate), intervalUs_((int64_t)(1e6 / fps)),
+      startUs_(0), encodeStartUs_(0), encoded_(0), dropped_(0),
+      skippedByEncoder_(0), deadlineMisses_(0) {}
+
+int64_t FramePacer::ReleaseUs(int frameNum) const {
+    return startUs_ + (int64_t)((frameNum - 1) * 1e6 / fps_);
+}
+
+long long FramePacer::TimestampMs(int frameNum) const {
+    return (long long)((frameNum - 1) * 1000.0 / fps_);
+}
+
+bool FramePacer::WaitForRelease(int frameNum) {
+    if (frameNum == 1) {
+        startUs_ = monotonicUs();
+    }
+    const int64_t releaseUs = ReleaseUs(frameNum);
+    int64_t nowUs = monotonicUs();
+    if (nowUs < releaseUs) {
+        this_thread::sleep_until(chrono::steady_clock::time_point(
+            chrono::microseconds(releaseUs)));
+        nowUs = monotonicUs();
+    } else if (dropLate_ && nowUs - releaseUs >= intervalUs_) {
+        dropped_++;
+        return false;
+    }
+    queueDelay_.Record((double)(nowUs - releaseUs));
+    encodeStartUs_ = nowUs;
+    return true;
+}
+
+void FramePacer::FrameEncoded(int frameNum, const SFrameBSInfo &info) {
+    const int64_t doneUs = monotonicUs();
+    const int64_t latencyUs = doneUs - ReleaseUs(frameNum);
+    latency_.Record((double)latencyUs);
+    encodeTime_.Record((double)(doneUs - encodeStartUs_));
+    if (latencyUs > intervalUs_) {
+        deadlineMisses_++;
+    }
+    if (info.eFrameType == videoFrameTypeSkip) {
+        skippedByEncoder_++;
+    } else {
+        encoded_++;
+    }
+}
+
+void FramePacer::printSummary() const {
+    const int frames = encoded_ + skippedByEncoder_ + dropped_;
+    cout << "Paced " << fps_ << " fps: " << frames << " frames, " << encoded_
+         << " encoded, " << dropped_ << " dropped, " << skippedByEncoder_
+         << " skipped by rate control, " << deadlineMisses_
+         << " deadline misses" << endl;
+    cout << "  capture-to-bitstream latency p50 " << latency_.Percentile(50)
+         << " us, p99 " << latency_.Percentile(99) << " us, max "
+         << latency_.Max() << " us (budget " << intervalUs_ << " us)"
+         << endl;
+}
+
+void FramePacer::AddToReport(StatsReport &report) const {
+    report.AddCounter("paced_fps", fps_);
+    report.AddCounter("frames_encoded", encoded_);
+    report.AddCounter("frames_dropped", dropped_);
+    report.AddCounter("frames_skipped_by_rc", skippedByEncoder_);
+    report.AddCounter("deadline_misses", deadlineMisses_);
+    report.AddCounter("deadline_us", (double)intervalUs_);
+    report.AddHistogram("capture_to_bitstream", latency_);
+    report.AddHistogram("encode_frame", encodeTime_);
+    report.AddHistogram("release_to_encode", queueDelay_);
+}
@@ -0,0 +1,46 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include "stats.h"
+
+#include <wels/codec_app_def.h>
+
+#include <stdint.h>
+
+// Releases frames on a monotonic 1/fps schedule, as a camera would, and
+// accounts capture-to-bitstream latency against that schedule. A frame
+// misses its deadline when its bitstream is not ready by the release of
+// the next frame. With dropLate, a frame that is already a full interval
+// old when the encoder gets to it is discarded, like a capture queue of
+// depth one.
+class FramePacer {
+  public:
+    FramePacer(float fps, bool dropLate);
+
+    // blocks until the release time; false if the frame should be dropped
+    bool WaitForRelease(int frameNum);
+    // media timestamp of the frame in milliseconds, for uiTimeStamp
+    long long TimestampMs(int frameNum) const;
+    void FrameEncoded(int frameNum, const SFrameBSInfo &info);
+
+    void printSummary() const;
+    void AddToReport(StatsReport &report) const;
+
+  private:
+    int64_t ReleaseUs(int frameNum) const;
+
+    float fps_;
+    bool dropLate_;
+    int64_t intervalUs_;
+    int64_t startUs_;
+    int64_t encodeStartUs_;
+    int encoded_;
+    int dropped_;
+    int skippedByEncoder_;
+    int deadlineMisses_;
+    LatencyHistogram latency_;
+    LatencyHistogram encodeTime_;
+    LatencyHistogram queueDelay_;
+};
+
+#endif //__PACER_H__
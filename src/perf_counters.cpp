@@ -0,0 +1,187 @@
+#include "perf_counters.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char *const stageNames[stageCount] = {"read", "priorities", "encode",
+                                            "callback"};
+
+#ifdef __linux__
+const uint64_t eventConfigs[PerfCounterGroup::eventCount] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+int openEvent(uint64_t config, int groupFd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // user space only, which perf_event_paranoid 2 still allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+#endif
+
+} // namespace
+
+PerfCounterGroup::PerfCounterGroup() : leader_(-1), members_(0) {
+    for (int e = 0; e < eventCount; e++) {
+        fds_[e] = slots_[e] = -1;
+    }
+}
+
+PerfCounterGroup::~PerfCounterGroup() {
+#ifdef __linux__
+    for (int e = 0; e < eventCount; e++) {
+        if (fds_[e] >= 0) {
+            close(fds_[e]);
+        }
+    }
+#endif
+}
+
+bool PerfCounterGroup::Open() {
+#ifdef __linux__
+    for (int e = 0; e < eventCount; e++) {
+        fds_[e] = openEvent(eventConfigs[e], leader_);
+        if (fds_[e] < 0) {
+            continue;
+        }
+        if (leader_ < 0) {
+            leader_ = fds_[e];
+        }
+        slots_[e] = members_++;
+    }
+#endif
+    return Available();
+}
+
+void PerfCounterGroup::Read(Sample &sample) const {
+    memset(&sample, 0, sizeof(sample));
+#ifdef __linux__
+    if (leader_ < 0) {
+        return;
+    }
+    // nr, time enabled, time running, then one value per member
+    uint64_t buf[3 + eventCount];
+    const ssize_t n = read(leader_, buf, sizeof(buf));
+    if (n < (ssize_t)(sizeof(uint64_t) * (3 + members_))) {
+        return;
+    }
+    const double scale =
+        buf[2] && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0;
+    for (int e = 0; e < eventCount; e++) {
+        if (slots_[e] >= 0) {
+            sample.values[e] = (uint64_t)(buf[3 + slots_[e]] * scale);
+        }
+    }
+#endif
+}
+
+StageProfiler::StageProfiler(const string &name)
+    : name_(name), opened_{false, false} {}
+
+PerfCounterGroup &StageProfiler::GroupOf(PipelineStage stage) {
+    const int g = stage == stageRead || stage == stagePriorities ? 1 : 0;
+    if (!opened_[g]) {
+        // on the thread that runs the stage
+        groups_[g].Open();
+        opened_[g] = true;
+    }
+    return groups_[g];
+}
+
+void StageProfiler::Begin(PipelineStage stage) {
+    Stage &s = stages_[stage];
+    GroupOf(stage).Read(s.start);
+    s.iStartUs = monotonicUs();
+}
+
+void StageProfiler::End(PipelineStage stage) {
+    Stage &s = stages_[stage];
+    const int64_t us = monotonicUs() - s.iStartUs;
+    PerfCounterGroup::Sample now;
+    GroupOf(stage).Read(now);
+    s.hist.Record((double)us);
+    for (int e = 0; e < PerfCounterGroup::eventCount; e++) {
+        s.total.values[e] += now.values[e] - s.start.values[e];
+    }
+}
+
+void StageProfiler::printSummary() const {
+    const bool counters = groups_[0].Available() || groups_[1].Available();
+    cout << "Stages of " << name_ << (counters ? "" : " (no hardware counters)")
+         << ":" << endl;
+    for (int st = 0; st < stageCount; st++) {
+        const Stage &s = stages_[st];
+        if (!s.hist.Count()) {
+            continue;
+        }
+        const double calls = (double)s.hist.Count();
+        cout << "  " << stageNames[st] << ": " << s.hist.Count()
+             << " calls, mean " << s.hist.Mean() << " us, p99 "
+             << s.hist.Percentile(99) << " us";
+        const uint64_t *v = s.total.values;
+        if (v[PerfCounterGroup::cycles]) {
+            cout << ", IPC "
+                 << (double)v[PerfCounterGroup::instructions] /
+                        v[PerfCounterGroup::cycles]
+                 << ", " << v[PerfCounterGroup::cacheMisses] / calls
+                 << " cache and " << v[PerfCounterGroup::branchMisses] / calls
+                 << " branch misses per call";
+        }
+        cout << endl;
+    }
+}
+
+void StageProfiler::AddToReport(StatsReport &report) const {
+    const int g[stageCount] = {1, 1, 0, 0};
+    report.AddCounter(name_ + "_perf_counters",
+                      groups_[0].Available() || groups_[1].Available());
+    for (int st = 0; st < stageCount; st++) {
+        const Stage &s = stages_[st];
+        if (!s.hist.Count()) {
+            continue;
+        }
+        const string prefix = name_ + "_" + stageNames[st];
+        report.AddHistogram(prefix + "_us", s.hist);
+        const PerfCounterGroup &group = groups_[g[st]];
+        const uint64_t *v = s.total.values;
+        const double calls = (double)s.hist.Count();
+        if (group.Has(PerfCounterGroup::cycles) &&
+            group.Has(PerfCounterGroup::instructions) &&
+            v[PerfCounterGroup::cycles]) {
+            report.AddCounter(prefix + "_ipc",
+                              (double)v[PerfCounterGroup::instructions] /
+                                  v[PerfCounterGroup::cycles]);
+        }
+        if (group.Has(PerfCounterGroup::cycles)) {
+            report.AddCounter(prefix + "_cycles_per_call",
+                              v[PerfCounterGroup::cycles] / calls);
+        }
+        if (group.Has(PerfCounterGroup::cacheMisses)) {
+            report.AddCounter(prefix + "_cache_misses_per_call",
+                              v[PerfCounterGroup::cacheMisses] / calls);
+        }
+        if (group.Has(PerfCounterGroup::branchMisses)) {
+            report.AddCounter(prefix + "_branch_misses_per_call",
+                              v[PerfCounterGroup::branchMisses] / calls);
+        }
+    }
+}
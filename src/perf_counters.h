@@ -0,0 +1,82 @@
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include "stats.h"
+
+#include <stdint.h>
+#include <string>
+
+// Hardware counters of the calling thread through perf_event_open, one
+// group read with a single syscall. Without them (not Linux, no
+// permission, a VM without a PMU) Available() is false and Read() gives
+// zeros; an event the CPU lacks is left out of the group and Has() says so.
+class PerfCounterGroup {
+  public:
+    enum Event { cycles, instructions, cacheMisses, branchMisses, eventCount };
+    struct Sample {
+        uint64_t values[eventCount];
+    };
+
+    PerfCounterGroup();
+    ~PerfCounterGroup();
+    PerfCounterGroup(const PerfCounterGroup &) = delete;
+    PerfCounterGroup &operator=(const PerfCounterGroup &) = delete;
+
+    // counts the calling thread from now on, user space only
+    bool Open();
+    bool Available() const { return leader_ >= 0; }
+    bool Has(Event e) const { return fds_[e] >= 0; }
+    // totals so far, scaled up when the kernel multiplexed the group
+    void Read(Sample &sample) const;
+
+  private:
+    int leader_; ///< fd of the first event that opened
+    int fds_[eventCount];
+    int slots_[eventCount]; ///< position in the group read
+    int members_;
+};
+
+// The stages of BaseEncoderTest::EncodeStream. Reads and priorities run
+// on the prefetch thread, the other two on the encoding thread.
+enum PipelineStage {
+    stageRead,
+    stagePriorities, ///< weights/<n>.txt parsing or a priority source
+    stageEncode,     ///< ISVCEncoder::EncodeFrame
+    stageCallback,   ///< onEncodeFrame and onFrameDone
+    stageCount,
+};
+
+// Wall time and hardware counters of every stage of one encoder instance.
+// Begin/End bracket a stage on the thread that runs it; the counter group
+// of each thread is opened there the first time. Nothing allocates after
+// construction, so profiling keeps the encode loop allocation free.
+class StageProfiler {
+  public:
+    // name prefixes the report entries, e.g. "encode" or "left"
+    explicit StageProfiler(const std::string &name);
+
+    void Begin(PipelineStage stage);
+    void End(PipelineStage stage);
+
+    void printSummary() const;
+    // <name>_<stage>_us histograms next to the timing ones, and per stage
+    // IPC and cache and branch misses per call when counters work
+    void AddToReport(StatsReport &report) const;
+
+  private:
+    struct Stage {
+        LatencyHistogram hist;
+        int64_t iStartUs = 0;
+        PerfCounterGroup::Sample start = {};
+        PerfCounterGroup::Sample total = {};
+    };
+    PerfCounterGroup &GroupOf(PipelineStage stage);
+
+    std::string name_;
+    // 0: encoding thread, 1: prefetch thread
+    PerfCounterGroup groups_[2];
+    bool opened_[2];
+    Stage stages_[stageCount];
+};
+
+#endif //__PERF_COUNTERS_H__
@@ -0,0 +1,120 @@
+// Mock priority-map producer for the --priority-socket path. It stands in
+// for the eye-tracking/saliency process: a gaze point circles the picture
+// and a foveated map is sent for every frame on the real-time schedule,
+// optionally late (jitter) or not at all (drop rate).
+
+#include "gaze_priority.h"
+#include "priority_socket.h"
+#include "socket_util.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+void printUsage(const char *prog) {
+    cerr << "Usage: " << prog << " <socketPath> [options]\n"
+         << "  --fps <f>          map rate (default 60)\n"
+         << "  --frames <n>       maps to send (default 600)\n"
+         << "  --grid <w>x<h>     grid size in MBs (default 114x120)\n"
+         << "  --delay-ms <d>     fixed lag behind the frame time\n"
+         << "  --jitter-ms <j>    extra uniform random lag in [0, j]\n"
+         << "  --drop <p>         probability of skipping a map\n";
+}
+
+int main(int argc, char const *argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const string socketPath = argv[1];
+    float fps = 60;
+    int frames = 600;
+    int widthInMb = 114, heightInMb = 120;
+    float delayMs = 0, jitterMs = 0, dropRate = 0;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const string key = argv[i];
+        const char *value = argv[i + 1];
+        if (key == "--fps") {
+            fps = (float)atof(value);
+        } else if (key == "--frames") {
+            frames = atoi(value);
+        } else if (key == "--grid") {
+            if (sscanf(value, "%dx%d", &widthInMb, &heightInMb) != 2) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (key == "--delay-ms") {
+            delayMs = (float)atof(value);
+        } else if (key == "--jitter-ms") {
+            jitterMs = (float)atof(value);
+        } else if (key == "--drop") {
+            dropRate = (float)atof(value);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the encoder owns the socket; give it a few seconds to come up
+    SocketHandle s = invalidSocket;
+    for (int attempt = 0; attempt < 100 && s == invalidSocket; attempt++) {
+        s = connectUnix(socketPath);
+        if (s == invalidSocket) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+        }
+    }
+    if (s == invalidSocket) {
+        cerr << "Cannot connect to " << socketPath << endl;
+        return 1;
+    }
+
+    FoveationModel model;
+    GazePrioritySource generator(vector<GazeSample>(), model, widthInMb * 16,
+                                 heightInMb * 16, fps);
+    vector<float> priorities(widthInMb * heightInMb);
+    PriorityMapHeader hdr;
+    hdr.uiMagic = priorityMapMagic;
+    hdr.uiWidthInMb = widthInMb;
+    hdr.uiHeightInMb = heightInMb;
+    hdr.uiReserved = 0;
+
+    mt19937 rng(1);
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    int sent = 0, dropped = 0;
+    const int64_t startUs = monotonicUs();
+    for (int k = 0; k < frames; k++) {
+        const int64_t frameUs = (int64_t)(k * 1e6 / fps);
+        const float lagMs = delayMs + jitterMs * uniform(rng);
+        if (uniform(rng) < dropRate) {
+            dropped++;
+            continue;
+        }
+        this_thread::sleep_until(
+            chrono::steady_clock::time_point(chrono::microseconds(
+                startUs + frameUs + (int64_t)(lagMs * 1000))));
+
+        const float phase = 6.2831853f * k / (2 * fps);
+        generator.ComputeGrid(0.5f + 0.3f * cosf(phase),
+                              0.5f + 0.3f * sinf(phase), priorities.data());
+        hdr.iTimestampUs = frameUs;
+        hdr.iSendTimeUs = monotonicUs();
+        if (!sendAll(s, &hdr, sizeof(hdr)) ||
+            !sendAll(s, priorities.data(), priorities.size() * sizeof(float))) {
+            cerr << "Encoder closed the connection after " << sent << " maps"
+                 << endl;
+            break;
+        }
+        sent++;
+    }
+    closeSocket(s);
+    cout << "Sent " << sent << " maps, dropped " << dropped << endl;
+    return 0;
+}
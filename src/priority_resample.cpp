@@ -0,0 +1,159 @@
+#include "priority_resample.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// taps of dst macroblocks of a picture scaled from srcPic to dstPic
+// samples, over a source grid of srcMb macroblocks
+ResampleTaps makeTaps(int srcMb, int srcPic, int dstPic,
+                      ResampleFilter filter) {
+    const int dstMb = (dstPic + 15) >> 4;
+    // source macroblocks per destination macroblock
+    const double s = (double)srcPic / dstPic;
+    ResampleTaps taps;
+    taps.first.resize(dstMb);
+    taps.offset.resize(dstMb + 1);
+    for (int d = 0; d < dstMb; d++) {
+        const size_t begin = taps.weight.size();
+        taps.offset[d] = (int32_t)begin;
+        if (filter == resampleBilinear) {
+            const double c =
+                max(0.0, min((d + 0.5) * s - 0.5, (double)(srcMb - 1)));
+            const int i = (int)c;
+            const double f = c - i;
+            taps.first[d] = i;
+            taps.weight.push_back((float)(1 - f));
+            if (f > 0 && i + 1 < srcMb) {
+                taps.weight.push_back((float)f);
+            }
+            continue;
+        }
+        const double x0 = d * s;
+        const double x1 = min((d + 1) * s, (double)srcMb);
+        if (x1 <= x0) {
+            // padding past the source grid takes its last macroblock
+            taps.first[d] = min((int)x0, srcMb - 1);
+            taps.weight.push_back(1);
+            continue;
+        }
+        taps.first[d] = (int)x0;
+        double sum = 0;
+        for (int x = (int)x0; x < x1; x++) {
+            const double w = min(x1, x + 1.0) - max(x0, (double)x);
+            taps.weight.push_back(filter == resampleMax ? 1 : (float)w);
+            sum += w;
+        }
+        if (filter == resampleArea) {
+            for (size_t k = begin; k < taps.weight.size(); k++) {
+                taps.weight[k] = (float)(taps.weight[k] / sum);
+            }
+        }
+    }
+    taps.offset[dstMb] = (int32_t)taps.weight.size();
+    return taps;
+}
+
+// row pass: dst = w * src, plus dst after the first row; max when pooling
+void weightRow(const float *src, float w, bool first, bool pool, float *dst,
+               int n) {
+    int i = 0;
+#ifdef HAVE_SSE2
+    const __m128 wv = _mm_set1_ps(w);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 s = _mm_loadu_ps(src + i);
+        __m128 d;
+        if (first) {
+            d = pool ? s : _mm_mul_ps(s, wv);
+        } else {
+            const __m128 acc = _mm_loadu_ps(dst + i);
+            d = pool ? _mm_max_ps(acc, s) : _mm_add_ps(acc, _mm_mul_ps(s, wv));
+        }
+        _mm_storeu_ps(dst + i, d);
+    }
+#endif
+    for (; i < n; i++) {
+        if (first) {
+            dst[i] = pool ? src[i] : src[i] * w;
+        } else {
+            dst[i] = pool ? max(dst[i], src[i]) : dst[i] + src[i] * w;
+        }
+    }
+}
+
+} // namespace
+
+bool parseResampleFilter(const string &name, ResampleFilter &filter) {
+    for (int f = resampleArea; f <= resampleMax; f++) {
+        if (name == resampleFilterName((ResampleFilter)f)) {
+            filter = (ResampleFilter)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *resampleFilterName(ResampleFilter filter) {
+    switch (filter) {
+    case resampleBilinear:
+        return "bilinear";
+    case resampleMax:
+        return "max";
+    default:
+        return "area";
+    }
+}
+
+PriorityResampler::PriorityResampler(int srcPicWidth, int srcPicHeight,
+                                     int dstPicWidth, int dstPicHeight,
+                                     ResampleFilter filter)
+    : srcPicWidth_(srcPicWidth), srcPicHeight_(srcPicHeight),
+      dstPicWidth_(dstPicWidth), dstPicHeight_(dstPicHeight),
+      filter_(filter), srcWidthInMb_((srcPicWidth + 15) >> 4),
+      srcHeightInMb_((srcPicHeight + 15) >> 4),
+      dstWidthInMb_((dstPicWidth + 15) >> 4),
+      dstHeightInMb_((dstPicHeight + 15) >> 4),
+      x_(makeTaps(srcWidthInMb_, srcPicWidth, dstPicWidth, filter)),
+      y_(makeTaps(srcHeightInMb_, srcPicHeight, dstPicHeight, filter)),
+      row_(srcWidthInMb_) {}
+
+bool PriorityResampler::Matches(int srcPicWidth, int srcPicHeight,
+                                int dstPicWidth, int dstPicHeight,
+                                ResampleFilter filter) const {
+    return srcPicWidth == srcPicWidth_ && srcPicHeight == srcPicHeight_ &&
+           dstPicWidth == dstPicWidth_ && dstPicHeight == dstPicHeight_ &&
+           filter == filter_;
+}
+
+void PriorityResampler::Resample(const float *src, float *dst) {
+    if (srcPicWidth_ == dstPicWidth_ && srcPicHeight_ == dstPicHeight_) {
+        memcpy(dst, src, sizeof(float) * srcWidthInMb_ * srcHeightInMb_);
+        return;
+    }
+    const bool pool = filter_ == resampleMax;
+    float *row = row_.data();
+    for (int dy = 0; dy < dstHeightInMb_; dy++) {
+        const float *wy = y_.weight.data() + y_.offset[dy];
+        const int ny = y_.offset[dy + 1] - y_.offset[dy];
+        const float *s = src + (size_t)y_.first[dy] * srcWidthInMb_;
+        for (int k = 0; k < ny; k++, s += srcWidthInMb_) {
+            weightRow(s, wy[k], k == 0, pool, row, srcWidthInMb_);
+        }
+
+        float *out = dst + (size_t)dy * dstWidthInMb_;
+        for (int dx = 0; dx < dstWidthInMb_; dx++) {
+            const float *wx = x_.weight.data() + x_.offset[dx];
+            const int nx = x_.offset[dx + 1] - x_.offset[dx];
+            const float *r = row + x_.first[dx];
+            float v = pool ? r[0] : r[0] * wx[0];
+            for (int k = 1; k < nx; k++) {
+                v = pool ? max(v, r[k]) : v + r[k] * wx[k];
+            }
+            out[dx] = v;
+        }
+    }
+}
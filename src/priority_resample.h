@@ -0,0 +1,62 @@
+#ifndef __PRIORITY_RESAMPLE_H__
+#define __PRIORITY_RESAMPLE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum ResampleFilter {
+    resampleArea,     ///< mean weighted by overlap, the default
+    resampleBilinear, ///< between the two nearest macroblock centres
+    resampleMax,      ///< the highest covered priority, keeps small peaks
+};
+
+// "area", "bilinear" or "max"
+bool parseResampleFilter(const std::string &name, ResampleFilter &filter);
+const char *resampleFilterName(ResampleFilter filter);
+
+// The source macroblocks feeding every destination macroblock along one
+// axis. They are consecutive, so a first index and the weights suffice.
+struct ResampleTaps {
+    std::vector<int32_t> first;  ///< per destination macroblock
+    std::vector<int32_t> offset; ///< into weight, one more than first
+    std::vector<float> weight;   ///< summing to 1, all 1 for max
+};
+
+// Maps a priority grid made for one picture size onto the macroblock grid
+// of another, both padded to whole macroblocks like the encoder pads the
+// picture, so the padding macroblocks of both grids line up. The filter is
+// separable: a vertical pass combines source rows into a scratch row, four
+// macroblocks per SSE2 step, and a horizontal pass applies the taps of
+// each destination macroblock. The taps are built here; Resample never
+// allocates. The scratch row makes a resampler single-threaded.
+class PriorityResampler {
+  public:
+    PriorityResampler(int srcPicWidth, int srcPicHeight, int dstPicWidth,
+                      int dstPicHeight, ResampleFilter filter);
+
+    bool Matches(int srcPicWidth, int srcPicHeight, int dstPicWidth,
+                 int dstPicHeight, ResampleFilter filter) const;
+    int SrcWidthInMb() const { return srcWidthInMb_; }
+    int SrcHeightInMb() const { return srcHeightInMb_; }
+    int DstWidthInMb() const { return dstWidthInMb_; }
+    int DstHeightInMb() const { return dstHeightInMb_; }
+
+    void Resample(const float *src, float *dst);
+
+  private:
+    int srcPicWidth_;
+    int srcPicHeight_;
+    int dstPicWidth_;
+    int dstPicHeight_;
+    ResampleFilter filter_;
+    int srcWidthInMb_;
+    int srcHeightInMb_;
+    int dstWidthInMb_;
+    int dstHeightInMb_;
+    ResampleTaps x_;
+    ResampleTaps y_;
+    std::vector<float> row_;
+};
+
+#endif //__PRIORITY_RESAMPLE_H__
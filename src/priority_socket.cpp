@@ -0,0 +1,213 @@
+#include "priority_socket.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+
+const int ringSize = 8;
+const int64_t emptySlot = numeric_limits<int64_t>::min();
+
+SocketPrioritySource::SocketPrioritySource(const string &socketPath,
+                                           int widthInMb, int heightInMb,
+                                           float fps, int64_t deadlineUs,
+                                           float defaultPriority)
+    : socketPath_(socketPath), widthInMb_(widthInMb), heightInMb_(heightInMb),
+      fps_(fps), deadlineUs_(deadlineUs), defaultPriority_(defaultPriority),
+      listener_(invalidSocket), conn_(invalidSocket), stopping_(false),
+      next_(0), newestUs_(emptySlot), haveLastValid_(false) {
+    ring_.resize(ringSize);
+    for (auto &slot : ring_) {
+        slot.iTimestampUs = emptySlot;
+        slot.bUsed = false;
+        slot.priorities.resize(widthInMb_ * heightInMb_);
+    }
+    lastValid_.resize(widthInMb_ * heightInMb_);
+}
+
+SocketPrioritySource::~SocketPrioritySource() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+        shutdownSocket(conn_);
+    }
+    shutdownSocket(listener_);
+    if (receiver_.joinable()) {
+        receiver_.join();
+    }
+    closeSocket(listener_);
+    remove(socketPath_.c_str());
+}
+
+bool SocketPrioritySource::Start() {
+    listener_ = listenUnix(socketPath_);
+    if (listener_ == invalidSocket) {
+        return false;
+    }
+    receiver_ = thread(&SocketPrioritySource::ReceiveLoop, this);
+    return true;
+}
+
+void SocketPrioritySource::ReceiveLoop() {
+    const size_t mapSize = widthInMb_ * heightInMb_;
+    vector<float> staging(mapSize);
+    while (true) {
+        SocketHandle c = acceptSocket(listener_);
+        if (c == invalidSocket) {
+            break;
+        }
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (stopping_) {
+                closeSocket(c);
+                break;
+            }
+            conn_ = c;
+        }
+
+        PriorityMapHeader hdr;
+        while (recvAll(c, &hdr, sizeof(hdr))) {
+            const int64_t arrivalUs = monotonicUs();
+            if (hdr.uiMagic != priorityMapMagic) {
+                // framing is lost, make the producer reconnect
+                lock_guard<mutex> lock(mutex_);
+                stats_.iRejected++;
+                break;
+            }
+            const size_t count = (size_t)hdr.uiWidthInMb * hdr.uiHeightInMb;
+            if (count != mapSize) {
+                bool ok = true;
+                for (size_t left = count; ok && left > 0;) {
+                    size_t n = min(left, mapSize);
+                    ok = recvAll(c, staging.data(), n * sizeof(float));
+                    left -= n;
+                }
+                lock_guard<mutex> lock(mutex_);
+                stats_.iRejected++;
+                if (!ok) {
+                    break;
+                }
+                continue;
+            }
+            if (!recvAll(c, staging.data(), mapSize * sizeof(float))) {
+                break;
+            }
+
+            lock_guard<mutex> lock(mutex_);
+            Slot &slot = ring_[next_];
+            if (slot.iTimestampUs != emptySlot && !slot.bUsed) {
+                stats_.iDropped++;
+            }
+            slot.iTimestampUs = hdr.iTimestampUs;
+            slot.bUsed = false;
+            slot.priorities.swap(staging);
+            next_ = (next_ + 1) % ringSize;
+            newestUs_ = max(newestUs_, hdr.iTimestampUs);
+            stats_.iReceived++;
+            stats_.fTransportUs += (double)(arrivalUs - hdr.iSendTimeUs);
+            arrived_.notify_all();
+        }
+
+        lock_guard<mutex> lock(mutex_);
+        conn_ = invalidSocket;
+        closeSocket(c);
+        if (stopping_) {
+            break;
+        }
+    }
+}
+
+// closest map within toleranceUs of the frame, -1 if there is none.
+// Caller holds mutex_.
+int SocketPrioritySource::FindSlot(int64_t timestampUs,
+                                   int64_t toleranceUs) const {
+    int best = -1;
+    int64_t bestDist = numeric_limits<int64_t>::max();
+    for (int k = 0; k < ringSize; k++) {
+        const int64_t ts = ring_[k].iTimestampUs;
+        if (ts == emptySlot) {
+            continue;
+        }
+        int64_t dist = ts > timestampUs ? ts - timestampUs : timestampUs - ts;
+        if (dist <= toleranceUs && dist < bestDist) {
+            best = k;
+            bestDist = dist;
+        }
+    }
+    return best;
+}
+
+bool SocketPrioritySource::fillPriorityArray(int frameNum,
+                                             const SSourcePicture &pic,
+                                             float *priorityArray) {
+    const int64_t frameUs = (int64_t)((frameNum - 1) * 1e6 / fps_);
+    const int64_t toleranceUs = (int64_t)(0.5e6 / fps_);
+    const size_t mapSize = widthInMb_ * heightInMb_;
+    const int64_t startUs = monotonicUs();
+
+    unique_lock<mutex> lock(mutex_);
+    arrived_.wait_until(
+        lock, chrono::steady_clock::now() + chrono::microseconds(deadlineUs_),
+        [&] {
+            return newestUs_ != emptySlot &&
+                   newestUs_ >= frameUs - toleranceUs;
+        });
+    stats_.fWaitUs += (double)(monotonicUs() - startUs);
+
+    int k = FindSlot(frameUs, toleranceUs);
+    if (k >= 0) {
+        ring_[k].bUsed = true;
+        memcpy(lastValid_.data(), ring_[k].priorities.data(),
+               mapSize * sizeof(float));
+        haveLastValid_ = true;
+        stats_.iAligned++;
+    } else {
+        // late or missing map: prefer the newest one not ahead of the frame
+        int fallback = -1;
+        for (int j = 0; j < ringSize; j++) {
+            const int64_t ts = ring_[j].iTimestampUs;
+            if (ts != emptySlot && ts <= frameUs &&
+                (fallback < 0 || ts > ring_[fallback].iTimestampUs)) {
+                fallback = j;
+            }
+        }
+        if (fallback >= 0) {
+            ring_[fallback].bUsed = true;
+            memcpy(lastValid_.data(), ring_[fallback].priorities.data(),
+                   mapSize * sizeof(float));
+            haveLastValid_ = true;
+        }
+        if (haveLastValid_) {
+            stats_.iDeadlineMisses++;
+        } else {
+            stats_.iNoMap++;
+            fill(priorityArray, priorityArray + mapSize, defaultPriority_);
+            return true;
+        }
+    }
+    memcpy(priorityArray, lastValid_.data(), mapSize * sizeof(float));
+    return true;
+}
+
+PrioritySocketStats SocketPrioritySource::Stats() {
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void SocketPrioritySource::printSummary() {
+    PrioritySocketStats st = Stats();
+    const int frames = st.iAligned + st.iDeadlineMisses + st.iNoMap;
+    cout << "Live priority maps: received " << st.iReceived << ", aligned "
+         << st.iAligned << "/" << frames << ", deadline misses "
+         << st.iDeadlineMisses << ", no map " << st.iNoMap << ", dropped "
+         << st.iDropped << ", rejected " << st.iRejected << endl;
+    cout << "  transport latency "
+         << (st.iReceived ? st.fTransportUs / st.iReceived : 0)
+         << " us/map, encoder wait " << (frames ? st.fWaitUs / frames : 0)
+         << " us/frame" << endl;
+}
@@ -0,0 +1,87 @@
+#ifndef __PRIORITY_SOCKET_H__
+#define __PRIORITY_SOCKET_H__
+
+#include "priority_source.h"
+#include "socket_util.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+const uint32_t priorityMapMagic = 0x50414d50; // "PMAP"
+
+// Wire format: this header followed by iWidthInMb * iHeightInMb floats,
+// both in host byte order (producer and encoder share a machine).
+struct PriorityMapHeader {
+    uint32_t uiMagic;
+    uint32_t uiWidthInMb;
+    uint32_t uiHeightInMb;
+    uint32_t uiReserved;
+    int64_t iTimestampUs; ///< media time of the frame the map belongs to
+    int64_t iSendTimeUs;  ///< producer monotonicUs() when sent
+};
+
+struct PrioritySocketStats {
+    int iReceived = 0;
+    int iRejected = 0;      ///< wrong magic or grid size
+    int iAligned = 0;       ///< frames that got a map within half a frame
+    int iDeadlineMisses = 0; ///< frames that reused the last valid map
+    int iNoMap = 0;         ///< frames encoded before any map arrived
+    int iDropped = 0;       ///< maps overwritten before any frame used them
+    double fTransportUs = 0; ///< summed send-to-arrival latency
+    double fWaitUs = 0;      ///< summed time the encoder waited
+};
+
+// Receives priority maps from a producer process over a Unix domain
+// socket. Maps are matched to frames by media timestamp; if no map for a
+// frame shows up before the deadline the last valid one is reused, so a
+// slow producer never stalls the encoder for more than deadlineUs.
+class SocketPrioritySource : public PrioritySource {
+  public:
+    SocketPrioritySource(const std::string &socketPath, int widthInMb,
+                         int heightInMb, float fps, int64_t deadlineUs,
+                         float defaultPriority);
+    ~SocketPrioritySource();
+
+    bool Start();
+    bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                           float *priorityArray) override;
+    void printSummary() override;
+    PrioritySocketStats Stats();
+
+  private:
+    struct Slot {
+        int64_t iTimestampUs;
+        bool bUsed;
+        std::vector<float> priorities;
+    };
+
+    void ReceiveLoop();
+    int FindSlot(int64_t timestampUs, int64_t toleranceUs) const;
+
+    std::string socketPath_;
+    int widthInMb_;
+    int heightInMb_;
+    float fps_;
+    int64_t deadlineUs_;
+    float defaultPriority_;
+
+    SocketHandle listener_;
+    SocketHandle conn_;
+    bool stopping_;
+    std::thread receiver_;
+
+    std::mutex mutex_;
+    std::condition_variable arrived_;
+    std::vector<Slot> ring_;
+    int next_;
+    int64_t newestUs_;
+    std::vector<float> lastValid_;
+    bool haveLastValid_;
+    PrioritySocketStats stats_;
+};
+
+#endif //__PRIORITY_SOCKET_H__
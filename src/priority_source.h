@@ -0,0 +1,16 @@
+#ifndef __PRIORITY_SOURCE_H__
+#define __PRIORITY_SOURCE_H__
+
+#include <wels/codec_app_def.h>
+
+// Supplies the per-macroblock priority array passed to
+// ISVCEncoder::EncodeFrame. Frames are numbered from 1 like weights/<n>.txt.
+struct PrioritySource {
+    virtual ~PrioritySource() {}
+    virtual bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                                   float *priorityArray) = 0;
+    // one-line cost/health report printed after the encode
+    virtual void printSummary() {}
+};
+
+#endif //__PRIORITY_SOURCE_H__
@@ -0,0 +1,298 @@
+#include "priority_transform.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// "name=a" or "name=a:b"; false unless the value is exactly one or two
+// numbers
+bool parseStep(const string &step, string &name, float args[2], int &count) {
+    const size_t eq = step.find('=');
+    if (eq == string::npos) {
+        return false;
+    }
+    name = step.substr(0, eq);
+    const char *p = step.c_str() + eq + 1;
+    for (count = 0; count < 2; count++) {
+        char *end;
+        args[count] = strtof(p, &end);
+        if (end == p) {
+            return false;
+        }
+        p = end;
+        if (*p != ':') {
+            count++;
+            break;
+        }
+        p++;
+    }
+    return *p == '\0';
+}
+
+#ifdef HAVE_SSE2
+// log2 of x > 0: the exponent bits plus a polynomial of the mantissa
+// in [1, 2), absolute error below 1e-6
+inline __m128 log2Ps(__m128 x) {
+    const __m128i bits = _mm_castps_si128(x);
+    const __m128 e = _mm_cvtepi32_ps(
+        _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    const __m128 t = _mm_sub_ps(
+        _mm_castsi128_ps(_mm_or_si128(
+            _mm_and_si128(bits, _mm_set1_epi32(0x7fffff)),
+            _mm_set1_epi32(0x3f800000))),
+        _mm_set1_ps(1.0f));
+    __m128 p = _mm_set1_ps(0.0152510467f);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.0783569111f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.192307104f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.324294866f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.472893375f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.720458317f));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.44265926f));
+    return _mm_add_ps(e, _mm_mul_ps(p, t));
+}
+
+// 2^y: the integer part into the exponent bits, a polynomial of the
+// fraction, relative error below 1e-6
+inline __m128 exp2Ps(__m128 y) {
+    y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+    __m128 i = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+    // truncation rounds negative numbers up
+    i = _mm_sub_ps(i, _mm_and_ps(_mm_cmpgt_ps(i, y), _mm_set1_ps(1.0f)));
+    const __m128 f = _mm_sub_ps(y, i);
+    __m128 p = _mm_set1_ps(0.00189437942f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.00894058253f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0558765569f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.240131692f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.693156777f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.99999977f));
+    const __m128i scale = _mm_slli_epi32(
+        _mm_add_epi32(_mm_cvttps_epi32(i), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+#endif
+
+// macroblocks per tile of the fused pass, a multiple of 4
+const int transformTile = 256;
+
+} // namespace
+
+bool PriorityTransform::Parse(const string &spec) {
+    spec_ = spec;
+    ops_.clear();
+    stringstream ss(spec);
+    string step;
+    while (getline(ss, step, ',')) {
+        string name;
+        float args[2] = {0, 0};
+        int count = 0;
+        TransformOp op = {TransformOp::gamma, 0, 0};
+        bool ok = parseStep(step, name, args, count);
+        if (name == "gamma") {
+            ok = ok && count == 1 && args[0] > 0;
+        } else if (name == "clamp") {
+            op.eKind = TransformOp::clamp;
+            ok = ok && count == 2 && args[0] <= args[1];
+        } else if (name == "mean") {
+            op.eKind = TransformOp::mean;
+            ok = ok && count == 1 && args[0] > 0;
+        } else if (name == "ema") {
+            op.eKind = TransformOp::ema;
+            ok = ok && count == 1 && args[0] > 0 && args[0] <= 1;
+        } else if (name == "border") {
+            op.eKind = TransformOp::border;
+            ok = ok && count == 2 && args[0] >= 1 && args[1] > 0;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            cerr << "Invalid priority transform step: " << step
+                 << " (gamma=<g>, clamp=<lo>:<hi>, mean=<m>, ema=<alpha>, "
+                    "border=<mbs>:<gain>)\n";
+            ops_.clear();
+            return false;
+        }
+        op.fA = args[0];
+        op.fB = args[1];
+        ops_.push_back(op);
+    }
+    return true;
+}
+
+void PriorityTransform::Prepare(int widthInMb, int heightInMb) {
+    size_ = widthInMb * heightInMb;
+    const size_t padded = (size_ + 3) & ~3;
+    primed_ = false;
+    emaState_.clear();
+    borderGain_.clear();
+    offset_.assign(ops_.size(), 0);
+    for (size_t k = 0; k < ops_.size(); k++) {
+        const TransformOp &op = ops_[k];
+        if (op.eKind == TransformOp::ema) {
+            offset_[k] = emaState_.size();
+            emaState_.resize(emaState_.size() + padded, 0);
+        } else if (op.eKind == TransformOp::border) {
+            offset_[k] = borderGain_.size();
+            borderGain_.resize(borderGain_.size() + padded, 1);
+            const int n = (int)op.fA;
+            float *gain = borderGain_.data() + offset_[k];
+            for (int y = 0; y < heightInMb; y++) {
+                for (int x = 0; x < widthInMb; x++) {
+                    if (x < n || y < n || x >= widthInMb - n ||
+                        y >= heightInMb - n) {
+                        gain[y * widthInMb + x] = op.fB;
+                    }
+                }
+            }
+        }
+    }
+}
+
+double PriorityTransform::Pass(float *priorities, size_t begin, size_t end,
+                               float scale) {
+    double sum = 0;
+    int i = 0;
+#ifdef HAVE_SSE2
+    // One trip through memory: a tile at a time, every op runs over the
+    // tile while it sits in L1, four macroblocks per step. The last tile
+    // goes through a zero-padded copy, the state arrays are padded.
+    float tail[transformTile];
+    for (; i < size_; i += transformTile) {
+        const int n = min(transformTile, size_ - i);
+        const int vectors = (n + 3) / 4;
+        float *p = priorities + i;
+        if (n % 4) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, sizeof(float) * n);
+            p = tail;
+        }
+        if (scale != 1) {
+            const __m128 s = _mm_set1_ps(scale);
+            for (int j = 0; j < vectors * 4; j += 4) {
+                _mm_storeu_ps(p + j, _mm_mul_ps(_mm_loadu_ps(p + j), s));
+            }
+        }
+        for (size_t k = begin; k < end; k++) {
+            const TransformOp &op = ops_[k];
+            const __m128 a = _mm_set1_ps(op.fA);
+            const __m128 b = _mm_set1_ps(op.fB);
+            switch (op.eKind) {
+            case TransformOp::gamma:
+                for (int j = 0; j < vectors * 4; j += 4) {
+                    const __m128 v = _mm_loadu_ps(p + j);
+                    const __m128 positive = _mm_cmpgt_ps(v, _mm_setzero_ps());
+                    const __m128 r = exp2Ps(_mm_mul_ps(log2Ps(v), a));
+                    _mm_storeu_ps(p + j, _mm_and_ps(positive, r));
+                }
+                break;
+            case TransformOp::clamp:
+                for (int j = 0; j < vectors * 4; j += 4) {
+                    _mm_storeu_ps(p + j,
+                                  _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p + j), a),
+                                             b));
+                }
+                break;
+            case TransformOp::ema: {
+                float *state = emaState_.data() + offset_[k] + i;
+                const __m128 decay = _mm_set1_ps(1 - op.fA);
+                for (int j = 0; j < vectors * 4; j += 4) {
+                    __m128 v = _mm_loadu_ps(p + j);
+                    if (primed_) {
+                        v = _mm_add_ps(
+                            _mm_mul_ps(v, a),
+                            _mm_mul_ps(_mm_loadu_ps(state + j), decay));
+                        _mm_storeu_ps(p + j, v);
+                    }
+                    _mm_storeu_ps(state + j, v);
+                }
+                break;
+            }
+            case TransformOp::border: {
+                const float *gain = borderGain_.data() + offset_[k] + i;
+                for (int j = 0; j < vectors * 4; j += 4) {
+                    _mm_storeu_ps(p + j, _mm_mul_ps(_mm_loadu_ps(p + j),
+                                                    _mm_loadu_ps(gain + j)));
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        __m128 acc = _mm_setzero_ps();
+        for (int j = 0; j + 4 <= n; j += 4) {
+            acc = _mm_add_ps(acc, _mm_loadu_ps(p + j));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, acc);
+        sum += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (int j = n & ~3; j < n; j++) {
+            sum += p[j];
+        }
+        if (p == tail) {
+            memcpy(priorities + i, tail, sizeof(float) * n);
+        }
+    }
+#else
+    for (; i < size_; i++) {
+        float v = priorities[i] * scale;
+        for (size_t k = begin; k < end; k++) {
+            const TransformOp &op = ops_[k];
+            switch (op.eKind) {
+            case TransformOp::gamma:
+                v = v > 0 ? powf(v, op.fA) : 0;
+                break;
+            case TransformOp::clamp:
+                v = min(max(v, op.fA), op.fB);
+                break;
+            case TransformOp::ema: {
+                float &state = emaState_[offset_[k] + i];
+                if (primed_) {
+                    v = op.fA * v + (1 - op.fA) * state;
+                }
+                state = v;
+                break;
+            }
+            case TransformOp::border:
+                v *= borderGain_[offset_[k] + i];
+                break;
+            default:
+                break;
+            }
+        }
+        priorities[i] = v;
+        sum += v;
+    }
+#endif
+    return sum;
+}
+
+void PriorityTransform::Apply(float *priorities) {
+    float scale = 1;
+    size_t begin = 0;
+    while (true) {
+        size_t end = begin;
+        while (end < ops_.size() && ops_[end].eKind != TransformOp::mean) {
+            end++;
+        }
+        if (begin == end && end == ops_.size() && scale == 1) {
+            break;
+        }
+        const double sum = Pass(priorities, begin, end, scale);
+        if (end == ops_.size()) {
+            break;
+        }
+        // the next pass starts by scaling to the requested mean
+        const double m = sum / size_;
+        scale = m > 0 ? (float)(ops_[end].fA / m) : 1;
+        begin = end + 1;
+    }
+    primed_ = true;
+}
@@ -0,0 +1,55 @@
+#ifndef __PRIORITY_TRANSFORM_H__
+#define __PRIORITY_TRANSFORM_H__
+
+#include <string>
+#include <vector>
+
+// One step of a priority transform chain.
+struct TransformOp {
+    enum Kind {
+        gamma,  ///< v = max(v, 0)^a
+        clamp,  ///< v = min(max(v, a), b)
+        mean,   ///< v *= a / mean of the map at this point
+        ema,    ///< v = a * v + (1 - a) * v of the previous frame
+        border, ///< v *= b within a macroblocks of the picture edge
+    };
+    Kind eKind;
+    float fA;
+    float fB;
+};
+
+// A chain like "gamma=0.8,clamp=0.1:0.9,ema=0.3,border=2:1.5,mean=0.5"
+// applied to every priority map in place, in the order given, after it is
+// read or generated and before EncodeFrame takes it. The steps between two
+// mean steps run fused in one pass over the map that also sums it for the
+// mean, every step over a tile of the map while it is in L1, four
+// macroblocks per SSE2 step; a chain without mean is a single pass. gamma
+// uses polynomial log2/exp2, relative error below 1e-5.
+class PriorityTransform {
+  public:
+    // false, with the reason on cerr, for a malformed spec
+    bool Parse(const std::string &spec);
+    const std::string &Spec() const { return spec_; }
+    bool Empty() const { return ops_.empty(); }
+
+    // sizes the ema and border state for a grid and forgets the previous
+    // stream; allocates
+    void Prepare(int widthInMb, int heightInMb);
+    // never allocates
+    void Apply(float *priorities);
+
+  private:
+    // one fused pass: scale by the mean before begin, then the ops in
+    // [begin, end); returns the sum of the result
+    double Pass(float *priorities, size_t begin, size_t end, float scale);
+
+    std::string spec_;
+    std::vector<TransformOp> ops_;
+    std::vector<size_t> offset_; ///< per op, into emaState_ or borderGain_
+    int size_ = 0;
+    bool primed_ = false;          ///< ema state holds a frame
+    std::vector<float> emaState_;   ///< per ema op, padded to 4
+    std::vector<float> borderGain_; ///< per border op, padded to 4
+};
+
+#endif //__PRIORITY_TRANSFORM_H__
@@ -0,0 +1,234 @@
+#include "process_util.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+// CommandLineToArgvW quoting: backslashes are literal unless they precede
+// a quote
+static string quoteArgument(const string &arg) {
+    if (!arg.empty() && arg.find_first_of(" \t\"") == string::npos) {
+        return arg;
+    }
+    string quoted = "\"";
+    int backslashes = 0;
+    for (char c : arg) {
+        if (c == '\\') {
+            backslashes++;
+            continue;
+        }
+        quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+        backslashes = 0;
+        quoted += c;
+    }
+    quoted.append(backslashes * 2, '\\');
+    return quoted + "\"";
+}
+
+ProcessHandle spawnProcess(const vector<string> &args) {
+    string commandLine;
+    for (const string &arg : args) {
+        commandLine += (commandLine.empty() ? "" : " ") + quoteArgument(arg);
+    }
+    STARTUPINFOA startup;
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION info;
+    if (!CreateProcessA(NULL, &commandLine[0], NULL, NULL, FALSE, 0,
+                        NULL, NULL, &startup, &info)) {
+        return invalidProcess;
+    }
+    CloseHandle(info.hThread);
+    return info.hProcess;
+}
+
+int waitProcess(ProcessHandle process) {
+    DWORD code = (DWORD)-1;
+    if (WaitForSingleObject(process, INFINITE) != WAIT_OBJECT_0 ||
+        !GetExitCodeProcess(process, &code)) {
+        code = (DWORD)-1;
+    }
+    CloseHandle(process);
+    return (int)code;
+}
+
+void killProcess(ProcessHandle process) { TerminateProcess(process, 1); }
+
+int currentProcessId() { return (int)GetCurrentProcessId(); }
+
+bool processAlive(int pid) {
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!process) {
+        return false;
+    }
+    const bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+}
+
+string currentExecutable() {
+    char path[MAX_PATH];
+    const DWORD n = GetModuleFileNameA(NULL, path, sizeof(path));
+    return n > 0 && n < sizeof(path) ? string(path, n) : string();
+}
+
+SharedMemory::SharedMemory() : data_(nullptr), size_(0), mapping_(nullptr) {}
+
+bool SharedMemory::Create(const string &name, size_t size) {
+    Close();
+    // paging-file backed; the name lives as long as a handle to it
+    mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                  (DWORD)((uint64_t)size >> 32),
+                                  (DWORD)size, ("Local\\" + name).c_str());
+    if (!mapping_ || GetLastError() == ERROR_ALREADY_EXISTS) {
+        Close();
+        return false;
+    }
+    data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!data_) {
+        Close();
+        return false;
+    }
+    size_ = size;
+    name_ = name;
+    return true;
+}
+
+bool SharedMemory::Open(const string &name) {
+    Close();
+    mapping_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE,
+                                ("Local\\" + name).c_str());
+    if (!mapping_) {
+        return false;
+    }
+    data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!data_ || !VirtualQuery(data_, &info, sizeof(info))) {
+        Close();
+        return false;
+    }
+    size_ = info.RegionSize;
+    return true;
+}
+
+void SharedMemory::Close() {
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    data_ = nullptr;
+    mapping_ = nullptr;
+    size_ = 0;
+    name_.clear();
+}
+#else
+ProcessHandle spawnProcess(const vector<string> &args) {
+    vector<char *> argv;
+    for (const string &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawn(&pid, args[0].c_str(), NULL, NULL, argv.data(),
+                    environ) != 0) {
+        return invalidProcess;
+    }
+    return pid;
+}
+
+int waitProcess(ProcessHandle process) {
+    int status;
+    if (waitpid(process, &status, 0) != process || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+void killProcess(ProcessHandle process) { kill(process, SIGKILL); }
+
+int currentProcessId() { return (int)getpid(); }
+
+bool processAlive(int pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+
+string currentExecutable() {
+    char path[PATH_MAX];
+    const ssize_t n = readlink("/proc/self/exe", path, sizeof(path));
+    return n > 0 && n < (ssize_t)sizeof(path) ? string(path, n) : string();
+}
+
+SharedMemory::SharedMemory() : data_(nullptr), size_(0) {}
+
+bool SharedMemory::Create(const string &name, size_t size) {
+    Close();
+    const int fd = shm_open(("/" + name).c_str(), O_RDWR | O_CREAT | O_EXCL,
+                            0600);
+    if (fd < 0) {
+        return false;
+    }
+    name_ = name;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        data_ = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data_ == MAP_FAILED || !data_) {
+        data_ = nullptr;
+        Close();
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+bool SharedMemory::Open(const string &name) {
+    Close();
+    const int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data_ = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+        size_ = (size_t)st.st_size;
+    }
+    close(fd);
+    if (data_ == MAP_FAILED || !data_) {
+        data_ = nullptr;
+        size_ = 0;
+        return false;
+    }
+    return true;
+}
+
+void SharedMemory::Close() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+    if (!name_.empty()) {
+        shm_unlink(("/" + name_).c_str());
+    }
+    data_ = nullptr;
+    size_ = 0;
+    name_.clear();
+}
+#endif
+
+SharedMemory::~SharedMemory() { Close(); }
@@ -0,0 +1,55 @@
+#ifndef __PROCESS_UTIL_H__
+#define __PROCESS_UTIL_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Thin portability layer over CreateProcess and posix_spawn for running
+// copies of this executable, and over named shared memory between them.
+#ifdef _WIN32
+typedef void *ProcessHandle;
+#else
+typedef int ProcessHandle;
+#endif
+const ProcessHandle invalidProcess = (ProcessHandle)0;
+
+// starts args[0] with args, sharing the console; invalidProcess on failure
+ProcessHandle spawnProcess(const std::vector<std::string> &args);
+// waits for the process to exit and returns its exit code, -1 when it
+// crashed or could not be waited for
+int waitProcess(ProcessHandle process);
+void killProcess(ProcessHandle process);
+int currentProcessId();
+// whether a process with this id is still running
+bool processAlive(int pid);
+// path of the running executable, for starting copies of it
+std::string currentExecutable();
+
+// A named, zero-filled block of memory mapped into every process that
+// opens it. The creator removes the name when it closes it; mappings of
+// other processes stay valid until they close theirs.
+class SharedMemory {
+  public:
+    SharedMemory();
+    ~SharedMemory();
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    bool Create(const std::string &name, size_t size);
+    bool Open(const std::string &name);
+    void *Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+  private:
+    void Close();
+
+    void *data_;
+    size_t size_;
+    std::string name_; ///< set for the creator
+#ifdef _WIN32
+    void *mapping_;
+#endif
+};
+
+#endif //__PROCESS_UTIL_H__
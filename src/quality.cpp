@@ -0,0 +1,228 @@
+#include "quality.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static int64_t rowSsd(const uint8_t *a, const uint8_t *b, int width) {
+    int x = 0;
+    int64_t ssd = 0;
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vSsd = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        const __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero),
+                                         _mm_unpacklo_epi8(vb, zero));
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero),
+                                         _mm_unpackhi_epi8(vb, zero));
+        vSsd = _mm_add_epi32(vSsd, _mm_madd_epi16(lo, lo));
+        vSsd = _mm_add_epi32(vSsd, _mm_madd_epi16(hi, hi));
+    }
+    // a row of 4096 pixels stays below 2^31 per lane
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, vSsd);
+    ssd = (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; x < width; x++) {
+        const int d = a[x] - b[x];
+        ssd += d * d;
+    }
+    return ssd;
+}
+
+double planePsnr(const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+                 int width, int height) {
+    int64_t ssd = 0;
+    for (int y = 0; y < height; y++, a += strideA, b += strideB) {
+        ssd += rowSsd(a, b, width);
+    }
+    if (ssd == 0) {
+        return 100;
+    }
+    const double mse = (double)ssd / ((double)width * height);
+    return 10 * log10(255.0 * 255.0 / mse);
+}
+
+// sum a, sum b, sum a^2 + b^2 and sum a*b of each 4x4 block in a row
+static void ssimBlockSums(const uint8_t *a, int strideA, const uint8_t *b,
+                          int strideB, int blocks, int *sums) {
+    for (int z = 0; z < blocks; z++, sums += 4) {
+        int s1 = 0, s2 = 0, ss = 0, s12 = 0;
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                const int pa = a[y * strideA + z * 4 + x];
+                const int pb = b[y * strideB + z * 4 + x];
+                s1 += pa;
+                s2 += pb;
+                ss += pa * pa + pb * pb;
+                s12 += pa * pb;
+            }
+        }
+        sums[0] = s1;
+        sums[1] = s2;
+        sums[2] = ss;
+        sums[3] = s12;
+    }
+}
+
+static double ssimWindow(int64_t s1, int64_t s2, int64_t ss, int64_t s12) {
+    static const double c1 = .01 * .01 * 255 * 255 * 64;
+    static const double c2 = .03 * .03 * 255 * 255 * 64 * 63;
+    const double vars = (double)(ss * 64 - s1 * s1 - s2 * s2);
+    const double covar = (double)(s12 * 64 - s1 * s2);
+    return (2.0 * s1 * s2 + c1) * (2 * covar + c2) /
+           (((double)s1 * s1 + (double)s2 * s2 + c1) * (vars + c2));
+}
+
+double planeSsim(const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+                 int width, int height, vector<int> &scratch) {
+    const int wb = width / 4;
+    const int hb = height / 4;
+    if (wb < 2 || hb < 2) {
+        return 1;
+    }
+    scratch.resize(2 * wb * 4);
+    int *rows[2] = {scratch.data(), scratch.data() + wb * 4};
+    ssimBlockSums(a, strideA, b, strideB, wb, rows[0]);
+    double total = 0;
+    for (int by = 1; by < hb; by++) {
+        int *top = rows[(by - 1) & 1];
+        int *bottom = rows[by & 1];
+        ssimBlockSums(a + by * 4 * strideA, strideA, b + by * 4 * strideB,
+                      strideB, wb, bottom);
+        for (int bx = 0; bx + 1 < wb; bx++) {
+            int64_t s[4];
+            for (int k = 0; k < 4; k++) {
+                s[k] = (int64_t)top[bx * 4 + k] + top[bx * 4 + 4 + k] +
+                       bottom[bx * 4 + k] + bottom[bx * 4 + 4 + k];
+            }
+            total += ssimWindow(s[0], s[1], s[2], s[3]);
+        }
+    }
+    return total / ((double)(wb - 1) * (hb - 1));
+}
+
+QualityCallback::QualityCallback(int width, int height)
+    : width_(width), height_(height), decoder_(NULL), sourceFrame_(0),
+      haveDecoded_(false), psnrSum_(0), ssimSum_(0), frames_(0), bytes_(0),
+      decodeFailures_(0) {
+    sourceY_.resize((size_t)width * height * 3 / 2);
+    decodedY_.resize((size_t)width * height);
+}
+
+QualityCallback::~QualityCallback() {
+    if (decoder_) {
+        decoder_->Uninitialize();
+        WelsDestroyDecoder(decoder_);
+    }
+}
+
+bool QualityCallback::Open(const string &sourceFileName) {
+    InputGeometry geometry = {width_, height_, inputFps};
+    source_ = openInput(sourceFileName, pixelI420, geometry);
+    if (!source_ || geometry.iWidth != width_ || geometry.iHeight != height_ ||
+        WelsCreateDecoder(&decoder_) != 0 || !decoder_) {
+        return false;
+    }
+    SDecodingParam decParam;
+    memset(&decParam, 0, sizeof(SDecodingParam));
+    decParam.eEcActiveIdc = ERROR_CON_DISABLE;
+    decParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+    return decoder_->Initialize(&decParam) == 0;
+}
+
+void QualityCallback::onFrameStart(int frameNum) {
+    TestCallback::onFrameStart(frameNum);
+    // whole frames, so a Y4M source stays in sync; frames dropped by the
+    // pacer never reach the encoder
+    for (; sourceFrame_ < frameNum; sourceFrame_++) {
+        if (source_->read(sourceY_.data(), sourceY_.size()) !=
+            (int)sourceY_.size()) {
+            cerr << "Short read of source frame " << sourceFrame_ + 1 << '\n';
+        }
+    }
+}
+
+void QualityCallback::onEncodeFrame(const SFrameBSInfo &frameInfo,
+                                    const string &outFileName) {
+    au_.clear();
+    for (int l = 0; l < frameInfo.iLayerNum; l++) {
+        const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+        int layerSize = 0;
+        for (int n = 0; n < layer.iNalCount; n++) {
+            layerSize += layer.pNalLengthInByte[n];
+        }
+        au_.insert(au_.end(), layer.pBsBuf, layer.pBsBuf + layerSize);
+    }
+    bytes_ += au_.size();
+
+    unsigned char *dst[3] = {NULL, NULL, NULL};
+    SBufferInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(SBufferInfo));
+    DECODING_STATE state = decoder_->DecodeFrameNoDelay(
+        au_.data(), (int)au_.size(), dst, &bufInfo);
+    const SSysMEMBuffer &sys = bufInfo.UsrData.sSystemBuffer;
+    if (state == dsErrorFree && bufInfo.iBufferStatus == 1 &&
+        sys.iWidth == width_ && sys.iHeight == height_) {
+        for (int y = 0; y < height_; y++) {
+            memcpy(&decodedY_[(size_t)y * width_], dst[0] + y * sys.iStride[0],
+                   width_);
+        }
+        haveDecoded_ = true;
+    } else {
+        decodeFailures_++;
+    }
+    if (haveDecoded_) {
+        Compare();
+    }
+
+    TestCallback::onEncodeFrame(frameInfo, outFileName);
+}
+
+void QualityCallback::onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+    if (frameInfo.eFrameType == videoFrameTypeSkip && haveDecoded_) {
+        Compare();
+    }
+}
+
+void QualityCallback::Compare() {
+    psnrSum_ += planePsnr(sourceY_.data(), width_, decodedY_.data(), width_,
+                          width_, height_);
+    ssimSum_ += planeSsim(sourceY_.data(), width_, decodedY_.data(), width_,
+                          width_, height_, ssimScratch_);
+    frames_++;
+}
+
+QualityScore QualityCallback::Score() const {
+    QualityScore score;
+    score.iFrames = frames_;
+    score.iBytes = bytes_;
+    if (frames_) {
+        score.fPsnr = psnrSum_ / frames_;
+        score.fSsim = ssimSum_ / frames_;
+    }
+    return score;
+}
+
+QualitySums QualityCallback::Sums() const {
+    QualitySums sums;
+    sums.fPsnrSum = psnrSum_;
+    sums.fSsimSum = ssimSum_;
+    sums.iFrames = frames_;
+    sums.iBytes = bytes_;
+    sums.iDecodeFailures = decodeFailures_;
+    return sums;
+}
+
+void QualityCallback::Restore(const QualitySums &sums) {
+    psnrSum_ = sums.fPsnrSum;
+    ssimSum_ = sums.fSsimSum;
+    frames_ = sums.iFrames;
+    bytes_ = sums.iBytes;
+    decodeFailures_ = sums.iDecodeFailures;
+}
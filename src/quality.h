@@ -0,0 +1,80 @@
+#ifndef __QUALITY_H__
+#define __QUALITY_H__
+
+#include "harness.h"
+
+#include <wels/codec_api.h>
+
+#include <cstdio>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Luma PSNR in dB (100 for identical planes) and SSIM over 8x8 windows
+// on a 4-pixel grid, the same sampling x264 uses.
+double planePsnr(const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+                 int width, int height);
+double planeSsim(const uint8_t *a, int strideA, const uint8_t *b, int strideB,
+                 int width, int height, std::vector<int> &scratch);
+
+// Mean of the per-frame values.
+struct QualityScore {
+    double fPsnr = 0;
+    double fSsim = 0;
+    int iFrames = 0;
+    long long iBytes = 0;
+};
+
+// The running sums behind a QualityScore, so an interrupted encode can
+// carry them over when it resumes.
+struct QualitySums {
+    double fPsnrSum = 0;
+    double fSsimSum = 0;
+    int iFrames = 0;
+    long long iBytes = 0;
+    int iDecodeFailures = 0;
+};
+
+// Decodes every encoded frame in-process and compares it with the source
+// frame, so quality needs neither a second pass nor ffmpeg. A frame the
+// encoder skips is scored as a repeat of the last decoded one, which is
+// what a viewer would see. Writes the bitstream like TestCallback.
+class QualityCallback : public TestCallback {
+  public:
+    QualityCallback(int width, int height);
+    ~QualityCallback();
+    bool Open(const std::string &sourceFileName);
+
+    virtual void onFrameStart(int frameNum);
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const std::string &outFileName);
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo);
+
+    QualityScore Score() const;
+    int DecodeFailures() const { return decodeFailures_; }
+    QualitySums Sums() const;
+    // continues from sums; the encode must resume at an IDR frame
+    void Restore(const QualitySums &sums);
+
+  private:
+    void Compare();
+
+    int width_;
+    int height_;
+    ISVCDecoder *decoder_;
+    std::unique_ptr<InputStream> source_;
+    int sourceFrame_; ///< number of the frame in sourceY_
+    std::vector<uint8_t> sourceY_; ///< whole I420 frame, luma compared
+    std::vector<uint8_t> decodedY_;
+    bool haveDecoded_;
+    std::vector<uint8_t> au_;
+    std::vector<int> ssimScratch_;
+    double psnrSum_;
+    double ssimSum_;
+    int frames_;
+    long long bytes_;
+    int decodeFailures_;
+};
+
+#endif //__QUALITY_H__
@@ -0,0 +1,445 @@
+#include "rtp.h"
+#include "hash.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// RTP packet without payload that ends the stream; outside the dynamic
+// range we send media on
+static const int byePayloadType = 127;
+static const int fuA = 28;
+static const uint8_t startCode[4] = {0, 0, 0, 1};
+
+static int startCodeLength(const uint8_t *nal, int len) {
+    if (len >= 4 && nal[0] == 0 && nal[1] == 0 && nal[2] == 0 && nal[3] == 1) {
+        return 4;
+    }
+    if (len >= 3 && nal[0] == 0 && nal[1] == 0 && nal[2] == 1) {
+        return 3;
+    }
+    return 0;
+}
+
+static uint16_t readBe16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t readBe32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void writeBe16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void writeBe32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+void configureSizeLimitedSlices(SEncParamExt &param, int mtu) {
+    const int maxPayload = rtpMaxPayload(mtu);
+    param.uiMaxNalSize = maxPayload;
+    for (int i = 0; i < param.iSpatialLayerNum; i++) {
+        SSliceArgument &slice = param.sSpatialLayers[i].sSliceArgument;
+        slice.uiSliceMode = SM_SIZELIMITED_SLICE;
+        // the encoder reserves NAL_HEADER_ADD_0X30BYTES (50) of uiMaxNalSize
+        slice.uiSliceSizeConstraint = maxPayload - 50;
+    }
+}
+
+RtpReceiver::RtpReceiver()
+    : socket_(invalidSocket), port_(0), fp_(nullptr), auTimestamp_(0),
+      auOpen_(false), auIntact_(true), inFragment_(false), fragmentStart_(0),
+      expectedSeq_(-1), packets_(0), lost_(0), stop_(false) {}
+
+RtpReceiver::~RtpReceiver() {
+    if (thread_.joinable()) {
+        Join();
+    }
+    closeSocket(socket_);
+    if (fp_) {
+        fclose(fp_);
+    }
+}
+
+bool RtpReceiver::Start(const string &outFileName) {
+    socket_ = bindUdpLoopback(port_);
+    if (socket_ == invalidSocket) {
+        return false;
+    }
+    // an IDR frame at our resolution is a burst of a few hundred packets
+    setRecvBufferSize(socket_, 8 << 20);
+    setRecvTimeout(socket_, 1000);
+    fp_ = fopen(outFileName.c_str(), "wb");
+    if (!fp_) {
+        return false;
+    }
+    thread_ = thread(&RtpReceiver::Run, this);
+    return true;
+}
+
+void RtpReceiver::Join() {
+    stop_ = true;
+    thread_.join();
+}
+
+void RtpReceiver::Run() {
+    vector<uint8_t> packet(65536);
+    while (true) {
+        const int len = recvDatagram(socket_, packet.data(), packet.size());
+        if (len < 0) {
+            // timed out; only give up once the sender is done
+            if (stop_) {
+                break;
+            }
+            continue;
+        }
+        if (len >= rtpHeaderSize && (packet[1] & 0x7f) == byePayloadType) {
+            break;
+        }
+        Receive(packet.data(), len);
+    }
+    if (auOpen_) {
+        auIntact_ = false;
+        FinishFrame();
+    }
+}
+
+void RtpReceiver::Receive(const uint8_t *packet, int len) {
+    if (len < rtpHeaderSize || (packet[0] >> 6) != 2) {
+        return;
+    }
+    const int csrcCount = packet[0] & 0x0f;
+    const bool marker = packet[1] >> 7;
+    const int seq = readBe16(packet + 2);
+    const uint32_t timestamp = readBe32(packet + 4);
+    const uint8_t *payload = packet + rtpHeaderSize + 4 * csrcCount;
+    const int payloadLen = len - rtpHeaderSize - 4 * csrcCount;
+    if (payloadLen < 1) {
+        return;
+    }
+    packets_++;
+
+    bool gap = false;
+    if (expectedSeq_ >= 0 && seq != expectedSeq_) {
+        lost_ += (uint16_t)(seq - expectedSeq_);
+        gap = true;
+    }
+    expectedSeq_ = (seq + 1) & 0xffff;
+    if (auOpen_ && timestamp != auTimestamp_) {
+        // the marker packet of the previous frame went missing
+        FinishFrame();
+    }
+    if (!auOpen_) {
+        au_.clear();
+        auTimestamp_ = timestamp;
+        auOpen_ = true;
+        auIntact_ = true;
+    }
+    if (gap) {
+        auIntact_ = false;
+        if (inFragment_) {
+            au_.resize(fragmentStart_);
+            inFragment_ = false;
+        }
+    }
+
+    const int type = payload[0] & 0x1f;
+    if (type >= 1 && type <= 23) {
+        au_.insert(au_.end(), startCode, startCode + 4);
+        au_.insert(au_.end(), payload, payload + payloadLen);
+    } else if (type == fuA && payloadLen >= 2) {
+        const uint8_t fuHeader = payload[1];
+        if (fuHeader & 0x80) {
+            fragmentStart_ = au_.size();
+            au_.insert(au_.end(), startCode, startCode + 4);
+            au_.push_back((payload[0] & 0xe0) | (fuHeader & 0x1f));
+            inFragment_ = true;
+        }
+        if (inFragment_) {
+            au_.insert(au_.end(), payload + 2, payload + payloadLen);
+            if (fuHeader & 0x40) {
+                inFragment_ = false;
+            }
+        } else {
+            auIntact_ = false;
+        }
+    } else {
+        // aggregation packets are never sent by RtpSinkCallback
+        auIntact_ = false;
+    }
+    if (marker) {
+        FinishFrame();
+    }
+}
+
+void RtpReceiver::FinishFrame() {
+    if (inFragment_) {
+        au_.resize(fragmentStart_);
+        inFragment_ = false;
+        auIntact_ = false;
+    }
+    fwrite(au_.data(), 1, au_.size(), fp_);
+    Frame frame;
+    frame.uiTimestamp = auTimestamp_;
+    frame.uiHash = fnv1a(fnvOffset, au_.data(), au_.size());
+    frame.uiSize = (uint32_t)au_.size();
+    frame.iDoneUs = monotonicUs();
+    frame.bIntact = auIntact_;
+    frames_.push_back(frame);
+    auOpen_ = false;
+}
+
+RtpSinkCallback::RtpSinkCallback(int mtu, float fps)
+    : mtu_(mtu), maxPayload_(rtpMaxPayload(mtu)), fps_(fps),
+      socket_(invalidSocket), seq_(0), ssrc_(0x4f504e48), timestamp_(0),
+      packets_(0), fuPackets_(0), nals_(0), nalBytes_(0), wireBytes_(0),
+      maxPacketsPerFrame_(0), firstSendUs_(0), lastSendUs_(0), verified_(0),
+      corrupt_(0), missing_(0) {
+    packet_.resize(rtpHeaderSize + maxPayload_);
+}
+
+RtpSinkCallback::~RtpSinkCallback() { closeSocket(socket_); }
+
+bool RtpSinkCallback::Start(const string &receiveFileName) {
+    if (maxPayload_ < 64 || !receiver_.Start(receiveFileName)) {
+        return false;
+    }
+    socket_ = connectUdpLoopback(receiver_.Port());
+    return socket_ != invalidSocket;
+}
+
+void RtpSinkCallback::onFrameStart(int frameNum) {
+    TestCallback::onFrameStart(frameNum);
+    timestamp_ = (uint32_t)((frameNum - 1) * (double)rtpClockRate / fps_);
+}
+
+void RtpSinkCallback::SendPacket(const uint8_t *payload, int len,
+                                 uint32_t timestamp, bool marker,
+                                 const uint8_t *prefix, int prefixLen) {
+    uint8_t *p = packet_.data();
+    p[0] = 0x80; // version 2, no padding, extension or CSRCs
+    p[1] = (marker ? 0x80 : 0) | rtpPayloadType;
+    writeBe16(p + 2, seq_++);
+    writeBe32(p + 4, timestamp);
+    writeBe32(p + 8, ssrc_);
+    memcpy(p + rtpHeaderSize, prefix, prefixLen);
+    memcpy(p + rtpHeaderSize + prefixLen, payload, len);
+    const int size = rtpHeaderSize + prefixLen + len;
+    if (!sendDatagram(socket_, p, size)) {
+        cerr << "RTP send failed, seq " << (uint16_t)(seq_ - 1) << '\n';
+    }
+    packets_++;
+    wireBytes_ += size + udpIpHeaderSize;
+}
+
+// RFC 6184 5.6 single NAL unit packet, or 5.8 FU-A fragments when the NAL
+// is larger than one packet
+void RtpSinkCallback::SendNal(const uint8_t *nal, int len, uint32_t timestamp,
+                              bool last) {
+    if (len <= maxPayload_) {
+        SendPacket(nal, len, timestamp, last, nullptr, 0);
+        return;
+    }
+    const int chunk = maxPayload_ - 2;
+    uint8_t fu[2];
+    fu[0] = (nal[0] & 0xe0) | fuA;
+    for (int pos = 1; pos < len; pos += chunk) {
+        const int n = min(chunk, len - pos);
+        const bool end = pos + n == len;
+        fu[1] = (pos == 1 ? 0x80 : 0) | (end ? 0x40 : 0) | (nal[0] & 0x1f);
+        SendPacket(nal + pos, n, timestamp, last && end, fu, 2);
+        fuPackets_++;
+    }
+}
+
+void RtpSinkCallback::onEncodeFrame(const SFrameBSInfo &frameInfo,
+                                    const string &outFileName) {
+    const int64_t readyUs = monotonicUs();
+    if (!firstSendUs_) {
+        firstSendUs_ = readyUs;
+    }
+    const long long packetsBefore = packets_;
+
+    // find the last NAL so its last packet carries the marker bit
+    int lastLayer = -1;
+    for (int l = 0; l < frameInfo.iLayerNum; l++) {
+        if (frameInfo.sLayerInfo[l].iNalCount > 0) {
+            lastLayer = l;
+        }
+    }
+    SentFrame sent;
+    sent.uiTimestamp = timestamp_;
+    sent.uiHash = fnvOffset;
+    sent.uiSize = 0;
+    sent.iReadyUs = readyUs;
+    for (int l = 0; l <= lastLayer; l++) {
+        const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+        const uint8_t *p = layer.pBsBuf;
+        for (int n = 0; n < layer.iNalCount; n++) {
+            const int len = layer.pNalLengthInByte[n];
+            const int sc = startCodeLength(p, len);
+            const uint8_t *nal = p + sc;
+            const int nalLen = len - sc;
+            p += len;
+            if (nalLen <= 0) {
+                continue;
+            }
+            SendNal(nal, nalLen, timestamp_,
+                    l == lastLayer && n == layer.iNalCount - 1);
+            sent.uiHash = fnv1a(sent.uiHash, startCode, 4);
+            sent.uiHash = fnv1a(sent.uiHash, nal, nalLen);
+            sent.uiSize += 4 + nalLen;
+            nals_++;
+            nalBytes_ += nalLen;
+        }
+    }
+    lastSendUs_ = monotonicUs();
+    packetize_.Record((double)(lastSendUs_ - readyUs));
+    maxPacketsPerFrame_ =
+        max(maxPacketsPerFrame_, (int)(packets_ - packetsBefore));
+    sent_.push_back(sent);
+
+    TestCallback::onEncodeFrame(frameInfo, outFileName);
+}
+
+void RtpSinkCallback::Finish() {
+    uint8_t bye[rtpHeaderSize];
+    memset(bye, 0, sizeof(bye));
+    bye[0] = 0x80;
+    bye[1] = byePayloadType;
+    writeBe16(bye + 2, seq_);
+    writeBe32(bye + 8, ssrc_);
+    sendDatagram(socket_, bye, sizeof(bye));
+    receiver_.Join();
+
+    // both sides are in timestamp order
+    const vector<RtpReceiver::Frame> &received = receiver_.Frames();
+    size_t r = 0;
+    for (const SentFrame &sent : sent_) {
+        while (r < received.size() &&
+               received[r].uiTimestamp < sent.uiTimestamp) {
+            r++;
+        }
+        if (r == received.size() ||
+            received[r].uiTimestamp != sent.uiTimestamp) {
+            missing_++;
+        } else if (!received[r].bIntact || received[r].uiHash != sent.uiHash ||
+                   received[r].uiSize != sent.uiSize) {
+            corrupt_++;
+        } else {
+            verified_++;
+            delivery_.Record((double)(received[r].iDoneUs - sent.iReadyUs));
+        }
+    }
+}
+
+void RtpSinkCallback::printSummary() const {
+    const double seconds = (lastSendUs_ - firstSendUs_) / 1e6;
+    cout << "RTP (MTU " << mtu_ << ", max payload " << maxPayload_
+         << "): " << packets_ << " packets (" << fuPackets_ << " FU-A), "
+         << (seconds > 0 ? packets_ / seconds : 0) << " packets/s, "
+         << (sent_.empty() ? 0 : (double)packets_ / sent_.size())
+         << " packets/frame (max " << maxPacketsPerFrame_ << ")" << endl;
+    cout << "  " << verified_ << "/" << sent_.size() << " frames verified, "
+         << corrupt_ << " corrupt, " << missing_ << " missing, "
+         << receiver_.Lost() << " packets lost" << endl;
+    cout << "  packetization p50 " << packetize_.Percentile(50) << " us, max "
+         << packetize_.Max() << " us; delivery p50 "
+         << delivery_.Percentile(50) << " us, max " << delivery_.Max()
+         << " us" << endl;
+    cout << "  " << nals_ << " NALs, header overhead "
+         << (nalBytes_ ? (double)(wireBytes_ - nalBytes_) / nalBytes_ * 100
+                       : 0)
+         << "% (RTP/UDP/IPv4 + FU-A)" << endl;
+}
+
+void RtpSinkCallback::AddToReport(StatsReport &report) const {
+    const double seconds = (lastSendUs_ - firstSendUs_) / 1e6;
+    report.AddCounter("rtp_mtu", mtu_);
+    report.AddCounter("rtp_packets", (double)packets_);
+    report.AddCounter("rtp_fu_a_packets", (double)fuPackets_);
+    report.AddCounter("rtp_packets_per_sec",
+                      seconds > 0 ? packets_ / seconds : 0);
+    report.AddCounter("rtp_max_packets_per_frame", maxPacketsPerFrame_);
+    report.AddCounter("rtp_nals", (double)nals_);
+    report.AddCounter("rtp_nal_bytes", (double)nalBytes_);
+    report.AddCounter("rtp_wire_bytes", (double)wireBytes_);
+    report.AddCounter("rtp_frames_verified", verified_);
+    report.AddCounter("rtp_frames_corrupt", corrupt_);
+    report.AddCounter("rtp_frames_missing", missing_);
+    report.AddCounter("rtp_packets_lost", (double)receiver_.Lost());
+    report.AddHistogram("rtp_packetize", packetize_);
+    report.AddHistogram("rtp_delivery", delivery_);
+}
+
+namespace {
+struct ByteCountCallback : public BaseEncoderTest::Callback {
+    long long bytes = 0;
+    long long nals = 0;
+    int frames = 0;
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const string &outFileName) {
+        for (int l = 0; l < frameInfo.iLayerNum; l++) {
+            const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+            for (int n = 0; n < layer.iNalCount; n++) {
+                bytes += layer.pNalLengthInByte[n];
+            }
+            nals += layer.iNalCount;
+        }
+        frames++;
+    }
+};
+} // namespace
+
+void measureSliceOverhead(const TestOptions &opts, const SEncParamExt &param,
+                          StatsReport &report) {
+    if (isDiffEncoding && !opts.prioritySocket.empty()) {
+        cerr << "Slice overhead needs replayable priorities, skipped with "
+                "--priority-socket\n";
+        return;
+    }
+    ByteCountCallback counts[2];
+    for (int limited = 0; limited < 2; limited++) {
+        SEncParamExt p = param;
+        p.iRCMode = RC_OFF_MODE;
+        if (!limited) {
+            p.uiMaxNalSize = 0;
+            for (int i = 0; i < p.iSpatialLayerNum; i++) {
+                p.sSpatialLayers[i].sSliceArgument.uiSliceMode =
+                    SM_SINGLE_SLICE;
+            }
+        }
+        string suffix;
+        BaseEncoderTest test;
+        test.inputFormat_ = opts.inputFormat;
+        test.convertThreads_ = opts.convertThreads;
+        test.prioritySource_ =
+            isDiffEncoding ? createPrioritySource(opts, suffix, "-ref")
+                           : nullptr;
+        test.SetUp();
+        test.EncodeFile(opts.input.c_str(), &p, &counts[limited], "");
+        test.TearDown();
+        delete test.prioritySource_;
+    }
+    const double overhead =
+        counts[0].bytes ? ((double)counts[1].bytes / counts[0].bytes - 1) * 100
+                        : 0;
+    const double slicesPerFrame =
+        counts[1].frames ? (double)counts[1].nals / counts[1].frames : 0;
+    cout << "Slice limiting at QP " << param.sSpatialLayers[0].iDLayerQp
+         << ": " << counts[1].bytes << " vs " << counts[0].bytes
+         << " bytes single-slice, overhead " << overhead << "%, "
+         << slicesPerFrame << " NALs/frame" << endl;
+    report.AddCounter("slice_qp", param.sSpatialLayers[0].iDLayerQp);
+    report.AddCounter("slice_bytes_single", (double)counts[0].bytes);
+    report.AddCounter("slice_bytes_limited", (double)counts[1].bytes);
+    report.AddCounter("slice_overhead_pct", overhead);
+    report.AddCounter("slice_nals_per_frame", slicesPerFrame);
+}
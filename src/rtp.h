@@ -0,0 +1,138 @@
+#ifndef __RTP_H__
+#define __RTP_H__
+
+#include "harness.h"
+#include "socket_util.h"
+#include "stats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int rtpHeaderSize = 12;
+// IPv4 + UDP headers in front of every RTP packet
+const int udpIpHeaderSize = 28;
+const int rtpPayloadType = 96;
+const int rtpClockRate = 90000;
+
+// Largest RTP payload that fits an mtu-sized IP packet.
+inline int rtpMaxPayload(int mtu) {
+    return mtu - udpIpHeaderSize - rtpHeaderSize;
+}
+
+// Switches the encoder to SM_SIZELIMITED_SLICE so that each slice NAL fits
+// one RTP packet of the given MTU.
+void configureSizeLimitedSlices(SEncParamExt &param, int mtu);
+
+// Receives RTP on a loopback port on its own thread, reassembles single NAL
+// and FU-A packets into Annex-B access units and keeps a hash per frame so
+// the sender can verify them.
+class RtpReceiver {
+  public:
+    struct Frame {
+        uint32_t uiTimestamp;
+        uint64_t uiHash;
+        uint32_t uiSize;
+        int64_t iDoneUs;
+        bool bIntact; ///< no packet of the frame was lost
+    };
+
+    RtpReceiver();
+    ~RtpReceiver();
+    // binds an ephemeral port; the Annex-B stream goes to outFileName
+    bool Start(const std::string &outFileName);
+    int Port() const { return port_; }
+    // waits for the BYE packet the sender finishes with
+    void Join();
+
+    const std::vector<Frame> &Frames() const { return frames_; }
+    long long Packets() const { return packets_; }
+    long long Lost() const { return lost_; }
+
+  private:
+    void Run();
+    void Receive(const uint8_t *packet, int len);
+    void FinishFrame();
+
+    SocketHandle socket_;
+    int port_;
+    std::thread thread_;
+    FILE *fp_;
+    std::vector<Frame> frames_;
+    std::vector<uint8_t> au_;
+    uint32_t auTimestamp_;
+    bool auOpen_;
+    bool auIntact_;
+    bool inFragment_;
+    size_t fragmentStart_; ///< au_ offset of the FU-A being reassembled
+    int expectedSeq_;
+    long long packets_;
+    long long lost_;
+    std::atomic<bool> stop_;
+};
+
+// Output stage that writes the bitstream like TestCallback and also sends
+// every frame over loopback UDP as RTP (RFC 6184 single NAL unit and FU-A
+// packets) to an in-process RtpReceiver.
+class RtpSinkCallback : public TestCallback {
+  public:
+    RtpSinkCallback(int mtu, float fps);
+    ~RtpSinkCallback();
+    bool Start(const std::string &receiveFileName);
+
+    virtual void onFrameStart(int frameNum);
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const std::string &outFileName);
+
+    // sends BYE, joins the receiver and checks every frame arrived intact
+    void Finish();
+    void printSummary() const;
+    void AddToReport(StatsReport &report) const;
+
+  private:
+    struct SentFrame {
+        uint32_t uiTimestamp;
+        uint64_t uiHash;
+        uint32_t uiSize;
+        int64_t iReadyUs;
+    };
+
+    void SendNal(const uint8_t *nal, int len, uint32_t timestamp, bool last);
+    void SendPacket(const uint8_t *payload, int len, uint32_t timestamp,
+                    bool marker, const uint8_t *prefix, int prefixLen);
+
+    int mtu_;
+    int maxPayload_;
+    float fps_;
+    RtpReceiver receiver_;
+    SocketHandle socket_;
+    uint16_t seq_;
+    uint32_t ssrc_;
+    uint32_t timestamp_;
+    std::vector<uint8_t> packet_;
+    std::vector<SentFrame> sent_;
+
+    long long packets_;
+    long long fuPackets_;
+    long long nals_;
+    long long nalBytes_;
+    long long wireBytes_;
+    int maxPacketsPerFrame_;
+    int64_t firstSendUs_;
+    int64_t lastSendUs_;
+    int verified_;
+    int corrupt_;
+    int missing_;
+    LatencyHistogram packetize_;
+    LatencyHistogram delivery_;
+};
+
+// Bitrate cost of size-limited slicing: encodes the input at the fixed
+// iDLayerQp twice, with and without slicing, and compares the sizes.
+void measureSliceOverhead(const TestOptions &opts, const SEncParamExt &param,
+                          StatsReport &report);
+
+#endif //__RTP_H__
@@ -0,0 +1,207 @@
+#include "saliency_priority.h"
+#include "simd.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+#ifdef HAVE_SSE2
+static inline int hsumSad(__m128i v) {
+    return _mm_cvtsi128_si32(v) + _mm_extract_epi16(v, 4);
+}
+
+static inline int hsumEpi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+#endif
+
+// sum and sum of squares of a 16x16 block
+static void blockSum16x16(const uint8_t *p, int stride, int &sum,
+                          int &sumSq) {
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vSum = zero, vSq = zero;
+    for (int y = 0; y < 16; y++, p += stride) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        vSum = _mm_add_epi64(vSum, _mm_sad_epu8(v, zero));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        vSq = _mm_add_epi32(vSq, _mm_madd_epi16(lo, lo));
+        vSq = _mm_add_epi32(vSq, _mm_madd_epi16(hi, hi));
+    }
+    sum = hsumSad(vSum);
+    sumSq = hsumEpi32(vSq);
+#else
+    sum = sumSq = 0;
+    for (int y = 0; y < 16; y++, p += stride) {
+        for (int x = 0; x < 16; x++) {
+            sum += p[x];
+            sumSq += p[x] * p[x];
+        }
+    }
+#endif
+}
+
+// sum of |horizontal| + |vertical| neighbour differences; xStep is +1, or
+// -1 for the last column so no load crosses the picture edge
+static int blockEdge16x16(const uint8_t *p, int stride, int xStep) {
+#ifdef HAVE_SSE2
+    __m128i vSad = _mm_setzero_si128();
+    __m128i cur = _mm_loadu_si128((const __m128i *)p);
+    for (int y = 0; y < 16; y++, p += stride) {
+        __m128i shifted = _mm_loadu_si128((const __m128i *)(p + xStep));
+        vSad = _mm_add_epi64(vSad, _mm_sad_epu8(cur, shifted));
+        if (y < 15) {
+            __m128i below = _mm_loadu_si128((const __m128i *)(p + stride));
+            vSad = _mm_add_epi64(vSad, _mm_sad_epu8(cur, below));
+            cur = below;
+        }
+    }
+    return hsumSad(vSad);
+#else
+    int sad = 0;
+    for (int y = 0; y < 16; y++, p += stride) {
+        for (int x = 0; x < 16; x++) {
+            sad += abs(p[x] - p[x + xStep]);
+            if (y < 15) {
+                sad += abs(p[x] - p[x + stride]);
+            }
+        }
+    }
+    return sad;
+#endif
+}
+
+static int blockSad16x16(const uint8_t *a, int strideA, const uint8_t *b,
+                         int strideB) {
+#ifdef HAVE_SSE2
+    __m128i vSad = _mm_setzero_si128();
+    for (int y = 0; y < 16; y++, a += strideA, b += strideB) {
+        vSad = _mm_add_epi64(
+            vSad, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)a),
+                               _mm_loadu_si128((const __m128i *)b)));
+    }
+    return hsumSad(vSad);
+#else
+    int sad = 0;
+    for (int y = 0; y < 16; y++, a += strideA, b += strideB) {
+        for (int x = 0; x < 16; x++) {
+            sad += abs(a[x] - b[x]);
+        }
+    }
+    return sad;
+#endif
+}
+
+SaliencyPrioritySource::SaliencyPrioritySource(const SaliencyWeights &weights,
+                                               int picWidth, int picHeight,
+                                               float minPriority,
+                                               float maxPriority)
+    : weights_(weights), picWidth_(picWidth), picHeight_(picHeight),
+      widthInMb_((picWidth + 15) / 16), heightInMb_((picHeight + 15) / 16),
+      minPriority_(minPriority), maxPriority_(maxPriority), havePrev_(false),
+      totalComputeUs_(0), computeCount_(0) {
+    const int mbCount = widthInMb_ * heightInMb_;
+    prevY_.resize(widthInMb_ * 16 * heightInMb_ * 16);
+    if (picWidth % 16 || picHeight % 16) {
+        paddedY_.resize(prevY_.size());
+    }
+    variance_.resize(mbCount);
+    edge_.resize(mbCount);
+    temporal_.resize(mbCount);
+}
+
+void SaliencyPrioritySource::AnalyzeFeatures(const uint8_t *pY, int stride) {
+    const int prevStride = widthInMb_ * 16;
+    if (!paddedY_.empty()) {
+        // the partial macroblocks at the edges read the nearest pixel
+        for (int y = 0; y < heightInMb_ * 16; y++) {
+            uint8_t *row = &paddedY_[y * prevStride];
+            if (y >= picHeight_) {
+                memcpy(row, row - prevStride, prevStride);
+                continue;
+            }
+            memcpy(row, pY + y * stride, picWidth_);
+            memset(row + picWidth_, row[picWidth_ - 1],
+                   prevStride - picWidth_);
+        }
+        pY = paddedY_.data();
+        stride = prevStride;
+    }
+    for (int mby = 0; mby < heightInMb_; mby++) {
+        for (int mbx = 0; mbx < widthInMb_; mbx++) {
+            const int idx = mby * widthInMb_ + mbx;
+            const uint8_t *p = pY + mby * 16 * stride + mbx * 16;
+            int sum = 0, sumSq = 0;
+            blockSum16x16(p, stride, sum, sumSq);
+            variance_[idx] = (sumSq - (float)sum * sum / 256) / 256;
+            edge_[idx] = (float)blockEdge16x16(
+                p, stride, mbx + 1 < widthInMb_ ? 1 : -1);
+            temporal_[idx] =
+                havePrev_ ? (float)blockSad16x16(
+                                p, stride,
+                                &prevY_[mby * 16 * prevStride + mbx * 16],
+                                prevStride)
+                          : 0;
+        }
+    }
+    for (int y = 0; y < heightInMb_ * 16; y++) {
+        memcpy(&prevY_[y * prevStride], pY + y * stride, prevStride);
+    }
+}
+
+bool SaliencyPrioritySource::fillPriorityArray(int frameNum,
+                                               const SSourcePicture &pic,
+                                               float *priorityArray) {
+    auto start = chrono::steady_clock::now();
+    const bool temporal = havePrev_;
+    AnalyzeFeatures(pic.pData[0], pic.iStride[0]);
+    havePrev_ = true;
+
+    const int mbCount = widthInMb_ * heightInMb_;
+    double meanVar = 0, meanEdge = 0, meanTemporal = 0;
+    for (int i = 0; i < mbCount; i++) {
+        meanVar += variance_[i];
+        meanEdge += edge_[i];
+        meanTemporal += temporal_[i];
+    }
+    // the epsilon keeps flat or static frames from amplifying noise
+    const float mv = (float)(meanVar / mbCount) + 1.0f;
+    const float me = (float)(meanEdge / mbCount) + 1.0f;
+    const float mt = (float)(meanTemporal / mbCount) + 1.0f;
+    const float wv = weights_.fVariance;
+    const float we = weights_.fEdge;
+    const float wt = temporal ? weights_.fTemporal : 0.0f;
+    if (wv + we + wt <= 0) {
+        // only temporal weight requested and no previous frame yet
+        for (int i = 0; i < mbCount; i++) {
+            priorityArray[i] = minPriority_;
+        }
+        return true;
+    }
+    const float norm = (maxPriority_ - minPriority_) / (wv + we + wt);
+    for (int i = 0; i < mbCount; i++) {
+        float v = variance_[i], e = edge_[i], t = temporal_[i];
+        float s = wv * v / (v + mv) + we * e / (e + me) + wt * t / (t + mt);
+        priorityArray[i] = minPriority_ + norm * s;
+    }
+
+    totalComputeUs_ += chrono::duration<double, micro>(
+                           chrono::steady_clock::now() - start)
+                           .count();
+    computeCount_++;
+    return true;
+}
+
+double SaliencyPrioritySource::AverageComputeUs() const {
+    return computeCount_ ? totalComputeUs_ / computeCount_ : 0;
+}
+
+void SaliencyPrioritySource::printSummary() {
+    cout << "Saliency priority map: " << AverageComputeUs() << " us/frame" << endl;
+}
@@ -0,0 +1,52 @@
+#ifndef __SALIENCY_PRIORITY_H__
+#define __SALIENCY_PRIORITY_H__
+
+#include "priority_source.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Relative weight of each per-MB feature in the final priority.
+struct SaliencyWeights {
+    float fVariance = 1.0f;
+    float fEdge = 1.0f;
+    float fTemporal = 2.0f;
+};
+
+// Derives priorities from the luma plane itself: 16x16 variance, gradient
+// energy and SAD against the previous frame. Each feature is normalized by
+// its frame mean as f / (f + mean), so the map adapts to the content level.
+class SaliencyPrioritySource : public PrioritySource {
+  public:
+    SaliencyPrioritySource(const SaliencyWeights &weights, int picWidth,
+                           int picHeight, float minPriority,
+                           float maxPriority);
+
+    bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                           float *priorityArray) override;
+    void printSummary() override;
+    double AverageComputeUs() const;
+
+  private:
+    void AnalyzeFeatures(const uint8_t *pY, int stride);
+
+    SaliencyWeights weights_;
+    int picWidth_;
+    int picHeight_;
+    int widthInMb_;
+    int heightInMb_;
+    float minPriority_;
+    float maxPriority_;
+    bool havePrev_;
+    std::vector<uint8_t> prevY_;
+    // the luma plane with its last column and row repeated out to whole
+    // macroblocks, when the picture is not a multiple of 16
+    std::vector<uint8_t> paddedY_;
+    std::vector<float> variance_;
+    std::vector<float> edge_;
+    std::vector<float> temporal_;
+    double totalComputeUs_;
+    int computeCount_;
+};
+
+#endif //__SALIENCY_PRIORITY_H__
@@ -0,0 +1,129 @@
+#include "scaler.h"
+#include "simd.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace {
+
+const bool useAvx2 = cpuHasAvx2();
+
+// source positions in 1/256 sample units: centre of destination sample d
+// is (d + 0.5) * src / dst - 0.5 source samples
+ScaleAxis makeAxis(int src, int dst) {
+    ScaleAxis axis;
+    axis.index.resize(dst);
+    axis.frac.resize(dst);
+    for (int d = 0; d < dst; d++) {
+        int64_t pos = ((int64_t)(2 * d + 1) * src * 256) / (2 * dst) - 128;
+        pos = max((int64_t)0, min(pos, (int64_t)(src - 1) * 256));
+        int index = (int)(pos >> 8);
+        int frac = (int)(pos & 255);
+        if (index >= src - 1) {
+            // the last sample, weighted fully from the one before
+            index = max(src - 2, 0);
+            frac = src > 1 ? 256 : 0;
+        }
+        axis.index[d] = index;
+        axis.frac[d] = frac;
+    }
+    return axis;
+}
+
+inline uint8_t lerp(int a, int b, int frac) {
+    return (uint8_t)((a * (256 - frac) + b * frac + 128) >> 8);
+}
+
+} // namespace
+
+FrameScaler::FrameScaler(int srcWidth, int srcHeight, int dstWidth,
+                         int dstHeight)
+    : srcWidth_(srcWidth), srcHeight_(srcHeight), dstWidth_(dstWidth),
+      dstHeight_(dstHeight), lumaX_(makeAxis(srcWidth, dstWidth)),
+      lumaY_(makeAxis(srcHeight, dstHeight)),
+      chromaX_(makeAxis(srcWidth / 2, dstWidth / 2)),
+      chromaY_(makeAxis(srcHeight / 2, dstHeight / 2)) {
+    assert(srcWidth % 2 == 0 && srcHeight % 2 == 0);
+    assert(dstWidth % 2 == 0 && dstHeight % 2 == 0);
+}
+
+void FrameScaler::ScalePlaneRows(const uint8_t *src, int srcWidth,
+                                 const ScaleAxis &x, const ScaleAxis &y,
+                                 uint8_t *dst, int dstWidth, int rowBegin,
+                                 int rowEnd, uint8_t *tmp) const {
+    for (int row = rowBegin; row < rowEnd; row++) {
+        const int fy = y.frac[row];
+        const uint8_t *s0 = src + (size_t)y.index[row] * srcWidth;
+        const uint8_t *s1 = fy ? s0 + srcWidth : s0;
+        int i = 0;
+#ifdef HAVE_AVX2
+        if (useAvx2) {
+            i = blendRowsAvx2(s0, s1, fy, tmp, srcWidth);
+        }
+#endif
+        for (; i < srcWidth; i++) {
+            tmp[i] = lerp(s0[i], s1[i], fy);
+        }
+        uint8_t *out = dst + (size_t)row * dstWidth;
+        int d = 0;
+#ifdef HAVE_AVX2
+        if (useAvx2) {
+            d = interpolateRowAvx2(tmp, x.index.data(), x.frac.data(), out,
+                                   dstWidth);
+        }
+#endif
+        for (; d < dstWidth; d++) {
+            const int xi = x.index[d];
+            out[d] = lerp(tmp[xi], tmp[xi + 1], x.frac[d]);
+        }
+    }
+}
+
+void FrameScaler::ScaleRows(const uint8_t *src, uint8_t *dst, int rowBegin,
+                            int rowEnd, vector<uint8_t> &tmp) const {
+    // interpolation reads one sample past its index, AVX2 gathers four
+    tmp.resize(srcWidth_ + 4);
+    const size_t srcLuma = (size_t)srcWidth_ * srcHeight_;
+    const size_t dstLuma = (size_t)dstWidth_ * dstHeight_;
+    ScalePlaneRows(src, srcWidth_, lumaX_, lumaY_, dst, dstWidth_, rowBegin,
+                   rowEnd, tmp.data());
+    for (int p = 0; p < 2; p++) {
+        ScalePlaneRows(src + srcLuma + p * srcLuma / 4, srcWidth_ / 2,
+                       chromaX_, chromaY_, dst + dstLuma + p * dstLuma / 4,
+                       dstWidth_ / 2, rowBegin / 2, rowEnd / 2, tmp.data());
+    }
+}
+
+ScalingInputStream::ScalingInputStream(InputStream *in, int srcWidth,
+                                       int srcHeight, int dstWidth,
+                                       int dstHeight, int threads)
+    : in_(in), scaler_(srcWidth, srcHeight, dstWidth, dstHeight),
+      frame_((size_t)srcWidth * srcHeight * 3 / 2),
+      // bands of at least 64 rows
+      tmp_(max(1, min(threads, dstHeight / 64))),
+      workers_(max(1, min(threads, dstHeight / 64))), scaleUs_(0) {}
+
+int ScalingInputStream::read(void *ptr, size_t len) {
+    assert(len == (size_t)scaler_.DstWidth() * scaler_.DstHeight() * 3 / 2);
+    size_t got = 0;
+    while (got < frame_.size()) {
+        const int n = in_->read(frame_.data() + got, frame_.size() - got);
+        if (n <= 0) {
+            return 0;
+        }
+        got += n;
+    }
+    const int64_t startUs = monotonicUs();
+    const int pairs = scaler_.DstHeight() / 2;
+    const int bands = workers_.Bands();
+    workers_.Run([&](int band) {
+        scaler_.ScaleRows(frame_.data(), (uint8_t *)ptr,
+                          pairs * band / bands * 2,
+                          pairs * (band + 1) / bands * 2, tmp_[band]);
+    });
+    scaleUs_ += monotonicUs() - startUs;
+    return (int)len;
+}
@@ -0,0 +1,85 @@
+#ifndef __SCALER_H__
+#define __SCALER_H__
+
+#include <wels/utils/InputStream.h>
+
+#include "band_workers.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Position of every destination sample along one axis: the source sample
+// on its left/top and the 8-bit weight of the one after it (0..256).
+struct ScaleAxis {
+    std::vector<int32_t> index;
+    std::vector<int32_t> frac;
+};
+
+// Bilinear downscaling of I420 frames with pixel centres aligned, meant
+// for ratios between 1:1 and 2:1 (beyond that it aliases). A vertical
+// pass blends two source rows into a scratch row, a horizontal pass
+// interpolates it; both round the same way in the scalar and AVX2 code,
+// so the output does not depend on the CPU.
+class FrameScaler {
+  public:
+    FrameScaler(int srcWidth, int srcHeight, int dstWidth, int dstHeight);
+
+    int SrcWidth() const { return srcWidth_; }
+    int SrcHeight() const { return srcHeight_; }
+    int DstWidth() const { return dstWidth_; }
+    int DstHeight() const { return dstHeight_; }
+    // destination luma rows [rowBegin, rowEnd), both even, and the chroma
+    // rows under them; tmp is the caller's scratch, one per thread
+    void ScaleRows(const uint8_t *src, uint8_t *dst, int rowBegin, int rowEnd,
+                   std::vector<uint8_t> &tmp) const;
+
+  private:
+    void ScalePlaneRows(const uint8_t *src, int srcWidth, const ScaleAxis &x,
+                        const ScaleAxis &y, uint8_t *dst, int dstWidth,
+                        int rowBegin, int rowEnd, uint8_t *tmp) const;
+
+    int srcWidth_;
+    int srcHeight_;
+    int dstWidth_;
+    int dstHeight_;
+    ScaleAxis lumaX_;
+    ScaleAxis lumaY_;
+    ScaleAxis chromaX_;
+    ScaleAxis chromaY_;
+};
+
+#ifdef HAVE_AVX2
+// 32 / 8 samples per step; FrameScaler picks these when the CPU has AVX2
+// and finishes the row with the scalar code. src of the interpolation
+// must be readable 4 bytes past the last sample it interpolates from.
+int blendRowsAvx2(const uint8_t *s0, const uint8_t *s1, int fy, uint8_t *dst,
+                  int width);
+int interpolateRowAvx2(const uint8_t *src, const int32_t *index,
+                       const int32_t *frac, uint8_t *dst, int width);
+#endif
+
+// Reads I420 frames of the scaler's source size and hands them out
+// scaled, rows split over threads. The full-size frame of the last read
+// stays available, so priority sources can look at the original picture.
+class ScalingInputStream : public InputStream {
+  public:
+    ScalingInputStream(InputStream *in, int srcWidth, int srcHeight,
+                       int dstWidth, int dstHeight, int threads);
+    // len must be one destination frame; returns 0 at the end of the input
+    int read(void *ptr, size_t len);
+
+    const uint8_t *SourceFrame() const { return frame_.data(); }
+    // wall time spent scaling, reads excluded
+    int64_t ScaleUs() const { return scaleUs_; }
+
+  private:
+    InputStream *in_;
+    FrameScaler scaler_;
+    std::vector<uint8_t> frame_;
+    std::vector<std::vector<uint8_t>> tmp_; ///< per band
+    BandWorkers workers_;
+    int64_t scaleUs_;
+};
+
+#endif //__SCALER_H__
@@ -0,0 +1,65 @@
+// Built with AVX2 code generation; only reached through the dispatch in
+// scaler.cpp.
+#include "scaler.h"
+
+#include <immintrin.h>
+
+int blendRowsAvx2(const uint8_t *s0, const uint8_t *s1, int fy, uint8_t *dst,
+                  int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i w0 = _mm256_set1_epi16((short)(256 - fy));
+    const __m256i w1 = _mm256_set1_epi16((short)fy);
+    const __m256i round = _mm256_set1_epi16(128);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(s0 + x));
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(s1 + x));
+        // the sum tops out at 65408, so it fits unsigned 16 bits
+        const __m256i lo = _mm256_srli_epi16(
+            _mm256_add_epi16(
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), w0),
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), w1)),
+                round),
+            8);
+        const __m256i hi = _mm256_srli_epi16(
+            _mm256_add_epi16(
+                _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), w0),
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), w1)),
+                round),
+            8);
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+int interpolateRowAvx2(const uint8_t *src, const int32_t *index,
+                       const int32_t *frac, uint8_t *dst, int width) {
+    const __m256i low = _mm256_set1_epi32(0xff);
+    const __m256i second = _mm256_set1_epi32(0xff00);
+    const __m256i full = _mm256_set1_epi32(256);
+    const __m256i round = _mm256_set1_epi32(128);
+    // dword 0 of each lane: samples 0-3 and 4-7 after the packs
+    const __m256i gather = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    int d = 0;
+    for (; d + 8 <= width; d += 8) {
+        const __m256i idx = _mm256_loadu_si256((const __m256i *)(index + d));
+        const __m256i f = _mm256_loadu_si256((const __m256i *)(frac + d));
+        const __m256i px = _mm256_i32gather_epi32((const int *)src, idx, 1);
+        // 16-bit pairs (left, right) against (256 - f, f)
+        const __m256i pair = _mm256_or_si256(
+            _mm256_and_si256(px, low),
+            _mm256_slli_epi32(_mm256_and_si256(px, second), 8));
+        const __m256i weight =
+            _mm256_or_si256(_mm256_sub_epi32(full, f), _mm256_slli_epi32(f, 16));
+        const __m256i r = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_madd_epi16(pair, weight), round), 8);
+        const __m256i words = _mm256_packus_epi32(r, r);
+        const __m256i bytes = _mm256_packus_epi16(words, words);
+        _mm_storel_epi64(
+            (__m128i *)(dst + d),
+            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bytes, gather)));
+    }
+    return d;
+}
@@ -0,0 +1,162 @@
+#include "scaling.h"
+#include "stats.h"
+#include "timing.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+struct ScalingCallback : public TestCallback {
+    ScalingCallback() : frames_(0) {}
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        frames_++;
+    }
+    int frames_;
+};
+
+struct InstanceResult {
+    bool bOk = false;
+    bool bPinned = false;
+    int iFrames = 0;
+    int64_t iStartUs = 0;
+    int64_t iEndUs = 0;
+};
+
+// one encoder; placed before it opens or allocates anything, so the input
+// buffers, the encoder and the threads they start are local as well
+void encodeInstance(const TestOptions &opts, const SEncParamExt &param,
+                    const CpuPlacement *placement, const string &outFile,
+                    InstanceResult &result) {
+    if (placement) {
+        result.bPinned = placement->Apply();
+    }
+    InputGeometry geometry = {width, height, inputFps};
+    unique_ptr<InputStream> in = openInput(opts.input, opts.inputFormat,
+                                           geometry, opts.convertThreads);
+    if (!in) {
+        return;
+    }
+    string unused;
+    unique_ptr<PrioritySource> source(
+        isDiffEncoding ? createPrioritySource(opts, unused) : nullptr);
+
+    SEncParamExt p = param;
+    BaseEncoderTest test;
+    test.prioritySource_ = source.get();
+    test.inputFormat_ = opts.inputFormat;
+    test.convertThreads_ = opts.convertThreads;
+    test.placement_ = placement;
+    ScalingCallback cbk;
+    test.SetUp();
+    result.iStartUs = monotonicUs();
+    test.EncodeInput(in.get(), &p, &cbk, outFile + h264Suffix);
+    result.iEndUs = monotonicUs();
+    test.TearDown();
+    result.bOk = true;
+    result.iFrames = cbk.frames_;
+}
+
+// aggregate fps of count encoders, 0 when one failed
+double runInstances(const TestOptions &opts, const SEncParamExt &param,
+                    const vector<CpuPlacement> *placements, int count,
+                    const string &outFile, bool &pinned) {
+    vector<InstanceResult> results(count);
+    vector<thread> encoders;
+    for (int i = 0; i < count; i++) {
+        encoders.emplace_back(encodeInstance, cref(opts), cref(param),
+                              placements ? &(*placements)[i] : nullptr,
+                              outFile + "-scaling-" + to_string(i),
+                              ref(results[i]));
+    }
+    for (thread &t : encoders) {
+        t.join();
+    }
+    int64_t startUs = 0, endUs = 0;
+    int frames = 0;
+    pinned = placements != nullptr;
+    for (const InstanceResult &r : results) {
+        if (!r.bOk) {
+            return 0;
+        }
+        startUs = startUs ? min(startUs, r.iStartUs) : r.iStartUs;
+        endUs = max(endUs, r.iEndUs);
+        frames += r.iFrames;
+        pinned = pinned && r.bPinned;
+    }
+    return endUs > startUs ? frames / ((endUs - startUs) / 1e6) : 0;
+}
+
+} // namespace
+
+int runScalingBench(const TestOptions &opts, const SEncParamExt &param,
+                    const string &outFile) {
+    CpuTopology topology;
+    topology.Load();
+    const int maxEncoders = opts.scaling;
+    cout << "Scaling 1 to " << maxEncoders << " encoders on "
+         << topology.Describe() << endl;
+
+    StatsReport report;
+    report.AddCounter("scaling_nodes", topology.Nodes());
+    report.AddCounter("scaling_cores", topology.Cores());
+    report.AddCounter("scaling_cpus", (double)topology.Cpus().size());
+    double baseFps[2] = {0, 0};
+    bool pinnedAll = true;
+    for (int count = 1; count <= maxEncoders; count++) {
+        // the best layout for this many, not a prefix of the largest run's
+        const vector<CpuPlacement> placements =
+            planPlacements(topology, count);
+        double fps[2];
+        for (int pin = 0; pin < 2; pin++) {
+            bool pinned;
+            fps[pin] = runInstances(opts, param, pin ? &placements : nullptr,
+                                    count, outFile, pinned);
+            if (fps[pin] <= 0) {
+                cerr << "A scaling encode could not open its input\n";
+                return 1;
+            }
+            pinnedAll = pinnedAll && (!pin || pinned);
+            if (count == 1) {
+                baseFps[pin] = fps[pin];
+            }
+        }
+        const string prefix = "scaling_" + to_string(count);
+        cout << "  " << count << " encoders: " << fps[0] << " fps ("
+             << fps[0] / (count * baseFps[0]) << " efficiency), pinned "
+             << fps[1] << " fps (" << fps[1] / (count * baseFps[1])
+             << "), pinned/unpinned " << fps[1] / fps[0] << endl;
+        for (int i = 0; i < count; i++) {
+            cout << "    encoder " << i << ": " << placements[i].Describe()
+                 << endl;
+        }
+        report.AddCounter(prefix + "_fps", fps[0]);
+        report.AddCounter(prefix + "_pinned_fps", fps[1]);
+        report.AddCounter(prefix + "_efficiency",
+                          fps[0] / (count * baseFps[0]));
+        report.AddCounter(prefix + "_pinned_efficiency",
+                          fps[1] / (count * baseFps[1]));
+    }
+    if (!pinnedAll) {
+        cerr << "Warning: the OS refused some placements, those encoders "
+                "ran unpinned\n";
+    }
+    report.AddCounter("scaling_pinned", pinnedAll);
+
+    for (int i = 0; i < maxEncoders; i++) {
+        const string name = outFile + "-scaling-" + to_string(i) + h264Suffix;
+        remove(name.c_str());
+        remove((name + bitstreamIndexSuffix).c_str());
+    }
+    if (!report.WriteJson(outFile + "-scaling.stats.json")) {
+        cerr << "Failed to write " << outFile << "-scaling.stats.json\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef __SCALING_H__
+#define __SCALING_H__
+
+#include "harness.h"
+
+#include <string>
+
+// Throughput of 1 to opts.scaling encoders of the input running side by
+// side, each on its own thread with its own read of the input, its own
+// priority source and its own <outFile>-scaling-<i>.h264. Every count runs
+// twice: left to the scheduler, then pinned with planPlacements so each
+// encoder, its prefetch thread and its frame buffers stay on one core set
+// and NUMA node. Prints aggregate fps and the efficiency against one
+// encoder, and writes <outFile>-scaling.stats.json.
+int runScalingBench(const TestOptions &opts, const SEncParamExt &param,
+                    const std::string &outFile);
+
+#endif //__SCALING_H__
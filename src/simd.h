@@ -0,0 +1,63 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+// SSE2 is part of the x86-64 baseline, so it is always available on the
+// targets we ship for; everything else falls back to the scalar loops.
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// index of the lowest set bit, mask must not be 0
+inline int lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// index of the highest set bit, mask must not be 0
+inline int highestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+// AVX2 kernels live in translation units built with AVX2 enabled
+// (HAVE_AVX2, the OPENH264_TEST_AVX2 CMake option) and are only called
+// when the CPU running us has it.
+inline bool cpuHasAvx2() {
+#if !defined(HAVE_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+    __cpuid(regs, 1);
+    // OSXSAVE and AVX, then the OS saving the YMM state
+    if ((regs[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) ||
+        (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif //__SIMD_H__
@@ -0,0 +1,776 @@
+#include "slice_parser.h"
+#include "bit_reader.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// Table 9-5, indexed by TotalCoeff * 4 + TrailingOnes, for
+// 0 <= nC < 2, 2 <= nC < 4, 4 <= nC < 8 and 8 <= nC
+const uint8_t coeffTokenLen[4][4 * 17] = {
+    {1,  0,  0,  0,  6,  2,  0,  0,  8,  6,  3,  0,  9,  8,  7,  5,  10,
+     9,  8,  6,  11, 10, 9,  7,  13, 11, 10, 8,  13, 13, 11, 9,  13, 13,
+     13, 10, 14, 14, 13, 11, 14, 14, 14, 13, 15, 15, 14, 14, 15, 15, 15,
+     14, 16, 15, 15, 15, 16, 16, 16, 15, 16, 16, 16, 16, 16, 16, 16, 16},
+    {2,  0,  0,  0,  6,  2,  0,  0,  6,  5,  3,  0,  7,  6,  6,  4,  8,
+     6,  6,  4,  8,  7,  7,  5,  9,  8,  8,  6,  11, 9,  9,  6,  11, 11,
+     11, 7,  12, 11, 11, 9,  12, 12, 12, 11, 12, 12, 12, 11, 13, 13, 13,
+     12, 13, 13, 13, 13, 13, 14, 13, 13, 14, 14, 14, 13, 14, 14, 14, 14},
+    {4, 0, 0, 0, 6, 4, 0, 0, 6, 5, 4, 0, 6, 5, 5, 4, 7, 5, 5, 4, 7,  5,  5,
+     4, 7, 6, 6, 4, 7, 6, 6, 4, 8, 7, 7, 5, 8, 8, 7, 6, 9, 8, 8, 7, 9,  9,
+     8, 8, 9, 9, 9, 8, 10, 9, 9, 9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+     10, 10},
+    {6, 0, 0, 0, 6, 6, 0, 0, 6, 6, 6, 0, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+     6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+     6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6},
+};
+
+const uint8_t coeffTokenBits[4][4 * 17] = {
+    {1,  0,  0,  0, 5,  1,  0,  0,  7,  4,  1,  0,  7,  6,  5,  3,  7,
+     6,  5,  3,  7, 6,  5,  4,  15, 6,  5,  4,  11, 14, 5,  4,  8,  10,
+     13, 4,  15, 14, 9, 4,  11, 10, 13, 12, 15, 14, 9,  12, 11, 10, 13,
+     8,  15, 1,  9,  12, 11, 14, 13, 8,  7,  10, 9,  12, 4,  6,  5,  8},
+    {3,  0,  0,  0,  11, 2,  0,  0, 7,  7,  3,  0,  7,  10, 9,  5,  7,
+     6,  5,  4,  4,  6,  5,  6,  7, 6,  5,  8,  15, 6,  5,  4,  11, 14,
+     13, 4,  15, 10, 9,  4,  11, 14, 13, 12, 8,  10, 9,  8,  15, 14, 13,
+     12, 11, 10, 9,  12, 7,  11, 6, 8,  9,  8,  10, 1,  7,  6,  5,  4},
+    {15, 0,  0,  0,  15, 14, 0,  0,  11, 15, 13, 0,  8,  12, 14, 12, 15,
+     10, 11, 11, 11, 8,  9,  10, 9,  14, 13, 9,  8,  10, 9,  8,  15, 14,
+     13, 13, 11, 14, 10, 12, 15, 10, 13, 12, 11, 14, 9,  12, 8,  10, 13,
+     8,  13, 7,  9,  12, 9,  12, 11, 10, 5,  8,  7,  6,  1,  4,  3,  2},
+    {3,  0,  0,  0,  0,  1,  0,  0,  4,  5,  6,  0,  8,  9,  10, 11, 12,
+     13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
+     30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46,
+     47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63},
+};
+
+// nC == -1, chroma DC of 4:2:0
+const uint8_t chromaDcCoeffTokenLen[4 * 5] = {2, 0, 0, 0, 6, 1, 0, 0, 6, 6,
+                                              3, 0, 6, 7, 7, 6, 6, 8, 8, 7};
+const uint8_t chromaDcCoeffTokenBits[4 * 5] = {1, 0, 0, 0, 7, 1, 0, 0, 4, 6,
+                                               1, 0, 3, 3, 2, 5, 2, 3, 2, 0};
+
+// Tables 9-7 and 9-8, indexed by TotalCoeff - 1 and total_zeros
+const uint8_t totalZerosLen[15][16] = {
+    {1, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9},
+    {3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6},
+    {4, 3, 3, 3, 4, 4, 3, 3, 4, 5, 5, 6, 5, 6},
+    {5, 3, 4, 4, 3, 3, 3, 4, 3, 4, 5, 5, 5},
+    {4, 4, 4, 3, 3, 3, 3, 3, 4, 5, 4, 5},
+    {6, 5, 3, 3, 3, 3, 3, 3, 4, 3, 6},
+    {6, 5, 3, 3, 3, 2, 3, 4, 3, 6},
+    {6, 4, 5, 3, 2, 2, 3, 3, 6},
+    {6, 6, 4, 2, 2, 3, 2, 5},
+    {5, 5, 3, 2, 2, 2, 4},
+    {4, 4, 3, 3, 1, 3},
+    {4, 4, 2, 1, 3},
+    {3, 3, 1, 2},
+    {2, 2, 1},
+    {1, 1},
+};
+
+const uint8_t totalZerosBits[15][16] = {
+    {1, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1},
+    {7, 6, 5, 4, 3, 5, 4, 3, 2, 3, 2, 3, 2, 1, 0},
+    {5, 7, 6, 5, 4, 3, 4, 3, 2, 3, 2, 1, 1, 0},
+    {3, 7, 5, 4, 6, 5, 4, 3, 3, 2, 2, 1, 0},
+    {5, 4, 3, 7, 6, 5, 4, 3, 2, 1, 1, 0},
+    {1, 1, 7, 6, 5, 4, 3, 2, 1, 1, 0},
+    {1, 1, 5, 4, 3, 3, 2, 1, 1, 0},
+    {1, 1, 1, 3, 3, 2, 2, 1, 0},
+    {1, 0, 1, 3, 2, 1, 1, 1},
+    {1, 0, 1, 3, 2, 1, 1},
+    {0, 1, 1, 2, 1, 3},
+    {0, 1, 1, 1, 1},
+    {0, 1, 1, 1},
+    {0, 1, 1},
+    {0, 1},
+};
+
+// Table 9-9 (a), chroma DC of 4:2:0
+const uint8_t chromaDcTotalZerosLen[3][4] = {
+    {1, 2, 3, 3}, {1, 2, 2, 0}, {1, 1, 0, 0}};
+const uint8_t chromaDcTotalZerosBits[3][4] = {
+    {1, 1, 1, 0}, {1, 1, 0, 0}, {1, 0, 0, 0}};
+
+// Table 9-10, indexed by min(zerosLeft, 7) - 1 and run_before
+const uint8_t runBeforeLen[7][15] = {
+    {1, 1},
+    {1, 2, 2},
+    {2, 2, 2, 2},
+    {2, 2, 2, 3, 3},
+    {2, 2, 3, 3, 3, 3},
+    {2, 3, 3, 3, 3, 3, 3},
+    {3, 3, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+};
+const uint8_t runBeforeBits[7][15] = {
+    {1, 0},
+    {1, 1, 0},
+    {3, 2, 1, 0},
+    {3, 2, 1, 1, 0},
+    {3, 2, 3, 2, 1, 0},
+    {3, 0, 1, 3, 2, 5, 4},
+    {7, 6, 5, 4, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+};
+
+// Table 9-4, codeNum to coded_block_pattern for ChromaArrayType 1
+const uint8_t intraCbp[48] = {
+    47, 31, 15, 0,  23, 27, 29, 30, 7,  11, 13, 14, 39, 43, 45, 46,
+    16, 3,  5,  10, 12, 19, 21, 26, 28, 35, 37, 42, 44, 1,  2,  4,
+    8,  17, 18, 20, 24, 6,  9,  22, 25, 32, 33, 34, 36, 40, 38, 41};
+const uint8_t interCbp[48] = {
+    0,  16, 1,  2,  4,  8,  32, 3,  5,  10, 12, 15, 47, 7,  11, 13,
+    14, 6,  9,  31, 35, 37, 42, 44, 33, 34, 36, 40, 39, 43, 45, 46,
+    17, 18, 20, 24, 19, 21, 26, 28, 23, 27, 29, 30, 22, 25, 38, 41};
+
+// sub-macroblock partitions of P_8x8 by sub_mb_type
+const int subMbParts[4] = {1, 2, 2, 4};
+
+// Prefix code looked up with a table over its longest code length.
+class Vlc {
+  public:
+    void Build(const uint8_t *lens, const uint8_t *bits, int count) {
+        maxLen_ = 0;
+        for (int i = 0; i < count; i++) {
+            maxLen_ = max(maxLen_, (int)lens[i]);
+        }
+        lut_.assign((size_t)1 << maxLen_, 0);
+        for (int i = 0; i < count; i++) {
+            if (!lens[i]) {
+                continue;
+            }
+            const int shift = maxLen_ - lens[i];
+            const size_t first = (size_t)bits[i] << shift;
+            for (size_t k = 0; k < ((size_t)1 << shift); k++) {
+                lut_[first + k] = (uint16_t)(lens[i] << 8 | i);
+            }
+        }
+    }
+    // the symbol index, -1 for an invalid code
+    int Decode(BitReader &br) const {
+        const uint16_t e = lut_[br.PeekBits(maxLen_)];
+        if (!e) {
+            return -1;
+        }
+        br.SkipBits(e >> 8);
+        return e & 0xff;
+    }
+
+  private:
+    int maxLen_ = 0;
+    vector<uint16_t> lut_;
+};
+
+struct CavlcTables {
+    Vlc coeffToken[4];
+    Vlc chromaDcCoeffToken;
+    Vlc totalZeros[15];
+    Vlc chromaDcTotalZeros[3];
+    Vlc runBefore[7];
+
+    CavlcTables() {
+        for (int t = 0; t < 4; t++) {
+            coeffToken[t].Build(coeffTokenLen[t], coeffTokenBits[t], 4 * 17);
+        }
+        chromaDcCoeffToken.Build(chromaDcCoeffTokenLen, chromaDcCoeffTokenBits,
+                                 4 * 5);
+        for (int t = 0; t < 15; t++) {
+            totalZeros[t].Build(totalZerosLen[t], totalZerosBits[t], 16 - t);
+        }
+        for (int t = 0; t < 3; t++) {
+            chromaDcTotalZeros[t].Build(chromaDcTotalZerosLen[t],
+                                        chromaDcTotalZerosBits[t], 4 - t);
+        }
+        for (int t = 0; t < 7; t++) {
+            runBefore[t].Build(runBeforeLen[t], runBeforeBits[t],
+                               t < 6 ? t + 2 : 15);
+        }
+    }
+};
+
+const CavlcTables &cavlcTables() {
+    static const CavlcTables tables;
+    return tables;
+}
+
+bool isHighProfile(int profileIdc) {
+    switch (profileIdc) {
+    case 100:
+    case 110:
+    case 122:
+    case 244:
+    case 44:
+    case 83:
+    case 86:
+    case 118:
+    case 128:
+    case 138:
+    case 139:
+    case 134:
+    case 135:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void skipScalingLists(BitReader &br, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!br.ReadBit()) {
+            continue;
+        }
+        const int size = i < 6 ? 16 : 64;
+        int last = 8, next = 8;
+        for (int j = 0; j < size && next != 0; j++) {
+            next = (last + br.ReadSe() + 256) % 256;
+            last = next ? next : last;
+        }
+    }
+}
+
+bool parseSps(BitReader &br, int &id, H264Sps &sps) {
+    sps = H264Sps();
+    sps.iProfileIdc = br.ReadBits(8);
+    br.SkipBits(16); // constraint flags, level_idc
+    id = br.ReadUe();
+    if (id >= 32) {
+        return false;
+    }
+    if (isHighProfile(sps.iProfileIdc)) {
+        const uint32_t chromaFormat = br.ReadUe();
+        if (chromaFormat != 1) {
+            return false; // only 4:2:0
+        }
+        if (br.ReadUe() != 0 || br.ReadUe() != 0) {
+            return false; // only 8-bit
+        }
+        br.SkipBits(1); // qpprime_y_zero_transform_bypass_flag
+        if (br.ReadBit()) {
+            skipScalingLists(br, 8);
+        }
+    }
+    sps.iLog2MaxFrameNum = br.ReadUe() + 4;
+    sps.iPocType = br.ReadUe();
+    if (sps.iPocType == 0) {
+        sps.iLog2MaxPocLsb = br.ReadUe() + 4;
+    } else if (sps.iPocType == 1) {
+        sps.bDeltaPicOrderAlwaysZero = br.ReadBit();
+        br.ReadSe(); // offset_for_non_ref_pic
+        br.ReadSe(); // offset_for_top_to_bottom_field
+        const uint32_t cycle = br.ReadUe();
+        for (uint32_t i = 0; i < cycle && !br.Overrun(); i++) {
+            br.ReadSe();
+        }
+    }
+    br.ReadUe();    // max_num_ref_frames
+    br.SkipBits(1); // gaps_in_frame_num_value_allowed_flag
+    sps.iWidthInMbs = br.ReadUe() + 1;
+    sps.iHeightInMbs = br.ReadUe() + 1;
+    sps.bFrameMbsOnly = br.ReadBit();
+    sps.bValid = !br.Overrun() && sps.iLog2MaxFrameNum <= 16 &&
+                 sps.iLog2MaxPocLsb <= 16 && sps.iWidthInMbs <= 1024 &&
+                 sps.iHeightInMbs <= 1024;
+    return sps.bValid;
+}
+
+bool parsePps(BitReader &br, int &id, H264Pps &pps) {
+    pps = H264Pps();
+    id = br.ReadUe();
+    pps.iSpsId = br.ReadUe();
+    if (id >= 256 || pps.iSpsId >= 32) {
+        return false;
+    }
+    pps.bCabac = br.ReadBit();
+    pps.bBottomFieldPicOrderPresent = br.ReadBit();
+    pps.iNumSliceGroups = br.ReadUe() + 1;
+    if (pps.iNumSliceGroups > 1) {
+        return false; // FMO is outside what the encoder produces
+    }
+    pps.iNumRefIdxL0Default = br.ReadUe() + 1;
+    br.ReadUe(); // num_ref_idx_l1_default_active_minus1
+    pps.bWeightedPred = br.ReadBit();
+    br.SkipBits(2); // weighted_bipred_idc
+    pps.iPicInitQp = 26 + br.ReadSe();
+    br.ReadSe(); // pic_init_qs_minus26
+    br.ReadSe(); // chroma_qp_index_offset
+    pps.bDeblockingFilterControlPresent = br.ReadBit();
+    br.SkipBits(1); // constrained_intra_pred_flag
+    pps.bRedundantPicCntPresent = br.ReadBit();
+    if (br.MoreRbspData()) {
+        pps.bTransform8x8 = br.ReadBit();
+    }
+    pps.bValid = !br.Overrun();
+    return pps.bValid;
+}
+
+} // namespace
+
+bool H264ParamSets::Add(const uint8_t *nal, size_t size) {
+    if (size < 2) {
+        return false;
+    }
+    const int type = nal[0] & 0x1f;
+    if (type != 7 && type != 8) {
+        return false;
+    }
+    vector<uint8_t> rbsp;
+    nalToRbsp(nal + 1, size - 1, rbsp);
+    BitReader br(rbsp.data(), rbsp.size());
+    int id;
+    if (type == 7) {
+        H264Sps parsed;
+        if (!parseSps(br, id, parsed)) {
+            return false;
+        }
+        sps[id] = parsed;
+    } else {
+        H264Pps parsed;
+        if (!parsePps(br, id, parsed)) {
+            return false;
+        }
+        pps[id] = parsed;
+    }
+    return true;
+}
+
+void SliceParser::Begin() {
+    width_ = 0;
+    height_ = 0;
+    headerBits_ = 0;
+    slices_ = 0;
+}
+
+void SliceParser::Resize(const H264Sps &sps) {
+    width_ = sps.iWidthInMbs;
+    height_ = sps.iHeightInMbs;
+    const size_t count = (size_t)width_ * height_;
+    MbStat missing = {0, 0, 0, mbMissing};
+    // assign keeps the capacity, so a sequence allocates once
+    mbs_.assign(count, missing);
+    sliceOf_.assign(count, -1);
+    nzLuma_.assign(count * 16, 0);
+    nzChroma_.assign(count * 8, 0);
+}
+
+static int combineNc(int nA, int nB) {
+    if (nA >= 0 && nB >= 0) {
+        return (nA + nB + 1) >> 1;
+    }
+    return nA >= 0 ? nA : nB >= 0 ? nB : 0;
+}
+
+// 9.2.1: neighbours count when they belong to the same slice
+int SliceParser::LumaNc(int mb, int bx, int by) const {
+    const int slice = sliceOf_[mb];
+    int nA = -1, nB = -1;
+    if (bx > 0) {
+        nA = nzLuma_[mb * 16 + by * 4 + bx - 1];
+    } else if (mb % width_ && sliceOf_[mb - 1] == slice) {
+        nA = nzLuma_[(mb - 1) * 16 + by * 4 + 3];
+    }
+    if (by > 0) {
+        nB = nzLuma_[mb * 16 + (by - 1) * 4 + bx];
+    } else if (mb >= width_ && sliceOf_[mb - width_] == slice) {
+        nB = nzLuma_[(mb - width_) * 16 + 12 + bx];
+    }
+    return combineNc(nA, nB);
+}
+
+int SliceParser::ChromaNc(int mb, int plane, int bx, int by) const {
+    const int slice = sliceOf_[mb];
+    const int base = plane * 4;
+    int nA = -1, nB = -1;
+    if (bx > 0) {
+        nA = nzChroma_[mb * 8 + base + by * 2];
+    } else if (mb % width_ && sliceOf_[mb - 1] == slice) {
+        nA = nzChroma_[(mb - 1) * 8 + base + by * 2 + 1];
+    }
+    if (by > 0) {
+        nB = nzChroma_[mb * 8 + base + bx];
+    } else if (mb >= width_ && sliceOf_[mb - width_] == slice) {
+        nB = nzChroma_[(mb - width_) * 8 + base + 2 + bx];
+    }
+    return combineNc(nA, nB);
+}
+
+// residual_block_cavlc, 7.3.5.3.2; returns TotalCoeff or -1. Only the
+// syntax is walked, the coefficient values are not needed.
+int SliceParser::ResidualBlock(BitReader &br, int nC, int maxNumCoeff) {
+    const CavlcTables &t = cavlcTables();
+    int token;
+    if (nC == -1) {
+        token = t.chromaDcCoeffToken.Decode(br);
+    } else {
+        token = t.coeffToken[nC < 2 ? 0 : nC < 4 ? 1 : nC < 8 ? 2 : 3].Decode(
+            br);
+    }
+    if (token < 0) {
+        return -1;
+    }
+    const int totalCoeff = token >> 2;
+    const int trailingOnes = token & 3;
+    if (totalCoeff == 0) {
+        return 0;
+    }
+    if (totalCoeff > maxNumCoeff) {
+        return -1;
+    }
+    int suffixLength = totalCoeff > 10 && trailingOnes < 3 ? 1 : 0;
+    br.SkipBits(trailingOnes); // trailing_ones_sign_flag
+    for (int i = trailingOnes; i < totalCoeff; i++) {
+        const int levelPrefix = br.ReadLeadingZeros();
+        if (levelPrefix > 31) {
+            return -1;
+        }
+        int levelCode = min(15, levelPrefix) << suffixLength;
+        int levelSuffixSize = suffixLength;
+        if (levelPrefix == 14 && suffixLength == 0) {
+            levelSuffixSize = 4;
+        } else if (levelPrefix >= 15) {
+            levelSuffixSize = levelPrefix - 3;
+        }
+        if (levelSuffixSize > 0) {
+            levelCode += br.ReadBits(levelSuffixSize);
+        }
+        if (levelPrefix >= 15 && suffixLength == 0) {
+            levelCode += 15;
+        }
+        if (levelPrefix >= 16) {
+            levelCode += (1 << (levelPrefix - 3)) - 4096;
+        }
+        if (i == trailingOnes && trailingOnes < 3) {
+            levelCode += 2;
+        }
+        const int absLevel = (levelCode + 2) >> 1;
+        if (suffixLength == 0) {
+            suffixLength = 1;
+        }
+        if (absLevel > (3 << (suffixLength - 1)) && suffixLength < 6) {
+            suffixLength++;
+        }
+    }
+    int zerosLeft = 0;
+    if (totalCoeff < maxNumCoeff) {
+        zerosLeft = maxNumCoeff == 4
+                        ? t.chromaDcTotalZeros[totalCoeff - 1].Decode(br)
+                        : t.totalZeros[totalCoeff - 1].Decode(br);
+        if (zerosLeft < 0 || zerosLeft > maxNumCoeff - totalCoeff) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < totalCoeff - 1 && zerosLeft > 0; i++) {
+        const int run = t.runBefore[min(zerosLeft, 7) - 1].Decode(br);
+        if (run < 0 || run > zerosLeft) {
+            return -1;
+        }
+        zerosLeft -= run;
+    }
+    return br.Overrun() ? -1 : totalCoeff;
+}
+
+// macroblock_layer, 7.3.5, for P and I slices
+bool SliceParser::ParseMacroblock(BitReader &br, int mb, bool pSlice,
+                                  int numRefIdxActive, int &qp) {
+    MbStat &stat = mbs_[mb];
+    uint32_t mbType = br.ReadUe();
+    bool intra = true;
+    if (pSlice) {
+        if (mbType < 5) {
+            intra = false;
+        } else {
+            mbType -= 5;
+        }
+    }
+    if (intra && mbType > 25) {
+        return false;
+    }
+    uint8_t *nzL = &nzLuma_[(size_t)mb * 16];
+    uint8_t *nzC = &nzChroma_[(size_t)mb * 8];
+
+    if (intra && mbType == 25) {
+        // I_PCM: byte-aligned raw samples, QP_Y 0 for this macroblock only
+        br.AlignToByte();
+        br.SkipBits(384 * 8);
+        fill(nzL, nzL + 16, 16);
+        fill(nzC, nzC + 8, 16);
+        stat.uiKind = mbPcm;
+        stat.iQp = 0;
+        stat.iQpDelta = 0;
+        return !br.Overrun();
+    }
+
+    const bool intra16x16 = intra && mbType >= 1;
+    int cbp = 0;
+    if (intra) {
+        if (!intra16x16) {
+            for (int i = 0; i < 16; i++) {
+                // prev_intra4x4_pred_mode_flag, rem_intra4x4_pred_mode
+                if (!br.ReadBit()) {
+                    br.SkipBits(3);
+                }
+            }
+        }
+        br.ReadUe(); // intra_chroma_pred_mode
+        if (intra16x16) {
+            cbp = ((mbType - 1) / 4 % 3) << 4 | (mbType >= 13 ? 15 : 0);
+        }
+    } else if (mbType >= 3) {
+        // P_8x8, P_8x8ref0
+        int subTypes[4];
+        for (int i = 0; i < 4; i++) {
+            const uint32_t subType = br.ReadUe();
+            if (subType > 3) {
+                return false;
+            }
+            subTypes[i] = subType;
+        }
+        if (numRefIdxActive > 1 && mbType == 3) {
+            for (int i = 0; i < 4; i++) {
+                br.ReadTe(numRefIdxActive - 1);
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            for (int p = 0; p < subMbParts[subTypes[i]]; p++) {
+                br.ReadSe();
+                br.ReadSe();
+            }
+        }
+    } else {
+        const int parts = mbType == 0 ? 1 : 2;
+        if (numRefIdxActive > 1) {
+            for (int p = 0; p < parts; p++) {
+                br.ReadTe(numRefIdxActive - 1);
+            }
+        }
+        for (int p = 0; p < parts; p++) {
+            br.ReadSe(); // mvd_l0 x, y
+            br.ReadSe();
+        }
+    }
+    if (!intra16x16) {
+        const uint32_t code = br.ReadUe();
+        if (code > 47) {
+            return false;
+        }
+        cbp = intra ? intraCbp[code] : interCbp[code];
+    }
+    const int cbpLuma = cbp & 15;
+    const int cbpChroma = cbp >> 4;
+    int qpDelta = 0;
+    if (cbpLuma || cbpChroma || intra16x16) {
+        qpDelta = br.ReadSe();
+        if (qpDelta < -26 || qpDelta > 25) {
+            return false;
+        }
+        qp = (qp + qpDelta + 52) % 52;
+    }
+    stat.uiKind = intra ? mbIntra : mbInter;
+    stat.iQp = (int8_t)qp;
+    stat.iQpDelta = (int8_t)qpDelta;
+
+    // residual_luma, 7.3.5.3.1
+    if (intra16x16 && ResidualBlock(br, LumaNc(mb, 0, 0), 16) < 0) {
+        return false;
+    }
+    for (int blk = 0; blk < 16; blk++) {
+        // blocks come in 8x8 quadrants, each in raster order
+        const int bx = (blk & 1) | (blk >> 1 & 2);
+        const int by = (blk >> 1 & 1) | (blk >> 2 & 2);
+        int total = 0;
+        if (cbpLuma & (1 << (blk >> 2))) {
+            total = ResidualBlock(br, LumaNc(mb, bx, by), intra16x16 ? 15 : 16);
+            if (total < 0) {
+                return false;
+            }
+        }
+        nzL[by * 4 + bx] = (uint8_t)total;
+    }
+    if (cbpChroma) {
+        for (int plane = 0; plane < 2; plane++) {
+            if (ResidualBlock(br, -1, 4) < 0) {
+                return false;
+            }
+        }
+    }
+    for (int plane = 0; plane < 2; plane++) {
+        for (int blk = 0; blk < 4; blk++) {
+            int total = 0;
+            if (cbpChroma & 2) {
+                total = ResidualBlock(br, ChromaNc(mb, plane, blk & 1, blk >> 1),
+                                      15);
+                if (total < 0) {
+                    return false;
+                }
+            }
+            nzC[plane * 4 + blk] = (uint8_t)total;
+        }
+    }
+    return !br.Overrun();
+}
+
+bool SliceParser::ParseSlice(const uint8_t *nal, size_t size,
+                             const H264ParamSets &params) {
+    if (size < 2) {
+        return false;
+    }
+    const int nalRefIdc = nal[0] >> 5 & 3;
+    const int nalType = nal[0] & 0x1f;
+    if (nalType != 1 && nalType != 5) {
+        return false;
+    }
+    nalToRbsp(nal + 1, size - 1, rbsp_);
+    BitReader br(rbsp_.data(), rbsp_.size());
+
+    // slice_header, 7.3.3
+    const uint32_t firstMb = br.ReadUe();
+    const uint32_t sliceType = br.ReadUe() % 5;
+    const uint32_t ppsId = br.ReadUe();
+    if (ppsId >= 256 || !params.pps[ppsId].bValid) {
+        return false;
+    }
+    const H264Pps &pps = params.pps[ppsId];
+    const H264Sps &sps = params.sps[pps.iSpsId];
+    if (!sps.bValid || !sps.bFrameMbsOnly || pps.bCabac ||
+        pps.bTransform8x8) {
+        return false;
+    }
+    if (slices_ == 0) {
+        Resize(sps);
+    } else if (sps.iWidthInMbs != width_ || sps.iHeightInMbs != height_) {
+        return false;
+    }
+    if (firstMb >= mbs_.size()) {
+        return false;
+    }
+    // P and I only, as in the Baseline profile
+    const bool pSlice = sliceType == 0;
+    if (!pSlice && sliceType != 2) {
+        return false;
+    }
+    br.SkipBits(sps.iLog2MaxFrameNum); // frame_num
+    if (nalType == 5) {
+        br.ReadUe(); // idr_pic_id
+    }
+    if (sps.iPocType == 0) {
+        br.SkipBits(sps.iLog2MaxPocLsb);
+        if (pps.bBottomFieldPicOrderPresent) {
+            br.ReadSe();
+        }
+    } else if (sps.iPocType == 1 && !sps.bDeltaPicOrderAlwaysZero) {
+        br.ReadSe();
+        if (pps.bBottomFieldPicOrderPresent) {
+            br.ReadSe();
+        }
+    }
+    if (pps.bRedundantPicCntPresent) {
+        br.ReadUe();
+    }
+    int numRefIdxActive = pps.iNumRefIdxL0Default;
+    if (pSlice) {
+        if (br.ReadBit()) { // num_ref_idx_active_override_flag
+            numRefIdxActive = br.ReadUe() + 1;
+        }
+        if (br.ReadBit()) { // ref_pic_list_modification_flag_l0
+            uint32_t idc;
+            while ((idc = br.ReadUe()) != 3 && !br.Overrun()) {
+                if (idc > 3) {
+                    return false;
+                }
+                br.ReadUe();
+            }
+        }
+        if (pps.bWeightedPred) {
+            br.ReadUe(); // luma_log2_weight_denom
+            br.ReadUe(); // chroma_log2_weight_denom
+            for (int i = 0; i < numRefIdxActive; i++) {
+                if (br.ReadBit()) {
+                    br.ReadSe();
+                    br.ReadSe();
+                }
+                if (br.ReadBit()) {
+                    for (int c = 0; c < 4; c++) {
+                        br.ReadSe();
+                    }
+                }
+            }
+        }
+    }
+    if (nalRefIdc) {
+        // dec_ref_pic_marking
+        if (nalType == 5) {
+            br.SkipBits(2);
+        } else if (br.ReadBit()) {
+            uint32_t op;
+            while ((op = br.ReadUe()) != 0 && !br.Overrun()) {
+                if (op > 6) {
+                    return false;
+                }
+                if (op != 5) {
+                    br.ReadUe();
+                }
+                if (op == 3) {
+                    br.ReadUe();
+                }
+            }
+        }
+    }
+    int qp = pps.iPicInitQp + br.ReadSe();
+    if (pps.bDeblockingFilterControlPresent) {
+        if (br.ReadUe() != 1) { // disable_deblocking_filter_idc
+            br.ReadSe();
+            br.ReadSe();
+        }
+    }
+    if (br.Overrun() || qp < 0 || qp > 51) {
+        return false;
+    }
+    headerBits_ += br.BitsRead();
+
+    // slice_data, 7.3.4
+    const int slice = slices_++;
+    const int mbCount = (int)mbs_.size();
+    int mb = (int)firstMb;
+    bool moreData = true;
+    size_t mbStart = br.BitsRead();
+    while (moreData) {
+        if (pSlice) {
+            const uint32_t skipRun = br.ReadUe();
+            if (skipRun > (uint32_t)(mbCount - mb)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < skipRun; i++, mb++) {
+                MbStat &stat = mbs_[mb];
+                stat.uiBits = 0;
+                stat.iQp = (int8_t)qp;
+                stat.iQpDelta = 0;
+                stat.uiKind = mbSkip;
+                sliceOf_[mb] = slice;
+                fill(&nzLuma_[(size_t)mb * 16], &nzLuma_[(size_t)mb * 16 + 16],
+                     0);
+                fill(&nzChroma_[(size_t)mb * 8], &nzChroma_[(size_t)mb * 8 + 8],
+                     0);
+            }
+            if (skipRun > 0) {
+                moreData = br.MoreRbspData();
+            }
+        }
+        if (moreData) {
+            if (mb >= mbCount) {
+                return false;
+            }
+            sliceOf_[mb] = slice;
+            if (!ParseMacroblock(br, mb, pSlice, numRefIdxActive, qp)) {
+                return false;
+            }
+            mbs_[mb].uiBits = (uint32_t)(br.BitsRead() - mbStart);
+            mbStart = br.BitsRead();
+            mb++;
+        }
+        moreData = br.MoreRbspData();
+    }
+    // a trailing skip run and rbsp_slice_trailing_bits
+    headerBits_ += rbsp_.size() * 8 - mbStart;
+    return true;
+}
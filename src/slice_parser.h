@@ -0,0 +1,100 @@
+#ifndef __SLICE_PARSER_H__
+#define __SLICE_PARSER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class BitReader;
+
+// The parts of a sequence parameter set the slice layer depends on.
+struct H264Sps {
+    bool bValid = false;
+    int iProfileIdc = 0;
+    int iLog2MaxFrameNum = 4;
+    int iPocType = 0;
+    int iLog2MaxPocLsb = 4;
+    bool bDeltaPicOrderAlwaysZero = false;
+    int iWidthInMbs = 0;
+    int iHeightInMbs = 0;
+    bool bFrameMbsOnly = true;
+};
+
+struct H264Pps {
+    bool bValid = false;
+    int iSpsId = 0;
+    bool bCabac = false;
+    bool bBottomFieldPicOrderPresent = false;
+    int iNumSliceGroups = 1;
+    int iNumRefIdxL0Default = 1;
+    bool bWeightedPred = false;
+    int iPicInitQp = 26;
+    bool bDeblockingFilterControlPresent = false;
+    bool bRedundantPicCntPresent = false;
+    bool bTransform8x8 = false;
+};
+
+// Active parameter sets by id.
+struct H264ParamSets {
+    H264Sps sps[32];
+    H264Pps pps[256];
+    // parses an SPS or PPS NAL unit (header byte included); other NAL
+    // types are ignored
+    bool Add(const uint8_t *nal, size_t size);
+};
+
+enum MbKind {
+    mbMissing, ///< not covered by any parsed slice
+    mbSkip,
+    mbInter,
+    mbIntra,
+    mbPcm,
+};
+
+struct MbStat {
+    uint32_t uiBits; ///< macroblock_layer, plus the mb_skip_run before it
+    int8_t iQp;      ///< QP_Y after mb_qp_delta
+    int8_t iQpDelta;
+    uint8_t uiKind;  ///< MbKind
+};
+
+// Walks the macroblock layer of CAVLC slices (Baseline, and Main or High
+// streams coded without CABAC or 8x8 transforms) and records the bits and
+// QP of every macroblock of one picture. Bits are counted on the RBSP,
+// so emulation prevention bytes are left out.
+class SliceParser {
+  public:
+    // starts a picture; its size comes from the SPS of its first slice
+    void Begin();
+    // parses one slice NAL unit (header byte included) of the picture;
+    // false on syntax it does not handle or a corrupt slice
+    bool ParseSlice(const uint8_t *nal, size_t size,
+                    const H264ParamSets &params);
+
+    const std::vector<MbStat> &Mbs() const { return mbs_; }
+    int WidthInMbs() const { return width_; }
+    int HeightInMbs() const { return height_; }
+    // slice headers and trailing bits
+    uint64_t HeaderBits() const { return headerBits_; }
+    int Slices() const { return slices_; }
+
+  private:
+    void Resize(const H264Sps &sps);
+    bool ParseMacroblock(BitReader &br, int mb, bool pSlice,
+                         int numRefIdxActive, int &qp);
+    int ResidualBlock(BitReader &br, int nC, int maxNumCoeff);
+    int LumaNc(int mb, int bx, int by) const;
+    int ChromaNc(int mb, int plane, int bx, int by) const;
+
+    int width_ = 0;
+    int height_ = 0;
+    int slices_ = 0;
+    uint64_t headerBits_ = 0;
+    std::vector<MbStat> mbs_;
+    std::vector<int> sliceOf_;    ///< slice of each macroblock, -1 before
+    std::vector<uint8_t> nzLuma_; ///< total_coeff per 4x4 block, raster
+    std::vector<uint8_t> nzChroma_; ///< Cb then Cr, 2x2 raster each
+    std::vector<uint8_t> rbsp_;
+};
+
+#endif //__SLICE_PARSER_H__
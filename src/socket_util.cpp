@@ -0,0 +1,281 @@
+#include "socket_util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#include <afunix.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// a peer that went away must surface as an error, not SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+bool socketStartup() {
+#ifdef _WIN32
+    static bool started = false;
+    if (!started) {
+        WSADATA wsaData;
+        started = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+    }
+    return started;
+#else
+    return true;
+#endif
+}
+
+void closeSocket(SocketHandle s) {
+    if (s == invalidSocket) {
+        return;
+    }
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+void shutdownSocket(SocketHandle s) {
+    if (s == invalidSocket) {
+        return;
+    }
+#ifdef _WIN32
+    shutdown(s, SD_BOTH);
+#else
+    shutdown(s, SHUT_RDWR);
+#endif
+}
+
+static bool unixAddress(const string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+SocketHandle listenUnix(const string &path) {
+    sockaddr_un addr;
+    if (!socketStartup() || !unixAddress(path, addr)) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == invalidSocket) {
+        return invalidSocket;
+    }
+    // a stale socket file from a previous run makes bind fail
+    remove(path.c_str());
+    if (::bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 4) != 0) {
+        closeSocket(s);
+        return invalidSocket;
+    }
+    return s;
+}
+
+SocketHandle connectUnix(const string &path) {
+    sockaddr_un addr;
+    if (!socketStartup() || !unixAddress(path, addr)) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == invalidSocket) {
+        return invalidSocket;
+    }
+    if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        closeSocket(s);
+        return invalidSocket;
+    }
+    return s;
+}
+
+SocketHandle acceptSocket(SocketHandle listener) {
+    return accept(listener, NULL, NULL);
+}
+
+static addrinfo *resolveTcp(const string &host, int port, bool passive) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *result = NULL;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(),
+                    to_string(port).c_str(), &hints, &result) != 0) {
+        return NULL;
+    }
+    return result;
+}
+
+void setNoDelay(SocketHandle s) {
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+}
+
+SocketHandle listenTcp(const string &host, int &port) {
+    addrinfo *addr = socketStartup() ? resolveTcp(host, port, true) : NULL;
+    if (!addr) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(addr->ai_family, SOCK_STREAM, 0);
+    if (s != invalidSocket) {
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on,
+                   sizeof(on));
+        sockaddr_in bound;
+        socklen_t boundLen = sizeof(bound);
+        if (::bind(s, addr->ai_addr, (int)addr->ai_addrlen) != 0 ||
+            listen(s, 16) != 0 ||
+            getsockname(s, (sockaddr *)&bound, &boundLen) != 0) {
+            closeSocket(s);
+            s = invalidSocket;
+        } else {
+            port = ntohs(bound.sin_port);
+        }
+    }
+    freeaddrinfo(addr);
+    return s;
+}
+
+SocketHandle connectTcp(const string &host, int port) {
+    addrinfo *addr = socketStartup() ? resolveTcp(host, port, false) : NULL;
+    if (!addr) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(addr->ai_family, SOCK_STREAM, 0);
+    if (s != invalidSocket &&
+        connect(s, addr->ai_addr, (int)addr->ai_addrlen) != 0) {
+        closeSocket(s);
+        s = invalidSocket;
+    }
+    freeaddrinfo(addr);
+    if (s != invalidSocket) {
+        setNoDelay(s);
+    }
+    return s;
+}
+
+bool splitHostPort(const string &address, string &host, int &port) {
+    const size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = atoi(address.c_str() + colon + 1);
+    return port >= 0 && port < 65536;
+}
+
+bool sendAll(SocketHandle s, const void *data, size_t len) {
+    const char *p = static_cast<const char *>(data);
+    while (len > 0) {
+        int chunk = len > (1 << 30) ? (1 << 30) : (int)len;
+        int n = (int)send(s, p, chunk, sendFlags);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool recvAll(SocketHandle s, void *data, size_t len) {
+    char *p = static_cast<char *>(data);
+    while (len > 0) {
+        int chunk = len > (1 << 30) ? (1 << 30) : (int)len;
+        int n = (int)recv(s, p, chunk, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void loopbackAddress(int port, sockaddr_in &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+}
+
+SocketHandle bindUdpLoopback(int &port) {
+    if (!socketStartup()) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == invalidSocket) {
+        return invalidSocket;
+    }
+    sockaddr_in addr;
+    loopbackAddress(port, addr);
+    socklen_t addrLen = sizeof(addr);
+    if (::bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(s, (sockaddr *)&addr, &addrLen) != 0) {
+        closeSocket(s);
+        return invalidSocket;
+    }
+    port = ntohs(addr.sin_port);
+    return s;
+}
+
+SocketHandle connectUdpLoopback(int port) {
+    if (!socketStartup()) {
+        return invalidSocket;
+    }
+    SocketHandle s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == invalidSocket) {
+        return invalidSocket;
+    }
+    sockaddr_in addr;
+    loopbackAddress(port, addr);
+    if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        closeSocket(s);
+        return invalidSocket;
+    }
+    return s;
+}
+
+bool setRecvTimeout(SocketHandle s, int timeoutMs) {
+#ifdef _WIN32
+    DWORD timeout = timeoutMs;
+#else
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+#endif
+    return setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+                      sizeof(timeout)) == 0;
+}
+
+bool setRecvBufferSize(SocketHandle s, int bytes) {
+    return setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&bytes,
+                      sizeof(bytes)) == 0;
+}
+
+bool sendDatagram(SocketHandle s, const void *data, size_t len) {
+    return send(s, (const char *)data, (int)len, sendFlags) == (int)len;
+}
+
+int recvDatagram(SocketHandle s, void *data, size_t len) {
+    return (int)recv(s, (char *)data, (int)len, 0);
+}
@@ -0,0 +1,49 @@
+#ifndef __SOCKET_UTIL_H__
+#define __SOCKET_UTIL_H__
+
+#include <stddef.h>
+#include <string>
+
+// Thin portability layer over Winsock and BSD sockets. Unix domain sockets
+// need Windows 10 1803 or later.
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET SocketHandle;
+const SocketHandle invalidSocket = INVALID_SOCKET;
+#else
+typedef int SocketHandle;
+const SocketHandle invalidSocket = -1;
+#endif
+
+bool socketStartup();
+void closeSocket(SocketHandle s);
+// unblocks a thread sitting in accept()/recv() on s
+void shutdownSocket(SocketHandle s);
+
+SocketHandle listenUnix(const std::string &path);
+SocketHandle connectUnix(const std::string &path);
+SocketHandle acceptSocket(SocketHandle listener);
+
+// TCP; host may be a name or an address, port 0 listens on an ephemeral
+// port and returns it in port
+SocketHandle listenTcp(const std::string &host, int &port);
+SocketHandle connectTcp(const std::string &host, int port);
+// small request/reply messages must not wait for Nagle; connectTcp sets it
+void setNoDelay(SocketHandle s);
+// "host:port"
+bool splitHostPort(const std::string &address, std::string &host, int &port);
+
+// loop until all of len is transferred; false on error or orderly close
+bool sendAll(SocketHandle s, const void *data, size_t len);
+bool recvAll(SocketHandle s, void *data, size_t len);
+
+// UDP on 127.0.0.1; port 0 binds an ephemeral port and returns it in port
+SocketHandle bindUdpLoopback(int &port);
+SocketHandle connectUdpLoopback(int port);
+bool setRecvTimeout(SocketHandle s, int timeoutMs);
+bool setRecvBufferSize(SocketHandle s, int bytes);
+bool sendDatagram(SocketHandle s, const void *data, size_t len);
+// size of the datagram, -1 on error or timeout
+int recvDatagram(SocketHandle s, void *data, size_t len);
+
+#endif //__SOCKET_UTIL_H__
@@ -0,0 +1,105 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0), min_(0), max_(0) {
+    memset(buckets_, 0, sizeof(buckets_));
+}
+
+void LatencyHistogram::Record(double us) {
+    int bucket = 0;
+    if (us >= 1.0) {
+        bucket = (int)(log2(us) * bucketsPerOctave);
+        bucket = min(bucket, bucketCount - 1);
+    }
+    buckets_[bucket]++;
+    min_ = count_ ? min(min_, us) : us;
+    max_ = count_ ? max(max_, us) : us;
+    sum_ += us;
+    count_++;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+    if (!other.count_) {
+        return;
+    }
+    for (int b = 0; b < bucketCount; b++) {
+        buckets_[b] += other.buckets_[b];
+    }
+    min_ = count_ ? min(min_, other.min_) : other.min_;
+    max_ = count_ ? max(max_, other.max_) : other.max_;
+    sum_ += other.sum_;
+    count_ += other.count_;
+}
+
+double LatencyHistogram::BucketLowerUs(int bucket) {
+    return bucket == 0 ? 0 : exp2((double)bucket / bucketsPerOctave);
+}
+
+// geometric centre of the bucket holding the p-th percentile, clamped to
+// the exact extremes
+double LatencyHistogram::Percentile(double p) const {
+    if (!count_) {
+        return 0;
+    }
+    const int64_t rank = max<int64_t>(1, (int64_t)ceil(p / 100 * count_));
+    int64_t seen = 0;
+    for (int b = 0; b < bucketCount; b++) {
+        seen += buckets_[b];
+        if (seen >= rank) {
+            double centre = exp2((b + 0.5) / bucketsPerOctave);
+            return min(max(centre, min_), max_);
+        }
+    }
+    return max_;
+}
+
+void StatsReport::AddCounter(const string &name, double value) {
+    counters_.push_back(make_pair(name, value));
+}
+
+void StatsReport::AddHistogram(const string &name,
+                               const LatencyHistogram &hist) {
+    histograms_.push_back(make_pair(name, hist));
+}
+
+bool StatsReport::WriteJson(const string &fileName) const {
+    FILE *fp = fopen(fileName.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+    fprintf(fp, "{\n  \"counters\": {");
+    for (size_t i = 0; i < counters_.size(); i++) {
+        fprintf(fp, "%s\n    \"%s\": %.6g", i ? "," : "",
+                counters_[i].first.c_str(), counters_[i].second);
+    }
+    fprintf(fp, "\n  },\n  \"histograms\": {");
+    for (size_t i = 0; i < histograms_.size(); i++) {
+        const LatencyHistogram &h = histograms_[i].second;
+        fprintf(fp,
+                "%s\n    \"%s\": {\"count\": %lld, \"mean_us\": %.3f, "
+                "\"min_us\": %.3f, \"max_us\": %.3f, \"p50_us\": %.3f, "
+                "\"p90_us\": %.3f, \"p99_us\": %.3f, \"buckets\": [",
+                i ? "," : "", histograms_[i].first.c_str(),
+                (long long)h.Count(), h.Mean(), h.Min(), h.Max(),
+                h.Percentile(50), h.Percentile(90), h.Percentile(99));
+        bool first = true;
+        for (int b = 0; b < LatencyHistogram::bucketCount; b++) {
+            if (h.buckets_[b]) {
+                fprintf(fp, "%s[%.3f, %lld]", first ? "" : ", ",
+                        LatencyHistogram::BucketLowerUs(b),
+                        (long long)h.buckets_[b]);
+                first = false;
+            }
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  }\n}\n");
+    fclose(fp);
+    return true;
+}
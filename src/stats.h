@@ -0,0 +1,51 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Log-scale histogram of durations in microseconds, 8 buckets per octave
+// (~9% resolution) from 1 us to ~2 minutes. Fixed size, so recording
+// never allocates.
+class LatencyHistogram {
+  public:
+    static const int bucketsPerOctave = 8;
+    static const int bucketCount = 27 * bucketsPerOctave;
+
+    LatencyHistogram();
+    void Record(double us);
+    void Merge(const LatencyHistogram &other);
+
+    int64_t Count() const { return count_; }
+    double Mean() const { return count_ ? sum_ / count_ : 0; }
+    double Min() const { return count_ ? min_ : 0; }
+    double Max() const { return max_; }
+    double Percentile(double p) const;
+    static double BucketLowerUs(int bucket);
+
+  private:
+    int64_t buckets_[bucketCount];
+    int64_t count_;
+    double sum_;
+    double min_;
+    double max_;
+
+    friend class StatsReport;
+};
+
+// Named counters and histograms of one run, written as a JSON document so
+// the python tooling can pick them up next to the bitstream.
+class StatsReport {
+  public:
+    void AddCounter(const std::string &name, double value);
+    void AddHistogram(const std::string &name, const LatencyHistogram &hist);
+    bool WriteJson(const std::string &fileName) const;
+
+  private:
+    std::vector<std::pair<std::string, double>> counters_;
+    std::vector<std::pair<std::string, LatencyHistogram>> histograms_;
+};
+
+#endif //__STATS_H__
@@ -0,0 +1,311 @@
+#include "stereo.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Reusable barrier; an eye whose input ends leaves so the other one does
+// not wait for it forever.
+class FrameBarrier {
+  public:
+    explicit FrameBarrier(int count)
+        : count_(count), waiting_(0), generation_(0) {}
+
+    void Arrive() {
+        unique_lock<mutex> lock(mutex_);
+        const int generation = generation_;
+        if (++waiting_ >= count_) {
+            Release();
+        } else {
+            cv_.wait(lock, [&] { return generation != generation_; });
+        }
+    }
+
+    void Leave() {
+        lock_guard<mutex> lock(mutex_);
+        count_--;
+        if (waiting_ > 0 && waiting_ >= count_) {
+            Release();
+        }
+    }
+
+  private:
+    void Release() {
+        waiting_ = 0;
+        generation_++;
+        cv_.notify_all();
+    }
+
+    mutex mutex_;
+    condition_variable cv_;
+    int count_;
+    int waiting_;
+    int generation_;
+};
+
+// Collects each eye's frame and writes left/right records in order.
+class StereoContainerWriter {
+  public:
+    StereoContainerWriter() : fp_(nullptr), active_{true, true} {}
+    ~StereoContainerWriter() {
+        if (fp_) {
+            fclose(fp_);
+        }
+    }
+
+    bool Open(const string &fileName, const SEncParamExt &param) {
+        fp_ = fopen(fileName.c_str(), "wb");
+        if (!fp_) {
+            return false;
+        }
+        StereoContainerHeader hdr = {stereoContainerMagic, 1,
+                                     (uint32_t)param.iPicWidth,
+                                     (uint32_t)param.iPicHeight,
+                                     param.fMaxFrameRate};
+        fwrite(&hdr, sizeof(hdr), 1, fp_);
+        return true;
+    }
+
+    void AddFrame(int eye, int frameNum, const SFrameBSInfo &info) {
+        lock_guard<mutex> lock(mutex_);
+        Pending &p = pending_[eye];
+        p.iFrameNum = frameNum;
+        p.bytes.clear();
+        if (info.eFrameType != videoFrameTypeSkip) {
+            for (int l = 0; l < info.iLayerNum; l++) {
+                const SLayerBSInfo &layer = info.sLayerInfo[l];
+                int size = 0;
+                for (int n = 0; n < layer.iNalCount; n++) {
+                    size += layer.pNalLengthInByte[n];
+                }
+                p.bytes.insert(p.bytes.end(), layer.pBsBuf,
+                               layer.pBsBuf + size);
+            }
+        }
+        p.bReady = true;
+        Flush();
+    }
+
+    void EyeFinished(int eye) {
+        lock_guard<mutex> lock(mutex_);
+        active_[eye] = false;
+        Flush();
+    }
+
+  private:
+    struct Pending {
+        int iFrameNum = 0;
+        bool bReady = false;
+        vector<uint8_t> bytes;
+    };
+
+    // write once every still-running eye has delivered the frame
+    void Flush() {
+        for (int eye = 0; eye < 2; eye++) {
+            if (active_[eye] && !pending_[eye].bReady) {
+                return;
+            }
+        }
+        for (int eye = 0; eye < 2; eye++) {
+            Pending &p = pending_[eye];
+            if (!p.bReady) {
+                continue;
+            }
+            StereoRecordHeader rec = {(uint32_t)eye, (uint32_t)p.iFrameNum,
+                                      (uint32_t)p.bytes.size()};
+            fwrite(&rec, sizeof(rec), 1, fp_);
+            fwrite(p.bytes.data(), 1, p.bytes.size(), fp_);
+            p.bReady = false;
+        }
+    }
+
+    FILE *fp_;
+    mutex mutex_;
+    bool active_[2];
+    Pending pending_[2];
+};
+
+struct StereoEyeCallback : public TestCallback {
+    StereoEyeCallback(int eye, FrameBarrier *barrier,
+                      StereoContainerWriter *writer)
+        : eye_(eye), bytes_(0), barrier_(barrier), writer_(writer) {}
+
+    virtual void onFrameStart(int frameNum) {
+        TestCallback::onFrameStart(frameNum);
+        barrier_->Arrive();
+        startUs_.push_back(monotonicUs());
+    }
+
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const string &outFileName) {
+        if (!writer_) {
+            TestCallback::onEncodeFrame(frameInfo, outFileName);
+        }
+    }
+
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        doneUs_.push_back(monotonicUs());
+        bytes_ += frameInfo.iFrameSizeInBytes;
+        if (writer_) {
+            writer_->AddFrame(eye_, frameNum, frameInfo);
+        }
+    }
+
+    int eye_;
+    int64_t bytes_;
+    vector<int64_t> startUs_;
+    vector<int64_t> doneUs_;
+    FrameBarrier *barrier_;
+    StereoContainerWriter *writer_;
+};
+
+int runStereo(const TestOptions &opts, const SEncParamExt &param,
+              PrioritySource *leftSource, const string &outFile) {
+    const string inputs[2] = {opts.input, opts.stereoRight};
+    const char *eyeNames[2] = {"left", "right"};
+    // both eyes open and equal in size before either encoder starts
+    unique_ptr<InputStream> ins[2];
+    for (int eye = 0; eye < 2; eye++) {
+        InputGeometry geometry = {width, height, inputFps};
+        ins[eye] = openInput(inputs[eye], opts.inputFormat, geometry,
+                             opts.convertThreads);
+        if (!ins[eye]) {
+            return 1;
+        }
+        if (geometry.iWidth != param.iPicWidth ||
+            geometry.iHeight != param.iPicHeight) {
+            cerr << "The " << eyeNames[eye] << " eye is " << geometry.iWidth
+                 << "x" << geometry.iHeight << ", the encode "
+                 << param.iPicWidth << "x" << param.iPicHeight << ": "
+                 << inputs[eye] << '\n';
+            return 1;
+        }
+    }
+    PrioritySource *sources[2] = {leftSource, nullptr};
+    if (leftSource) {
+        string unused;
+        sources[1] = createPrioritySource(opts, unused, "-right");
+    }
+
+    StereoContainerWriter writer;
+    const string containerName = outFile + "-stereo.s264";
+    if (opts.stereoInterleave && !writer.Open(containerName, param)) {
+        cerr << "Cannot create " << containerName << endl;
+        return 1;
+    }
+
+    FrameBarrier barrier(2);
+    StereoEyeCallback cbks[2] = {
+        StereoEyeCallback(0, &barrier,
+                          opts.stereoInterleave ? &writer : nullptr),
+        StereoEyeCallback(1, &barrier,
+                          opts.stereoInterleave ? &writer : nullptr)};
+
+    // one per encoder instance, so each eye has its own counters
+    StageProfiler profilers[2] = {StageProfiler(eyeNames[0]),
+                                  StageProfiler(eyeNames[1])};
+    vector<CpuPlacement> placements;
+    if (opts.pin) {
+        CpuTopology topology;
+        topology.Load();
+        placements = planPlacements(topology, 2);
+    }
+    auto runEye = [&](int eye) {
+        if (opts.pin && !placements[eye].Apply()) {
+            cerr << "Cannot pin the " << eyeNames[eye] << " eye to "
+                 << placements[eye].Describe() << endl;
+        }
+        SEncParamExt eyeParam = param;
+        BaseEncoderTest test;
+        test.prioritySource_ = sources[eye];
+        test.inputFormat_ = opts.inputFormat;
+        test.convertThreads_ = opts.convertThreads;
+        if (opts.perfCounters) {
+            test.profiler_ = &profilers[eye];
+        }
+        if (opts.pin) {
+            test.placement_ = &placements[eye];
+        }
+        if (eye == 1 && !opts.stereoRightWeights.empty()) {
+            test.weightsDir_ = opts.stereoRightWeights;
+        }
+        test.SetUp();
+        test.EncodeInput(ins[eye].get(), &eyeParam, &cbks[eye],
+                         outFile + "-" + eyeNames[eye] + h264Suffix);
+        test.TearDown();
+        barrier.Leave();
+        if (opts.stereoInterleave) {
+            writer.EyeFinished(eye);
+        }
+    };
+
+    const int64_t startUs = monotonicUs();
+    thread eyes[2] = {thread(runEye, 0), thread(runEye, 1)};
+    eyes[0].join();
+    eyes[1].join();
+    const double wallSec = (monotonicUs() - startUs) / 1e6;
+
+    for (int eye = 0; eye < 2; eye++) {
+        const StereoEyeCallback &cbk = cbks[eye];
+        double busyUs = 0;
+        for (size_t n = 0; n < cbk.doneUs_.size(); n++) {
+            busyUs += (double)(cbk.doneUs_[n] - cbk.startUs_[n]);
+        }
+        const size_t frames = cbk.doneUs_.size();
+        cout << "Stereo " << eyeNames[eye] << ": " << frames << " frames, "
+             << (busyUs > 0 ? frames / (busyUs / 1e6) : 0) << " fps encode, "
+             << frames / wallSec << " fps wall, "
+             << cbk.bytes_ * 8 / 1e6 / (frames / inputFps) << " Mbps" << endl;
+        if (sources[eye]) {
+            sources[eye]->printSummary();
+        }
+    }
+    const size_t pairs = min(cbks[0].doneUs_.size(), cbks[1].doneUs_.size());
+    double skewSum = 0, skewMax = 0;
+    for (size_t n = 0; n < pairs; n++) {
+        double skew = (double)llabs(cbks[0].doneUs_[n] - cbks[1].doneUs_[n]);
+        skewSum += skew;
+        skewMax = max(skewMax, skew);
+    }
+    cout << "Stereo combined: "
+         << (cbks[0].doneUs_.size() + cbks[1].doneUs_.size()) / wallSec
+         << " fps, eye skew avg " << (pairs ? skewSum / pairs : 0)
+         << " us, max " << skewMax << " us" << endl;
+    if (cbks[0].doneUs_.size() != cbks[1].doneUs_.size()) {
+        cerr << "Warning: eye inputs differ in length, extra frames were "
+                "encoded without a partner"
+             << endl;
+    }
+
+    if (opts.perfCounters) {
+        StatsReport report;
+        for (int eye = 0; eye < 2; eye++) {
+            profilers[eye].printSummary();
+            profilers[eye].AddToReport(report);
+        }
+        if (!report.WriteJson(outFile + "-stereo.stats.json")) {
+            cerr << "Failed to write " << outFile << "-stereo.stats.json\n";
+        }
+    }
+
+    delete sources[1];
+    if (!opts.stereoInterleave) {
+        for (int eye = 0; eye < 2; eye++) {
+            const string eyeFile = outFile + "-" + eyeNames[eye];
+            if (h264ToMp4(eyeFile) != 0) {
+                cerr << "Cannot convert " << eyeFile << h264Suffix
+                     << " to mp4\n";
+            }
+        }
+    }
+    return 0;
+}
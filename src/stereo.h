@@ -0,0 +1,35 @@
+#ifndef __STEREO_H__
+#define __STEREO_H__
+
+#include "harness.h"
+
+#include <stdint.h>
+#include <string>
+
+const uint32_t stereoContainerMagic = 0x34363253; // "S264"
+
+// Interleaved stereo container: this header, then one record per eye and
+// frame (left before right), each a StereoRecordHeader followed by the
+// Annex-B bytes of that frame. Skipped frames have size 0.
+struct StereoContainerHeader {
+    uint32_t uiMagic;
+    uint32_t uiVersion;
+    uint32_t uiWidth;
+    uint32_t uiHeight;
+    float fFps;
+};
+
+struct StereoRecordHeader {
+    uint32_t uiEye; ///< 0 left, 1 right
+    uint32_t uiFrameNum;
+    uint32_t uiSize;
+};
+
+// Encodes the left (regular) input and opts.stereoRight with two encoders
+// on their own threads, held in lockstep per frame. leftSource is the
+// priority source of the left eye (nullptr for weight files); the right
+// eye gets its own instance of the same kind.
+int runStereo(const TestOptions &opts, const SEncParamExt &param,
+              PrioritySource *leftSource, const std::string &outFile);
+
+#endif //__STEREO_H__
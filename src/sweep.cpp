@@ -0,0 +1,355 @@
+#include "sweep.h"
+#include "durable.h"
+#include "harness.h"
+#include "quality.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+const char *const checkpointSuffix = ".ckpt";
+
+// Where an interrupted encode picks up: the stream up to uiOffset holds
+// closed GOPs only, frame iFrame is the IDR opening the next one.
+struct Checkpoint {
+    string sJob;
+    int iFrame = 1;
+    uint64_t uiOffset = 0;
+    QualitySums sums;
+};
+
+string formatCheckpoint(const Checkpoint &c) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), " %d %llu %.17g %.17g %d %lld %d\n", c.iFrame,
+             (unsigned long long)c.uiOffset, c.sums.fPsnrSum,
+             c.sums.fSsimSum, c.sums.iFrames, c.sums.iBytes,
+             c.sums.iDecodeFailures);
+    return c.sJob + buf;
+}
+
+bool loadCheckpoint(const string &fileName, Checkpoint &c) {
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+    char job[128];
+    unsigned long long offset = 0;
+    const bool ok =
+        fscanf(fp, "%127s %d %llu %lf %lf %d %lld %d", job, &c.iFrame,
+               &offset, &c.sums.fPsnrSum, &c.sums.fSsimSum, &c.sums.iFrames,
+               &c.sums.iBytes, &c.sums.iDecodeFailures) == 8;
+    fclose(fp);
+    c.sJob = job;
+    c.uiOffset = offset;
+    return ok;
+}
+
+// Scores the encode and, at every IDR frame, makes the closed GOPs before
+// it durable and records where they end.
+class SweepCallback : public QualityCallback {
+  public:
+    SweepCallback(const string &checkpointFile, const string &job,
+                  int firstFrame)
+        : QualityCallback(width, height), checkpointFile_(checkpointFile),
+          firstFrame_(firstFrame) {
+        next_.sJob = job;
+    }
+
+    virtual void onFrameStart(int frameNum) {
+        QualityCallback::onFrameStart(frameNum);
+        next_.iFrame = frameNum;
+        next_.uiOffset = StreamOffset();
+        next_.sums = Sums();
+    }
+
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        QualityCallback::onFrameDone(frameNum, frameInfo);
+        if (frameNum > firstFrame_ &&
+            frameInfo.eFrameType == videoFrameTypeIDR) {
+            if (!Sync() ||
+                !writeFileAtomic(checkpointFile_, formatCheckpoint(next_))) {
+                cerr << "Cannot write " << checkpointFile_ << '\n';
+            }
+        }
+    }
+
+    virtual void onStreamDone() {
+        Sync();
+        QualityCallback::onStreamDone();
+    }
+
+  private:
+    string checkpointFile_;
+    int firstFrame_;
+    Checkpoint next_; ///< state before the frame being encoded
+};
+
+// Cuts stream and its sidecar back to the checkpoint. False when they do
+// not reach it, then the encode starts over.
+bool rewindToCheckpoint(const string &stream, const Checkpoint &c) {
+    return truncateBitstream(stream, c.uiOffset);
+}
+
+} // namespace
+
+bool runSweepJob(const TestOptions &opts, const SEncParamExt &param,
+                 const SweepJob &job, bool &resumed, QualityScore &score) {
+    const string stream = job.sOutFile + h264Suffix;
+    const string checkpointFile = stream + checkpointSuffix;
+    Checkpoint checkpoint;
+    resumed = loadCheckpoint(checkpointFile, checkpoint) &&
+              checkpoint.sJob == job.sJob &&
+              rewindToCheckpoint(stream, checkpoint);
+    if (!resumed) {
+        checkpoint = Checkpoint();
+        remove(stream.c_str());
+        remove((stream + bitstreamIndexSuffix).c_str());
+        remove(checkpointFile.c_str());
+    }
+
+    isDiffEncoding = job.bDiff;
+    SEncParamExt p = param;
+    p.sSpatialLayers[0].iSpatialBitrate = (int)(job.fMbps * 1000 * 1000);
+    string suffix;
+    BaseEncoderTest test;
+    test.inputFormat_ = opts.inputFormat;
+    test.convertThreads_ = opts.convertThreads;
+    test.startFrame_ = checkpoint.iFrame;
+    SweepCallback cbk(checkpointFile, job.sJob, checkpoint.iFrame);
+    if (!cbk.Open(job.sClip)) {
+        cerr << "Cannot open decoder or " << job.sClip << '\n';
+        return false;
+    }
+    cbk.Restore(checkpoint.sums);
+    InputGeometry geometry = {width, height, inputFps};
+    unique_ptr<InputStream> in =
+        openInput(job.sClip, opts.inputFormat, geometry, opts.convertThreads);
+    if (!in) {
+        return false;
+    }
+    test.prioritySource_ =
+        job.bDiff ? createPrioritySource(opts, suffix, "-sweep") : nullptr;
+    if (resumed) {
+        cout << "Resuming " << stream << " at frame " << checkpoint.iFrame
+             << endl;
+    }
+    test.SetUp();
+    test.EncodeStream(in.get(), &p, &cbk, stream);
+    test.TearDown();
+    if (test.prioritySource_) {
+        test.prioritySource_->printSummary();
+        delete test.prioritySource_;
+    }
+    if (cbk.DecodeFailures()) {
+        cerr << cbk.DecodeFailures() << " frames failed to decode\n";
+    }
+    score = cbk.Score();
+    return true;
+}
+
+bool parseBitrates(const string &value, vector<float> &mbps) {
+    stringstream ss(value);
+    string item;
+    while (getline(ss, item, ',')) {
+        const float f = parseFloat(item);
+        if (!(f > 0)) {
+            return false;
+        }
+        mbps.push_back(f);
+    }
+    return !mbps.empty();
+}
+
+bool checkSweepOptions(const TestOptions &opts) {
+    if (!opts.stereoRight.empty() || !opts.prioritySocket.empty() ||
+        opts.rtpMtu > 0 || opts.targetPsnr > 0 || opts.targetSsim > 0 ||
+        opts.paced || !opts.bandwidthTrace.empty() || opts.dumpRecon ||
+        !opts.ladder.empty() || opts.temporalLayers > 1 ||
+        !opts.submitSocket.empty() || !opts.outFile.empty()) {
+        // a resumed encode must reproduce its priorities and its output
+        cerr << "A sweep runs plain encodes only, without --stereo, "
+                "--priority-socket, --rtp, --paced, --bandwidth-trace, "
+                "--dump-recon, --ladder, --temporal-layers, --submit, --out "
+                "or a quality target\n";
+        return false;
+    }
+    if (!fs::is_regular_file(opts.input) || opts.inputFormat != pixelI420) {
+        // every encode and its scoring read the input again
+        cerr << "A sweep needs I420 file inputs: " << opts.input << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool prepareSweepInput(const TestOptions &opts) {
+    InputGeometry geometry = {width, height, inputFps};
+    if (opts.inputWidth > 0) {
+        geometry.iWidth = opts.inputWidth;
+        geometry.iHeight = opts.inputHeight;
+    }
+    if (opts.inputFps > 0) {
+        geometry.fFps = opts.inputFps;
+    }
+    if (!openInput(opts.input, opts.inputFormat, geometry)) {
+        return false;
+    }
+    setInputGeometry(geometry);
+    applyPriorityOptions(opts);
+    return true;
+}
+
+void fillSweepParam(const TestOptions &opts, SEncParamExt &param) {
+    fillEncParamExt(param, 0);
+    param.bEnableFrameSkip = opts.frameSkip;
+    param.uiIntraPeriod = opts.gop;
+}
+
+void addSweepJobs(const TestOptions &opts, const SEncParamExt &param,
+                  const vector<float> &mbps, const string &outDir,
+                  vector<SweepJob> &jobs) {
+    const string configs[2] = {encodeConfigHash(opts, param, false),
+                               encodeConfigHash(opts, param, true)};
+    const string diffSuffix = prioritySuffix(opts);
+    for (float f : mbps) {
+        const string dir = outDir + to_string(f) + "m/";
+        for (int diff = 0; diff < 2; diff++) {
+            SweepJob job;
+            job.sClip = opts.input;
+            job.fMbps = f;
+            job.bDiff = diff != 0;
+            job.sOutFile = dir + "out" + (diff ? diffSuffix : "");
+            job.sJob = configs[diff] + (diff ? diffSuffix : "-base") + "-" +
+                       to_string((int)(f * 1000)) + "k";
+            jobs.push_back(job);
+        }
+    }
+}
+
+string formatSweepScore(const QualityScore &score) {
+    char value[128];
+    snprintf(value, sizeof(value), "%.4f %.6f %d %lld", score.fPsnr,
+             score.fSsim, score.iFrames, score.iBytes);
+    return value;
+}
+
+bool parseSweepScore(const string &value, QualityScore &score) {
+    return sscanf(value.c_str(), "%lf %lf %d %lld", &score.fPsnr,
+                  &score.fSsim, &score.iFrames, &score.iBytes) == 4;
+}
+
+bool writeScoreTables(const string &prefix, const vector<SweepJob> &jobs,
+                      const vector<QualityScore> &scores) {
+    // per bitrate: scores without and with priorities
+    map<float, pair<QualityScore, QualityScore>> byRate;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pair<QualityScore, QualityScore> &s = byRate[jobs[i].fMbps];
+        (jobs[i].bDiff ? s.second : s.first) = scores[i];
+    }
+    stringstream psnr, ssim;
+    for (const auto &s : byRate) {
+        psnr << "BitsLevel=" << to_string(s.first)
+             << ": withScore=" << s.second.second.fPsnr
+             << ", withoutScore=" << s.second.first.fPsnr << '\n';
+        ssim << "BitsLevel=" << to_string(s.first)
+             << ": withScore=" << s.second.second.fSsim
+             << ", withoutScore=" << s.second.first.fSsim << '\n';
+    }
+    return writeFileAtomic(prefix + "psnr.txt", psnr.str()) &&
+           writeFileAtomic(prefix + "ssim.txt", ssim.str());
+}
+
+int runSweep(int argc, char const *argv[]) {
+    vector<float> bitrates;
+    if (!parseBitrates(argv[2], bitrates)) {
+        cerr << "Invalid bitrate list: " << argv[2] << '\n';
+        return 1;
+    }
+    TestOptions opts;
+    if (!parseOptions(argc, argv, opts) || !checkSweepOptions(opts) ||
+        !prepareSweepInput(opts)) {
+        return 1;
+    }
+    if (!usesGeneratedPriorities(opts)) {
+        prepareWeightFiles();
+    }
+    SEncParamExt param;
+    fillSweepParam(opts, param);
+    if (!opts.gop) {
+        cout << "Without --gop an interrupted encode restarts from its "
+                "first frame" << endl;
+    }
+
+    const string sweepDir = testbinDir + "sweep/";
+    fs::create_directories(sweepDir);
+    Journal journal;
+    if (!journal.Open(sweepDir + sweepJournalName)) {
+        cerr << "Cannot open " << sweepDir << sweepJournalName << '\n';
+        return 1;
+    }
+    if (journal.Discarded()) {
+        cout << "Discarded " << journal.Discarded()
+             << " torn journal records" << endl;
+    }
+
+    vector<SweepJob> jobs;
+    addSweepJobs(opts, param, bitrates, testbinDir, jobs);
+    vector<QualityScore> scores(jobs.size());
+    int skipped = 0, resumedJobs = 0, failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const SweepJob &job = jobs[i];
+        QualityScore &score = scores[i];
+        const string *record = journal.Find(job.sJob);
+        const bool fromJournal = record && parseSweepScore(*record, score);
+        if (fromJournal) {
+            skipped++;
+        } else {
+            cout << "Encoding " << job.sOutFile << h264Suffix << " at "
+                 << job.fMbps << " Mbps" << endl;
+            fs::create_directories(fs::path(job.sOutFile).parent_path());
+            bool resumed = false;
+            if (!runSweepJob(opts, param, job, resumed, score)) {
+                // its checkpoint stays for the next run
+                cerr << "Encoding " << job.sOutFile << h264Suffix
+                     << " failed\n";
+                failed++;
+                continue;
+            }
+            resumedJobs += resumed;
+            if (h264ToMp4(job.sOutFile) != 0) {
+                cerr << "Cannot convert " << job.sOutFile << h264Suffix
+                     << " to mp4\n";
+            }
+            // the record makes the encode final, the checkpoint is done
+            if (!journal.Append(job.sJob, formatSweepScore(score))) {
+                return 1;
+            }
+            remove((job.sOutFile + h264Suffix + checkpointSuffix).c_str());
+        }
+        cout << "  " << job.fMbps << " Mbps " << (job.bDiff ? "diff" : "base")
+             << ": PSNR " << score.fPsnr << " dB, SSIM " << score.fSsim
+             << (fromJournal ? " [journal]" : "") << endl;
+    }
+    cout << "Sweep: " << jobs.size() << " encodes, " << skipped
+         << " from the journal, " << resumedJobs << " resumed" << endl;
+    if (failed) {
+        // the tables would miss these, the journal keeps the others
+        cerr << failed << " encodes failed, no score tables written\n";
+        return 1;
+    }
+
+    if (!writeScoreTables(sweepDir, jobs, scores)) {
+        cerr << "Cannot write the scores to " << sweepDir << '\n';
+        return 1;
+    }
+    return 0;
+}
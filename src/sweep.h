@@ -0,0 +1,57 @@
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include "harness.h"
+#include "quality.h"
+
+#include <string>
+#include <vector>
+
+// `--sweep <bitrates> [options]`: encodes the input at every bitrate (Mbps,
+// comma separated) without and with priority maps into
+// testbin/<bitrate>m/out[-diff].h264, like single encodes, and scores every
+// encode in-process (quality.h). testbin/sweep/journal.txt records each
+// finished (configuration, mode, bitrate) encode with its scores, so a
+// rerun after a crash skips it. With --gop the encoder checkpoints at every
+// IDR frame and an interrupted encode resumes from its last closed GOP.
+// psnr.txt and ssim.txt for python/draw.py go into testbin/sweep/.
+int runSweep(int argc, char const *argv[]);
+
+// The pieces runSweep is made of, shared with the distributed sweep
+// (cluster.h).
+struct SweepJob {
+    std::string sClip;
+    float fMbps = 0;
+    bool bDiff = false;
+    std::string sOutFile; ///< without suffix
+    std::string sJob;     ///< journal key
+};
+
+const char *const sweepJournalName = "journal.txt";
+
+// rejects the options a sweep can neither repeat nor resume
+bool checkSweepOptions(const TestOptions &opts);
+bool parseBitrates(const std::string &value, std::vector<float> &mbps);
+// sizes the geometry globals for opts.input, as a single encode does
+bool prepareSweepInput(const TestOptions &opts);
+// parameters of every sweep encode of opts.input; jobs set the bitrate
+void fillSweepParam(const TestOptions &opts, SEncParamExt &param);
+// the base and priority-map jobs of opts.input at every bitrate, written to
+// <outDir><bitrate>m/out[-diff].h264
+void addSweepJobs(const TestOptions &opts, const SEncParamExt &param,
+                  const std::vector<float> &mbps, const std::string &outDir,
+                  std::vector<SweepJob> &jobs);
+// encodes and scores job.sClip into job.sOutFile, resuming from its
+// checkpoint when an earlier run was interrupted; false, with the reason
+// printed, when the clip cannot be read
+bool runSweepJob(const TestOptions &opts, const SEncParamExt &param,
+                 const SweepJob &job, bool &resumed, QualityScore &score);
+std::string formatSweepScore(const QualityScore &score);
+bool parseSweepScore(const std::string &value, QualityScore &score);
+// <prefix>psnr.txt and <prefix>ssim.txt in the format python/draw.py reads,
+// for jobs[i] scored scores[i]
+bool writeScoreTables(const std::string &prefix,
+                      const std::vector<SweepJob> &jobs,
+                      const std::vector<QualityScore> &scores);
+
+#endif //__SWEEP_H__
@@ -0,0 +1,315 @@
+#include "temporal.h"
+#include "bitstream_index.h"
+#include "mapped_file.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+string fpsLabel(float fps) {
+    ostringstream ss;
+    ss << fps;
+    return ss.str();
+}
+
+// Passes on every step-th frame of in, starting with the first.
+class DecimatingInputStream : public InputStream {
+  public:
+    DecimatingInputStream(InputStream *in, int step)
+        : in_(in), step_(step), started_(false) {}
+
+    int read(void *ptr, size_t len) {
+        if (started_) {
+            skip_.resize(len);
+            for (int k = 1; k < step_; k++) {
+                if (in_->read(skip_.data(), len) != (int)len) {
+                    return 0;
+                }
+            }
+        }
+        started_ = true;
+        return in_->read(ptr, len);
+    }
+
+  private:
+    InputStream *in_;
+    int step_;
+    bool started_;
+    vector<uint8_t> skip_;
+};
+
+// Maps the frame numbers of a decimated encode back to source frames, so
+// weights/<n>.txt and generated maps describe the frame being encoded.
+class DecimatedPrioritySource : public PrioritySource {
+  public:
+    DecimatedPrioritySource(PrioritySource *inner, int step)
+        : inner_(inner), step_(step) {}
+
+    virtual bool fillPriorityArray(int frameNum, const SSourcePicture &pic,
+                                   float *priorityArray) {
+        const int sourceFrame = (frameNum - 1) * step_ + 1;
+        if (inner_) {
+            return inner_->fillPriorityArray(sourceFrame, pic, priorityArray);
+        }
+        BaseEncoderTest::ReadWeights(
+            weightsDir + "/" + to_string(sourceFrame) + ".txt", priorityArray,
+            pic.iPicWidth, pic.iPicHeight);
+        return true;
+    }
+
+  private:
+    PrioritySource *inner_;
+    int step_;
+};
+
+// bytes per temporal id; parameter sets count towards layer 0, which
+// every tier keeps
+struct TierCountCallback : public BaseEncoderTest::Callback {
+    TierCountCallback() : bytes(maxTemporalLayers, 0), frames(0) {}
+    virtual void onEncodeFrame(const SFrameBSInfo &frameInfo,
+                               const string &outFileName) {
+        for (int l = 0; l < frameInfo.iLayerNum; l++) {
+            const SLayerBSInfo &layer = frameInfo.sLayerInfo[l];
+            const int tid = layer.uiLayerType == VIDEO_CODING_LAYER
+                                ? min((int)layer.uiTemporalId,
+                                      maxTemporalLayers - 1)
+                                : 0;
+            for (int n = 0; n < layer.iNalCount; n++) {
+                bytes[tid] += layer.pNalLengthInByte[n];
+            }
+        }
+    }
+    virtual void onFrameDone(int frameNum, const SFrameBSInfo &frameInfo) {
+        frames++;
+    }
+    vector<int64_t> bytes;
+    int frames;
+};
+
+} // namespace
+
+void configureTemporalLayers(SEncParamExt &param, int layers) {
+    param.iTemporalLayerNum = layers;
+    param.bPrefixNalAddingCtrl = layers > 1;
+}
+
+float temporalTierFps(const SEncParamExt &param, int maxTemporalId) {
+    return param.fMaxFrameRate /
+           (float)(1 << (param.iTemporalLayerNum - 1 - maxTemporalId));
+}
+
+bool extractTemporalLayers(const string &stream, int maxTemporalId,
+                           const string &outStream,
+                           TemporalExtractStats &stats) {
+    MappedFile in;
+    if (!in.Open(stream)) {
+        cerr << "Cannot map " << stream << '\n';
+        return false;
+    }
+    vector<BitstreamIndexEntry> entries;
+    if (!loadBitstreamIndex(stream + bitstreamIndexSuffix, entries)) {
+        indexAnnexB(in.Data(), in.Size(), entries);
+    }
+    FILE *fp = fopen(outStream.c_str(), "wb");
+    if (!fp) {
+        cerr << "Cannot create " << outStream << '\n';
+        return false;
+    }
+    stats = TemporalExtractStats();
+    vector<BitstreamIndexEntry> kept;
+    uint64_t offset = 0;
+    bool ok = true;
+    for (const BitstreamIndexEntry &e : entries) {
+        if (e.uiTemporalId > maxTemporalId) {
+            continue;
+        }
+        if (e.uiOffset + e.uiSize > in.Size()) {
+            cerr << stream << ": sidecar reaches past the end of the stream\n";
+            ok = false;
+            break;
+        }
+        ok = fwrite(in.Data() + e.uiOffset, 1, e.uiSize, fp) == e.uiSize;
+        if (!ok) {
+            break;
+        }
+        BitstreamIndexEntry out = e;
+        out.uiOffset = offset;
+        kept.push_back(out);
+        offset += e.uiSize;
+        stats.iFrames += e.uiFrameType != videoFrameTypeInvalid &&
+                         e.uiFrameType != videoFrameTypeSkip;
+    }
+    ok = fclose(fp) == 0 && ok;
+    stats.iBytes = (int64_t)offset;
+    return ok &&
+           writeBitstreamIndex(outStream + bitstreamIndexSuffix, kept);
+}
+
+int runTemporalExtract(int argc, char const *argv[]) {
+    const string stream = argv[2];
+    const int maxTemporalId = parseInt(argv[3]);
+    string outStream;
+    if (argc > 4) {
+        outStream = argv[4];
+    } else {
+        const size_t dot = stream.rfind('.');
+        outStream = stream.substr(0, dot) + "-t" + to_string(maxTemporalId) +
+                    (dot == string::npos ? h264Suffix : stream.substr(dot));
+    }
+    TemporalExtractStats stats;
+    const int64_t startUs = monotonicUs();
+    if (maxTemporalId < 0 ||
+        !extractTemporalLayers(stream, maxTemporalId, outStream, stats)) {
+        return 1;
+    }
+    cout << outStream << ": " << stats.iFrames << " frames, " << stats.iBytes
+         << " bytes in " << (monotonicUs() - startUs) / 1000.0 << " ms"
+         << endl;
+    return 0;
+}
+
+void extractTemporalTiers(const SEncParamExt &param, const string &outFile,
+                          StatsReport &report) {
+    const string stream = outFile + h264Suffix;
+    vector<BitstreamIndexEntry> entries;
+    if (!loadBitstreamIndex(stream + bitstreamIndexSuffix, entries)) {
+        cerr << "No sidecar for " << stream << ", tiers not extracted\n";
+        return;
+    }
+    // every tier spans the duration of the full-rate stream
+    int frames = 0;
+    for (const BitstreamIndexEntry &e : entries) {
+        frames += e.uiFrameType != videoFrameTypeInvalid &&
+                  e.uiFrameType != videoFrameTypeSkip;
+    }
+    const double seconds = frames / param.fMaxFrameRate;
+    const int layers = param.iTemporalLayerNum;
+    for (int tid = 0; tid < layers - 1; tid++) {
+        const float fps = temporalTierFps(param, tid);
+        const string name = outFile + "-" + fpsLabel(fps) + "fps" + h264Suffix;
+        TemporalExtractStats stats;
+        if (!extractTemporalLayers(stream, tid, name, stats)) {
+            return;
+        }
+        const double kbps =
+            seconds > 0 ? stats.iBytes * 8 / 1000.0 / seconds : 0;
+        cout << "Temporal tier " << fpsLabel(fps) << " fps: " << stats.iFrames
+             << " frames, " << kbps << " kbps -> " << name << endl;
+        report.AddCounter("temporal_" + fpsLabel(fps) + "fps_kbps", kbps);
+    }
+    report.AddCounter("temporal_layers", layers);
+}
+
+bool measureTemporalCost(const TestOptions &opts, const SEncParamExt &param,
+                         StatsReport &report) {
+    if (isDiffEncoding && !opts.prioritySocket.empty()) {
+        cerr << "The temporal layer cost needs replayable priorities, "
+                "skipped with --priority-socket\n";
+        return true;
+    }
+    const int layers = param.iTemporalLayerNum;
+    const int qp = param.sSpatialLayers[0].iDLayerQp;
+
+    // one encode serving every tier
+    SEncParamExt layeredParam = param;
+    layeredParam.iRCMode = RC_OFF_MODE;
+    TierCountCallback layered;
+    string suffix;
+    InputGeometry layeredGeometry = {width, height, inputFps};
+    unique_ptr<InputStream> layeredSource = openInput(
+        opts.input, opts.inputFormat, layeredGeometry, opts.convertThreads);
+    if (!layeredSource) {
+        return false;
+    }
+    int64_t startCpuUs = processCpuUs();
+    {
+        BaseEncoderTest test;
+        test.inputFormat_ = opts.inputFormat;
+        test.convertThreads_ = opts.convertThreads;
+        test.prioritySource_ =
+            isDiffEncoding ? createPrioritySource(opts, suffix, "-layered")
+                           : nullptr;
+        test.SetUp();
+        test.EncodeStream(layeredSource.get(), &layeredParam, &layered, "");
+        test.TearDown();
+        delete test.prioritySource_;
+    }
+    const double layeredCpuSec = (processCpuUs() - startCpuUs) / 1e6;
+    const double seconds = layered.frames / param.fMaxFrameRate;
+
+    cout << "Temporal layers at QP " << qp
+         << ", one layered encode vs one encode per tier:" << endl;
+    double separateCpuSec = 0;
+    int64_t layeredBytes = 0;
+    for (int tid = 0; tid < layers; tid++) {
+        layeredBytes += layered.bytes[tid];
+        const int step = 1 << (layers - 1 - tid);
+        const float fps = temporalTierFps(param, tid);
+        SEncParamExt tierParam = param;
+        tierParam.iRCMode = RC_OFF_MODE;
+        configureTemporalLayers(tierParam, 1);
+        tierParam.fMaxFrameRate = fps;
+        tierParam.sSpatialLayers[0].fFrameRate = fps;
+
+        InputGeometry geometry = {width, height, inputFps};
+        unique_ptr<InputStream> source =
+            openInput(opts.input, opts.inputFormat, geometry,
+                      opts.convertThreads);
+        if (!source) {
+            return false;
+        }
+        DecimatingInputStream decimated(source.get(), step);
+        TierCountCallback separate;
+        startCpuUs = processCpuUs();
+        {
+            BaseEncoderTest test;
+            test.inputFormat_ = opts.inputFormat;
+            test.convertThreads_ = opts.convertThreads;
+            unique_ptr<PrioritySource> inner(
+                isDiffEncoding ? createPrioritySource(
+                                     opts, suffix, "-t" + to_string(tid))
+                               : nullptr);
+            DecimatedPrioritySource priorities(inner.get(), step);
+            test.prioritySource_ = &priorities;
+            test.SetUp();
+            test.EncodeStream(&decimated, &tierParam, &separate, "");
+            test.TearDown();
+        }
+        const double tierCpuSec = (processCpuUs() - startCpuUs) / 1e6;
+        separateCpuSec += tierCpuSec;
+
+        int64_t separateBytes = 0;
+        for (int64_t b : separate.bytes) {
+            separateBytes += b;
+        }
+        const double layeredKbps =
+            seconds > 0 ? layeredBytes * 8 / 1000.0 / seconds : 0;
+        const double separateKbps =
+            seconds > 0 ? separateBytes * 8 / 1000.0 / seconds : 0;
+        const double costPct =
+            separateBytes ? ((double)layeredBytes / separateBytes - 1) * 100
+                          : 0;
+        cout << "  " << fpsLabel(fps) << " fps: " << layeredKbps << " vs "
+             << separateKbps << " kbps (" << (costPct >= 0 ? "+" : "")
+             << costPct << "%), separate encode CPU " << tierCpuSec << " s"
+             << endl;
+        const string prefix = "temporal_" + fpsLabel(fps) + "fps_";
+        report.AddCounter(prefix + "layered_kbps", layeredKbps);
+        report.AddCounter(prefix + "separate_kbps", separateKbps);
+        report.AddCounter(prefix + "cost_pct", costPct);
+    }
+    cout << "  CPU: layered " << layeredCpuSec << " s for all tiers, "
+         << "separate " << separateCpuSec << " s" << endl;
+    report.AddCounter("temporal_qp", qp);
+    report.AddCounter("temporal_cpu_layered_ms", layeredCpuSec * 1000);
+    report.AddCounter("temporal_cpu_separate_ms", separateCpuSec * 1000);
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef __TEMPORAL_H__
+#define __TEMPORAL_H__
+
+#include "harness.h"
+#include "stats.h"
+
+#include <stdint.h>
+#include <string>
+
+// openh264 takes at most four temporal layers (a dyadic GOP of 8)
+const int maxTemporalLayers = 4;
+
+// Dyadic temporal layers with prefix NALs, so the temporal id of every
+// base layer slice is also in the bitstream and a rebuilt sidecar sees it.
+void configureTemporalLayers(SEncParamExt &param, int layers);
+
+// frame rate of the sub-stream of temporal ids 0..maxTemporalId
+float temporalTierFps(const SEncParamExt &param, int maxTemporalId);
+
+struct TemporalExtractStats {
+    int64_t iBytes = 0;
+    int iFrames = 0; ///< video coding layers kept
+};
+
+// Copies the entries of stream's sidecar with temporal ids up to
+// maxTemporalId into outStream and writes its sidecar. Lower temporal
+// layers never reference higher ones, so the result decodes on its own at
+// the lower frame rate. Without a sidecar the stream is indexed first.
+bool extractTemporalLayers(const std::string &stream, int maxTemporalId,
+                           const std::string &outStream,
+                           TemporalExtractStats &stats);
+
+// `--extract-temporal <stream.h264> <max_tid> [out.h264]`; out defaults to
+// <stream>-t<max_tid>.h264
+int runTemporalExtract(int argc, char const *argv[]);
+
+// After an encode with temporal layers: extracts <outFile>-<fps>fps.h264
+// for every lower tier and reports their bitrates.
+void extractTemporalTiers(const SEncParamExt &param, const std::string &outFile,
+                          StatsReport &report);
+
+// The price of the layering: one layered encode against a separate
+// single-layer encode per tier fed every 2^k-th frame, all at the fixed
+// QP of the base layer, comparing each tier's bitrate and the CPU time.
+// false when the input cannot be read again.
+bool measureTemporalCost(const TestOptions &opts, const SEncParamExt &param,
+                         StatsReport &report);
+
+#endif //__TEMPORAL_H__
@@ -0,0 +1,31 @@
+#include "timing.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+int64_t processCpuUs() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel,
+                         &user)) {
+        return 0;
+    }
+    auto us = [](const FILETIME &t) {
+        // 100 ns units
+        return (int64_t)(((uint64_t)t.dwHighDateTime << 32) |
+                         t.dwLowDateTime) /
+               10;
+    };
+    return us(kernel) + us(user);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+               1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
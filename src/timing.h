@@ -0,0 +1,18 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <chrono>
+#include <stdint.h>
+
+// Monotonic clock in microseconds. steady_clock is system-wide on the
+// platforms we run on, so values are comparable across local processes.
+inline int64_t monotonicUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// User plus system CPU time of the process, all threads included.
+int64_t processCpuUs();
+
+#endif //__TIMING_H__
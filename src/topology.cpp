@@ -0,0 +1,281 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef __linux__
+#include <filesystem>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+#ifdef __linux__
+namespace fs = std::filesystem;
+
+const string sysCpuDir = "/sys/devices/system/cpu/";
+const string sysNodeDir = "/sys/devices/system/node/";
+
+int readSysInt(const string &fileName, int fallback) {
+    ifstream in(fileName.c_str());
+    int value;
+    return in >> value ? value : fallback;
+}
+
+// "0-3,8,10-11" as in sysfs cpulist files
+vector<int> parseCpuList(const string &list) {
+    vector<int> cpus;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+        int first, last;
+        const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1) {
+            continue;
+        }
+        for (int cpu = first; cpu <= (n == 2 ? last : first); cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+void loadLinux(vector<LogicalCpu> &cpus) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    map<int, int> nodeOf;
+    error_code ec;
+    for (fs::directory_iterator it(sysNodeDir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        const string name = it->path().filename().string();
+        int node;
+        if (sscanf(name.c_str(), "node%d", &node) != 1) {
+            continue;
+        }
+        ifstream in((it->path() / "cpulist").string().c_str());
+        string list;
+        getline(in, list);
+        for (int cpu : parseCpuList(list)) {
+            nodeOf[cpu] = node;
+        }
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        const string dir = sysCpuDir + "cpu" + to_string(cpu) + "/topology/";
+        LogicalCpu c;
+        c.iCpu = cpu;
+        c.iPackage = readSysInt(dir + "physical_package_id", 0);
+        // core_id is only unique within a package, made global below
+        c.iCore = readSysInt(dir + "core_id", cpu);
+        c.iNode = nodeOf.count(cpu) ? nodeOf[cpu] : 0;
+        cpus.push_back(c);
+    }
+}
+#endif
+
+#ifdef _WIN32
+void loadWindows(vector<LogicalCpu> &cpus) {
+    DWORD_PTR processMask, systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask,
+                                &systemMask)) {
+        return;
+    }
+    DWORD size = 0;
+    GetLogicalProcessorInformation(NULL, &size);
+    vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(
+        size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (infos.empty() || !GetLogicalProcessorInformation(infos.data(), &size)) {
+        return;
+    }
+    const int maxCpus = (int)sizeof(DWORD_PTR) * 8;
+    vector<LogicalCpu> all(maxCpus, LogicalCpu{-1, 0, 0, 0});
+    int core = 0, package = 0;
+    for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION &info : infos) {
+        for (int cpu = 0; cpu < maxCpus; cpu++) {
+            if (!(info.ProcessorMask & ((DWORD_PTR)1 << cpu))) {
+                continue;
+            }
+            all[cpu].iCpu = cpu;
+            if (info.Relationship == RelationProcessorCore) {
+                all[cpu].iCore = core;
+            } else if (info.Relationship == RelationProcessorPackage) {
+                all[cpu].iPackage = package;
+            } else if (info.Relationship == RelationNumaNode) {
+                all[cpu].iNode = (int)info.NumaNode.NodeNumber;
+            }
+        }
+        core += info.Relationship == RelationProcessorCore;
+        package += info.Relationship == RelationProcessorPackage;
+    }
+    for (int cpu = 0; cpu < maxCpus; cpu++) {
+        if (all[cpu].iCpu >= 0 && (processMask & ((DWORD_PTR)1 << cpu))) {
+            cpus.push_back(all[cpu]);
+        }
+    }
+}
+#endif
+
+// "8-11,24-27"
+string describeCpus(vector<int> cpus) {
+    sort(cpus.begin(), cpus.end());
+    string s;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        s += (s.empty() ? "" : ",") + to_string(cpus[i]);
+        if (j > i) {
+            s += "-" + to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return s;
+}
+
+} // namespace
+
+void CpuTopology::Load() {
+    cpus_.clear();
+#if defined(__linux__)
+    loadLinux(cpus_);
+#elif defined(_WIN32)
+    loadWindows(cpus_);
+#endif
+    if (cpus_.empty()) {
+        const int n = max(1, (int)thread::hardware_concurrency());
+        for (int cpu = 0; cpu < n; cpu++) {
+            cpus_.push_back(LogicalCpu{cpu, cpu, 0, 0});
+        }
+    }
+
+    // dense core numbers across packages, siblings next to each other
+    map<pair<int, int>, int> coreIds;
+    set<int> packages, nodes;
+    for (LogicalCpu &c : cpus_) {
+        const pair<int, int> key(c.iPackage, c.iCore);
+        if (!coreIds.count(key)) {
+            const int id = (int)coreIds.size();
+            coreIds[key] = id;
+        }
+        c.iCore = coreIds[key];
+        packages.insert(c.iPackage);
+        nodes.insert(c.iNode);
+    }
+    sort(cpus_.begin(), cpus_.end(),
+         [](const LogicalCpu &a, const LogicalCpu &b) {
+             return make_tuple(a.iNode, a.iPackage, a.iCore, a.iCpu) <
+                    make_tuple(b.iNode, b.iPackage, b.iCore, b.iCpu);
+         });
+    cores_ = (int)coreIds.size();
+    packages_ = (int)packages.size();
+    nodes_ = (int)nodes.size();
+}
+
+string CpuTopology::Describe() const {
+    return to_string(nodes_) + (nodes_ == 1 ? " node, " : " nodes, ") +
+           to_string(packages_) + (packages_ == 1 ? " socket, " : " sockets, ") +
+           to_string(cores_) + " cores, " + to_string(cpus_.size()) + " CPUs";
+}
+
+bool CpuPlacement::Apply() const {
+    if (cpus.empty()) {
+        return false;
+    }
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        mask |= (DWORD_PTR)1 << cpu;
+    }
+    // Windows allocates from the node of the ideal processor
+    SetThreadIdealProcessor(GetCurrentThread(), (DWORD)cpus[0]);
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+    // preferred, not bound: a full node falls back to the others instead
+    // of failing; a kernel without NUMA support just refuses
+    const int bits = (int)sizeof(unsigned long) * 8;
+    unsigned long nodes[16] = {};
+    if (iNode >= 0 && iNode < bits * 16) {
+        nodes[iNode / bits] = 1UL << (iNode % bits);
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+                (unsigned long)(bits * 16));
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+string CpuPlacement::Describe() const {
+    return "node " + to_string(iNode) + ", CPUs " + describeCpus(cpus);
+}
+
+vector<CpuPlacement> planPlacements(const CpuTopology &topology,
+                                    int instances) {
+    // the cores of every node, each with its SMT siblings
+    map<int, vector<vector<int>>> nodeCores;
+    int lastCore = -1;
+    for (const LogicalCpu &c : topology.Cpus()) {
+        vector<vector<int>> &cores = nodeCores[c.iNode];
+        if (c.iCore != lastCore) {
+            cores.emplace_back();
+            lastCore = c.iCore;
+        }
+        cores.back().push_back(c.iCpu);
+    }
+    vector<int> nodeIds;
+    for (const auto &node : nodeCores) {
+        nodeIds.push_back(node.first);
+    }
+
+    vector<CpuPlacement> placements(instances);
+    const int nodes = (int)nodeIds.size();
+    for (int i = 0; i < instances; i++) {
+        const int node = nodeIds[i % nodes];
+        const vector<vector<int>> &cores = nodeCores[node];
+        const int onNode = instances / nodes + (i % nodes < instances % nodes);
+        const int j = i / nodes;
+        const int count = (int)cores.size();
+        int first = j % count, last = j % count + 1;
+        if (onNode <= count) {
+            first = j * count / onNode;
+            last = (j + 1) * count / onNode;
+        }
+        CpuPlacement &p = placements[i];
+        p.iNode = node;
+        for (int core = first; core < last; core++) {
+            p.cpus.insert(p.cpus.end(), cores[core].begin(), cores[core].end());
+        }
+    }
+    return placements;
+}
@@ -0,0 +1,57 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <string>
+#include <vector>
+
+// One logical CPU the process may run on.
+struct LogicalCpu {
+    int iCpu;     ///< OS index, as in sched_setaffinity / affinity masks
+    int iCore;    ///< physical core, shared by SMT siblings
+    int iPackage; ///< socket
+    int iNode;    ///< NUMA node
+};
+
+// The CPUs of the process affinity mask, grouped into cores, sockets and
+// NUMA nodes. Read from sysfs on Linux and GetLogicalProcessorInformation
+// on Windows (processor group 0); elsewhere, or when that fails, every
+// hardware thread counts as a core of its own on node 0.
+class CpuTopology {
+  public:
+    void Load();
+
+    const std::vector<LogicalCpu> &Cpus() const { return cpus_; }
+    int Cores() const { return cores_; }
+    int Nodes() const { return nodes_; }
+    // e.g. "2 nodes, 2 sockets, 16 cores, 32 CPUs"
+    std::string Describe() const;
+
+  private:
+    std::vector<LogicalCpu> cpus_; ///< sorted by node, package, core
+    int cores_ = 0;
+    int packages_ = 0;
+    int nodes_ = 0;
+};
+
+// The CPUs and memory node of one encoder instance.
+struct CpuPlacement {
+    int iNode = 0;
+    std::vector<int> cpus;
+
+    // Pins the calling thread to cpus and prefers iNode for the memory it
+    // touches from now on, so buffers allocated afterwards are node-local.
+    // Threads started afterwards inherit both on Linux. False when the OS
+    // refused the affinity.
+    bool Apply() const;
+    // e.g. "node 1, CPUs 8-11,24-27"
+    std::string Describe() const;
+};
+
+// Placements for instances encoders running side by side. Instances go
+// round-robin over the NUMA nodes, and the cores of a node are split into
+// disjoint contiguous runs between its instances, SMT siblings included;
+// with more instances than cores they share cores.
+std::vector<CpuPlacement> planPlacements(const CpuTopology &topology,
+                                         int instances);
+
+#endif //__TOPOLOGY_H__